@@ -20,58 +20,149 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <nanomsg/nn.h>
 #include <nanomsg/pipeline.h>
 #include "libparodus.h"
 #include "libparodus_private.h"
 #include "libparodus_time.h"
-#include "libparodus_test_timing.h"
 #include <pthread.h>
 #include "libparodus_queues.h"
+#include "libparodus_wrp.h"
+#include "libparodus_latency.h"
+#include "libparodus_requests.h"
+#include "libparodus_routes.h"
+#include "libparodus_workers.h"
+#include "libparodus_ipc.h"
+#include "libparodus_shm.h"
+#include "libparodus_pool.h"
 
 //#define PARODUS_SERVICE_REQUIRES_REGISTRATION 1
 
 #define PARODUS_SERVICE_URL "tcp://127.0.0.1:6666"
-//#define PARODUS_URL "ipc:///tmp/parodus_server.ipc"
+#define PARODUS_SERVICE_IPC_URL "ipc://" LIBPD_IPC_DIR "/parodus_server.ipc"
 
 #define PARODUS_CLIENT_URL "tcp://127.0.0.1:6667"
-//#define CLIENT_URL "ipc:///tmp/parodus_client.ipc"
+// each service gets its own ipc client url, from libpd_ipc_client_url
+
+#ifdef LIBPD_IPC_DEFAULT
+#define DEFAULT_TRANSPORT LIBPD_TRANSPORT_IPC
+#else
+#define DEFAULT_TRANSPORT LIBPD_TRANSPORT_TCP
+#endif
 
 #define DEFAULT_KEEPALIVE_TIMEOUT_SECS 65
 
 #define URL_SIZE 32
 
+// another service received on an instance (cfg.extra_service_names)
+typedef struct {
+	char *queue_name;
+	libpd_mq_t queue;	// NULL unless msgs are received with libparodus_receive
+} extra_service_t;
+
+// where the receiver thread is in getting back to parodus after a
+// keep alive timeout. Only the receiver thread touches it.
+typedef struct {
+	bool active;
+	unsigned attempts;	// registrations tried since parodus was lost
+	uint64_t start;	// libpd_lat_now_coarse when parodus was lost
+	uint64_t next_try;	// libpd_lat_now_coarse of the next registration
+	uint32_t delay_ms;	// last retry delay, the jitter is based on it
+	unsigned seed;
+} reconnect_t;
+
+// keep alive watchdog. last_alive is set by whichever receiver thread
+// gets the keep alive, the rest only by the wrp receiver thread.
+typedef struct {
+	uint64_t period;	// keepalive_timeout_secs in ns, 0 for no watchdog
+	unsigned miss_limit;
+	uint64_t last_alive;	// libpd_lat_now_coarse of the last keep alive
+	uint64_t misses;	// keep alives missed since last_alive
+	libpd_link_state_t state;
+} watchdog_t;
 
 typedef struct {
 	int run_state;
 	const char *parodus_url;
 	const char *client_url;
-	int keep_alive_count;
-	int reconnect_count;
+	char *ipc_client_url;	// default client_url of the ipc transport, else NULL
+	libpd_stats_t stats;	// queue fields are filled in by libparodus_get_stats
 	libpd_cfg_t cfg;
 	bool connect_on_every_send; // always false, currently
 	int rcv_sock;
-	int stop_rcv_sock;
+	int rcv_fd;	// NN_RCVFD of rcv_sock, polled by sock_receive
+	int rcv_timeout_ms;	// how long the receiver waits for a msg, -1 for ever
+	int stop_fd;	// eventfd that tells the receiver thread to stop
 	int send_sock;
 	char *wrp_queue_name;
 	libpd_mq_t wrp_queue;
+	unsigned rcv_queue_size;	// size of wrp_queue and handler_queue
+	unsigned rcv_queue_lanes;	// priority lanes in wrp_queue and handler_queue
 	extra_err_info_t rcv_err_info;
 	pthread_t wrp_receiver_tid;
 	pthread_mutex_t send_mutex;
 	bool auth_received;
+	char *send_queue_name;
+	libpd_mq_t send_queue;	// NULL unless cfg.send_queue_size
+	pthread_t wrp_sender_tid;
+	libpd_mq_t handler_queue;	// NULL unless cfg.msg_handler_threads, without an order
+	libpd_workers_t workers;	// NULL unless cfg.msg_handler_threads, with an order
+	pthread_t *handler_tids;
+	unsigned handler_thread_count;
+	libpd_reqs_t reqs;	// requests waiting for a response, NULL unless cfg.receive
+	libpd_routes_t routes;	// dest path routes, NULL unless cfg.receive
+	libpd_lat_hist_t lat_encode;
+	libpd_lat_hist_t lat_send;
+	libpd_lat_hist_t lat_queue_wait;
+	libpd_lat_hist_t lat_receive;
+	extra_service_t *extra_services;	// NULL unless cfg.num_extra_services
+	libpd_shm_t shm;	// NULL unless cfg.shm_ring_size
+	bool shm_active;	// parodus accepted the shm segment
+	pthread_mutex_t shm_mutex;	// the up ring has one producer, so senders take turns
+	pthread_t shm_receiver_tid;
+	pthread_mutex_t rcv_mutex;	// one receiver thread at a time handles a msg
+	watchdog_t watchdog;
+	reconnect_t reconnect;
+	libpd_pool_t *rcv_pool;	// NULL unless cfg.zero_copy_receive
+	libpd_pool_cache_t rcv_cache;	// used by whichever receiver thread handles a msg
 } __instance_t;
 
-#define SOCK_SEND_TIMEOUT_MS 2000
+#define STATS_ADD(inst, counter, n) \
+	__atomic_fetch_add (&(inst)->stats.counter, (n), __ATOMIC_RELAXED)
 
-#define MAX_RECONNECT_RETRY_DELAY_SECS 63
+#define STATS_SUB(inst, counter, n) \
+	__atomic_fetch_sub (&(inst)->stats.counter, (n), __ATOMIC_RELAXED)
+
+#define STATS_GET(inst, counter) \
+	__atomic_load_n (&(inst)->stats.counter, __ATOMIC_RELAXED)
 
-#define END_MSG "---END-PARODUS---\n"
-static const char *end_msg = END_MSG;
+#define SOCK_SEND_TIMEOUT_MS 2000
+#define NOWAIT_SEND_TIMEOUT_MS 100	// see sock_send_bytes
 
-static char *closed_msg = "---CLOSED---\n";
+#define RECONNECT_BASE_DELAY_MS 500
+#define MAX_RECONNECT_RETRY_DELAY_SECS 63
+#define RECONNECT_TEST_SEED 1	// see CFG_TEST_FIXED_RECONNECT_SEED
+
+static char closed_msg[] = "---CLOSED---\n";
+
+// posted by libparodus_close_receiver. Never freed, so it can be
+// posted any number of times and told apart by its address.
+static wrp_msg_t closed_wrp_msg = {
+	.msg_type = WRP_MSG_TYPE__REQ,
+	.u.req = {
+		.transaction_uuid = closed_msg,
+		.source = closed_msg,
+		.dest = closed_msg,
+		.payload = (void *) closed_msg,
+		.payload_size = sizeof (closed_msg) - 1
+	}
+};
 
 typedef struct {
 	int len;
@@ -81,12 +172,56 @@ typedef struct {
 #define WRP_QUEUE_SEND_TIMEOUT_MS	2000
 #define WRP_QNAME_HDR "/LIBPD_WRP_QUEUE"
 #define WRP_QUEUE_SIZE 50
+#define SEND_QNAME_HDR "/LIBPD_SEND_QUEUE"
+#define SEND_QUEUE_RCV_TIMEOUT_MS 60000
+#define HANDLER_QUEUE_RCV_TIMEOUT_MS 60000
+#define SHM_RCV_TIMEOUT_MS 60000
+#define RCV_POOL_MAX_BYTES (256 * 1024)
+
+// an encoded msg waiting on the send queue
+typedef struct {
+	void *msg_bytes;
+	ssize_t msg_len;
+	bool nn_buf;	// msg_bytes is from nn_allocmsg
+	libpd_send_cb_t *callback;
+	void *ctx;
+} async_send_t;
+
+// posted by libparodus_shutdown to stop the wrp sender thread
+static async_send_t async_send_end;
+
+// posted by libparodus_shutdown to stop each msg handler thread
+static wrp_msg_t msg_handler_end;
+
+// A msg passed to the msg handler thread pool, with the handler
+// the wrp receiver thread found for it
+typedef struct {
+	wrp_msg_t *msg;
+	libpd_msg_handler_t *handler;
+	void *ctx;
+} handler_msg_t;
+
+// how wrp_send sends a msg
+typedef enum {
+	SEND_ANY,		// through the shm ring if parodus accepted it
+	SEND_SOCK,		// over the socket
+	SEND_SOCK_NOWAIT	// over the socket, failing if it would block
+} send_mode_t;
 
 const char *wrp_qname_hdr = WRP_QNAME_HDR;
 
-int flush_wrp_queue (libpd_mq_t wrp_queue, uint32_t delay_ms, int *exterr);
-static int wrp_sock_send (__instance_t *inst, wrp_msg_t *msg, extra_err_info_t *err_info);
+int flush_wrp_queue (libpd_mq_t wrp_queue);
+static int wrp_send (__instance_t *inst, wrp_msg_t *msg, send_mode_t mode,
+	const char *shm_offer, extra_err_info_t *err_info);
 static void *wrp_receiver_thread (void *arg);
+static void *shm_receiver_thread (void *arg);
+static void *wrp_sender_thread (void *arg);
+static void *msg_handler_thread (void *arg);
+static void handle_worker_msg (void *msg, void *arg);
+static void stop_msg_handlers (__instance_t *inst, extra_err_info_t *err_info);
+static void start_reconnect (__instance_t *inst);
+static void keepalive_received (__instance_t *inst);
+static void watchdog_init (__instance_t *inst);
 static void libparodus_shutdown__ (__instance_t *inst, extra_err_info_t *err_info);
 
 #define RUN_STATE_RUNNING		1234
@@ -111,6 +246,10 @@ err_table_item_t error_msg_table[] = {
 			 "Error on libparodus init. Could not create receive queue."},
 		{ LIBPD_ERROR_INIT_REGISTER,
 			 "Error on libparodus init. Registration failed."},
+		{ LIBPD_ERROR_INIT_SEND_THREAD,
+			 "Error on libparodus init. Could not create sender thread."},
+		{ LIBPD_ERROR_INIT_HANDLER_THREAD,
+			 "Error on libparodus init. Could not create msg handler thread."},
 		{ LIBPD_ERROR_RCV_NULL_INST,
 			 "Error on libparodus receive. Null instance given."},
 		{ LIBPD_ERROR_RCV_STATE,
@@ -121,6 +260,8 @@ err_table_item_t error_msg_table[] = {
 			 "Error on libparodus receive. Error receiveing from receive queue."},
 		{ LIBPD_ERROR_RCV_THR_LIMIT,
 			 "Error on libparodus receive. Thread limit exceeded."},
+		{ LIBPD_ERROR_RCV_PARAM,
+			 "Error on libparodus receive. Invalid parameter."},
 		{ LIBPD_ERROR_CLOSE_RCV_NULL_INST,
 			 "Error on libparodus close receiver. Null instance given."},
 		{ LIBPD_ERROR_CLOSE_RCV_STATE,
@@ -142,7 +283,41 @@ err_table_item_t error_msg_table[] = {
 		{ LIBPD_ERROR_SEND_SOCKET,
 			 "Error on libparodus send. Socket send error."},
 		{ LIBPD_ERROR_SEND_THR_LIMIT,
-			 "Error on libparodus send. Thread limit exceeded."}
+			 "Error on libparodus send. Thread limit exceeded."},
+		{ LIBPD_ERROR_SEND_ASYNC_CFG,
+			 "Error on libparodus send. Not configured for async send."},
+		{ LIBPD_ERROR_SEND_QUEUE_FULL,
+			 "Error on libparodus send. Send queue full."},
+		{ LIBPD_ERROR_SEND_QUEUE,
+			 "Error on libparodus send. Error enqueueing on send queue."},
+		{ LIBPD_ERROR_STATS_NULL_INST,
+			 "Error on libparodus get stats. Null instance given."},
+		{ LIBPD_ERROR_STATS_PARAM,
+			 "Error on libparodus get stats. Invalid parameter."},
+		{ LIBPD_ERROR_REQUEST_NULL_INST,
+			 "Error on libparodus request. Null instance given."},
+		{ LIBPD_ERROR_REQUEST_STATE,
+			 "Error on libparodus request. Run state error."},
+		{ LIBPD_ERROR_REQUEST_CFG,
+			 "Error on libparodus request. Not configured for receive."},
+		{ LIBPD_ERROR_REQUEST_PARAM,
+			 "Error on libparodus request. Invalid parameter."},
+		{ LIBPD_ERROR_REQUEST_DUP,
+			 "Error on libparodus request. Transaction uuid already in use."},
+		{ LIBPD_ERROR_REQUEST_ADD,
+			 "Error on libparodus request. Unable to add request."},
+		{ LIBPD_ERROR_ROUTE_NULL_INST,
+			 "Error on libparodus add route. Null instance given."},
+		{ LIBPD_ERROR_ROUTE_STATE,
+			 "Error on libparodus add route. Run state error."},
+		{ LIBPD_ERROR_ROUTE_CFG,
+			 "Error on libparodus add route. Not configured for receive."},
+		{ LIBPD_ERROR_ROUTE_PARAM,
+			 "Error on libparodus add route. Invalid parameter."},
+		{ LIBPD_ERROR_ROUTE_DUP,
+			 "Error on libparodus add route. Path already has a route."},
+		{ LIBPD_ERROR_ROUTE_ADD,
+			 "Error on libparodus add route. Unable to add route."}
 };
 
 
@@ -164,12 +339,29 @@ const char *libparodus_strerror (libpd_error_t err)
 }
 
 
-static void getParodusUrl(__instance_t *inst)
+static libpd_transport_t cfg_transport (libpd_cfg_t *cfg)
 {
+	if (cfg->transport == LIBPD_TRANSPORT_DEFAULT)
+		return DEFAULT_TRANSPORT;
+	return cfg->transport;
+}
+
+// returns false if out of memory
+static bool getParodusUrl(__instance_t *inst)
+{
+	bool ipc = (cfg_transport (&inst->cfg) == LIBPD_TRANSPORT_IPC);
+
 	inst->parodus_url = inst->cfg.parodus_url;
 	inst->client_url = inst->cfg.client_url;
 	if (NULL == inst->parodus_url)
-		inst->parodus_url = PARODUS_SERVICE_URL;
+		inst->parodus_url = ipc ? PARODUS_SERVICE_IPC_URL : PARODUS_SERVICE_URL;
+	if ((NULL == inst->client_url) && ipc) {
+		inst->ipc_client_url = libpd_ipc_client_url (LIBPD_IPC_DIR, 
+			inst->cfg.service_name);
+		if (NULL == inst->ipc_client_url)
+			return false;
+		inst->client_url = inst->ipc_client_url;
+	}
 	if (NULL == inst->client_url)
 		inst->client_url = PARODUS_CLIENT_URL;
 	// to test connect_on_every_send, start the parodus_url with "test:"
@@ -180,6 +372,115 @@ static void getParodusUrl(__instance_t *inst)
 	}
   libpd_log (LEVEL_INFO, ("LIBPARODUS: parodus url is  %s\n", inst->parodus_url));
   libpd_log (LEVEL_INFO, ("LIBPARODUS: client url is  %s\n", inst->client_url));
+	return true;
+}
+
+// one lane per priority used, plus the lowest for msgs that match no rule
+static unsigned priority_lanes (libpd_cfg_t *cfg)
+{
+	unsigned i, lanes = 1;
+	const libpd_priority_rule_t *rule;
+
+	if (NULL == cfg->priority_rules)
+		return 1;
+	for (i=0; i<cfg->num_priority_rules; i++) {
+		rule = &cfg->priority_rules[i];
+		if ((rule->priority <= LIBPD_MAX_PRIORITY) && (rule->priority+2 > lanes))
+			lanes = rule->priority+2;
+	}
+	return lanes;
+}
+
+// extra services are only received, so they need the receiver
+static bool valid_extra_services (libpd_cfg_t *cfg)
+{
+	unsigned i;
+	const char *name;
+
+	if (cfg->num_extra_services == 0)
+		return true;
+	if (!cfg->receive || (NULL == cfg->extra_service_names))
+		return false;
+	for (i=0; i<cfg->num_extra_services; i++) {
+		name = cfg->extra_service_names[i];
+		if ((NULL == name) || (name[0] == '\0') || (NULL != strchr (name, '/')))
+			return false;
+	}
+	return true;
+}
+
+// the keyed worker pool has no priority lanes, and can't drop
+// msgs once they have been handed to it
+static bool valid_handler_order (libpd_cfg_t *cfg)
+{
+	if (cfg->msg_handler_order > LIBPD_ORDER_BY_UUID)
+		return false;
+	if ((cfg->msg_handler_order == LIBPD_ORDER_NONE) || 
+	    (cfg->msg_handler_threads == 0))
+		return true;
+	return (cfg->num_priority_rules == 0) &&
+		(cfg->receive_overflow != LIBPD_OVERFLOW_DROP_OLDEST) &&
+		(cfg->receive_overflow != LIBPD_OVERFLOW_DROP_BY_TYPE);
+}
+
+static bool valid_priority_rules (libpd_cfg_t *cfg)
+{
+	unsigned i;
+
+	if (cfg->num_priority_rules == 0)
+		return true;
+	if (NULL == cfg->priority_rules)
+		return false;
+	for (i=0; i<cfg->num_priority_rules; i++)
+		if (cfg->priority_rules[i].priority > LIBPD_MAX_PRIORITY)
+			return false;
+	return true;
+}
+
+// the shm segment is offered in the registration, which needs the receiver
+static bool valid_shm_ring_size (libpd_cfg_t *cfg)
+{
+	unsigned size = cfg->shm_ring_size;
+
+	if (size == 0)
+		return true;
+	return cfg->receive && (size >= LIBPD_SHM_MIN_RING_SIZE) &&
+		(size <= LIBPD_SHM_MAX_RING_SIZE) && ((size & (size - 1)) == 0);
+}
+
+// Checks the config fields init can't default.
+// returns 0, or the LIBPD_ERR_INIT_CFG_ error for the first bad one
+static int check_cfg (libpd_cfg_t *cfg)
+{
+	if (cfg->receive_overflow > LIBPD_OVERFLOW_DROP_BY_TYPE) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid receive_overflow\n"));
+		return LIBPD_ERR_INIT_CFG_OVERFLOW;
+	}
+	if (cfg->receive_queue_size == 1) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid receive_queue_size\n"));
+		return LIBPD_ERR_INIT_CFG_QUEUE_SIZE;
+	}
+	if (!valid_priority_rules (cfg)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid priority_rules\n"));
+		return LIBPD_ERR_INIT_CFG_PRIORITY;
+	}
+	if (!valid_handler_order (cfg)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid msg_handler_order\n"));
+		return LIBPD_ERR_INIT_CFG_ORDER;
+	}
+	if (!valid_extra_services (cfg)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid extra_service_names\n"));
+		return LIBPD_ERR_INIT_CFG_SERVICES;
+	}
+	if (cfg->transport > LIBPD_TRANSPORT_IPC) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid transport\n"));
+		return LIBPD_ERR_INIT_CFG_TRANSPORT;
+	}
+	if (!valid_shm_ring_size (cfg)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid shm_ring_size\n"));
+		return LIBPD_ERR_INIT_CFG_SHM;
+	}
+	return 0;
 }
 
 static __instance_t *make_new_instance (libpd_cfg_t *cfg)
@@ -197,10 +498,24 @@ static __instance_t *make_new_instance (libpd_cfg_t *cfg)
 	}
 	memset ((void*) inst, 0, sizeof(__instance_t));
 	inst->wrp_queue_name = wrp_queue_name;
-	pthread_mutex_init (&inst->send_mutex, NULL);
 	//inst->cfg = *cfg;
 	memcpy (&inst->cfg, cfg, sizeof(libpd_cfg_t));
-	getParodusUrl (inst);
+	if (!getParodusUrl (inst)) {
+		free (wrp_queue_name);
+		free (inst);
+		return NULL;
+	}
+	pthread_mutex_init (&inst->send_mutex, NULL);
+	pthread_mutex_init (&inst->rcv_mutex, NULL);
+	pthread_mutex_init (&inst->shm_mutex, NULL);
+	// so a fleet of clients doesn't retry in lockstep
+	inst->reconnect.seed = (unsigned) libpd_lat_now () ^ ((unsigned) getpid () << 16) ^
+		(unsigned) (uintptr_t) inst;
+	if (cfg->test_flags & CFG_TEST_FIXED_RECONNECT_SEED)
+		inst->reconnect.seed = RECONNECT_TEST_SEED;
+	inst->rcv_queue_size = (cfg->receive_queue_size > 0) ? 
+		cfg->receive_queue_size : WRP_QUEUE_SIZE;
+	inst->rcv_queue_lanes = priority_lanes (cfg);
 	sprintf (inst->wrp_queue_name, "%s.%s", wrp_qname_hdr, cfg->service_name);
 	return inst;
 }
@@ -213,13 +528,58 @@ static void destroy_instance (libpd_instance_t *instance)
 		if (NULL != inst) {
 			if (NULL != inst->wrp_queue_name)
 				free (inst->wrp_queue_name);
+			if (NULL != inst->send_queue_name)
+				free (inst->send_queue_name);
+			free (inst->ipc_client_url);
+			free (inst->extra_services);
 			pthread_mutex_destroy (&inst->send_mutex);
-			free (inst);
+			pthread_mutex_destroy (&inst->rcv_mutex);
+			pthread_mutex_destroy (&inst->shm_mutex);
 			*instance = NULL;
+			// zero copy msgs not yet freed hold the pool
+			// until the last is freed
+			libpd_pool_destroy (inst->rcv_pool, NULL, NULL);
+			free (inst);
 		}
 	}
 }
 
+// true if msgs are received with libparodus_receive, not a msg_handler
+static bool queued_receive (__instance_t *inst)
+{
+	return inst->cfg.receive && (NULL == inst->cfg.msg_handler);
+}
+
+// returns 0 for cfg.service_name, 1 + the index of an extra service, or -1
+static int find_service (__instance_t *inst, const char *service_name)
+{
+	unsigned i;
+
+	if (NULL == service_name)
+		return -1;
+	if (strcmp (service_name, inst->cfg.service_name) == 0)
+		return 0;
+	for (i = 0; i < inst->cfg.num_extra_services; i++)
+		if (strcmp (service_name, inst->cfg.extra_service_names[i]) == 0)
+			return (int) i + 1;
+	return -1;
+}
+
+// the receive queue of a service from dest_service or find_service
+static libpd_mq_t service_queue (__instance_t *inst, int service)
+{
+	if (service == 0)
+		return inst->wrp_queue;
+	return inst->extra_services[service - 1].queue;
+}
+
+// true if the receive overflow policy takes msgs off of a full queue
+static bool evicting_overflow (__instance_t *inst)
+{
+	return (inst->cfg.receive_overflow == LIBPD_OVERFLOW_DROP_OLDEST) ||
+		(inst->cfg.receive_overflow == LIBPD_OVERFLOW_DROP_BY_TYPE);
+}
+
 bool is_auth_received (libpd_instance_t instance)
 {
 	__instance_t *inst = (__instance_t *) instance;
@@ -260,7 +620,22 @@ typedef enum {
 	 * @brief Error on connect_receiver
 	 * error binding to socket
 	 */
-	CONN_RCV_ERR_BIND = -0xC0
+	CONN_RCV_ERR_BIND = -0xC0,
+	/** 
+	 * @brief Error on bind_receiver
+	 * ipc socket file in use or not removable
+	 */
+	CONN_RCV_ERR_IPC = -0x100,
+	/** 
+	 * @brief Error on bind_receiver
+	 * error setting ipc socket file permissions
+	 */
+	CONN_RCV_ERR_IPC_MODE = -0x140,
+	/** 
+	 * @brief Error on bind_receiver
+	 * error getting the socket's receive fd
+	 */
+	CONN_RCV_ERR_RCVFD = -0x180
 } conn_rcv_error_t;
 
 /**
@@ -300,6 +675,62 @@ int connect_receiver (const char *rcv_url, int keepalive_timeout_secs, int *oser
 	return sock;
 }
 
+/**
+ * Open the receive socket of an instance and bind it to the client url.
+ * An ipc:// socket file left by a process that is gone is removed first,
+ * and the new one gets the cfg.ipc_mode permissions.
+ */
+static int bind_receiver (__instance_t *inst, int *oserr)
+{
+	const char *path = libpd_ipc_path (inst->client_url);
+	unsigned mode = inst->cfg.ipc_mode;
+	size_t fd_size = sizeof (inst->rcv_fd);
+	unsigned old_mask = 0;
+	int sock;
+
+	*oserr = 0;
+	if (0 == mode)
+		mode = LIBPD_IPC_DEFAULT_MODE;
+	if ((NULL != path) && (libpd_ipc_clean (path, oserr) != 0))
+		return CONN_RCV_ERR_IPC;
+	// so the socket file is never there with looser permissions than
+	// mode, not even between the bind and the chmod
+	if (NULL != path)
+		old_mask = libpd_ipc_tighten_umask (mode);
+	// no socket timeout, the receiver thread times its own waits
+	sock = connect_receiver (inst->client_url, 0, oserr);
+	if (NULL != path)
+		libpd_ipc_restore_umask (old_mask);
+	if (sock < 0)
+		return sock;
+	if ((NULL != path) && (libpd_ipc_set_mode (path, mode, oserr) != 0)) {
+		shutdown_socket (&sock);
+		unlink (path);
+		return CONN_RCV_ERR_IPC_MODE;
+	}
+	// the fd is the same for the life of the socket
+	if (nn_getsockopt (sock, NN_SOL_SOCKET, NN_RCVFD, 
+	    &inst->rcv_fd, &fd_size) < 0) {
+		*oserr = errno;
+		shutdown_socket (&sock);
+		if (NULL != path)
+			unlink (path);
+		return CONN_RCV_ERR_RCVFD;
+	}
+	return sock;
+}
+
+// closes the receive socket, and removes its ipc:// socket file
+static void shutdown_rcv_socket (__instance_t *inst)
+{
+	const char *path = libpd_ipc_path (inst->client_url);
+	bool bound = (inst->rcv_sock >= 0);
+
+	shutdown_socket (&inst->rcv_sock);
+	if (bound && (NULL != path))
+		unlink (path);
+}
+
 typedef enum {
 	/** 
 	 * @brief Error on connect_sender
@@ -368,10 +799,34 @@ static int create_thread (pthread_t *tid, void *(*thread_func) (void*),
 	return rtn; 
 }
 
+static void free_msg_bytes (void *msg_bytes, bool nn_buf)
+{
+	if (NULL == msg_bytes)
+		return;
+	if (nn_buf)
+		nn_freemsg (msg_bytes);
+	else
+		free (msg_bytes);
+}
+
+static void async_send_free (void *msg)
+{
+	async_send_t *item = (async_send_t *) msg;
+	if ((NULL == item) || (&async_send_end == item))
+		return;
+	free_msg_bytes (item->msg_bytes, item->nn_buf);
+	free (item);
+}
+
 static bool is_closed_msg (wrp_msg_t *msg)
 {
-	return (msg->msg_type == WRP_MSG_TYPE__REQ) &&
-		(strcmp (msg->u.req.dest, closed_msg) == 0);
+	return msg == &closed_wrp_msg;
+}
+
+// stop test for libpd_qreceive_until
+static bool is_closed_queued_msg (void *msg)
+{
+	return is_closed_msg ((wrp_msg_t *) msg);
 }
 
 static void wrp_free (void *msg)
@@ -380,12 +835,57 @@ static void wrp_free (void *msg)
 	if (NULL == msg)
 		return;
 	wrp_msg = (wrp_msg_t *) msg;
-	if (is_closed_msg (wrp_msg))
-		free (wrp_msg);
-	else
+	if (!is_closed_msg (wrp_msg))
 		wrp_free_struct (wrp_msg);
 }
 
+// queue free function for zero copy receive
+static void wrp_free_zc (void *msg)
+{
+	wrp_msg_t *wrp_msg;
+	if (NULL == msg)
+		return;
+	wrp_msg = (wrp_msg_t *) msg;
+	if (!is_closed_msg (wrp_msg))
+		libpd_wrp_free_msg (wrp_msg);
+}
+
+static void free_rcv_msg (__instance_t *inst, wrp_msg_t *msg)
+{
+	if (inst->cfg.zero_copy_receive)
+		libpd_wrp_free_msg (msg);
+	else
+		wrp_free_struct (msg);
+}
+
+// handler queue free functions
+static void handler_msg_free (void *msg)
+{
+	if ((NULL == msg) || (msg == (void *) &msg_handler_end))
+		return;
+	wrp_free_struct (((handler_msg_t *) msg)->msg);
+	free (msg);
+}
+
+static void handler_msg_free_zc (void *msg)
+{
+	if ((NULL == msg) || (msg == (void *) &msg_handler_end))
+		return;
+	libpd_wrp_free_msg (((handler_msg_t *) msg)->msg);
+	free (msg);
+}
+
+// frees a msg taken off, or not put on, the wrp queue or handler queue
+static void free_queued_msg (__instance_t *inst, libpd_mq_t queue, void *msg)
+{
+	if (queue != inst->handler_queue) {
+		free_rcv_msg (inst, (wrp_msg_t *) msg);
+		return;
+	}
+	free_rcv_msg (inst, ((handler_msg_t *) msg)->msg);
+	free (msg);
+}
+
 typedef enum {
 	/** 
 	 * @brief Error on sock_send
@@ -401,18 +901,18 @@ typedef enum {
 
 typedef enum {
 	/** 
-	 * @brief Error on wrp_sock_send
+	 * @brief Error on wrp_send
 	 * convert to struct error
 	 */
 	WRP_SEND_ERR_CONVERT = -0x01,
 	/** 
-	 * @brief Error on wrp_sock_send
+	 * @brief Error on wrp_send
 	 * connect sender error
 	 * only applies if connect_on_every_send
 	 */
 	WRP_SEND_ERR_CONNECT = -0x200,
 	/** 
-	 * @brief Error on wrp_sock_send
+	 * @brief Error on wrp_send
 	 * socket send error
 	 */
 	WRP_SEND_ERR_SOCK_SEND = -0x800,
@@ -423,37 +923,243 @@ typedef enum {
 	WRP_SEND_ERR_BYTE_CNT = -0x801,
 	/** 
 	 * @brief Error on sock_send
-	 * nn_send error
+	 * nn_send error, or the shm ring stayed full
 	 */
 	WRP_SEND_ERR_NN = -0x840
-} wrp_sock_send_error_t;
+} wrp_send_error_t;
 
-static int send_registration_msg (__instance_t *inst, extra_err_info_t *err)
+// Registration always goes over the socket. The registration of
+// cfg.service_name offers parodus the shm segment, if there is one.
+// With nowait, a send that would block fails with EAGAIN instead.
+static int send_registration_msg (__instance_t *inst, bool nowait, 
+	extra_err_info_t *err)
 {
+	send_mode_t mode = nowait ? SEND_SOCK_NOWAIT : SEND_SOCK;
 	wrp_msg_t reg_msg;
+	unsigned i;
+	int rtn;
+	const char *shm_offer = NULL;
+
+	if ((NULL != inst->shm) && !libpd_shm_is_closed (inst->shm))
+		shm_offer = libpd_shm_path (inst->shm);
 	reg_msg.msg_type = WRP_MSG_TYPE__SVC_REGISTRATION;
 	reg_msg.u.reg.service_name = (char *) inst->cfg.service_name;
 	reg_msg.u.reg.url = (char *) inst->client_url;
-	return wrp_sock_send (inst, &reg_msg, err);
+	rtn = wrp_send (inst, &reg_msg, mode, shm_offer, err);
+	// extra services are registered at the same url
+	for (i = 0; (rtn == 0) && (i < inst->cfg.num_extra_services); i++) {
+		reg_msg.u.reg.service_name = (char *) inst->cfg.extra_service_names[i];
+		rtn = wrp_send (inst, &reg_msg, mode, NULL, err);
+	}
+	return rtn;
 }
 
 // define ABORT FLAGS
 #define ABORT_RCV_SOCK	1
 #define ABORT_QUEUE			2
 #define ABORT_SEND_SOCK	4
-#define ABORT_STOP_RCV_SOCK	8
+#define ABORT_STOP_FD	8
+
+
+// Creates a receive queue for each extra service, with the same options
+// as the wrp queue. Without queued receive, msgs for the extra services
+// go to the handlers, so no queues are needed.
+// returns 0 or LIBPD_QERR_CREATE_ error, with oserr set
+static int create_extra_services (__instance_t *inst, unsigned qopts, int *oserr)
+{
+	unsigned i, n = inst->cfg.num_extra_services;
+	extra_service_t *svc;
+	const char *name;
+	int err;
+
+	if (n == 0)
+		return 0;
+	inst->extra_services = (extra_service_t *) calloc (n, sizeof (extra_service_t));
+	if (NULL == inst->extra_services) {
+		*oserr = ENOMEM;
+		return LIBPD_QERR_CREATE_ALLOC_1;
+	}
+	if (!queued_receive (inst))
+		return 0;
+	for (i = 0; i < n; i++) {
+		svc = &inst->extra_services[i];
+		name = inst->cfg.extra_service_names[i];
+		svc->queue_name = (char *) malloc (strlen (wrp_qname_hdr) + strlen (name) + 2);
+		if (NULL == svc->queue_name) {
+			*oserr = ENOMEM;
+			return LIBPD_QERR_CREATE_ALLOC_1;
+		}
+		sprintf (svc->queue_name, "%s.%s", wrp_qname_hdr, name);
+		err = libpd_qcreate_prio (&svc->queue, svc->queue_name,
+			inst->rcv_queue_size, inst->rcv_queue_lanes, qopts, oserr);
+		if (err == 0)
+			err = libpd_qset_latency (svc->queue, &inst->lat_queue_wait,
+				&inst->lat_receive);
+		if (err != 0)
+			return err;
+	}
+	return 0;
+}
+
+static void destroy_extra_services (__instance_t *inst)
+{
+	unsigned i;
+	extra_service_t *svc;
+
+	if (NULL == inst->extra_services)
+		return;
+	for (i = 0; i < inst->cfg.num_extra_services; i++) {
+		svc = &inst->extra_services[i];
+		libpd_qdestroy (&svc->queue, 
+			inst->cfg.zero_copy_receive ? &wrp_free_zc : &wrp_free);
+		free (svc->queue_name);
+	}
+	free (inst->extra_services);
+	inst->extra_services = NULL;
+}
+
+// Starts the msg handler thread pool. The wrp receiver thread hands
+// msgs to the pool through the handler queue.
+// returns 0 or LIBPD_ERR_INIT_HANDLER_ error, with oserr set
+static int start_msg_handlers (__instance_t *inst, int *oserr)
+{
+	unsigned i, n = inst->cfg.msg_handler_threads;
+	int err;
+
+	if (inst->cfg.msg_handler_order != LIBPD_ORDER_NONE) {
+		err = libpd_workers_create (&inst->workers, n, inst->rcv_queue_size,
+			handle_worker_msg, inst, &inst->lat_queue_wait, &inst->lat_receive,
+			oserr);
+		if (err == LIBPD_WORKERR_CREATE_THREAD)
+			return LIBPD_ERR_INIT_HANDLER_THREAD_PCR;
+		if (err != 0)
+			return LIBPD_ERR_INIT_HANDLER_QUEUE + err;
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: Started %u ordered msg handler threads\n", n));
+		return 0;
+	}
+	err = libpd_qcreate_prio (&inst->handler_queue, inst->wrp_queue_name,
+		inst->rcv_queue_size, inst->rcv_queue_lanes, 0, oserr);
+	if (err != 0)
+		return LIBPD_ERR_INIT_HANDLER_QUEUE + err;
+	err = libpd_qset_latency (inst->handler_queue, &inst->lat_queue_wait,
+		&inst->lat_receive);
+	if (err != 0) {
+		libpd_qdestroy (&inst->handler_queue, NULL);
+		return LIBPD_ERR_INIT_HANDLER_QUEUE + err;
+	}
+	inst->handler_tids = (pthread_t *) malloc (n * sizeof (pthread_t));
+	if (NULL == inst->handler_tids) {
+		libpd_qdestroy (&inst->handler_queue, NULL);
+		*oserr = ENOMEM;
+		return LIBPD_ERR_INIT_HANDLER_THREAD_PCR;
+	}
+	for (i = 0; i < n; i++) {
+		err = create_thread (&inst->handler_tids[i], msg_handler_thread, inst);
+		if (err != 0) {
+			*oserr = err;
+			break;
+		}
+		inst->handler_thread_count++;
+	}
+	if (inst->handler_thread_count < n) {
+		extra_err_info_t err_info;
+		stop_msg_handlers (inst, &err_info);
+		return LIBPD_ERR_INIT_HANDLER_THREAD_PCR;
+	}
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Started %u msg handler threads\n", n));
+	return 0;
+}
+
+// Stops the msg handler threads once they have handled everything
+// already on the handler queue. Called after the wrp receiver thread
+// has stopped, so nothing more gets queued.
+static void stop_msg_handlers (__instance_t *inst, extra_err_info_t *err_info)
+{
+	unsigned i;
+	int rtn = 0;
+
+	libpd_workers_destroy (&inst->workers);
+	if (NULL == inst->handler_queue)
+		return;
+	for (i = 0; i < inst->handler_thread_count; i++) {
+		do {
+			rtn = libpd_qsend (inst->handler_queue, (void *) &msg_handler_end,
+				WRP_QUEUE_SEND_TIMEOUT_MS, &err_info->oserr);
+		} while (rtn == 1);
+		if (rtn != 0)
+			break;
+	}
+	if (rtn == 0) {
+		for (i = 0; i < inst->handler_thread_count; i++) {
+			rtn = pthread_join (inst->handler_tids[i], NULL);
+			if (rtn != 0) {
+				libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating msg handler thread\n"));
+			}
+		}
+	} else {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: Unable to stop msg handler threads\n"));
+	}
+	inst->handler_thread_count = 0;
+	free (inst->handler_tids);
+	inst->handler_tids = NULL;
+	libpd_qdestroy (&inst->handler_queue, 
+		inst->cfg.zero_copy_receive ? &handler_msg_free_zc : &handler_msg_free);
+}
+
+// Creates the shm segment and its receiver thread. If either can't
+// be created, the instance runs over the sockets only.
+static void start_shm (__instance_t *inst)
+{
+	int err, oserr;
+
+	if (inst->cfg.shm_ring_size == 0)
+		return;
+	err = libpd_shm_create (&inst->shm, inst->cfg.shm_ring_size, &oserr);
+	if (err != 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: Unable to create shm segment (%d)\n", err));
+		return;
+	}
+	err = create_thread (&inst->shm_receiver_tid, shm_receiver_thread, inst);
+	if (err != 0) {
+		libpd_shm_destroy (&inst->shm);
+		return;
+	}
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Created shm segment %s\n", 
+		libpd_shm_path (inst->shm)));
+}
+
+// Closes the shm segment, for parodus too, and stops its receiver
+// thread. The segment stays mapped until it is destroyed.
+static void stop_shm (__instance_t *inst)
+{
+	int rtn;
 
+	if (NULL == inst->shm)
+		return;
+	__atomic_store_n (&inst->shm_active, false, __ATOMIC_RELAXED);
+	libpd_shm_close (inst->shm);
+	rtn = pthread_join (inst->shm_receiver_tid, NULL);
+	if (rtn != 0) {
+		libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating shm receiver thread\n"));
+	}
+}
 
 static void abort_init (__instance_t *inst, unsigned opt)
 {
 	if (opt & ABORT_RCV_SOCK)
-		shutdown_socket (&inst->rcv_sock);
-	if (opt & ABORT_QUEUE)
+		shutdown_rcv_socket (inst);
+	if (opt & ABORT_QUEUE) {
+		destroy_extra_services (inst);
+		libpd_routes_destroy (&inst->routes);
+		libpd_reqs_destroy (&inst->reqs);
 		libpd_qdestroy (&inst->wrp_queue, &wrp_free);
+		libpd_pool_destroy (inst->rcv_pool, NULL, NULL);
+		inst->rcv_pool = NULL;
+	}
 	if (opt & ABORT_SEND_SOCK)
 		shutdown_socket(&inst->send_sock);
-	if (opt & ABORT_STOP_RCV_SOCK)
-			shutdown_socket(&inst->stop_rcv_sock);
+	if (opt & ABORT_STOP_FD)
+		close (inst->stop_fd);
 }
 
 int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
@@ -461,6 +1167,7 @@ int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
 {
 	bool need_to_send_registration;
 	int err;
+	unsigned qopts;
 	int oserr = 0;
 	__instance_t *inst = make_new_instance (libpd_cfg);
 #define SETERR(oserr_,err_) \
@@ -485,9 +1192,15 @@ int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
 		("LIBPARODUS Options: Rcv: %d, KA Timeout: %d\n",
 		libpd_cfg->receive, libpd_cfg->keepalive_timeout_secs));
 
+	err = check_cfg (&inst->cfg);
+	if (err != 0) {
+		SETERR (0, err);
+		return LIBPD_ERROR_INIT_CFG;
+	}
+
 	if (inst->cfg.receive) {
 		libpd_log (LEVEL_INFO, ("LIBPARODUS: connecting receiver to %s\n",  inst->client_url));
-		err = connect_receiver (inst->client_url, inst->cfg.keepalive_timeout_secs, &oserr);
+		err = bind_receiver (inst, &oserr);
 		if (err < 0) {
 			SETERR(oserr, LIBPD_ERR_INIT_RCV + err); 
 			return CONNECT_ERR (oserr);
@@ -507,35 +1220,116 @@ int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
 			inst->parodus_url, inst->send_sock));
 	}
 	if (inst->cfg.receive) {
-		// We use the stop_rcv_sock to send a stop msg to our own receive socket.
-		err = connect_sender (inst->client_url, &oserr);
-		if (err < 0) {
+		// the receiver thread polls this along with the receive socket
+		inst->stop_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (inst->stop_fd < 0) {
+			oserr = errno;
+			libpd_log_err (LEVEL_ERROR, oserr, ("Error creating receiver stop eventfd\n"));
 			abort_init (inst, ABORT_RCV_SOCK | ABORT_SEND_SOCK);
-			SETERR (oserr, LIBPD_ERR_INIT_TERMSOCK + err); 
-			return CONNECT_ERR (oserr);
+			SETERR (oserr, LIBPD_ERR_INIT_STOP_FD); 
+			return LIBPD_ERROR_INIT_CONNECT;
 		}
-		inst->stop_rcv_sock = err;
+		inst->rcv_timeout_ms = -1;
 		libpd_log (LEVEL_INFO, ("LIBPARODUS: Opened sockets\n"));
-		err = libpd_qcreate (&inst->wrp_queue, inst->wrp_queue_name, WRP_QUEUE_SIZE, &oserr);
+		// the wrp receiver thread is the only producer on the wrp queue,
+		// so if the app has only one receiving thread we can go lock free,
+		// unless the receiver has to be able to drop msgs already queued,
+		// or the queue has priority lanes.
+		qopts = inst->cfg.single_receiver ? LIBPD_QOPT_SPSC : 0;
+		if (evicting_overflow (inst) || (inst->rcv_queue_lanes > 1))
+			qopts = 0;
+		if (inst->cfg.receive_fd)
+			qopts |= LIBPD_QOPT_EVENTFD;
+		// with a msg_handler, every msg goes to a handler, so there
+		// is no wrp queue
+		err = 0;
+		if (queued_receive (inst))
+			err = libpd_qcreate_prio (&inst->wrp_queue, inst->wrp_queue_name,
+				inst->rcv_queue_size, inst->rcv_queue_lanes, qopts, &oserr);
+		if ((err == 0) && (NULL != inst->wrp_queue))
+			err = libpd_qset_latency (inst->wrp_queue, &inst->lat_queue_wait,
+				&inst->lat_receive);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_SEND_SOCK | ABORT_STOP_FD);
+			SETERR (oserr, LIBPD_ERR_INIT_QUEUE + err); 
+			return LIBPD_ERROR_INIT_QUEUE;
+		}
+		if (inst->cfg.zero_copy_receive) {
+			// without a pool, received msgs are just malloc'd
+			inst->rcv_pool = libpd_pool_create (RCV_POOL_MAX_BYTES);
+			if (NULL == inst->rcv_pool) {
+				libpd_log (LEVEL_ERROR, ("LIBPARODUS: Unable to create receive pool\n"));
+			}
+			libpd_pool_cache_init (&inst->rcv_cache, inst->rcv_pool);
+		}
+		err = libpd_reqs_create (&inst->reqs, (libpd_instance_t) inst, 
+			libparodus_free_msg);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SEND_SOCK | ABORT_STOP_FD);
+			SETERR (0, LIBPD_ERR_INIT_REQUESTS + err); 
+			return LIBPD_ERROR_INIT_QUEUE;
+		}
+		err = libpd_routes_create (&inst->routes);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SEND_SOCK | ABORT_STOP_FD);
+			SETERR (0, LIBPD_ERR_INIT_ROUTES + err); 
+			return LIBPD_ERROR_INIT_QUEUE;
+		}
+		// only the wrp queue can be polled with libparodus_get_fd
+		err = create_extra_services (inst, qopts & ~LIBPD_QOPT_EVENTFD, &oserr);
 		if (err != 0) {
-			abort_init (inst, ABORT_RCV_SOCK | ABORT_SEND_SOCK | ABORT_STOP_RCV_SOCK);
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SEND_SOCK | ABORT_STOP_FD);
 			SETERR (oserr, LIBPD_ERR_INIT_QUEUE + err); 
 			return LIBPD_ERROR_INIT_QUEUE;
 		}
 		libpd_log (LEVEL_INFO, ("LIBPARODUS: Created queues\n"));
+		if (inst->cfg.msg_handler_threads > 0) {
+			err = start_msg_handlers (inst, &oserr);
+			if (err != 0) {
+				abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SEND_SOCK | ABORT_STOP_FD); 
+				SETERR (oserr, err);
+				return (err == LIBPD_ERR_INIT_HANDLER_THREAD_PCR) ?
+					LIBPD_ERROR_INIT_HANDLER_THREAD : LIBPD_ERROR_INIT_QUEUE;
+			}
+		}
+		start_shm (inst);
+		watchdog_init (inst);
 		err = create_thread (&inst->wrp_receiver_tid, wrp_receiver_thread,
 				inst);
 		if (err != 0) {
-			abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SEND_SOCK | ABORT_STOP_RCV_SOCK); 
+			stop_shm (inst);
+			libpd_shm_destroy (&inst->shm);
+			stop_msg_handlers (inst, err_info);
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SEND_SOCK | ABORT_STOP_FD); 
 			SETERR (err, LIBPD_ERR_INIT_RCV_THREAD_PCR);
 			return LIBPD_ERROR_INIT_RCV_THREAD;
 		}
 	}
 
-
-#ifdef TEST_SOCKET_TIMING
-	sst_init_totals ();
-#endif
+	if (inst->cfg.send_queue_size > 0) {
+		char *send_queue_name = (char *) malloc 
+			(strlen (SEND_QNAME_HDR) + strlen (inst->cfg.service_name) + 2);
+		if (NULL != send_queue_name)
+			sprintf (send_queue_name, "%s.%s", SEND_QNAME_HDR, inst->cfg.service_name);
+		inst->send_queue_name = send_queue_name;
+		err = libpd_qcreate (&inst->send_queue, 
+			(NULL != send_queue_name) ? send_queue_name : SEND_QNAME_HDR,
+			inst->cfg.send_queue_size, &oserr);
+		if (err != 0) {
+			libparodus_shutdown__ (inst, err_info);
+			SETERR (oserr, LIBPD_ERR_INIT_SEND_QUEUE + err);
+			return (err == LIBPD_QERR_CREATE_INVAL_SZ) ?
+				LIBPD_ERROR_INIT_CFG : LIBPD_ERROR_INIT_QUEUE;
+		}
+		err = create_thread (&inst->wrp_sender_tid, wrp_sender_thread, inst);
+		if (err != 0) {
+			libpd_qdestroy (&inst->send_queue, &async_send_free);
+			libparodus_shutdown__ (inst, err_info);
+			SETERR (err, LIBPD_ERR_INIT_SEND_THREAD_PCR);
+			return LIBPD_ERROR_INIT_SEND_THREAD;
+		}
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: Created send queue\n"));
+	}
 
 	inst->run_state = RUN_STATE_RUNNING;
 
@@ -551,7 +1345,7 @@ int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
 
 	if (need_to_send_registration) {
 		libpd_log (LEVEL_INFO, ("LIBPARODUS: sending registration msg\n"));
-		err = send_registration_msg (inst, err_info);
+		err = send_registration_msg (inst, false, err_info);
 		if (err != 0) {
 			libpd_log (LEVEL_ERROR, ("LIBPARODUS: error sending registration msg\n"));
 			oserr = err_info->oserr;
@@ -574,13 +1368,14 @@ int libparodus_init (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg)
 }
 
 // When msg_len is given as -1, then msg is a null terminated string
-static int sock_send (int sock, const char *msg, int msg_len, int *oserr)
+static int sock_send (int sock, const char *msg, int msg_len, int flags,
+	int *oserr)
 {
   int bytes;
 	*oserr = 0;
 	if (msg_len < 0)
 		msg_len = strlen (msg) + 1; // include terminating null
-	bytes = nn_send (sock, msg, msg_len, 0);
+	bytes = nn_send (sock, msg, msg_len, flags);
   if (bytes < 0) {
 		*oserr = errno; 
 		libpd_log_err (LEVEL_ERROR, errno, ("Error sending msg\n"));
@@ -593,49 +1388,117 @@ static int sock_send (int sock, const char *msg, int msg_len, int *oserr)
 	return 0;
 }
 
-// returns 0 OK, 1 timedout, -1 error
-static int sock_receive (int rcv_sock, raw_msg_t *msg, int *oserr)
+// Sends a buffer from nn_allocmsg without copying it.
+// The buffer belongs to nanomsg afterwards, even on error.
+static int sock_send_nn_buf (int sock, void *nn_buf, int msg_len, int flags,
+	int *oserr)
 {
-	char *buf = NULL;
-  msg->len = nn_recv (rcv_sock, &buf, NN_MSG, 0);
-
+	int bytes;
 	*oserr = 0;
-  if (msg->len < 0) {
-		libpd_log_err (LEVEL_ERROR, errno, ("Error receiving msg\n"));
-		if (errno == ETIMEDOUT)
-			return 1;
+	bytes = nn_send (sock, &nn_buf, NN_MSG, flags);
+	if (bytes < 0) {
 		*oserr = errno; 
+		libpd_log_err (LEVEL_ERROR, errno, ("Error sending msg\n"));
+		nn_freemsg (nn_buf);
+		return -0x40;
+	}
+	if (bytes != msg_len) {
+		libpd_log (LEVEL_ERROR, ("Not all bytes sent, just %d\n", bytes));
 		return -1;
 	}
-	msg->msg = buf;
 	return 0;
 }
 
-static void libparodus_shutdown__ (__instance_t *inst, extra_err_info_t *err_info)
+// Waits up to rcv_timeout_ms for a msg, polling the socket's receive
+// fd along with stop_fd, so shutdown doesn't wait on the socket.
+// returns 0 OK, 1 timedout, 2 stopped, -1 error
+static int sock_receive (__instance_t *inst, raw_msg_t *msg, int *oserr)
 {
+	struct pollfd fds[2];
+	char *buf = NULL;
 	int rtn;
-#ifdef TEST_SOCKET_TIMING
-	sst_display_totals ();
-#endif
 
-	inst->run_state = RUN_STATE_DONE;
+	*oserr = 0;
+	while (true) {
+		msg->len = nn_recv (inst->rcv_sock, &buf, NN_MSG, NN_DONTWAIT);
+		if (msg->len >= 0) {
+			msg->msg = buf;
+			return 0;
+		}
+		if (errno != EAGAIN)
+			break;
+		fds[0].fd = inst->rcv_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = inst->stop_fd;
+		fds[1].events = POLLIN;
+		rtn = poll (fds, 2, inst->rcv_timeout_ms);
+		if (rtn < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents & POLLIN)
+			return 2;
+		if (rtn == 0)
+			return 1;
+	}
+	*oserr = errno;
+	libpd_log_err (LEVEL_ERROR, errno, ("Error receiving msg\n"));
+	return -1;
+}
+
+static void libparodus_shutdown__ (__instance_t *inst, extra_err_info_t *err_info)
+{
+	int rtn;
+
+	inst->run_state = RUN_STATE_DONE;
 	libpd_log (LEVEL_INFO, ("LIBPARODUS: Shutting Down\n"));
 	if (inst->cfg.receive) {
-		sock_send (inst->stop_rcv_sock, end_msg, -1, &err_info->oserr);
+		if (eventfd_write (inst->stop_fd, 1) != 0) {
+			libpd_log_err (LEVEL_ERROR, errno, ("Error signalling wrp receiver thread\n"));
+		}
 	 	rtn = pthread_join (inst->wrp_receiver_tid, NULL);
 		if (rtn != 0) {
 			libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating wrp receiver thread\n"));
 		}
-		shutdown_socket(&inst->rcv_sock);
-		libpd_log (LEVEL_INFO, ("LIBPARODUS: Flushing wrp queue\n"));
-		flush_wrp_queue (inst->wrp_queue, 5, &err_info->oserr);
-		libpd_qdestroy (&inst->wrp_queue, &wrp_free);
+		close (inst->stop_fd);
+		stop_shm (inst);
+		stop_msg_handlers (inst, err_info);
+		libpd_reqs_destroy (&inst->reqs);
+		libpd_routes_destroy (&inst->routes);
+		shutdown_rcv_socket (inst);
+		if (inst->cfg.zero_copy_receive) {
+			libpd_qdestroy (&inst->wrp_queue, &wrp_free_zc);
+		} else {
+			// the receiver threads are stopped, so nothing more
+			// can arrive. No need to wait for it.
+			libpd_log (LEVEL_INFO, ("LIBPARODUS: Flushing wrp queue\n"));
+			flush_wrp_queue (inst->wrp_queue);
+			libpd_qdestroy (&inst->wrp_queue, &wrp_free);
+		}
+		destroy_extra_services (inst);
+	}
+	if (NULL != inst->send_queue) {
+		// the end msg goes behind anything already queued, so the
+		// sender thread sends everything before it stops.
+		do {
+			rtn = libpd_qsend (inst->send_queue, (void *) &async_send_end,
+				WRP_QUEUE_SEND_TIMEOUT_MS, &err_info->oserr);
+		} while (rtn == 1);
+		if (rtn == 0) {
+		 	rtn = pthread_join (inst->wrp_sender_tid, NULL);
+			if (rtn != 0) {
+				libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating wrp sender thread\n"));
+			}
+		} else {
+			libpd_log (LEVEL_ERROR, ("LIBPARODUS: Unable to stop wrp sender thread\n"));
+		}
+		libpd_qdestroy (&inst->send_queue, &async_send_free);
 	}
 	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Shut down send sock %d\n", inst->send_sock));
 	shutdown_socket(&inst->send_sock);
-	if (inst->cfg.receive) {
-		shutdown_socket(&inst->stop_rcv_sock);
-	}
+	// async sends may have used the ring until the sender thread stopped
+	libpd_shm_destroy (&inst->shm);
 	inst->run_state = 0;
 	inst->auth_received = false;
 }
@@ -692,20 +1555,6 @@ static int timed_wrp_queue_receive (libpd_mq_t wrp_queue,	wrp_msg_t **msg,
 	return 0;
 }
 
-static wrp_msg_t *make_closed_msg (void)
-{
-	wrp_msg_t *msg = (wrp_msg_t *) malloc (sizeof (wrp_msg_t));
-	if (NULL == msg)
-		return NULL;
-	msg->msg_type = WRP_MSG_TYPE__REQ;
-	msg->u.req.transaction_uuid = closed_msg;
-	msg->u.req.source = closed_msg;
-	msg->u.req.dest = closed_msg;
-	msg->u.req.payload = (void*) closed_msg;
-	msg->u.req.payload_size = strlen(closed_msg);
-	return msg;
-}
-
 // returns 0 OK
 //  2 closed msg received
 //  1 timed out
@@ -753,7 +1602,7 @@ int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg,
 		return LIBPD_ERROR_RCV_NULL_INST;
 	}
 
-	if (!inst->cfg.receive) {
+	if (!queued_receive (inst)) {
 		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_receive\n"));
 		err_info->err_detail = LIBPD_ERR_RCV_CFG;
 		return LIBPD_ERROR_RCV_CFG;
@@ -771,16 +1620,261 @@ int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg,
 	return LIBPD_ERROR_RCV_RCV;
 }
 
+int libparodus_receive_service_dbg (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms, 
+	extra_err_info_t *err_info)
+{
+	int rtn, service;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_receive_service\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_NULL_INST;
+		return LIBPD_ERROR_RCV_NULL_INST;
+	}
+	if (!queued_receive (inst)) {
+		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_receive_service\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_CFG;
+		return LIBPD_ERROR_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at receive\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_STATE;
+		return LIBPD_ERROR_RCV_STATE;
+	}
+	service = find_service (inst, service_name);
+	if (service < 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: unknown service on libparodus_receive_service\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_PARAM;
+		return LIBPD_ERROR_RCV_PARAM;
+	}
+	rtn = libparodus_receive__ (service_queue (inst, service), msg, ms, 
+		&err_info->oserr);
+	if (rtn >= 0)
+		return rtn;
+	err_info->err_detail = rtn;
+	return LIBPD_ERROR_RCV_RCV;
+}
+
+int libparodus_receive_service (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms)
+{
+  extra_err_info_t err;
+  return libparodus_receive_service_dbg (instance, service_name, msg, ms, &err);
+}
+
 int libparodus_receive (libpd_instance_t instance, wrp_msg_t **msg, uint32_t ms)
 {
   extra_err_info_t err;
   return libparodus_receive_dbg (instance, msg, ms, &err);
 }
 
+int libparodus_try_receive (libpd_instance_t instance, wrp_msg_t **msg)
+{
+  extra_err_info_t err;
+  return libparodus_receive_dbg (instance, msg, 0, &err);
+}
+
+int libparodus_get_fd (libpd_instance_t instance)
+{
+	__instance_t *inst = (__instance_t *) instance;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_get_fd\n"));
+		return LIBPD_ERROR_RCV_NULL_INST;
+	}
+	if (!queued_receive (inst) || !inst->cfg.receive_fd) {
+		libpd_log (LEVEL_ERROR, ("No receive_fd option on libparodus_get_fd\n"));
+		return LIBPD_ERROR_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at get_fd\n"));
+		return LIBPD_ERROR_RCV_STATE;
+	}
+	return libpd_qfd (inst->wrp_queue);
+}
+
+int libparodus_get_stats (libpd_instance_t instance, libpd_stats_t *stats)
+{
+	__instance_t *inst = (__instance_t *) instance;
+	libpd_mq_t rcv_queue;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_get_stats\n"));
+		return LIBPD_ERROR_STATS_NULL_INST;
+	}
+	if (NULL == stats) {
+		libpd_log (LEVEL_ERROR, ("Null stats on libparodus_get_stats\n"));
+		return LIBPD_ERROR_STATS_PARAM;
+	}
+	stats->msgs_sent = STATS_GET (inst, msgs_sent);
+	stats->bytes_sent = STATS_GET (inst, bytes_sent);
+	stats->msgs_received = STATS_GET (inst, msgs_received);
+	stats->bytes_received = STATS_GET (inst, bytes_received);
+	stats->msgs_dropped = STATS_GET (inst, msgs_dropped);
+	stats->decode_errors = STATS_GET (inst, decode_errors);
+	stats->queue_full = STATS_GET (inst, queue_full);
+	stats->auth_msgs = STATS_GET (inst, auth_msgs);
+	stats->keep_alive_msgs = STATS_GET (inst, keep_alive_msgs);
+	stats->reconnects = STATS_GET (inst, reconnects);
+	stats->reconnect_attempts = STATS_GET (inst, reconnect_attempts);
+	stats->reconnect_ms = STATS_GET (inst, reconnect_ms);
+	stats->last_reconnect_ms = STATS_GET (inst, last_reconnect_ms);
+	stats->max_reconnect_ms = STATS_GET (inst, max_reconnect_ms);
+	stats->keepalive_misses = STATS_GET (inst, keepalive_misses);
+	stats->link_state_changes = STATS_GET (inst, link_state_changes);
+	stats->link_state = STATS_GET (inst, link_state);
+	stats->shm_msgs_sent = STATS_GET (inst, shm_msgs_sent);
+	stats->shm_msgs_received = STATS_GET (inst, shm_msgs_received);
+	stats->pool_bytes = (uint32_t) libpd_pool_bytes (inst->rcv_pool);
+	stats->pool_fallbacks = libpd_pool_fallbacks (inst->rcv_pool);
+	// with a msg handler, received msgs wait on the handler queue,
+	// or don't wait at all if there is no handler thread pool
+	rcv_queue = queued_receive (inst) ? inst->wrp_queue : inst->handler_queue;
+	if (!queued_receive (inst) && (NULL != inst->workers)) {
+		stats->queue_high_water = libpd_workers_high_water (inst->workers);
+		stats->queue_size = inst->rcv_queue_size;
+		return 0;
+	}
+	stats->queue_high_water = libpd_qhigh_water (rcv_queue);
+	stats->queue_size = (NULL != rcv_queue) ? 
+		(inst->rcv_queue_size * inst->rcv_queue_lanes) : 0;
+	return 0;
+}
+
+int libparodus_get_latency_stats (libpd_instance_t instance,
+	libpd_latency_stats_t *stats)
+{
+	__instance_t *inst = (__instance_t *) instance;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_get_latency_stats\n"));
+		return LIBPD_ERROR_STATS_NULL_INST;
+	}
+	if (NULL == stats) {
+		libpd_log (LEVEL_ERROR, ("Null stats on libparodus_get_latency_stats\n"));
+		return LIBPD_ERROR_STATS_PARAM;
+	}
+	libpd_lat_summary (&inst->lat_encode, &stats->encode);
+	libpd_lat_summary (&inst->lat_send, &stats->send);
+	libpd_lat_summary (&inst->lat_queue_wait, &stats->queue_wait);
+	libpd_lat_summary (&inst->lat_receive, &stats->receive);
+	return 0;
+}
+
+// returns 0 OK
+//  2 closed msg received
+//  1 timed out
+//  LIBPD_ERR_RCV_ ... on error
+int libparodus_receive_batch__ (libpd_mq_t wrp_queue, wrp_msg_t **msgs, 
+	size_t max, uint32_t ms, size_t *count, int *oserr)
+{
+	int err;
+	unsigned i, n, qcount;
+	bool closed = false;
+
+	*count = 0;
+	if (max > UINT_MAX)
+		max = UINT_MAX;
+	// the closed msg ends the batch, leaving what's behind it queued
+	err = libpd_qreceive_until (wrp_queue, (void **) msgs, (unsigned) max,
+		is_closed_queued_msg, ms, &qcount, oserr);
+	if (err == 1) // timed out
+		return 1;
+	if (err != 0) {
+		libpd_log (LEVEL_ERROR, ("Unable to receive on queue /WRP_QUEUE\n"));
+		return LIBPD_ERR_RCV_QUEUE + err;
+	}
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received %u msgs on WRP QUEUE\n", qcount));
+	// squeeze out the closed msg, which can only be last,
+	// and any NULLs, keeping the order
+	for (i = 0, n = 0; i < qcount; i++) {
+		if (NULL == msgs[i]) {
+			libpd_log (LEVEL_DEBUG, ("LIBPARODOS: NULL msg from wrp queue\n"));
+			continue;
+		}
+		if (is_closed_msg (msgs[i])) {
+			wrp_free (msgs[i]);
+			libpd_log (LEVEL_INFO, ("LIBPARODUS: closed msg received\n"));
+			closed = true;
+			continue;
+		}
+		msgs[n++] = msgs[i];
+	}
+	*count = n;
+	if (closed)
+		return 2;
+	if (n == 0)
+		return LIBPD_ERR_RCV_NULL_MSG;
+	return 0;
+}
+
+// returns 0 OK
+//  2 closed msg received
+//  1 timed out
+// LIBPD_ERR_RCV_ ... on error
+int libparodus_receive_batch_dbg (libpd_instance_t instance, wrp_msg_t **msgs, 
+	size_t max, uint32_t ms, size_t *count, extra_err_info_t *err_info)
+{
+	int rtn;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_receive_batch\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_NULL_INST;
+		return LIBPD_ERROR_RCV_NULL_INST;
+	}
+	if ((NULL == msgs) || (NULL == count) || (0 == max)) {
+		libpd_log (LEVEL_ERROR, ("Invalid parameter on libparodus_receive_batch\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_PARAM;
+		return LIBPD_ERROR_RCV_PARAM;
+	}
+	*count = 0;
+	if (!queued_receive (inst)) {
+		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_receive_batch\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_CFG;
+		return LIBPD_ERROR_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at receive batch\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_STATE;
+		return LIBPD_ERROR_RCV_STATE;
+	}
+	rtn = libparodus_receive_batch__ (inst->wrp_queue, msgs, max, ms, count,
+		&err_info->oserr);
+	if (rtn >= 0)
+		return rtn;
+	err_info->err_detail = rtn;
+	return LIBPD_ERROR_RCV_RCV;
+}
+
+int libparodus_receive_batch (libpd_instance_t instance, wrp_msg_t **msgs,
+	size_t max, uint32_t ms, size_t *count)
+{
+  extra_err_info_t err;
+  return libparodus_receive_batch_dbg (instance, msgs, max, ms, count, &err);
+}
+
+// a NULL instance is one already shut down, and only zero copy msgs
+// may be freed after that
+void libparodus_free_msg (libpd_instance_t instance, wrp_msg_t *msg)
+{
+	__instance_t *inst = (__instance_t *) instance;
+
+	if ((NULL == inst) || inst->cfg.zero_copy_receive)
+		libpd_wrp_free_msg (msg);
+	else
+		wrp_free_struct (msg);
+}
+
 int libparodus_close_receiver__ (libpd_mq_t wrp_queue, int *oserr)
 {
-	wrp_msg_t *closed_msg_ptr =	make_closed_msg ();
-	int rtn = libpd_qsend (wrp_queue, (void *) closed_msg_ptr, 
+	// not called from the wrp receiver thread, so use qpost
+	int rtn = libpd_qpost (wrp_queue, (void *) &closed_wrp_msg, 
 				WRP_QUEUE_SEND_TIMEOUT_MS, oserr);
 	if (rtn == 1) // timed out
 		return 1;
@@ -795,6 +1889,7 @@ int libparodus_close_receiver_dbg (libpd_instance_t instance,
     extra_err_info_t *err_info)
 {
 	int rtn;
+	unsigned i;
 	__instance_t *inst = (__instance_t *) instance;
 
 	err_info->err_detail = 0;
@@ -804,7 +1899,7 @@ int libparodus_close_receiver_dbg (libpd_instance_t instance,
 		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_NULL_INST;
 		return LIBPD_ERROR_CLOSE_RCV_NULL_INST;
 	}
-	if (!inst->cfg.receive) {
+	if (!queued_receive (inst)) {
 		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_close_receiver\n"));
 		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_CFG;
 		return LIBPD_ERROR_CLOSE_RCV_CFG;
@@ -815,6 +1910,9 @@ int libparodus_close_receiver_dbg (libpd_instance_t instance,
 		return LIBPD_ERROR_CLOSE_RCV_STATE;
 	}
 	rtn = libparodus_close_receiver__ (inst->wrp_queue, &err_info->oserr);
+	for (i = 0; (rtn == 0) && (i < inst->cfg.num_extra_services); i++)
+		rtn = libparodus_close_receiver__ (inst->extra_services[i].queue, 
+			&err_info->oserr);
 	if (rtn == 0)
 		return 0;
 	if (rtn == 1) {
@@ -831,61 +1929,170 @@ int libparodus_close_receiver (libpd_instance_t instance)
   return libparodus_close_receiver_dbg (instance, &err);
 }
 
-static int wrp_sock_send (__instance_t *inst, wrp_msg_t *msg, extra_err_info_t *err_info)
+// Encode a wrp msg for sending.
+// Where we can, the msg is encoded straight into a nanomsg buffer
+// (nn_buf set true) so it can be sent without another copy.
+// Otherwise wrp_struct_to is used, and any shm_offer is left out.
+static ssize_t encode_wrp_msg (__instance_t *inst, wrp_msg_t *msg, 
+	const char *shm_offer, void **msg_bytes, bool *nn_buf)
 {
-	int rtn;
 	ssize_t msg_len;
-	void *msg_bytes;
-#ifdef TEST_SOCKET_TIMING
-	sst_times_t sst_times;
-#define SST(func) func
-#else
-#define SST(func)
-#endif
-
-	err_info->err_detail = 0;
-	err_info->oserr = 0;
-	pthread_mutex_lock (&inst->send_mutex);
-	msg_len = wrp_struct_to (msg, WRP_BYTES, &msg_bytes);
-	if (msg_len < 1) {
-		libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting WRP to bytes\n"));
-		pthread_mutex_unlock (&inst->send_mutex);
-		return -0x1001;
+	uint64_t start = libpd_lat_now ();
+	size_t buf_size = libpd_wrp_encoded_size_ext (msg, LIBPD_SHM_FIELD, shm_offer);
+
+	if (buf_size > 0) {
+		*msg_bytes = nn_allocmsg (buf_size, 0);
+		if (NULL != *msg_bytes) {
+			msg_len = libpd_wrp_encode_ext (msg, LIBPD_SHM_FIELD, shm_offer,
+				*msg_bytes, buf_size);
+			if (msg_len > 0) {
+				*nn_buf = true;
+				libpd_lat_record_since (&inst->lat_encode, start);
+				return msg_len;
+			}
+			nn_freemsg (*msg_bytes);
+		}
 	}
+	// msgs libpd_wrp_encode doesn't handle, such as those with money
+	// trace spans, and unknown msg types, are left to wrp-c
+	*nn_buf = false;
+	msg_len = wrp_struct_to (msg, WRP_BYTES, msg_bytes);
+	libpd_lat_record_since (&inst->lat_encode, start);
+	return msg_len;
+}
 
-	SST (sst_start_total_timing (&sst_times);)
+// sends already encoded bytes, with nn_send flags. Always frees msg_bytes.
+static int sock_send_bytes (__instance_t *inst, void *msg_bytes, ssize_t msg_len,
+	bool nn_buf, int flags, extra_err_info_t *err_info)
+{
+	int rtn;
+	int send_timeout = NOWAIT_SEND_TIMEOUT_MS;
+	uint64_t start;
 
+	// nanomsg sockets are thread safe, so nn_send itself needs no lock.
+	// send_mutex only protects send_sock when it is opened and
+	// closed around each send.
 	if (inst->connect_on_every_send) {
+		pthread_mutex_lock (&inst->send_mutex);
 		rtn = connect_sender (inst->parodus_url, &err_info->oserr);
 		if (rtn < 0) {
-			free (msg_bytes);
 			pthread_mutex_unlock (&inst->send_mutex);
+			free_msg_bytes (msg_bytes, nn_buf);
 			return -0x1200 + rtn;
 		}
 		inst->send_sock = rtn;
+		// a new connection is never ready at once, so a send that
+		// mustn't block waits a little instead
+		if (flags & NN_DONTWAIT) {
+			nn_setsockopt (inst->send_sock, NN_SOL_SOCKET, NN_SNDTIMEO,
+				&send_timeout, sizeof (send_timeout));
+			flags &= ~NN_DONTWAIT;
+		}
 	}
 
-	SST (sst_start_send_timing (&sst_times);)
-	rtn = sock_send (inst->send_sock, (const char *)msg_bytes, msg_len, 
-	    &err_info->oserr);
-	SST (sst_update_send_time (&sst_times);)
+	start = libpd_lat_now ();
+	if (nn_buf) {
+		rtn = sock_send_nn_buf (inst->send_sock, msg_bytes, msg_len, 
+			flags, &err_info->oserr);
+	} else {
+		rtn = sock_send (inst->send_sock, (const char *)msg_bytes, msg_len, 
+			flags, &err_info->oserr);
+		free (msg_bytes);
+	}
+	libpd_lat_record_since (&inst->lat_send, start);
 
 	if (inst->connect_on_every_send) {
 		shutdown_socket (&inst->send_sock);
+		pthread_mutex_unlock (&inst->send_mutex);
 	}
-	SST (sst_update_total_time (&sst_times);)
 
-	free (msg_bytes);
-	pthread_mutex_unlock (&inst->send_mutex);
-	if (rtn == 0)
+	if (rtn == 0) {
+		STATS_ADD (inst, msgs_sent, 1);
+		STATS_ADD (inst, bytes_sent, (uint64_t) msg_len);
 		return 0;
+	}
 	return -0x1800 + rtn;
 }
 
+// Copies encoded bytes into the up ring of the shm segment. Always
+// frees msg_bytes, except when it returns LIBPD_SHMERR_CLOSED, so
+// the msg can go over the socket instead.
+static int shm_send_bytes (__instance_t *inst, void *msg_bytes, ssize_t msg_len,
+	bool nn_buf, extra_err_info_t *err_info)
+{
+	int rtn;
+	uint64_t start = libpd_lat_now ();
+
+	// shm_mutex, not send_mutex, so a sender waiting for room in
+	// the ring doesn't hold up socket sends
+	pthread_mutex_lock (&inst->shm_mutex);
+	rtn = libpd_shm_send (inst->shm, LIBPD_SHM_UP, msg_bytes, 
+		(unsigned) msg_len, SOCK_SEND_TIMEOUT_MS);
+	pthread_mutex_unlock (&inst->shm_mutex);
+	libpd_lat_record_since (&inst->lat_send, start);
+	if (rtn == LIBPD_SHMERR_CLOSED) {
+		__atomic_store_n (&inst->shm_active, false, __ATOMIC_RELAXED);
+		return rtn;
+	}
+	free_msg_bytes (msg_bytes, nn_buf);
+	if (rtn == 0) {
+		STATS_ADD (inst, msgs_sent, 1);
+		STATS_ADD (inst, bytes_sent, (uint64_t) msg_len);
+		STATS_ADD (inst, shm_msgs_sent, 1);
+		return 0;
+	}
+	// the same as a socket send that timed out
+	libpd_log (LEVEL_ERROR, ("LIBPARODUS: shm ring full, msg not sent\n"));
+	err_info->oserr = ETIMEDOUT;
+	return -0x1800 + SOCK_SEND_ERR_NN;
+}
+
+// sends already encoded bytes through the shm ring if parodus has
+// accepted it, else over the socket. Always frees msg_bytes.
+// Every msg takes the ring, large ones in fragments, so that one
+// sender's msgs reach parodus in the order they were sent.
+static int send_bytes (__instance_t *inst, void *msg_bytes, ssize_t msg_len,
+	bool nn_buf, extra_err_info_t *err_info)
+{
+	int rtn;
+
+	if (__atomic_load_n (&inst->shm_active, __ATOMIC_RELAXED)) {
+		rtn = shm_send_bytes (inst, msg_bytes, msg_len, nn_buf, err_info);
+		if (rtn != LIBPD_SHMERR_CLOSED)
+			return rtn;
+	}
+	return sock_send_bytes (inst, msg_bytes, msg_len, nn_buf, 0, err_info);
+}
+
+// Encodes and sends a wrp msg, the way mode says.
+// Encoding is done in the calling thread, outside of any lock, so that
+// concurrent senders are not serialized behind msgpack.
+static int wrp_send (__instance_t *inst, wrp_msg_t *msg, send_mode_t mode,
+	const char *shm_offer, extra_err_info_t *err_info)
+{
+	ssize_t msg_len;
+	void *msg_bytes;
+	bool nn_buf;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	msg_len = encode_wrp_msg (inst, msg, shm_offer, &msg_bytes, &nn_buf);
+	if (msg_len < 1) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting WRP to bytes\n"));
+		return -0x1001;
+	}
+	if (mode == SEND_SOCK)
+		return sock_send_bytes (inst, msg_bytes, msg_len, nn_buf, 0, err_info);
+	if (mode == SEND_SOCK_NOWAIT)
+		return sock_send_bytes (inst, msg_bytes, msg_len, nn_buf, 
+			NN_DONTWAIT, err_info);
+	return send_bytes (inst, msg_bytes, msg_len, nn_buf, err_info);
+}
+
 int libparodus_send__ (libpd_instance_t instance, wrp_msg_t *msg, 
     extra_err_info_t *err_info)
 {
-	int rtn = wrp_sock_send ((__instance_t *) instance, msg, err_info);
+	int rtn = wrp_send ((__instance_t *) instance, msg, SEND_ANY, NULL, err_info);
 	if (rtn == 0)
 		return 0;
 	return LIBPD_ERR_SEND + rtn;
@@ -925,153 +2132,1017 @@ int libparodus_send (libpd_instance_t instance, wrp_msg_t *msg)
   return libparodus_send_dbg (instance, msg, &err);
 }
 
-static char *find_wrp_msg_dest (wrp_msg_t *wrp_msg)
+static int libparodus_send_async__ (__instance_t *inst, wrp_msg_t *msg,
+	libpd_send_cb_t *callback, void *ctx, extra_err_info_t *err_info)
 {
-	if (wrp_msg->msg_type == WRP_MSG_TYPE__REQ)
-		return wrp_msg->u.req.dest;
-	if (wrp_msg->msg_type == WRP_MSG_TYPE__EVENT)
-		return wrp_msg->u.event.dest;
-	if (wrp_msg->msg_type == WRP_MSG_TYPE__CREATE)
-		return wrp_msg->u.crud.dest;
-	if (wrp_msg->msg_type == WRP_MSG_TYPE__RETREIVE)
-		return wrp_msg->u.crud.dest;
-	if (wrp_msg->msg_type == WRP_MSG_TYPE__UPDATE)
-		return wrp_msg->u.crud.dest;
-	if (wrp_msg->msg_type == WRP_MSG_TYPE__DELETE)
-		return wrp_msg->u.crud.dest;
-	return NULL;
+	int rtn;
+	async_send_t *item = (async_send_t *) malloc (sizeof (async_send_t));
+
+	if (NULL == item) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: unable to allocate async send msg\n"));
+		return LIBPD_ERR_SEND_QUEUE;
+	}
+	item->msg_len = encode_wrp_msg (inst, msg, NULL, &item->msg_bytes, &item->nn_buf);
+	if (item->msg_len < 1) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting WRP to bytes\n"));
+		free (item);
+		return LIBPD_ERR_SEND_CONVERT;
+	}
+	item->callback = callback;
+	item->ctx = ctx;
+	// don't wait if the queue is full
+	rtn = libpd_qsend (inst->send_queue, (void *) item, 0, &err_info->oserr);
+	if (rtn == 0)
+		return 0;
+	async_send_free (item);
+	if (rtn == 1)
+		return LIBPD_ERR_SEND_QUEUE_FULL;
+	return LIBPD_ERR_SEND_QUEUE + rtn;
 }
 
-static void wrp_receiver_reconnect (__instance_t *inst, extra_err_info_t *err_info)
+int libparodus_send_async_dbg (libpd_instance_t instance, wrp_msg_t *msg,
+	libpd_send_cb_t *callback, void *ctx, extra_err_info_t *err_info)
 {
-	int p = 2;
-	int retry_delay = 0;
+	int rtn;
+	__instance_t *inst = (__instance_t *) instance;
 
-	while (true)
-	{
-		shutdown_socket (&inst->rcv_sock);
-		if (retry_delay < MAX_RECONNECT_RETRY_DELAY_SECS) {
-			p = p+p;
-			retry_delay = p-1;
-		}
-		sleep (retry_delay);
-		libpd_log (LEVEL_DEBUG, ("Retrying receiver connection\n"));
-		inst->rcv_sock = connect_receiver 
-			(inst->client_url, inst->cfg.keepalive_timeout_secs, 
-			 &err_info->oserr);
-		if (inst->rcv_sock < 0)
-			continue;
-		if (send_registration_msg (inst, err_info) != 0)
-			continue;
-		break;
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_send_async\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_NULL_INST;
+		return LIBPD_ERROR_SEND_NULL_INST;
 	}
-	inst->auth_received = false;
-	inst->reconnect_count++;
-	return;
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at send async\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_STATE;
+		return LIBPD_ERROR_SEND_STATE;
+	}
+	if (NULL == inst->send_queue) {
+		libpd_log (LEVEL_ERROR, ("No send queue on libparodus_send_async\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_ASYNC_CFG;
+		return LIBPD_ERROR_SEND_ASYNC_CFG;
+	}
+	rtn = libparodus_send_async__ (inst, msg, callback, ctx, err_info);
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = rtn;
+	if (rtn == LIBPD_ERR_SEND_CONVERT)
+		return LIBPD_ERROR_SEND_WRP_MSG;
+	if (rtn == LIBPD_ERR_SEND_QUEUE_FULL)
+		return LIBPD_ERROR_SEND_QUEUE_FULL;
+	return LIBPD_ERROR_SEND_QUEUE;
 }
 
-static void *wrp_receiver_thread (void *arg)
+int libparodus_send_async (libpd_instance_t instance, wrp_msg_t *msg,
+	libpd_send_cb_t *callback, void *ctx)
 {
-	int rtn, msg_len;
-	raw_msg_t raw_msg;
-	wrp_msg_t *wrp_msg;
-	int end_msg_len = strlen(end_msg);
-	__instance_t *inst = (__instance_t*) arg;
-	extra_err_info_t *rcv_err = &inst->rcv_err_info;
-	char *msg_dest, *msg_service;
+  extra_err_info_t err;
+  return libparodus_send_async_dbg (instance, msg, callback, ctx, &err);
+}
 
-	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting wrp receiver thread\n"));
-	while (1) {
-		rtn = sock_receive (inst->rcv_sock, &raw_msg, &rcv_err->oserr);
-		if (rtn != 0) {
-			if (rtn == 1) { // timed out
-				if (RUN_STATE_RUNNING != inst->run_state) {
-					break;
-				}
-				wrp_receiver_reconnect (inst, rcv_err);
-				continue;
-			}
-			break;
-		}
-		if (raw_msg.len >= end_msg_len) {
-			if (strncmp (raw_msg.msg, end_msg, end_msg_len) == 0) {
-				nn_freemsg (raw_msg.msg);
-				break;
-			}
-		}
-		if (RUN_STATE_RUNNING != inst->run_state) {
-			nn_freemsg (raw_msg.msg);
+// checks the instance and req, and adds req to the request table.
+// returns 0 or LIBPD_ERROR_REQUEST_ error, with err_info set
+static int add_request (__instance_t *inst, wrp_msg_t *req, uint32_t timeout_ms,
+	libpd_response_cb_t *callback, void *ctx, pending_req_t **pending,
+	extra_err_info_t *err_info)
+{
+	const char *uuid;
+	int rtn;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_request\n"));
+		err_info->err_detail = LIBPD_ERR_REQUEST_NULL_INST;
+		return LIBPD_ERROR_REQUEST_NULL_INST;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at request\n"));
+		err_info->err_detail = LIBPD_ERR_REQUEST_STATE;
+		return LIBPD_ERROR_REQUEST_STATE;
+	}
+	if (NULL == inst->reqs) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: request needs receive configured\n"));
+		err_info->err_detail = LIBPD_ERR_REQUEST_CFG;
+		return LIBPD_ERROR_REQUEST_CFG;
+	}
+	uuid = (NULL != req) ? libpd_reqs_msg_uuid (req) : NULL;
+	if (NULL == uuid) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: request without a transaction uuid\n"));
+		err_info->err_detail = LIBPD_ERR_REQUEST_PARAM;
+		return LIBPD_ERROR_REQUEST_PARAM;
+	}
+	rtn = libpd_reqs_add (inst->reqs, uuid, timeout_ms, callback, ctx, pending);
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = LIBPD_ERR_REQUEST_ADD + rtn;
+	if (rtn == LIBPD_REQERR_ADD_DUP)
+		return LIBPD_ERROR_REQUEST_DUP;
+	if (rtn == LIBPD_REQERR_ADD_CLOSED)
+		return LIBPD_ERROR_REQUEST_STATE;
+	return LIBPD_ERROR_REQUEST_ADD;
+}
+
+// sends a request that has been added to the request table
+static int send_request (__instance_t *inst, wrp_msg_t *req,
+	extra_err_info_t *err_info)
+{
+	int rtn = libparodus_send__ ((libpd_instance_t) inst, req, err_info);
+
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = rtn;
+	if (rtn == LIBPD_ERR_SEND_CONVERT)
+		return LIBPD_ERROR_SEND_WRP_MSG;
+	return LIBPD_ERROR_SEND_SOCKET;
+}
+
+int libparodus_request_dbg (libpd_instance_t instance, wrp_msg_t *req,
+	wrp_msg_t **resp, uint32_t timeout_ms, extra_err_info_t *err_info)
+{
+	__instance_t *inst = (__instance_t *) instance;
+	pending_req_t *pending;
+	int rtn;
+
+	if (NULL == resp) {
+		err_info->err_detail = LIBPD_ERR_REQUEST_PARAM;
+		err_info->oserr = 0;
+		return LIBPD_ERROR_REQUEST_PARAM;
+	}
+	*resp = NULL;
+	// added before it is sent, so the response can't beat us to the table
+	rtn = add_request (inst, req, timeout_ms, NULL, NULL, &pending, err_info);
+	if (rtn != 0)
+		return rtn;
+	rtn = send_request (inst, req, err_info);
+	if (rtn != 0) {
+		libpd_reqs_cancel (inst->reqs, pending);
+		return rtn;
+	}
+	return libpd_reqs_wait (inst->reqs, pending, resp);
+}
+
+int libparodus_request (libpd_instance_t instance, wrp_msg_t *req,
+	wrp_msg_t **resp, uint32_t timeout_ms)
+{
+  extra_err_info_t err;
+  return libparodus_request_dbg (instance, req, resp, timeout_ms, &err);
+}
+
+int libparodus_request_async_dbg (libpd_instance_t instance, wrp_msg_t *req,
+	uint32_t timeout_ms, libpd_response_cb_t *callback, void *ctx,
+	extra_err_info_t *err_info)
+{
+	__instance_t *inst = (__instance_t *) instance;
+	pending_req_t *pending;
+	int rtn;
+
+	if (NULL == callback) {
+		err_info->err_detail = LIBPD_ERR_REQUEST_PARAM;
+		err_info->oserr = 0;
+		return LIBPD_ERROR_REQUEST_PARAM;
+	}
+	rtn = add_request (inst, req, timeout_ms, callback, ctx, &pending, err_info);
+	if (rtn != 0)
+		return rtn;
+	rtn = send_request (inst, req, err_info);
+	if (rtn != 0) {
+		libpd_reqs_cancel (inst->reqs, pending);
+		return rtn;
+	}
+	libpd_reqs_start (inst->reqs, pending);
+	return 0;
+}
+
+int libparodus_request_async (libpd_instance_t instance, wrp_msg_t *req,
+	uint32_t timeout_ms, libpd_response_cb_t *callback, void *ctx)
+{
+  extra_err_info_t err;
+  return libparodus_request_async_dbg (instance, req, timeout_ms, 
+		callback, ctx, &err);
+}
+
+int libparodus_add_service_route_dbg (libpd_instance_t instance, 
+	const char *service_name, const char *path,
+	libpd_msg_handler_t *handler, void *ctx, extra_err_info_t *err_info)
+{
+	__instance_t *inst = (__instance_t *) instance;
+	char *route_path;
+	int rtn;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_add_route\n"));
+		err_info->err_detail = LIBPD_ERR_ROUTE_NULL_INST;
+		return LIBPD_ERROR_ROUTE_NULL_INST;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at add route\n"));
+		err_info->err_detail = LIBPD_ERR_ROUTE_STATE;
+		return LIBPD_ERROR_ROUTE_STATE;
+	}
+	if (NULL == inst->routes) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: route needs receive configured\n"));
+		err_info->err_detail = LIBPD_ERR_ROUTE_CFG;
+		return LIBPD_ERROR_ROUTE_CFG;
+	}
+	if ((NULL == path) || (find_service (inst, service_name) < 0)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid service or path on add route\n"));
+		err_info->err_detail = LIBPD_ERR_ROUTE_PARAM;
+		return LIBPD_ERROR_ROUTE_PARAM;
+	}
+	// routes for all the services are in one table, under the service name
+	route_path = (char *) malloc (strlen (service_name) + strlen (path) + 2);
+	if (NULL == route_path) {
+		err_info->err_detail = LIBPD_ERR_ROUTE_ADD + LIBPD_ROUTEERR_ALLOC;
+		return LIBPD_ERROR_ROUTE_ADD;
+	}
+	sprintf (route_path, "%s/%s", service_name, path);
+	rtn = libpd_routes_add (inst->routes, route_path, handler, ctx);
+	if (rtn == 0) {
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: Added route %s\n", route_path));
+	}
+	free (route_path);
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = LIBPD_ERR_ROUTE_ADD + rtn;
+	if (rtn == LIBPD_ROUTEERR_PATH)
+		return LIBPD_ERROR_ROUTE_PARAM;
+	if (rtn == LIBPD_ROUTEERR_DUP)
+		return LIBPD_ERROR_ROUTE_DUP;
+	return LIBPD_ERROR_ROUTE_ADD;
+}
+
+int libparodus_add_service_route (libpd_instance_t instance, 
+	const char *service_name, const char *path,
+	libpd_msg_handler_t *handler, void *ctx)
+{
+  extra_err_info_t err;
+  return libparodus_add_service_route_dbg (instance, service_name, path, 
+		handler, ctx, &err);
+}
+
+int libparodus_add_route_dbg (libpd_instance_t instance, const char *path,
+	libpd_msg_handler_t *handler, void *ctx, extra_err_info_t *err_info)
+{
+	__instance_t *inst = (__instance_t *) instance;
+
+	return libparodus_add_service_route_dbg (instance, 
+		(NULL != inst) ? inst->cfg.service_name : NULL, path, 
+		handler, ctx, err_info);
+}
+
+int libparodus_add_route (libpd_instance_t instance, const char *path,
+	libpd_msg_handler_t *handler, void *ctx)
+{
+  extra_err_info_t err;
+  return libparodus_add_route_dbg (instance, path, handler, ctx, &err);
+}
+
+static void *wrp_sender_thread (void *arg)
+{
+	int rtn;
+	void *raw_msg;
+	async_send_t *item;
+	extra_err_info_t err_info;
+	__instance_t *inst = (__instance_t*) arg;
+
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting wrp sender thread\n"));
+	while (true) {
+		rtn = libpd_qreceive (inst->send_queue, &raw_msg, 
+			SEND_QUEUE_RCV_TIMEOUT_MS, &err_info.oserr);
+		if (rtn == 1) // timed out
 			continue;
-		}
-		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Converting bytes to WRP\n")); 
- 		msg_len = (int) wrp_to_struct (raw_msg.msg, raw_msg.len, WRP_BYTES, &wrp_msg);
-		nn_freemsg (raw_msg.msg);
-		if (msg_len < 1) {
-			libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting bytes to WRP\n"));
+		if (rtn != 0) {
+			libpd_log (LEVEL_ERROR, ("Unable to receive on send queue\n"));
+			delay_ms (100);
 			continue;
 		}
-		if (wrp_msg->msg_type == WRP_MSG_TYPE__AUTH) {
-			libpd_log (LEVEL_INFO, ("LIBPARODUS: AUTH msg received\n"));
-			inst->auth_received = true;
-			wrp_free_struct (wrp_msg);
-			continue;
+		item = (async_send_t *) raw_msg;
+		if (&async_send_end == item)
+			break;
+		rtn = send_bytes (inst, item->msg_bytes, item->msg_len, 
+			item->nn_buf, &err_info);
+		item->msg_bytes = NULL;
+		if (rtn != 0) {
+			libpd_log (LEVEL_ERROR, ("LIBPARODUS: async send failed (%d)\n", rtn));
 		}
+		if (NULL != item->callback)
+			(*item->callback) ((rtn == 0) ? 0 : LIBPD_ERROR_SEND_SOCKET, item->ctx);
+		async_send_free (item);
+	}
+	libpd_log (LEVEL_INFO, ("Ended wrp sender thread\n"));
+	return NULL;
+}
 
-		if (wrp_msg->msg_type == WRP_MSG_TYPE__SVC_ALIVE) {
-			libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received keep alive message\n"));
-			inst->keep_alive_count++;
-			wrp_free_struct (wrp_msg);
-			continue;
+static char *find_wrp_msg_dest (wrp_msg_t *wrp_msg)
+{
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__REQ)
+		return wrp_msg->u.req.dest;
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__EVENT)
+		return wrp_msg->u.event.dest;
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__CREATE)
+		return wrp_msg->u.crud.dest;
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__RETREIVE)
+		return wrp_msg->u.crud.dest;
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__UPDATE)
+		return wrp_msg->u.crud.dest;
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__DELETE)
+		return wrp_msg->u.crud.dest;
+	return NULL;
+}
+
+// the service is the part of the dest between the first and second '/'.
+// returns 0 for cfg.service_name, 1 + the index of an extra service,
+// or -1 if the msg isn't for this instance
+static int dest_service (__instance_t *inst, const char *dest, 
+	size_t dest_len)
+{
+	const char *msg_service = (const char *) memchr (dest, '/', dest_len);
+	const char *tmp;
+	size_t len;
+	unsigned i;
+
+	if (NULL == msg_service)
+		return -1;
+	msg_service++;
+	len = dest_len - (size_t) (msg_service - dest);
+	tmp = (const char *) memchr (msg_service, '/', len);
+	if (NULL != tmp)
+		len = (size_t) (tmp - msg_service);
+	if ((strlen (inst->cfg.service_name) == len) && 
+	    (memcmp (msg_service, inst->cfg.service_name, len) == 0))
+		return 0;
+	for (i = 0; i < inst->cfg.num_extra_services; i++) {
+		tmp = inst->cfg.extra_service_names[i];
+		if ((strlen (tmp) == len) && (memcmp (msg_service, tmp, len) == 0))
+			return (int) i + 1;
+	}
+	return -1;
+}
+
+// Finds the handler for a msg whose dest matches a service: the
+// route for the dest path from the service on, else the cfg msg_handler.
+// returns NULL if the msg is for libparodus_receive
+static libpd_msg_handler_t *find_msg_handler (__instance_t *inst, 
+	const char *dest, void **ctx)
+{
+	const char *path = strchr (dest, '/');
+	libpd_msg_handler_t *handler = NULL;
+
+	if (NULL == path)
+		path = "";
+	handler = libpd_routes_find (inst->routes, path, strlen (path), ctx);
+	if (NULL == handler) {
+		handler = inst->cfg.msg_handler;
+		*ctx = inst->cfg.msg_handler_ctx;
+	}
+	return handler;
+}
+
+static bool is_dest_msg_type (int msg_type)
+{
+	switch (msg_type) {
+		case WRP_MSG_TYPE__REQ:
+		case WRP_MSG_TYPE__EVENT:
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			return true;
+	}
+	return false;
+}
+
+// parodus accepts the shm segment by sending its path back in the AUTH
+// msg. Sends go through the ring from then on.
+static void check_shm_accepted (__instance_t *inst, raw_msg_t *raw_msg)
+{
+	const char *path;
+	size_t path_len;
+	const char *shm_path;
+
+	if ((NULL == inst->shm) || libpd_shm_is_closed (inst->shm))
+		return;
+	if (libpd_wrp_peek_str (raw_msg->msg, (size_t) raw_msg->len, 
+	    LIBPD_SHM_FIELD, &path, &path_len) != 0)
+		return;
+	shm_path = libpd_shm_path (inst->shm);
+	if ((path_len != strlen (shm_path)) || (memcmp (path, shm_path, path_len) != 0))
+		return;
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: parodus accepted shm segment\n"));
+	__atomic_store_n (&inst->shm_active, true, __ATOMIC_RELAXED);
+}
+
+// Looks at the msg type and dest in the raw msg, and handles the msgs
+// that don't need decoding: auth, keep alives and msgs for other
+// services. Returns true if the msg was handled (and freed).
+static bool handle_raw_msg (__instance_t *inst, raw_msg_t *raw_msg)
+{
+	int msg_type;
+	const char *dest;
+	size_t dest_len;
+
+	if (libpd_wrp_peek (raw_msg->msg, (size_t) raw_msg->len, 
+	    &msg_type, &dest, &dest_len) != 0)
+		return false;	// let the decoder sort it out
+	if (msg_type == WRP_MSG_TYPE__AUTH) {
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: AUTH msg received\n"));
+		check_shm_accepted (inst, raw_msg);
+		inst->auth_received = true;
+		STATS_ADD (inst, auth_msgs, 1);
+	} else if (msg_type == WRP_MSG_TYPE__SVC_ALIVE) {
+		keepalive_received (inst);
+	} else if (!is_dest_msg_type (msg_type) || (NULL == dest)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARADOS: Unprocessed msg type %d received\n",
+			msg_type));
+		STATS_ADD (inst, msgs_dropped, 1);
+	} else if (dest_service (inst, dest, dest_len) >= 0) {
+		return false;
+	} else {
+		STATS_ADD (inst, msgs_dropped, 1);
+	}
+	nn_freemsg (raw_msg->msg);
+	return true;
+}
+
+// Sets how long the next receive waits. -1 waits forever.
+static void set_rcv_timeout (__instance_t *inst, int timeout_ms)
+{
+	inst->rcv_timeout_ms = timeout_ms;
+}
+
+static void watchdog_init (__instance_t *inst)
+{
+	watchdog_t *w = &inst->watchdog;
+
+	w->period = (inst->cfg.keepalive_timeout_secs > 0) ?
+		(uint64_t) inst->cfg.keepalive_timeout_secs * 1000000000 : 0;
+	w->miss_limit = (inst->cfg.keepalive_miss_limit > 0) ? 
+		inst->cfg.keepalive_miss_limit : 1;
+	w->last_alive = libpd_lat_now_coarse ();
+	w->misses = 0;
+	w->state = LIBPD_LINK_UP;
+}
+
+// Only keep alives show that parodus is there. Other msgs, for this
+// service or not, could be left over in the socket.
+static void keepalive_received (__instance_t *inst)
+{
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received keep alive message\n"));
+	__atomic_store_n (&inst->watchdog.last_alive, libpd_lat_now_coarse (), __ATOMIC_RELAXED);
+	STATS_ADD (inst, keep_alive_msgs, 1);
+}
+
+static void set_link_state (__instance_t *inst, libpd_link_state_t state)
+{
+	if (state == inst->watchdog.state)
+		return;
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: link state %d -> %d\n", 
+		inst->watchdog.state, state));
+	inst->watchdog.state = state;
+	__atomic_store_n (&inst->stats.link_state, (uint32_t) state, __ATOMIC_RELAXED);
+	STATS_ADD (inst, link_state_changes, 1);
+	if (NULL != inst->cfg.link_state_cb)
+		inst->cfg.link_state_cb ((libpd_instance_t) inst, state, 
+			inst->cfg.link_state_ctx);
+}
+
+// Counts the keep alives missed as of now, and moves the link state.
+// Reconnects once miss_limit keep alives have been missed in a row.
+static void watchdog_check (__instance_t *inst, uint64_t now)
+{
+	watchdog_t *w = &inst->watchdog;
+	uint64_t last = __atomic_load_n (&w->last_alive, __ATOMIC_RELAXED);
+	uint64_t misses;
+
+	if (0 == w->period)
+		return;
+	misses = (now > last) ? (now - last) / w->period : 0;
+	if (0 == misses) {
+		w->misses = 0;
+		set_link_state (inst, LIBPD_LINK_UP);
+		return;
+	}
+	if (inst->reconnect.active)
+		return;
+	if (misses > w->misses) {
+		STATS_ADD (inst, keepalive_misses, misses - w->misses);
+		w->misses = misses;
+	}
+	if (misses < w->miss_limit) {
+		set_link_state (inst, LIBPD_LINK_IDLE);
+		return;
+	}
+	set_link_state (inst, LIBPD_LINK_DEAD);
+	start_reconnect (inst);
+}
+
+// Sets the receive timeout to the next keep alive deadline
+static void watchdog_arm (__instance_t *inst, uint64_t now)
+{
+	watchdog_t *w = &inst->watchdog;
+	uint64_t last = __atomic_load_n (&w->last_alive, __ATOMIC_RELAXED);
+	uint64_t deadline;
+
+	if ((0 == w->period) || inst->reconnect.active)
+		return;
+	if (now < last)
+		now = last;
+	deadline = last + (((now - last) / w->period) + 1) * w->period;
+	set_rcv_timeout (inst, (int) ((deadline - now + 999999) / 1000000));
+}
+
+// Decorrelated jitter: each delay is random, between the base delay
+// and three times the last one, up to the max.
+static uint32_t next_reconnect_delay (reconnect_t *r)
+{
+	uint32_t max_ms = MAX_RECONNECT_RETRY_DELAY_SECS * 1000;
+	uint32_t hi = r->delay_ms * 3;
+
+	if (hi > max_ms)
+		hi = max_ms;
+	if (hi <= RECONNECT_BASE_DELAY_MS)
+		r->delay_ms = RECONNECT_BASE_DELAY_MS;
+	else
+		r->delay_ms = RECONNECT_BASE_DELAY_MS + 
+			(uint32_t) rand_r (&r->seed) % (hi - RECONNECT_BASE_DELAY_MS + 1);
+	return r->delay_ms;
+}
+
+// parodus has gone quiet. The first try is right away.
+static void start_reconnect (__instance_t *inst)
+{
+	reconnect_t *r = &inst->reconnect;
+
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: keep alives missed, reconnecting\n"));
+	r->active = true;
+	r->attempts = 0;
+	r->start = libpd_lat_now_coarse ();
+	r->next_try = r->start;
+	r->delay_ms = RECONNECT_BASE_DELAY_MS;
+}
+
+// Something came from parodus while reconnecting, so it is back.
+// Try registering now, and start the delays over if that fails.
+static void retry_reconnect_now (__instance_t *inst)
+{
+	inst->reconnect.next_try = libpd_lat_now_coarse ();
+	inst->reconnect.delay_ms = RECONNECT_BASE_DELAY_MS;
+}
+
+static void end_reconnect (__instance_t *inst)
+{
+	reconnect_t *r = &inst->reconnect;
+	uint64_t ms = (libpd_lat_now_coarse () - r->start) / 1000000;
+
+	r->active = false;
+	inst->auth_received = false;
+	// registered again, so parodus gets a full miss_limit from now
+	__atomic_store_n (&inst->watchdog.last_alive, libpd_lat_now_coarse (), __ATOMIC_RELAXED);
+	inst->watchdog.misses = 0;
+	set_link_state (inst, LIBPD_LINK_UP);
+	STATS_ADD (inst, reconnects, 1);
+	STATS_ADD (inst, reconnect_ms, ms);
+	__atomic_store_n (&inst->stats.last_reconnect_ms, (uint32_t) ms, __ATOMIC_RELAXED);
+	if ((uint32_t) ms > STATS_GET (inst, max_reconnect_ms))
+		__atomic_store_n (&inst->stats.max_reconnect_ms, (uint32_t) ms, __ATOMIC_RELAXED);
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: reconnected after %u tries, %u ms\n",
+		r->attempts, (unsigned) ms));
+}
+
+// Rebinds the receive socket on the first try, or if it could not be
+// bound before, and registers again.
+static bool try_reconnect (__instance_t *inst, extra_err_info_t *err_info)
+{
+	reconnect_t *r = &inst->reconnect;
+
+	libpd_log (LEVEL_DEBUG, ("Retrying receiver connection\n"));
+	STATS_ADD (inst, reconnect_attempts, 1);
+	if ((r->attempts++ == 0) || (inst->rcv_sock < 0)) {
+		shutdown_rcv_socket (inst);
+		inst->rcv_sock = bind_receiver (inst, &err_info->oserr);
+		if (inst->rcv_sock < 0)
+			return false;
+	}
+	// a parodus that has restarted has to accept the segment again
+	__atomic_store_n (&inst->shm_active, false, __ATOMIC_RELAXED);
+	// the receiver thread mustn't block on a parodus that isn't there.
+	// EAGAIN is just a failed try.
+	return send_registration_msg (inst, true, err_info) == 0;
+}
+
+// Waits, unless shutting down, while there is no receive socket to wait on
+static void wait_reconnect (__instance_t *inst, uint32_t ms)
+{
+	struct pollfd pfd;
+
+	pfd.fd = inst->stop_fd;
+	pfd.events = POLLIN;
+	while ((poll (&pfd, 1, (int) ms) < 0) && (errno == EINTR))
+		;
+}
+
+// One step of the reconnect state machine, run by the receiver thread
+// between receives. Registers again if it is time to. Otherwise the
+// receiver keeps receiving until then, so msgs still get through while
+// parodus is away.
+// Returns false if there is no receive socket to receive on.
+static bool reconnect_step (__instance_t *inst, extra_err_info_t *err_info)
+{
+	reconnect_t *r = &inst->reconnect;
+	uint64_t now = libpd_lat_now_coarse ();
+	uint32_t wait_ms;
+
+	if (now >= r->next_try) {
+		if (try_reconnect (inst, err_info)) {
+			end_reconnect (inst);
+			watchdog_arm (inst, libpd_lat_now_coarse ());
+			return true;
 		}
+		now = libpd_lat_now_coarse ();
+		r->next_try = now + (uint64_t) next_reconnect_delay (r) * 1000000;
+	}
+	wait_ms = (uint32_t) ((r->next_try - now + 999999) / 1000000);
+	if (inst->rcv_sock < 0) {
+		wait_reconnect (inst, wait_ms);
+		return false;
+	}
+	set_rcv_timeout (inst, (int) wait_ms);
+	return true;
+}
+
+// Msgs that the receive overflow policy may drop to make room.
+// Never the closed msg or the handler thread end msg.
+static bool can_evict_msg (void *msg)
+{
+	return (msg != (void *) &closed_wrp_msg) && (msg != (void *) &msg_handler_end);
+}
+
+static bool can_evict_event (void *msg)
+{
+	return can_evict_msg (msg) && 
+		(((wrp_msg_t *) msg)->msg_type == WRP_MSG_TYPE__EVENT);
+}
+
+static bool can_evict_handler_event (void *msg)
+{
+	return can_evict_msg (msg) && 
+		(((handler_msg_t *) msg)->msg->msg_type == WRP_MSG_TYPE__EVENT);
+}
+
+// Priority of a received msg, from the first priority rule it matches.
+// Msgs that match no rule go in the lowest lane.
+static unsigned rcv_msg_lane (__instance_t *inst, wrp_msg_t *wrp_msg)
+{
+	unsigned i;
+	const libpd_priority_rule_t *rule;
+	const char *dest;
 
-		// Pass thru REQ, EVENT, and CRUD if dest matches the selected service
-		msg_dest = find_wrp_msg_dest (wrp_msg);
-		if (NULL == msg_dest) {
-			libpd_log (LEVEL_ERROR, ("LIBPARADOS: Unprocessed msg type %d received\n",
-				wrp_msg->msg_type));
-			wrp_free_struct (wrp_msg);
+	if (inst->rcv_queue_lanes <= 1)
+		return 0;
+	dest = find_wrp_msg_dest (wrp_msg);
+	for (i=0; i<inst->cfg.num_priority_rules; i++) {
+		rule = &inst->cfg.priority_rules[i];
+		if ((rule->msg_type != 0) && (rule->msg_type != (int) wrp_msg->msg_type))
 			continue;
-		}
-		msg_service = strchr (msg_dest, '/');
-		if (NULL == msg_service) {
-			wrp_free_struct (wrp_msg);
+		if ((NULL != rule->dest_prefix) && ((NULL == dest) ||
+		    (strncmp (dest, rule->dest_prefix, strlen (rule->dest_prefix)) != 0)))
+			continue;
+		return rule->priority;
+	}
+	return LIBPD_QLANE_LOWEST;
+}
+
+// Puts a received msg on the wrp queue (or, as a handler_msg_t, on the
+// handler queue), in the lane for the priority of wrp_msg, following
+// the receive_overflow policy if the lane is full.
+// The msg is freed if it is dropped.
+static void queue_rcv_msg (__instance_t *inst, libpd_mq_t queue, 
+	void *msg, wrp_msg_t *wrp_msg, uint64_t t_recv)
+{
+	int rtn;
+	void *evicted = NULL;
+	int *oserr = &inst->rcv_err_info.oserr;
+	unsigned lane = rcv_msg_lane (inst, wrp_msg);
+
+	// counted before it is queued, since it may be received (or handled)
+	// before qsend returns. Taken back off if it is dropped.
+	STATS_ADD (inst, msgs_received, 1);
+	switch (inst->cfg.receive_overflow) {
+		case LIBPD_OVERFLOW_DROP_NEWEST:
+			rtn = libpd_qsend_prio (queue, msg, lane, t_recv, 0, oserr);
+			break;
+		case LIBPD_OVERFLOW_DROP_OLDEST:
+			rtn = libpd_qsend_evict (queue, msg, lane, t_recv, 
+				can_evict_msg, &evicted, oserr);
+			break;
+		case LIBPD_OVERFLOW_DROP_BY_TYPE:
+			rtn = libpd_qsend_evict (queue, msg, lane, t_recv, 
+				(queue == inst->handler_queue) ? 
+					can_evict_handler_event : can_evict_event,
+				&evicted, oserr);
+			break;
+		default:
+			rtn = libpd_qsend_prio (queue, msg, lane, t_recv,
+				WRP_QUEUE_SEND_TIMEOUT_MS, oserr);
+			break;
+	}
+	if (NULL != evicted) {
+		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Receive queue full, dropped oldest msg\n"));
+		STATS_SUB (inst, msgs_received, 1);
+		STATS_ADD (inst, queue_full, 1);
+		free_queued_msg (inst, queue, evicted);
+	}
+	if (rtn == 1) {
+		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Receive queue full, dropped msg\n"));
+		STATS_SUB (inst, msgs_received, 1);
+		STATS_ADD (inst, queue_full, 1);
+		free_queued_msg (inst, queue, msg);
+	} else if (rtn != 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: Unable to queue received msg\n"));
+		STATS_SUB (inst, msgs_received, 1);
+		free_queued_msg (inst, queue, msg);
+	}
+}
+
+// the key that orders msgs on the keyed worker pool
+static uint32_t msg_order_key (__instance_t *inst, wrp_msg_t *wrp_msg)
+{
+	const char *key = NULL;
+
+	if (inst->cfg.msg_handler_order == LIBPD_ORDER_BY_UUID)
+		key = libpd_reqs_msg_uuid (wrp_msg);
+	if (NULL == key)
+		key = find_wrp_msg_dest (wrp_msg);
+	return libpd_workers_key (key);
+}
+
+static void submit_rcv_msg (__instance_t *inst, handler_msg_t *hmsg, 
+	uint64_t t_recv)
+{
+	int rtn;
+
+	// counted before it is submitted, since a worker may handle it
+	// before submit returns
+	STATS_ADD (inst, msgs_received, 1);
+	rtn = libpd_workers_submit (inst->workers, msg_order_key (inst, hmsg->msg),
+		(void *) hmsg, t_recv, 
+		(inst->cfg.receive_overflow == LIBPD_OVERFLOW_DROP_NEWEST) ?
+			0 : WRP_QUEUE_SEND_TIMEOUT_MS);
+	if (rtn == 1) {
+		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Msg handler pool full, dropped msg\n"));
+		STATS_SUB (inst, msgs_received, 1);
+		STATS_ADD (inst, queue_full, 1);
+		free_rcv_msg (inst, hmsg->msg);
+		free (hmsg);
+	} else if (rtn != 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: Unable to queue received msg\n"));
+		STATS_SUB (inst, msgs_received, 1);
+		free_rcv_msg (inst, hmsg->msg);
+		free (hmsg);
+	}
+}
+
+// Callback receive mode: call the msg handler right here in the
+// wrp receiver thread, or pass the msg, with its handler, to the 
+// handler thread pool.
+static void dispatch_msg (__instance_t *inst, libpd_msg_handler_t *handler,
+	void *ctx, wrp_msg_t *wrp_msg, uint64_t t_recv)
+{
+	handler_msg_t *hmsg;
+
+	if ((NULL == inst->workers) && (NULL == inst->handler_queue)) {
+		STATS_ADD (inst, msgs_received, 1);
+		libpd_lat_record_since (&inst->lat_receive, t_recv);
+		(*handler) ((libpd_instance_t) inst, wrp_msg, ctx);
+		return;
+	}
+	hmsg = (handler_msg_t *) malloc (sizeof (handler_msg_t));
+	if (NULL == hmsg) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: Unable to queue received msg\n"));
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+	hmsg->msg = wrp_msg;
+	hmsg->handler = handler;
+	hmsg->ctx = ctx;
+	if (NULL != inst->workers)
+		submit_rcv_msg (inst, hmsg, t_recv);
+	else
+		queue_rcv_msg (inst, inst->handler_queue, (void *) hmsg, wrp_msg, t_recv);
+}
+
+// calls the handler for a msg on a msg handler thread
+static void handle_msg (__instance_t *inst, handler_msg_t *hmsg)
+{
+	(*hmsg->handler) ((libpd_instance_t) inst, hmsg->msg, hmsg->ctx);
+	free (hmsg);
+}
+
+static void handle_worker_msg (void *msg, void *arg)
+{
+	handle_msg ((__instance_t *) arg, (handler_msg_t *) msg);
+}
+
+static void *msg_handler_thread (void *arg)
+{
+	int rtn, oserr;
+	void *msg;
+	__instance_t *inst = (__instance_t*) arg;
+
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Starting msg handler thread\n"));
+	while (true) {
+		rtn = libpd_qreceive (inst->handler_queue, &msg, 
+			HANDLER_QUEUE_RCV_TIMEOUT_MS, &oserr);
+		if (rtn == 1) // timed out
+			continue;
+		if (rtn != 0) {
+			libpd_log (LEVEL_ERROR, ("Unable to receive on msg handler queue\n"));
+			delay_ms (100);
 			continue;
 		}
-                msg_service++;
-                size_t len = strlen(msg_service);
-                char *tmp = strchr (msg_service, '/');
-                if (NULL != tmp) {
-                    len = (uintptr_t)tmp - (uintptr_t)msg_service;
-                }
-		if (strncmp (msg_service, inst->cfg.service_name, len) != 0) {
-			wrp_free_struct (wrp_msg);
+		if (&msg_handler_end == msg)
+			break;
+		handle_msg (inst, (handler_msg_t *) msg);
+	}
+	libpd_log (LEVEL_DEBUG, ("Ended msg handler thread\n"));
+	return NULL;
+}
+
+// Handles a msg from the receive socket or the shm ring.
+// Frees the raw msg, or hands it on.
+static void handle_rcv_msg (__instance_t *inst, raw_msg_t *raw_msg, 
+	uint64_t t_recv)
+{
+	int msg_len;
+	wrp_msg_t *wrp_msg;
+	char *msg_dest;
+	int service;
+	libpd_msg_handler_t *handler;
+	void *handler_ctx;
+
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		nn_freemsg (raw_msg->msg);
+		return;
+	}
+	STATS_ADD (inst, bytes_received, (uint64_t) raw_msg->len);
+	if (handle_raw_msg (inst, raw_msg))
+		return;
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Converting bytes to WRP\n")); 
+	if (inst->cfg.zero_copy_receive) {
+		// on success the msg owns the nn buffer
+		msg_len = (int) libpd_wrp_decode_pooled (raw_msg->msg, raw_msg->len, 
+			&inst->rcv_cache, &wrp_msg);
+		if (msg_len < 1)
+			nn_freemsg (raw_msg->msg);
+	} else {
+		msg_len = (int) wrp_to_struct (raw_msg->msg, raw_msg->len, WRP_BYTES, &wrp_msg);
+		nn_freemsg (raw_msg->msg);
+	}
+	if (msg_len < 1) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting bytes to WRP\n"));
+		STATS_ADD (inst, decode_errors, 1);
+		return;
+	}
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__AUTH) {
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: AUTH msg received\n"));
+		inst->auth_received = true;
+		STATS_ADD (inst, auth_msgs, 1);
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__SVC_ALIVE) {
+		keepalive_received (inst);
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+
+	// Pass thru REQ, EVENT, and CRUD if dest matches the selected service
+	msg_dest = find_wrp_msg_dest (wrp_msg);
+	if (NULL == msg_dest) {
+		libpd_log (LEVEL_ERROR, ("LIBPARADOS: Unprocessed msg type %d received\n",
+			wrp_msg->msg_type));
+		STATS_ADD (inst, msgs_dropped, 1);
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+	service = dest_service (inst, msg_dest, strlen (msg_dest));
+	if (service < 0) {
+		STATS_ADD (inst, msgs_dropped, 1);
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received msg directed to service %s\n",
+		inst->cfg.service_name));
+	if (libpd_reqs_complete (inst->reqs, wrp_msg)) {
+		STATS_ADD (inst, msgs_received, 1);
+		return;
+	}
+	handler = find_msg_handler (inst, msg_dest, &handler_ctx);
+	if (NULL != handler) {
+		dispatch_msg (inst, handler, handler_ctx, wrp_msg, t_recv);
+		return;
+	}
+	queue_rcv_msg (inst, service_queue (inst, service), (void *) wrp_msg, 
+		wrp_msg, t_recv);
+}
+
+// With a shm segment there are two receiver threads. They take turns,
+// so the receive queue still has one producer, and the msg handler
+// is not called from both at once.
+static void receive_raw_msg (__instance_t *inst, raw_msg_t *raw_msg, 
+	uint64_t t_recv)
+{
+	if (NULL == inst->shm) {
+		handle_rcv_msg (inst, raw_msg, t_recv);
+		return;
+	}
+	pthread_mutex_lock (&inst->rcv_mutex);
+	handle_rcv_msg (inst, raw_msg, t_recv);
+	pthread_mutex_unlock (&inst->rcv_mutex);
+}
+
+static void *wrp_receiver_thread (void *arg)
+{
+	int rtn;
+	raw_msg_t raw_msg;
+	__instance_t *inst = (__instance_t*) arg;
+	extra_err_info_t *rcv_err = &inst->rcv_err_info;
+	uint64_t now;
+
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting wrp receiver thread\n"));
+	watchdog_arm (inst, libpd_lat_now_coarse ());
+	// stop_fd ends a wait for msgs, and the run state a stream of them.
+	// Init starts this thread before the instance is running, so it
+	// only stops once libparodus_shutdown__ has set RUN_STATE_DONE.
+	while (RUN_STATE_DONE != inst->run_state) {
+		if (inst->reconnect.active && !reconnect_step (inst, rcv_err))
 			continue;
+		rtn = sock_receive (inst, &raw_msg, &rcv_err->oserr);
+		if (rtn != 0) {
+			if (rtn == 1) { // timed out
+				// keep alives may have come through the shm ring
+				now = libpd_lat_now_coarse ();
+				watchdog_check (inst, now);
+				watchdog_arm (inst, now);
+				continue;
+			}
+			break;
 		}
-		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received msg directed to service %s\n",
-			inst->cfg.service_name));
-		libpd_qsend (inst->wrp_queue, (void *) wrp_msg, WRP_QUEUE_SEND_TIMEOUT_MS, 
-			&rcv_err->oserr);
+		if (inst->reconnect.active)
+			retry_reconnect_now (inst);
+		receive_raw_msg (inst, &raw_msg, libpd_lat_now ());
+		// the watchdog only needs ms
+		now = libpd_lat_now_coarse ();
+		watchdog_check (inst, now);
+		watchdog_arm (inst, now);
 	}
 	libpd_log (LEVEL_INFO, ("Ended wrp receiver thread\n"));
 	return NULL;
 }
 
-
-int flush_wrp_queue (libpd_mq_t wrp_queue, uint32_t delay_ms, int *oserr)
+// Receives the msgs parodus sends through the shm ring, once it has
+// accepted the segment. Runs until the segment is closed.
+static void *shm_receiver_thread (void *arg)
 {
-	wrp_msg_t *wrp_msg = NULL;
-	int count = 0;
-	int err;
+	int rtn;
+	unsigned len;
+	raw_msg_t raw_msg;
+	__instance_t *inst = (__instance_t*) arg;
 
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting shm receiver thread\n"));
 	while (1) {
-		err = timed_wrp_queue_receive (wrp_queue, &wrp_msg, delay_ms, oserr);
-		if (err == 1)	// timed out
+		rtn = libpd_shm_receive (inst->shm, LIBPD_SHM_DOWN, 
+			(void **) &raw_msg.msg, &len, SHM_RCV_TIMEOUT_MS);
+		if (rtn == 1) // timed out
+			continue;
+		if (rtn == LIBPD_SHMERR_RCV_ALLOC) {
+			delay_ms (100);
+			continue;
+		}
+		if (rtn != 0)
 			break;
-		if (err != 0)
-			return err;
-		count++;
-		wrp_free (wrp_msg);
+		raw_msg.len = (int) len;
+		STATS_ADD (inst, shm_msgs_received, 1);
+		receive_raw_msg (inst, &raw_msg, libpd_lat_now ());
 	}
+	// closed by either side, or parodus wrote garbage. Either way
+	// everything goes over the sockets from now on.
+	__atomic_store_n (&inst->shm_active, false, __ATOMIC_RELAXED);
+	if (rtn != LIBPD_SHMERR_CLOSED)
+		libpd_shm_close (inst->shm);
+	libpd_log (LEVEL_INFO, ("Ended shm receiver thread\n"));
+	return NULL;
+}
+
+
+int flush_wrp_queue (libpd_mq_t wrp_queue)
+{
+	int count = libpd_qdrain (wrp_queue, &wrp_free);
 	libpd_log (LEVEL_INFO, ("LIBPARODUS: flushed %d messages out of WRP Queue\n", 
 		count));
 	return count;
@@ -1112,7 +3183,7 @@ void test_get_counts (libpd_instance_t instance,
 	int *keep_alive_count, int *reconnect_count)
 {
 	__instance_t *inst = (__instance_t *) instance;
-	*keep_alive_count = inst->keep_alive_count;
-	*reconnect_count = inst->reconnect_count;
+	*keep_alive_count = (int) __atomic_load_n (&inst->stats.keep_alive_msgs, __ATOMIC_RELAXED);
+	*reconnect_count = (int) __atomic_load_n (&inst->stats.reconnects, __ATOMIC_RELAXED);
 }
 
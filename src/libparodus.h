@@ -29,6 +29,138 @@ extern "C" { /* open extern "C" */
  * to the parodus service.
  */ 
 
+typedef void *libpd_instance_t;
+
+/**
+ * Message handler for callback receive mode (see libpd_cfg_t.msg_handler)
+ *
+ * Called for each message directed to the service. The handler owns
+ * the msg and must free it with libparodus_free_msg. It must not call
+ * libparodus_shutdown.
+ */
+typedef void libpd_msg_handler_t (libpd_instance_t instance, 
+	wrp_msg_t *msg, void *ctx);
+
+/**
+ * What the receiver does with a message when the receive queue is full
+ * (see libpd_cfg_t.receive_overflow). Dropped messages are counted in
+ * libpd_stats_t.queue_full, not in msgs_received. Keep alive and AUTH
+ * messages are handled by the receiver and never queued, so they are
+ * never dropped.
+ */
+typedef enum {
+	LIBPD_OVERFLOW_BLOCK = 0,	// wait up to 2 secs for room, then drop the new msg
+	LIBPD_OVERFLOW_DROP_NEWEST,	// drop the new msg
+	LIBPD_OVERFLOW_DROP_OLDEST,	// drop the oldest queued msg to make room
+	LIBPD_OVERFLOW_DROP_BY_TYPE	// drop the oldest queued event, or else the new msg
+} libpd_overflow_t;
+
+/**
+ * Receive priority rule (see libpd_cfg_t.priority_rules)
+ *
+ * A received message matches a rule if both its msg type and dest match.
+ * Messages are received in priority order, oldest first within a priority.
+ * Messages that match no rule are received after all those that do.
+ * Each priority gets its own receive_queue_size messages of room, so
+ * a burst of low priority messages can't fill the queue for higher ones.
+ * The rules and their dest prefixes must stay valid until
+ * libparodus_shutdown.
+ */
+#define LIBPD_MAX_PRIORITY 15
+
+/**
+ * How msgs are ordered on the msg handler thread pool
+ * (see libpd_cfg_t.msg_handler_order)
+ *
+ * With an order key, msgs with the same key are handled one at a time,
+ * in the order received, while msgs with different keys are handled in
+ * parallel, so a slow handler only holds up msgs with its own key.
+ * Each handler thread has its own queue, and an idle thread takes work
+ * from a busy one's. The pool holds up to receive_queue_size msgs.
+ * An order key can't be combined with priority_rules, or with the
+ * DROP_OLDEST and DROP_BY_TYPE overflow policies.
+ */
+typedef enum {
+	LIBPD_ORDER_NONE = 0,	// handler threads share one queue, with no ordering
+	LIBPD_ORDER_BY_DEST,	// msgs with the same dest are handled in order
+	LIBPD_ORDER_BY_UUID	// msgs with the same transaction_uuid (else dest) in order
+} libpd_handler_order_t;
+
+/**
+ * Transport of the default parodus_url and client_url
+ * (see libpd_cfg_t.transport)
+ *
+ * ipc:// skips the TCP loopback stack, so each msg costs less CPU,
+ * but parodus has to be listening on the matching ipc:// url.
+ * With IPC, parodus is at LIBPD_IPC_DIR/parodus_server.ipc, and each
+ * service has a client socket file of its own,
+ * LIBPD_IPC_DIR/parodus_client_<service_name>.ipc. LIBPD_IPC_DIR is
+ * /tmp unless the library is built with it set.
+ *
+ * Whenever the client_url is ipc://, default or not, libparodus_init
+ * first removes a socket file left behind by a process that is gone,
+ * failing if anything else is at the path. The socket file is created
+ * with no more than the ipc_mode permissions, then set to exactly
+ * ipc_mode. libparodus_shutdown removes it.
+ */
+typedef enum {
+	LIBPD_TRANSPORT_DEFAULT = 0,	// TCP, or IPC if built with LIBPD_IPC_DEFAULT
+	LIBPD_TRANSPORT_TCP,	// tcp://127.0.0.1:6666 and tcp://127.0.0.1:6667
+	LIBPD_TRANSPORT_IPC	// ipc:// socket files in LIBPD_IPC_DIR
+} libpd_transport_t;
+
+/**
+ * Shared memory transport (see libpd_cfg_t.shm_ring_size)
+ *
+ * libparodus_init creates a memfd segment with a ring of shm_ring_size
+ * bytes each way, and offers it to parodus in the registration msg,
+ * as a "shm" field holding the path /proc/<pid>/fd/<fd>. A parodus
+ * that opens the segment puts the same field in its AUTH msg, and from
+ * then on msgs go through the rings, with no syscall at all while both
+ * sides are busy. A parodus that doesn't know the field ignores it,
+ * and everything stays on the sockets.
+ *
+ * msgs larger than half a ring go through the ring in fragments, so
+ * msgs from one sender reach parodus in the order they were sent. A
+ * parodus that accepts the segment must take fragmented msgs from both
+ * rings. The msg handler may be called on the shm receiver thread,
+ * though never at the same time as on the socket receiver thread. If
+ * the segment can't be created, the instance runs without it.
+ */
+
+/**
+ * State of the link to parodus, as seen by the keep alive watchdog
+ * (see libpd_cfg_t.keepalive_miss_limit)
+ *
+ * A keep alive is missed each keepalive_timeout_secs that goes by
+ * without one, timed on the monotonic clock. Only keep alives count:
+ * other msgs, even ones for this service, don't show that parodus is
+ * still there. Once keepalive_miss_limit are missed in a row, parodus
+ * is taken to be gone, and the instance registers again until it gets
+ * through. With keepalive_timeout_secs 0 there is no watchdog, and the
+ * link stays up.
+ */
+typedef enum {
+	LIBPD_LINK_UP = 0,	// keep alives are on time
+	LIBPD_LINK_IDLE,	// keep alives missed, but fewer than keepalive_miss_limit
+	LIBPD_LINK_DEAD	// keepalive_miss_limit missed, reconnecting
+} libpd_link_state_t;
+
+/**
+ * Called on each link state change (see libpd_cfg_t.link_state_cb)
+ *
+ * Called from the receiver thread, so it should return quickly, and
+ * must not call libparodus_shutdown.
+ */
+typedef void libpd_link_state_cb_t (libpd_instance_t instance, 
+	libpd_link_state_t state, void *ctx);
+
+typedef struct {
+	int msg_type;	// WRP_MSG_TYPE__ value, or 0 for any type
+	const char *dest_prefix;	// dest must start with this, or NULL for any dest
+	unsigned priority;	// 0 is highest, LIBPD_MAX_PRIORITY is lowest
+} libpd_priority_rule_t;
+
 typedef struct {
 	const char *service_name;
 	bool receive;
@@ -36,10 +168,28 @@ typedef struct {
 	const char *parodus_url;
 	const char *client_url;
 	unsigned test_flags;  // always 0 except when testing
+	bool single_receiver; // only one thread calls libparodus_receive
+	unsigned send_queue_size; // if not 0, enables libparodus_send_async
+	bool zero_copy_receive; // received msgs must be freed with libparodus_free_msg
+	bool receive_fd; // if true, enables libparodus_get_fd
+	libpd_msg_handler_t *msg_handler; // if not NULL, msgs go to the handler, not libparodus_receive
+	void *msg_handler_ctx; // passed to msg_handler
+	unsigned msg_handler_threads; // if not 0, msg_handler and route handlers are called from a pool of this many threads
+	unsigned receive_queue_size; // if not 0, max msgs waiting to be received (default 50)
+	libpd_overflow_t receive_overflow; // DROP_OLDEST and DROP_BY_TYPE override single_receiver
+	const libpd_priority_rule_t *priority_rules; // first matching rule sets a msg's priority
+	unsigned num_priority_rules; // if not 0, overrides single_receiver
+	libpd_handler_order_t msg_handler_order; // order key for msg_handler_threads
+	const char *const *extra_service_names; // more services received on this instance
+	unsigned num_extra_services; // if not 0, receive must be set
+	libpd_transport_t transport; // for parodus_url and client_url when NULL
+	unsigned ipc_mode; // permissions of an ipc:// client_url socket file (default 0660)
+	unsigned shm_ring_size; // if not 0, offers parodus shared memory rings of this size (power of 2, 4K to 64M), receive must be set
+	unsigned keepalive_miss_limit; // keep alives missed in a row before reconnecting (default 1)
+	libpd_link_state_cb_t *link_state_cb; // if not NULL, called on each link state change
+	void *link_state_ctx; // passed to link_state_cb
 } libpd_cfg_t;
 
-typedef void *libpd_instance_t;
-
 
 /** 
  * @brief libparodus error rtn codes
@@ -76,6 +226,16 @@ typedef enum {
 	 * error sending registration msg
 	 */
 	LIBPD_ERROR_INIT_REGISTER = -106,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating wrp sender thread
+	 */
+	LIBPD_ERROR_INIT_SEND_THREAD = -107,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating msg handler thread
+	 */
+	LIBPD_ERROR_INIT_HANDLER_THREAD = -108,
 	/** 
 	 * @brief Error on libparodus_receive
 	 * null instance given
@@ -101,6 +261,11 @@ typedef enum {
 	 * thread limit exceeded
 	 */
 	LIBPD_ERROR_RCV_THR_LIMIT = -205,
+	/** 
+	 * @brief Error on libparodus_receive_batch
+	 * invalid parameter
+	 */
+	LIBPD_ERROR_RCV_PARAM = -206,
 	/** 
 	 * @brief Error on libparodus_close_receiver
 	 * null instance given
@@ -155,7 +320,92 @@ typedef enum {
 	 * @brief Error on libparodus_send
 	 * thread limit exceeded
 	 */
-	LIBPD_ERROR_SEND_THR_LIMIT = -405
+	LIBPD_ERROR_SEND_THR_LIMIT = -405,
+	/** 
+	 * @brief Error on libparodus_send_async
+	 * not configured for async send
+	 */
+	LIBPD_ERROR_SEND_ASYNC_CFG = -406,
+	/** 
+	 * @brief Error on libparodus_send_async
+	 * send queue full
+	 */
+	LIBPD_ERROR_SEND_QUEUE_FULL = -407,
+	/** 
+	 * @brief Error on libparodus_send_async
+	 * send queue error
+	 */
+	LIBPD_ERROR_SEND_QUEUE = -408,
+	/** 
+	 * @brief Error on libparodus_get_stats or libparodus_get_latency_stats
+	 * null instance given
+	 */
+	LIBPD_ERROR_STATS_NULL_INST = -501,
+	/** 
+	 * @brief Error on libparodus_get_stats or libparodus_get_latency_stats
+	 * invalid parameter
+	 */
+	LIBPD_ERROR_STATS_PARAM = -502,
+	/** 
+	 * @brief Error on libparodus_request
+	 * null instance given
+	 */
+	LIBPD_ERROR_REQUEST_NULL_INST = -601,
+	/** 
+	 * @brief Error on libparodus_request
+	 * run state error
+	 */
+	LIBPD_ERROR_REQUEST_STATE = -602,
+	/** 
+	 * @brief Error on libparodus_request
+	 * not configured for receive
+	 */
+	LIBPD_ERROR_REQUEST_CFG = -603,
+	/** 
+	 * @brief Error on libparodus_request
+	 * invalid parameter
+	 */
+	LIBPD_ERROR_REQUEST_PARAM = -604,
+	/** 
+	 * @brief Error on libparodus_request
+	 * a request with the same transaction_uuid is waiting for its response
+	 */
+	LIBPD_ERROR_REQUEST_DUP = -605,
+	/** 
+	 * @brief Error on libparodus_request
+	 * unable to add request
+	 */
+	LIBPD_ERROR_REQUEST_ADD = -606,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * null instance given
+	 */
+	LIBPD_ERROR_ROUTE_NULL_INST = -701,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * run state error
+	 */
+	LIBPD_ERROR_ROUTE_STATE = -702,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * not configured for receive
+	 */
+	LIBPD_ERROR_ROUTE_CFG = -703,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * invalid parameter
+	 */
+	LIBPD_ERROR_ROUTE_PARAM = -704,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * the path already has a route
+	 */
+	LIBPD_ERROR_ROUTE_DUP = -705,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * unable to add route
+	 */
+	LIBPD_ERROR_ROUTE_ADD = -706
 } libpd_error_t;
 
 /**
@@ -171,6 +421,8 @@ typedef enum {
  *		LIBPD_ERROR_INIT_RCV_THREAD = -104, error creating wrp receiver thread
  *		LIBPD_ERROR_INIT_QUEUE = -105, error creating wrp msg receive queue
  *		LIBPD_ERROR_INIT_REGISTER = -106, error sending registration msg
+ *		LIBPD_ERROR_INIT_SEND_THREAD = -107, error creating wrp sender thread
+ *		LIBPD_ERROR_INIT_HANDLER_THREAD = -108, error creating msg handler thread
  *
  * @note libparodus_shutdown must be called even if there is an error
  * on libparodus_init   
@@ -191,13 +443,118 @@ int libparodus_init (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg);
  *  @return 0 on success, 2 if closed msg received, 1 if timed out, else:
  *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
  *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
- *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive, or msg_handler configured
  *		LIBPD_ERROR_RCV_RCV = -204, receive error
  *
  *  @note don't free the msg when return is 2. 
  */
 int libparodus_receive (libpd_instance_t instance, wrp_msg_t **msg, uint32_t ms);
 
+/**
+ *  Receives the next message sent to one of the services of the instance.
+ *
+ *  An instance can receive for more services than its service_name
+ *  (see libpd_cfg_t.extra_service_names). They are all registered with
+ *  parodus at the client_url of the instance, and share its sockets,
+ *  receiver thread and keep alive handling. Messages are sorted by the
+ *  service in their dest, and each service has a receive queue of its
+ *  own. With a msg_handler, the handler gets the messages of every
+ *  service instead. libparodus_close_receiver closes all the queues,
+ *  while libparodus_get_fd and the queue stats are for service_name only.
+ *
+ *  @param instance instance object
+ *  @param service_name service_name or one of extra_service_names
+ *  @param msg the pointer to receive the next msg struct
+ *  @param ms the number of milliseconds to wait for the next message
+ *
+ *  @return the same as libparodus_receive, or
+ *		LIBPD_ERROR_RCV_PARAM = -206, not a service of the instance
+ */
+int libparodus_receive_service (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms);
+
+/**
+ *  Receives the next message on the queue without waiting.
+ *
+ *  Meant to be called when the fd from libparodus_get_fd is readable.
+ *
+ *  @param instance instance object
+ *  @param msg pointer to wrp_msg_t struct that will receive the msg
+ *
+ *  @return the same as libparodus_receive, including 1 if there
+ *   is no message waiting.
+ */
+int libparodus_try_receive (libpd_instance_t instance, wrp_msg_t **msg);
+
+/**
+ *  Gets a file descriptor that is readable while there are messages
+ *  waiting to be received, so the instance can be added to an
+ *  existing poll/select/epoll loop instead of calling
+ *  libparodus_receive from a thread of its own.
+ *
+ *  Requires the receive_fd option. The fd belongs to the instance,
+ *  is closed by libparodus_shutdown, and must not be read or written.
+ *  When it is readable, call libparodus_try_receive until it returns 1.
+ *  It can occasionally be readable a moment before a message can be
+ *  received, in which case libparodus_try_receive returns 1.
+ *
+ *  @param instance instance object
+ *  @return the fd on success, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive, or
+ *		  receive_fd not configured, or msg_handler configured
+ */
+int libparodus_get_fd (libpd_instance_t instance);
+
+/**
+ *  Receives up to max messages from the queue in one call, waiting
+ *  the prescribed number of milliseconds for the first one.
+ *
+ *  Whatever else is already on the queue (up to max) is returned
+ *  without waiting, so a burst of messages can be drained with
+ *  a few calls.
+ *
+ *  @param instance instance object
+ *  @param msgs array of at least max pointers to receive the msg structs
+ *  @param max the maximum number of messages to receive
+ *  @param ms the number of milliseconds to wait for the first message
+ *  @param count receives the number of messages placed in msgs
+ *
+ *  @return 0 on success, 2 if closed msg received, 1 if timed out, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive, or msg_handler configured
+ *		LIBPD_ERROR_RCV_RCV = -204, receive error
+ *		LIBPD_ERROR_RCV_PARAM = -206, null msgs or count, or max is 0
+ *
+ *  @note the closed msg ends a batch. When return is 2, the messages
+ *  that were queued ahead of the closed msg are still returned in msgs
+ *  and count, in queue order, and must be freed. Messages queued
+ *  behind it are left on the queue, as with libparodus_receive.
+ */
+int libparodus_receive_batch (libpd_instance_t instance, wrp_msg_t **msgs,
+	size_t max, uint32_t ms, size_t *count);
+
+/**
+ *  Frees a message received with libparodus_receive or
+ *  libparodus_receive_batch.
+ *
+ *  With zero_copy_receive configured, the strings and payload of
+ *  received messages point into the buffer they arrived in, and the
+ *  message must be freed with this function, not wrp_free_struct.
+ *  The payload of such a message is not null terminated. Only zero
+ *  copy messages come from the pool kept by the instance. One still
+ *  held at libparodus_shutdown stays valid, and may be freed after it.
+ *  The pool is freed along with the last such message.
+ *  Without zero_copy_receive, this is the same as wrp_free_struct.
+ *
+ *  @param instance instance the message was received on. It is NULL
+ *   only for a zero copy message freed after libparodus_shutdown.
+ *  @param msg message to free, or NULL
+ */
+void libparodus_free_msg (libpd_instance_t instance, wrp_msg_t *msg);
+
 /**
  * Sends a close message to the receiver
  *
@@ -205,7 +562,7 @@ int libparodus_receive (libpd_instance_t instance, wrp_msg_t **msg, uint32_t ms)
  *  @return 0 on success,  else:
  *		LIBPD_ERROR_CLOSE_RCV_NULL_INST = -301, null instance given
  *		LIBPD_ERROR_CLOSE_RCV_STATE = -302, run state error, not running
- *		LIBPD_ERROR_CLOSE_RCV_CFG = -303, not configured for receive
+ *		LIBPD_ERROR_CLOSE_RCV_CFG = -303, not configured for receive, or msg_handler configured
  *		LIBPD_ERROR_CLOSE_RCV_TIMEDOUT = -304, timed out on queue send
  *		LIBPD_ERROR_CLOSE_RCV_SEND = -305, unable to send close receiver msg
  */
@@ -234,6 +591,239 @@ int libparodus_shutdown (libpd_instance_t *instance);
  */
 int libparodus_send (libpd_instance_t instance, wrp_msg_t *msg);
 
+/**
+ * Completion callback for libparodus_send_async.
+ * Called from the wrp sender thread once the message has been
+ * handed to the socket, or has failed.
+ *
+ * @param rtn 0 if the message was sent, else LIBPD_ERROR_SEND_SOCKET
+ * @param ctx the ctx given to libparodus_send_async
+ */
+typedef void libpd_send_cb_t (int rtn, void *ctx);
+
+/**
+ * Queue a wrp message to be sent to the parodus service, without
+ * waiting on the socket.
+ *
+ * The message is encoded in the calling thread, so msg may be freed
+ * or reused as soon as this returns. The encoded bytes are placed on
+ * the send queue (see libpd_cfg_t.send_queue_size) and sent by the
+ * wrp sender thread. Queued messages are still sent by
+ * libparodus_shutdown.
+ *
+ * @param instance instance object
+ * @param msg wrp message to send
+ * @param callback completion callback, or NULL for fire-and-forget
+ * @param ctx passed to callback
+ *
+ * @return 0 when queued, else:
+ *		LIBPD_ERROR_SEND_NULL_INST = -401, null instance given
+ *		LIBPD_ERROR_SEND_STATE = -402, run state error, not running
+ *		LIBPD_ERROR_SEND_WRP_MSG = -403, invalid wrp message
+ *		LIBPD_ERROR_SEND_ASYNC_CFG = -406, send_queue_size not configured
+ *		LIBPD_ERROR_SEND_QUEUE_FULL = -407, send queue full
+ *		LIBPD_ERROR_SEND_QUEUE = -408, send queue error
+ */
+int libparodus_send_async (libpd_instance_t instance, wrp_msg_t *msg,
+	libpd_send_cb_t *callback, void *ctx);
+
+/**
+ * Sends a request to the parodus service and waits for the response.
+ *
+ * The response is the REQ (or CRUD) msg directed to this service with
+ * the same transaction_uuid as req. It is handed straight to the
+ * waiting caller by the wrp receiver thread, and never goes to
+ * libparodus_receive or the msg_handler. Any number of threads can
+ * have requests outstanding at once. Since the response comes from
+ * the wrp receiver thread, this must not be called from a response
+ * callback, or from a msg_handler unless msg_handler_threads is set.
+ *
+ * @param instance instance object
+ * @param req REQ or CRUD msg to send, with a transaction_uuid
+ * @param resp receives the response, which must be freed with
+ *   libparodus_free_msg
+ * @param timeout_ms how long to wait for the response
+ *
+ * @return 0 on success, 2 if the instance was shut down while waiting,
+ *  1 if timed out, else:
+ *		LIBPD_ERROR_REQUEST_NULL_INST = -601, null instance given
+ *		LIBPD_ERROR_REQUEST_STATE = -602, run state error, not running
+ *		LIBPD_ERROR_REQUEST_CFG = -603, not configured for receive
+ *		LIBPD_ERROR_REQUEST_PARAM = -604, null req or resp, or no transaction_uuid
+ *		LIBPD_ERROR_REQUEST_DUP = -605, transaction_uuid already in use
+ *		LIBPD_ERROR_REQUEST_ADD = -606, unable to add request
+ *		LIBPD_ERROR_SEND_WRP_MSG = -403, invalid wrp message
+ *		LIBPD_ERROR_SEND_SOCKET = -404, socket send error
+ */
+int libparodus_request (libpd_instance_t instance, wrp_msg_t *req,
+	wrp_msg_t **resp, uint32_t timeout_ms);
+
+/**
+ * Response callback for libparodus_request_async.
+ * Called from the wrp receiver thread with the response, from a timer
+ * thread if the request times out, or from libparodus_shutdown.
+ * It must not call libparodus_shutdown.
+ *
+ * @param instance instance object
+ * @param rtn 0 if the response was received, 1 if timed out,
+ *   2 if the instance was shut down
+ * @param resp the response when rtn is 0, else NULL. It belongs to
+ *   the callback and must be freed with libparodus_free_msg.
+ * @param ctx the ctx given to libparodus_request_async
+ */
+typedef void libpd_response_cb_t (libpd_instance_t instance, int rtn,
+	wrp_msg_t *resp, void *ctx);
+
+/**
+ * Sends a request to the parodus service without waiting for the
+ * response, which is passed to callback. Each request has its own
+ * timeout.
+ *
+ * @param instance instance object
+ * @param req REQ or CRUD msg to send, with a transaction_uuid
+ * @param timeout_ms how long to wait for the response
+ * @param callback response callback, called once for every request
+ *   that this returns 0 for
+ * @param ctx passed to callback
+ *
+ * @return 0 when sent, else the errors of libparodus_request,
+ *   and callback is not called.
+ */
+int libparodus_request_async (libpd_instance_t instance, wrp_msg_t *req,
+	uint32_t timeout_ms, libpd_response_cb_t *callback, void *ctx);
+
+/**
+ * Adds a route, so that msgs directed to a dest path of this service
+ * go to their own handler.
+ *
+ * The path is the part of the dest after the service name, so for
+ * service "iot", "/config/wifi" matches dest "mac:112233445566/iot/config/wifi".
+ * A last segment of "*" matches one or more segments: "/config/" then
+ * "*" matches "/config/wifi" and "/config/wifi/ssid", but not "/config".
+ * An exact route wins over a "*" route, and a longer "*" route over a
+ * shorter one. Finding the route takes one step per path segment, no
+ * matter how many routes there are.
+ *
+ * The handler is called like the msg_handler of the cfg: from the
+ * msg handler thread pool if msg_handler_threads is set, else from the
+ * wrp receiver thread. Msgs that match no route go to the msg_handler,
+ * or to libparodus_receive if there isn't one.
+ * Routes can be added at any time while the instance is running,
+ * and stay until libparodus_shutdown.
+ *
+ * @param instance instance object
+ * @param path dest path following the service name
+ * @param handler msg handler for the route
+ * @param ctx passed to handler
+ *
+ * @return 0 on success, else:
+ *		LIBPD_ERROR_ROUTE_NULL_INST = -701, null instance given
+ *		LIBPD_ERROR_ROUTE_STATE = -702, run state error, not running
+ *		LIBPD_ERROR_ROUTE_CFG = -703, not configured for receive
+ *		LIBPD_ERROR_ROUTE_PARAM = -704, null handler, or invalid path
+ *		LIBPD_ERROR_ROUTE_DUP = -705, path already has a route
+ *		LIBPD_ERROR_ROUTE_ADD = -706, unable to add route
+ */
+int libparodus_add_route (libpd_instance_t instance, const char *path,
+	libpd_msg_handler_t *handler, void *ctx);
+
+/**
+ * Adds a route for one of the extra_service_names of the instance,
+ * like libparodus_add_route does for its service_name.
+ *
+ * @param instance instance object
+ * @param service_name service_name or one of extra_service_names
+ * @param path dest path following the service name
+ * @param handler msg handler for the route
+ * @param ctx passed to handler
+ *
+ * @return the same as libparodus_add_route, with
+ *		LIBPD_ERROR_ROUTE_PARAM = -704 if not a service of the instance
+ */
+int libparodus_add_service_route (libpd_instance_t instance, 
+	const char *service_name, const char *path,
+	libpd_msg_handler_t *handler, void *ctx);
+
+/**
+ * Counters kept by an instance since libparodus_init
+ */
+typedef struct {
+	uint64_t msgs_sent;	// msgs sent to parodus
+	uint64_t bytes_sent;
+	uint64_t msgs_received;	// msgs for this service, passed to the app
+	uint64_t bytes_received;	// everything read from the receive socket
+	uint64_t msgs_dropped;	// msgs not for this service
+	uint64_t decode_errors;	// msgs that could not be decoded
+	uint64_t queue_full;	// msgs lost to a full receive (or handler) queue
+	uint64_t auth_msgs;
+	uint64_t keep_alive_msgs;
+	uint64_t reconnects;	// times registered again after a keep alive timeout
+	uint64_t reconnect_attempts;	// registrations tried while reconnecting
+	uint64_t reconnect_ms;	// total time from keep alive timeouts to reconnects
+	uint32_t last_reconnect_ms;	// how long the last reconnect took
+	uint32_t max_reconnect_ms;
+	uint64_t keepalive_misses;	// keepalive_timeout_secs periods that went by without one
+	uint64_t link_state_changes;
+	uint32_t link_state;	// libpd_link_state_t
+	uint64_t shm_msgs_sent;	// msgs_sent that went through the shm ring
+	uint64_t shm_msgs_received;	// msgs read from the shm ring, counted in bytes_received too
+	uint32_t pool_bytes;	// memory kept for zero copy received msgs
+	uint64_t pool_fallbacks;	// zero copy received msgs that had to be malloc'd
+	uint32_t queue_high_water;	// most msgs that have been waiting to be received
+	uint32_t queue_size;	// receive queue capacity
+} libpd_stats_t;
+
+/**
+ * Get a snapshot of the instance counters
+ *
+ * Each counter is read atomically, and they can be read at any time
+ * from any thread while the instance is running.
+ *
+ * @param instance instance object
+ * @param stats receives the counters
+ * @return 0 on success, else:
+ *		LIBPD_ERROR_STATS_NULL_INST = -501, null instance given
+ *		LIBPD_ERROR_STATS_PARAM = -502, null stats given
+ */
+int libparodus_get_stats (libpd_instance_t instance, libpd_stats_t *stats);
+
+/**
+ * Latency summary for one stage of message handling.
+ * Times are in nanoseconds. Percentiles are accurate to within 25%.
+ */
+typedef struct {
+	uint64_t count;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+} libpd_latency_t;
+
+/**
+ * Latencies measured by an instance since libparodus_init
+ */
+typedef struct {
+	libpd_latency_t encode;	// encoding a wrp msg to be sent
+	libpd_latency_t send;	// nn_send of an encoded msg
+	libpd_latency_t queue_wait;	// time a received msg waits in the receive queue
+	libpd_latency_t receive;	// socket receive to the msg being handed to the app
+} libpd_latency_stats_t;
+
+/**
+ * Get send and receive latency statistics
+ *
+ * The statistics are always collected, and can be read at any time
+ * from any thread while the instance is running.
+ *
+ * @param instance instance object
+ * @param stats receives the statistics
+ * @return 0 on success, else:
+ *		LIBPD_ERROR_STATS_NULL_INST = -501, null instance given
+ *		LIBPD_ERROR_STATS_PARAM = -502, null stats given
+ */
+int libparodus_get_latency_stats (libpd_instance_t instance,
+	libpd_latency_stats_t *stats);
+
 /**
  * Return the string value of a libparodus error code
  *
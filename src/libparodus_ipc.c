@@ -0,0 +1,147 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "libparodus_ipc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "libparodus_log.h"
+
+#define IPC_URL_HDR "ipc://"
+#define CLIENT_FILE_HDR "parodus_client_"
+#define CLIENT_FILE_EXT ".ipc"
+
+const char *libpd_ipc_path (const char *url)
+{
+	size_t hdr_len = strlen (IPC_URL_HDR);
+
+	if ((NULL == url) || (strncmp (url, IPC_URL_HDR, hdr_len) != 0))
+		return NULL;
+	return url + hdr_len;
+}
+
+char *libpd_ipc_client_url (const char *dir, const char *service_name)
+{
+	size_t len = strlen (IPC_URL_HDR) + strlen (dir) + 1 +
+		strlen (CLIENT_FILE_HDR) + strlen (service_name) +
+		strlen (CLIENT_FILE_EXT);
+	char *url = (char *) malloc (len + 1);
+	char *name;
+
+	if (NULL == url)
+		return NULL;
+	sprintf (url, "%s%s/%s", IPC_URL_HDR, dir, CLIENT_FILE_HDR);
+	// the service name becomes part of a file name
+	for (name = url + strlen (url); *service_name != '\0'; service_name++) {
+		if (isalnum ((unsigned char) *service_name) || (*service_name == '-') ||
+		    (*service_name == '_') || (*service_name == '.'))
+			*name++ = *service_name;
+		else
+			*name++ = '_';
+	}
+	strcpy (name, CLIENT_FILE_EXT);
+	return url;
+}
+
+int libpd_ipc_clean (const char *path, int *oserr)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int sock, rtn;
+
+	*oserr = 0;
+	if (strlen (path) >= sizeof (addr.sun_path)) {
+		*oserr = ENAMETOOLONG;
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: ipc path too long: %s\n", path));
+		return LIBPD_IPCERR_LONG;
+	}
+	if (lstat (path, &st) != 0) {
+		if (errno == ENOENT)
+			return 0;
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to check ipc path %s\n", path));
+		return LIBPD_IPCERR_STAT;
+	}
+	if (!S_ISSOCK (st.st_mode)) {
+		*oserr = ENOTSOCK;
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: ipc path is not a socket: %s\n", path));
+		return LIBPD_IPCERR_NOT_SOCK;
+	}
+	// a socket file nobody is listening on is stale
+	sock = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to create ipc check socket\n"));
+		return LIBPD_IPCERR_CONNECT;
+	}
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+	rtn = connect (sock, (struct sockaddr *) &addr, sizeof (addr));
+	if (rtn != 0)
+		*oserr = errno;
+	close (sock);
+	if (rtn == 0) {
+		*oserr = EADDRINUSE;
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: ipc path in use: %s\n", path));
+		return LIBPD_IPCERR_IN_USE;
+	}
+	if (*oserr != ECONNREFUSED) {
+		libpd_log_err (LEVEL_ERROR, *oserr, ("Unable to check ipc socket %s\n", path));
+		return LIBPD_IPCERR_CONNECT;
+	}
+	*oserr = 0;
+	if ((unlink (path) != 0) && (errno != ENOENT)) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to remove stale ipc socket %s\n", path));
+		return LIBPD_IPCERR_UNLINK;
+	}
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: removed stale ipc socket %s\n", path));
+	return 0;
+}
+
+unsigned libpd_ipc_tighten_umask (unsigned mode)
+{
+	// umask can only be read by setting it, so set the strictest
+	// mask first, never a looser one
+	mode_t old_mask = umask (0777);
+
+	umask (old_mask | (mode_t) (0777 & ~mode));
+	return (unsigned) old_mask;
+}
+
+void libpd_ipc_restore_umask (unsigned old_mask)
+{
+	umask ((mode_t) old_mask);
+}
+
+int libpd_ipc_set_mode (const char *path, unsigned mode, int *oserr)
+{
+	*oserr = 0;
+	if (chmod (path, (mode_t) mode) != 0) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to set permissions of %s\n", path));
+		return LIBPD_IPCERR_CHMOD;
+	}
+	return 0;
+}
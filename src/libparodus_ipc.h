@@ -0,0 +1,140 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_IPC_H
+#define  _LIBPARODUS_IPC_H
+
+/*
+ * ipc:// endpoints: the socket files behind the ipc:// urls that
+ * libparodus binds, and the default urls of the ipc transport.
+ */
+
+// where the socket files of the default ipc:// urls go
+#ifndef LIBPD_IPC_DIR
+#define LIBPD_IPC_DIR "/tmp"
+#endif
+
+// permissions of a client socket file, if libpd_cfg_t.ipc_mode is 0
+#define LIBPD_IPC_DEFAULT_MODE 0660
+
+/**
+ * @brief ipc endpoint error rtn codes
+ *
+ */
+typedef enum {
+	/**
+	 * @brief Error on libpd_ipc_clean
+	 * path is too long for a unix domain socket
+	 */
+	LIBPD_IPCERR_LONG = -0x6001,
+	/**
+	 * @brief Error on libpd_ipc_clean
+	 * path exists and is not a socket
+	 */
+	LIBPD_IPCERR_NOT_SOCK = -0x6002,
+	/**
+	 * @brief Error on libpd_ipc_clean
+	 * another process is listening on the socket
+	 */
+	LIBPD_IPCERR_IN_USE = -0x6003,
+	/**
+	 * @brief Error on libpd_ipc_clean
+	 * unable to check the path
+	 */
+	LIBPD_IPCERR_STAT = -0x6040,
+	/**
+	 * @brief Error on libpd_ipc_clean
+	 * unable to tell if the socket is in use
+	 */
+	LIBPD_IPCERR_CONNECT = -0x6080,
+	/**
+	 * @brief Error on libpd_ipc_clean
+	 * unable to remove a stale socket file
+	 */
+	LIBPD_IPCERR_UNLINK = -0x60C0,
+	/**
+	 * @brief Error on libpd_ipc_set_mode
+	 * unable to set permissions
+	 */
+	LIBPD_IPCERR_CHMOD = -0x6100
+} libpd_ipcerror_t;
+
+/**
+ * Get the socket file path of an ipc:// url
+ *
+ * @param url url, may be NULL
+ * @return the path within url, or NULL if url is not ipc://
+ */
+const char *libpd_ipc_path (const char *url);
+
+/**
+ * Make the default client url of a service for the ipc transport
+ *
+ * The socket file is dir/parodus_client_<service_name>.ipc, with any
+ * character of service_name that is not a letter, digit, '-', '_'
+ * or '.' changed to '_'.
+ *
+ * @param dir directory of the socket file
+ * @param service_name service name
+ * @return the url, to be freed with free, or NULL if out of memory
+ */
+char *libpd_ipc_client_url (const char *dir, const char *service_name);
+
+/**
+ * Make sure a socket file path is free to bind to
+ *
+ * Removes a socket file left behind by a process that has gone away,
+ * which is one that nobody is listening on. Anything else at the path
+ * is left alone.
+ *
+ * @param path socket file path
+ * @param oserr receives the OS error code on failure
+ * @return 0 on success, valid libpd_ipcerror_t otherwise.
+ */
+int libpd_ipc_clean (const char *path, int *oserr);
+
+/**
+ * Set the permissions of a socket file
+ *
+ * @param path socket file path
+ * @param mode permission bits
+ * @param oserr receives the OS error code on failure
+ * @return 0 on success, valid libpd_ipcerror_t otherwise.
+ */
+int libpd_ipc_set_mode (const char *path, unsigned mode, int *oserr);
+
+/**
+ * Tighten the process umask so a socket file is created with no more
+ * than mode, before binding it
+ *
+ * The umask is per process, so while it is tightened, files other
+ * threads create get at most the same permissions. They are only ever
+ * made stricter, never looser. libpd_ipc_set_mode still sets the exact
+ * mode after the bind.
+ *
+ * @param mode permission bits the socket file will get
+ * @return the umask to give libpd_ipc_restore_umask
+ */
+unsigned libpd_ipc_tighten_umask (unsigned mode);
+
+/**
+ * Put back the umask from libpd_ipc_tighten_umask
+ *
+ * @param old_mask return value of libpd_ipc_tighten_umask
+ */
+void libpd_ipc_restore_umask (unsigned old_mask);
+
+#endif
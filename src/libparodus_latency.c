@@ -0,0 +1,115 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "libparodus_latency.h"
+#include <time.h>
+
+uint64_t libpd_lat_now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t libpd_lat_now_coarse (void)
+{
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (clock_gettime (CLOCK_MONOTONIC_COARSE, &ts) != 0)
+#endif
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+static unsigned bucket_index (uint64_t ns)
+{
+	unsigned msb;
+
+	if (ns >= (1ULL << LIBPD_LAT_MAX_BITS))
+		ns = (1ULL << LIBPD_LAT_MAX_BITS) - 1;
+	if (ns < (1U << LIBPD_LAT_SUB_BITS))
+		return (unsigned) ns;
+	msb = 63 - (unsigned) __builtin_clzll (ns);
+	return ((msb - LIBPD_LAT_SUB_BITS + 1) << LIBPD_LAT_SUB_BITS) +
+		(unsigned) ((ns >> (msb - LIBPD_LAT_SUB_BITS)) &
+			((1U << LIBPD_LAT_SUB_BITS) - 1));
+}
+
+// lowest value that falls in a bucket
+static uint64_t bucket_floor (unsigned index)
+{
+	unsigned shift, sub;
+
+	if (index < (1U << LIBPD_LAT_SUB_BITS))
+		return index;
+	shift = (index >> LIBPD_LAT_SUB_BITS) - 1;
+	sub = index & ((1U << LIBPD_LAT_SUB_BITS) - 1);
+	return ((uint64_t) ((1U << LIBPD_LAT_SUB_BITS) + sub)) << shift;
+}
+
+void libpd_lat_record (libpd_lat_hist_t *hist, uint64_t ns)
+{
+	uint64_t max = __atomic_load_n (&hist->max_ns, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add (&hist->counts[bucket_index (ns)], 1, __ATOMIC_RELAXED);
+	while (ns > max) {
+		if (__atomic_compare_exchange_n (&hist->max_ns, &max, ns, true,
+		    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+}
+
+void libpd_lat_record_since (libpd_lat_hist_t *hist, uint64_t start)
+{
+	uint64_t now = libpd_lat_now ();
+	libpd_lat_record (hist, (now > start) ? (now - start) : 0);
+}
+
+void libpd_lat_summary (libpd_lat_hist_t *hist, libpd_latency_t *summary)
+{
+	static const unsigned per_mille[3] = {500, 990, 999};
+	uint64_t *results[3];
+	uint64_t counts[LIBPD_LAT_BUCKETS];
+	uint64_t total = 0, sum = 0, target;
+	unsigned i, p = 0;
+
+	results[0] = &summary->p50_ns;
+	results[1] = &summary->p99_ns;
+	results[2] = &summary->p999_ns;
+	// work from a snapshot, so the percentiles agree with the count
+	for (i = 0; i < LIBPD_LAT_BUCKETS; i++) {
+		counts[i] = __atomic_load_n (&hist->counts[i], __ATOMIC_RELAXED);
+		total += counts[i];
+	}
+	summary->count = total;
+	summary->max_ns = __atomic_load_n (&hist->max_ns, __ATOMIC_RELAXED);
+	summary->p50_ns = summary->p99_ns = summary->p999_ns = 0;
+	if (0 == total)
+		return;
+	for (i = 0; (i < LIBPD_LAT_BUCKETS) && (p < 3); i++) {
+		sum += counts[i];
+		while ((p < 3) && (sum > 0)) {
+			target = ((total * per_mille[p]) + 999) / 1000;
+			if (sum < target)
+				break;
+			*results[p] = bucket_floor (i + 1) - 1;
+			if (*results[p] > summary->max_ns)
+				*results[p] = summary->max_ns;
+			p++;
+		}
+	}
+}
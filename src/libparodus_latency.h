@@ -0,0 +1,86 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_LATENCY_H
+#define  _LIBPARODUS_LATENCY_H
+
+#include <stdint.h>
+#include "libparodus.h"
+
+/*
+ * Log bucketed latency histograms.
+ *
+ * Each power of two range of nanoseconds is split into 4 buckets,
+ * so a bucket is at most 25% wide. Recording is a couple of relaxed
+ * atomic adds, so histograms can be updated from any thread without
+ * a lock and are cheap enough to leave on all the time.
+ */
+
+#define LIBPD_LAT_SUB_BITS 2
+#define LIBPD_LAT_MAX_BITS 40	// about 18 minutes, longer times are clamped
+#define LIBPD_LAT_BUCKETS (((LIBPD_LAT_MAX_BITS - 1) << LIBPD_LAT_SUB_BITS))
+
+typedef struct {
+	uint64_t counts[LIBPD_LAT_BUCKETS];
+	uint64_t max_ns;
+} libpd_lat_hist_t;
+
+/**
+ * Get the current monotonic time
+ *
+ * @return time in nanoseconds
+ */
+uint64_t libpd_lat_now (void);
+
+/**
+ * Get the current monotonic time, cheaply, to within a scheduler tick
+ *
+ * For bookkeeping that only needs ms, such as keep alive deadlines.
+ * Only compare it with other libpd_lat_now_coarse times, since it
+ * lags libpd_lat_now.
+ *
+ * @return time in nanoseconds
+ */
+uint64_t libpd_lat_now_coarse (void);
+
+/**
+ * Record a latency
+ *
+ * @param hist histogram to update
+ * @param ns latency in nanoseconds
+ */
+void libpd_lat_record (libpd_lat_hist_t *hist, uint64_t ns);
+
+/**
+ * Record the time elapsed since start
+ *
+ * @param hist histogram to update
+ * @param start start time from libpd_lat_now
+ */
+void libpd_lat_record_since (libpd_lat_hist_t *hist, uint64_t start);
+
+/**
+ * Summarize a histogram
+ *
+ * Percentiles are reported as the upper bound of the bucket they
+ * fall in (but never more than the max).
+ *
+ * @param hist histogram
+ * @param summary receives the count, percentiles and max
+ */
+void libpd_lat_summary (libpd_lat_hist_t *hist, libpd_latency_t *summary);
+
+#endif
@@ -0,0 +1,252 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "libparodus_pool.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_MIN_SHIFT		7	// smallest class is 128 bytes
+#define POOL_SLAB_CHUNKS	16
+#define POOL_CACHE_LINE		64
+
+/*
+ * Every block starts with a chunk header. cls is NULL for blocks from
+ * malloc. next links the chunk into a cache or free stack while it is
+ * free. The header is two pointers, so the block after it is aligned
+ * for anything a decoded msg holds.
+ */
+typedef struct pool_chunk {
+	struct pool_class *cls;
+	struct pool_chunk *next;
+} pool_chunk_t;
+
+typedef struct pool_slab {
+	struct pool_slab *next;
+	void *pad;		// keeps the chunks aligned like a chunk header
+} pool_slab_t;
+
+typedef struct pool_class {
+	size_t chunk_size;	// including the header
+	pool_chunk_t *freed;	// pushed by any thread
+	char pad[POOL_CACHE_LINE];
+} pool_class_t;
+
+struct libpd_pool {
+	pool_class_t classes[LIBPD_POOL_CLASSES];
+	pool_slab_t *slabs;
+	size_t max_bytes;
+	size_t slab_bytes;
+	uint64_t fallbacks;
+	unsigned holds;		// one for the owner until destroyed
+	libpd_pool_release_t *release;
+	void *release_arg;
+};
+
+libpd_pool_t *libpd_pool_create (size_t max_bytes)
+{
+	unsigned i;
+	libpd_pool_t *pool = (libpd_pool_t *) malloc (sizeof (libpd_pool_t));
+
+	if (NULL == pool)
+		return NULL;
+	memset ((void*) pool, 0, sizeof (libpd_pool_t));
+	for (i = 0; i < LIBPD_POOL_CLASSES; i++)
+		pool->classes[i].chunk_size = (size_t) 1 << (POOL_MIN_SHIFT + i);
+	pool->max_bytes = max_bytes;
+	pool->holds = 1;
+	return pool;
+}
+
+static void free_pool (libpd_pool_t *pool)
+{
+	pool_slab_t *slab, *next;
+	libpd_pool_release_t *release = pool->release;
+	void *arg = pool->release_arg;
+
+	for (slab = pool->slabs; NULL != slab; slab = next) {
+		next = slab->next;
+		free (slab);
+	}
+	free (pool);
+	if (NULL != release)
+		(*release) (arg);
+}
+
+void libpd_pool_destroy (libpd_pool_t *pool, libpd_pool_release_t *release,
+	void *arg)
+{
+	if (NULL == pool)
+		return;
+	pool->release = release;
+	pool->release_arg = arg;
+	libpd_pool_drop (pool);
+}
+
+void libpd_pool_hold (libpd_pool_t *pool)
+{
+	if (NULL != pool)
+		__atomic_add_fetch (&pool->holds, 1, __ATOMIC_RELAXED);
+}
+
+void libpd_pool_drop (libpd_pool_t *pool)
+{
+	// acq_rel, so whoever frees the pool sees every free pushed
+	// before the other holds were dropped
+	if ((NULL != pool) &&
+	    (__atomic_sub_fetch (&pool->holds, 1, __ATOMIC_ACQ_REL) == 0))
+		free_pool (pool);
+}
+
+void libpd_pool_cache_init (libpd_pool_cache_t *cache, libpd_pool_t *pool)
+{
+	memset ((void*) cache, 0, sizeof (libpd_pool_cache_t));
+	cache->pool = pool;
+}
+
+// push a list of chunks, from first to last, on a class's free stack
+static void push_freed (pool_class_t *cls, pool_chunk_t *first,
+	pool_chunk_t *last)
+{
+	pool_chunk_t *top = __atomic_load_n (&cls->freed, __ATOMIC_RELAXED);
+
+	do {
+		last->next = top;
+	} while (!__atomic_compare_exchange_n (&cls->freed, &top, first, true,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void libpd_pool_cache_flush (libpd_pool_cache_t *cache)
+{
+	pool_chunk_t *first, *last;
+	unsigned i;
+
+	if (NULL == cache->pool)
+		return;
+	for (i = 0; i < LIBPD_POOL_CLASSES; i++) {
+		first = (pool_chunk_t *) cache->chunks[i];
+		if (NULL == first)
+			continue;
+		for (last = first; NULL != last->next; last = last->next)
+			;
+		push_freed (&cache->pool->classes[i], first, last);
+		cache->chunks[i] = NULL;
+	}
+}
+
+// Carve a new slab into chunks for the cache, if the pool
+// is allowed to grow
+static pool_chunk_t *new_slab (libpd_pool_t *pool, pool_class_t *cls)
+{
+	size_t slab_size = sizeof (pool_slab_t) + (POOL_SLAB_CHUNKS * cls->chunk_size);
+	pool_slab_t *slab;
+	pool_chunk_t *chunk, *first = NULL;
+	char *p;
+	unsigned i;
+
+	if (__atomic_add_fetch (&pool->slab_bytes, slab_size, __ATOMIC_RELAXED) 
+	    > pool->max_bytes) {
+		__atomic_sub_fetch (&pool->slab_bytes, slab_size, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	slab = (pool_slab_t *) malloc (slab_size);
+	if (NULL == slab) {
+		__atomic_sub_fetch (&pool->slab_bytes, slab_size, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	slab->next = __atomic_load_n (&pool->slabs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n (&pool->slabs, &slab->next, slab, true,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	p = (char *) (slab + 1);
+	for (i = 0; i < POOL_SLAB_CHUNKS; i++) {
+		chunk = (pool_chunk_t *) (p + ((POOL_SLAB_CHUNKS - 1 - i) * cls->chunk_size));
+		chunk->cls = cls;
+		chunk->next = first;
+		first = chunk;
+	}
+	return first;
+}
+
+static int size_class (size_t size)
+{
+	int i;
+	size_t total = size + sizeof (pool_chunk_t);
+
+	for (i = 0; i < LIBPD_POOL_CLASSES; i++)
+		if (total <= ((size_t) 1 << (POOL_MIN_SHIFT + i)))
+			return i;
+	return -1;
+}
+
+void *libpd_pool_alloc (libpd_pool_cache_t *cache, size_t size)
+{
+	libpd_pool_t *pool;
+	pool_class_t *cls;
+	pool_chunk_t *chunk = NULL;
+	int i = -1;
+
+	if ((NULL != cache) && (NULL != cache->pool))
+		i = size_class (size);
+	if (i >= 0) {
+		pool = cache->pool;
+		cls = &pool->classes[i];
+		chunk = (pool_chunk_t *) cache->chunks[i];
+		if (NULL == chunk)
+			chunk = __atomic_exchange_n (&cls->freed, NULL, __ATOMIC_ACQUIRE);
+		if (NULL == chunk)
+			chunk = new_slab (pool, cls);
+		if (NULL != chunk) {
+			cache->chunks[i] = chunk->next;
+			return (void *) (chunk + 1);
+		}
+	}
+	if ((NULL != cache) && (NULL != cache->pool))
+		__atomic_add_fetch (&cache->pool->fallbacks, 1, __ATOMIC_RELAXED);
+	chunk = (pool_chunk_t *) malloc (sizeof (pool_chunk_t) + size);
+	if (NULL == chunk)
+		return NULL;
+	chunk->cls = NULL;
+	return (void *) (chunk + 1);
+}
+
+void libpd_pool_free (void *ptr)
+{
+	pool_chunk_t *chunk;
+
+	if (NULL == ptr)
+		return;
+	chunk = ((pool_chunk_t *) ptr) - 1;
+	if (NULL == chunk->cls)
+		free (chunk);
+	else
+		push_freed (chunk->cls, chunk, chunk);
+}
+
+size_t libpd_pool_bytes (libpd_pool_t *pool)
+{
+	if (NULL == pool)
+		return 0;
+	return __atomic_load_n (&pool->slab_bytes, __ATOMIC_RELAXED);
+}
+
+uint64_t libpd_pool_fallbacks (libpd_pool_t *pool)
+{
+	if (NULL == pool)
+		return 0;
+	return __atomic_load_n (&pool->fallbacks, __ATOMIC_RELAXED);
+}
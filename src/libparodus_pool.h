@@ -0,0 +1,147 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_POOL_H
+#define  _LIBPARODUS_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Size classed pool allocator for received msgs.
+ *
+ * Each size class hands out chunks carved from slabs. A chunk is taken
+ * from a cache owned by the allocating thread, so allocation takes no
+ * lock. Chunks can be freed by any thread: they are pushed onto their
+ * class's free stack with a compare and swap, and the allocating thread
+ * takes the whole stack into its cache when the cache runs dry.
+ * Slabs are kept until the pool is destroyed, up to max_bytes. Beyond
+ * that, and for sizes larger than the largest class, blocks come
+ * from malloc.
+ *
+ * A pool is freed when it has been destroyed and every hold on it has
+ * been dropped, so blocks that are held can outlive libpd_pool_destroy.
+ */
+
+#define LIBPD_POOL_CLASSES	5	// 128 to 2048 bytes, by powers of 2
+
+typedef struct libpd_pool libpd_pool_t;
+
+typedef void libpd_pool_release_t (void *arg);
+
+// A thread's cache of free chunks. Only one thread may allocate
+// through a cache at a time.
+typedef struct {
+	libpd_pool_t *pool;
+	void *chunks[LIBPD_POOL_CLASSES];
+} libpd_pool_cache_t;
+
+/**
+ * Create a pool
+ *
+ * @param max_bytes most memory the pool may keep in slabs
+ * @return the pool, or NULL if out of memory
+ */
+libpd_pool_t *libpd_pool_create (size_t max_bytes);
+
+/**
+ * Destroy a pool
+ *
+ * Every block allocated from the pool must have been freed, unless
+ * it is covered by a hold. The pool is freed when the last hold is
+ * dropped, which may be now.
+ *
+ * @param pool pool to destroy, or NULL
+ * @param release if not NULL, called with arg once the pool is freed
+ * @param arg passed to release
+ */
+void libpd_pool_destroy (libpd_pool_t *pool, libpd_pool_release_t *release,
+	void *arg);
+
+/**
+ * Keep a pool from being freed
+ *
+ * May be called from any thread, while the pool is not yet destroyed
+ * or the caller has another hold on it.
+ *
+ * @param pool pool object, or NULL
+ */
+void libpd_pool_hold (libpd_pool_t *pool);
+
+/**
+ * Drop a hold from libpd_pool_hold
+ *
+ * May be called from any thread. Frees the pool, and calls its release
+ * function, if the pool was destroyed and this was the last hold.
+ *
+ * @param pool pool object, or NULL
+ */
+void libpd_pool_drop (libpd_pool_t *pool);
+
+/**
+ * Set up a cache for a thread that allocates from a pool
+ *
+ * @param cache cache to set up
+ * @param pool pool to allocate from
+ */
+void libpd_pool_cache_init (libpd_pool_cache_t *cache, libpd_pool_t *pool);
+
+/**
+ * Give the chunks in a cache back to its pool
+ *
+ * Must be called by the thread that owns the cache, if the cache goes
+ * away before the pool does.
+ *
+ * @param cache cache to empty
+ */
+void libpd_pool_cache_flush (libpd_pool_cache_t *cache);
+
+/**
+ * Allocate a block
+ *
+ * @param cache cache of the calling thread, or NULL to allocate with malloc
+ * @param size size of the block
+ * @return the block, which must be freed with libpd_pool_free,
+ *   or NULL if out of memory
+ */
+void *libpd_pool_alloc (libpd_pool_cache_t *cache, size_t size);
+
+/**
+ * Free a block from libpd_pool_alloc
+ *
+ * May be called from any thread.
+ *
+ * @param ptr block to free, or NULL
+ */
+void libpd_pool_free (void *ptr);
+
+/**
+ * Get the memory a pool keeps in slabs
+ *
+ * @param pool pool object, or NULL
+ * @return bytes allocated for slabs
+ */
+size_t libpd_pool_bytes (libpd_pool_t *pool);
+
+/**
+ * Get the number of allocations a pool could not serve
+ *
+ * @param pool pool object, or NULL
+ * @return allocations (through a cache) that went to malloc
+ */
+uint64_t libpd_pool_fallbacks (libpd_pool_t *pool);
+
+#endif
@@ -33,6 +33,53 @@ typedef enum {
 	 * could not create new instance
 	 */
 	LIBPD_ERR_INIT_INST = -0x40001,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 */
+	LIBPD_ERR_INIT_CFG = -0x40002,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 * receive_overflow
+	 */
+	LIBPD_ERR_INIT_CFG_OVERFLOW = -0x41001,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 * receive_queue_size
+	 */
+	LIBPD_ERR_INIT_CFG_QUEUE_SIZE = -0x41002,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 * priority_rules
+	 */
+	LIBPD_ERR_INIT_CFG_PRIORITY = -0x41003,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 * msg_handler_order
+	 */
+	LIBPD_ERR_INIT_CFG_ORDER = -0x41004,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 * extra_service_names
+	 */
+	LIBPD_ERR_INIT_CFG_SERVICES = -0x41005,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 * transport
+	 */
+	LIBPD_ERR_INIT_CFG_TRANSPORT = -0x41006,
+	/** 
+	 * @brief Error on libparodus_init
+	 * invalid config parameter
+	 * shm_ring_size
+	 */
+	LIBPD_ERR_INIT_CFG_SHM = -0x41007,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error connecting receiver
@@ -62,6 +109,24 @@ typedef enum {
 	 * error binding to socket
 	 */
 	LIBPD_ERR_INIT_RCV_BIND = -0x420C0,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error connecting receiver
+	 * ipc socket file in use or not removable
+	 */
+	LIBPD_ERR_INIT_RCV_IPC = -0x42100,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error connecting receiver
+	 * error setting ipc socket file permissions
+	 */
+	LIBPD_ERR_INIT_RCV_IPC_MODE = -0x42140,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error connecting receiver
+	 * error getting the socket's receive fd
+	 */
+	LIBPD_ERR_INIT_RCV_RCVFD = -0x42180,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error connecting sender
@@ -93,42 +158,42 @@ typedef enum {
 	LIBPD_ERR_INIT_SEND_CONN = -0x430C0,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error connecting termination socket
+	 * error creating the receiver stop eventfd
 	 */
-	LIBPD_ERR_INIT_TERMSOCK = -0x44000,
+	LIBPD_ERR_INIT_STOP_FD = -0x44000,
 	/** 
-	 * @brief Error on connect termination socket
-	 * null url specified
+	 * @brief Error on libparodus_init
+	 * error creating wrp receiver thread
 	 */
-	LIBPD_ERR_INIT_TERMSO_NULL = -0x44001,
+	LIBPD_ERR_INIT_RCV_THREAD = -0x45000,
 	/** 
-	 * @brief Error on connect termination socket
-	 * error creating socket
+	 * @brief Error on libparodus_init
+	 * error creating wrp receiver thread
+	 * pthread_create error
 	 */
-	LIBPD_ERR_INIT_TERMSO_CREATE = -0x44040,
+	LIBPD_ERR_INIT_RCV_THREAD_PCR = -0x45040,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error connecting termination socket
-	 * error setting socket option
+	 * error creating wrp sender thread
 	 */
-	LIBPD_ERR_INIT_TERMSO_SETOPT = -0x44080,
+	LIBPD_ERR_INIT_SEND_THREAD = -0x46000,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error connecting termination socket
-	 * error connecting to socket
+	 * error creating wrp sender thread
+	 * pthread_create error
 	 */
-	LIBPD_ERR_INIT_TERMSO_CONN = -0x440C0,
+	LIBPD_ERR_INIT_SEND_THREAD_PCR = -0x46040,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error creating wrp receiver thread
+	 * error creating msg handler thread
 	 */
-	LIBPD_ERR_INIT_RCV_THREAD = -0x45000,
+	LIBPD_ERR_INIT_HANDLER_THREAD = -0x47000,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error creating wrp receiver thread
+	 * error creating msg handler thread
 	 * pthread_create error
 	 */
-	LIBPD_ERR_INIT_RCV_THREAD_PCR = -0x45040,
+	LIBPD_ERR_INIT_HANDLER_THREAD_PCR = -0x47040,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error creating wrp msg rcv queue
@@ -169,11 +234,42 @@ typedef enum {
 	 * unable to create not_full cond var for rcv queue
 	 */
 	LIBPD_ERR_INIT_QCREATE_NFCOND = -0x510C0,
+	/** 
+	 * @brief Error on libparodus init
+	 * unable to create eventfd for rcv queue
+	 */
+	LIBPD_ERR_INIT_QCREATE_EVENTFD = -0x51100,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error sending registration msg
 	 */
 	LIBPD_ERR_INIT_REGISTER = -0x60000,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating send queue
+	 * (add libpd_qcreate error)
+	 */
+	LIBPD_ERR_INIT_SEND_QUEUE = -0x70000,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating msg handler queue
+	 * (add libpd_qcreate error)
+	 */
+	LIBPD_ERR_INIT_HANDLER_QUEUE = -0x80000,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating request table
+	 * (add libpd_reqs_create error)
+	 */
+	LIBPD_ERR_INIT_REQUESTS = -0x90000,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating route table
+	 * (add libpd_routes_create error)
+	 * Past the other bases, since INIT_REQUESTS plus a request error
+	 * runs down to -0x98180
+	 */
+	LIBPD_ERR_INIT_ROUTES = -0x1A0000,
 	/** 
 	 * @brief Error on libparodus_init
 	 * convert to struct error on send registration
@@ -248,6 +344,11 @@ typedef enum {
 	 * null msg received from wrp queue
 	 */
 	LIBPD_ERR_RCV_NULL_MSG = -0xA0004,
+	/** 
+	 * @brief Error on libparodus_receive_batch
+	 * invalid parameter
+	 */
+	LIBPD_ERR_RCV_PARAM = -0xA0005,
 	/** 
 	 * @brief Error on libparodus_receive
 	 * wrp queue receive error
@@ -345,6 +446,16 @@ typedef enum {
 	 * run state error
 	 */
 	LIBPD_ERR_SEND_STATE = -0x140002,
+	/** 
+	 * @brief Error on libparodus_send_async
+	 * not configured for async send
+	 */
+	LIBPD_ERR_SEND_ASYNC_CFG = -0x140003,
+	/** 
+	 * @brief Error on libparodus_send_async
+	 * send queue full
+	 */
+	LIBPD_ERR_SEND_QUEUE_FULL = -0x140004,
 	/** 
 	 * @brief Error on libparodus_send
 	 * convert to struct error
@@ -392,6 +503,72 @@ typedef enum {
 	 * nanomsg send error
 	 */
 	LIBPD_ERR_SEND_NN = -0x141840,
+	/** 
+	 * @brief Error on libparodus_send_async
+	 * send queue error
+	 * (add libpd_qsend error)
+	 */
+	LIBPD_ERR_SEND_QUEUE = -0x150000,
+	/** 
+	 * @brief Error on libparodus_request
+	 */
+	LIBPD_ERR_REQUEST = -0x160000,
+	/** 
+	 * @brief Error on libparodus_request
+	 * null instance given
+	 */
+	LIBPD_ERR_REQUEST_NULL_INST = -0x160001,
+	/** 
+	 * @brief Error on libparodus_request
+	 * run state error
+	 */
+	LIBPD_ERR_REQUEST_STATE = -0x160002,
+	/** 
+	 * @brief Error on libparodus_request
+	 * not configured for receive
+	 */
+	LIBPD_ERR_REQUEST_CFG = -0x160003,
+	/** 
+	 * @brief Error on libparodus_request
+	 * invalid parameter
+	 */
+	LIBPD_ERR_REQUEST_PARAM = -0x160004,
+	/** 
+	 * @brief Error on libparodus_request
+	 * error adding to the request table
+	 * (add libpd_reqs_add error)
+	 */
+	LIBPD_ERR_REQUEST_ADD = -0x170000,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 */
+	LIBPD_ERR_ROUTE = -0x180000,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * null instance given
+	 */
+	LIBPD_ERR_ROUTE_NULL_INST = -0x180001,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * run state error
+	 */
+	LIBPD_ERR_ROUTE_STATE = -0x180002,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * not configured for receive
+	 */
+	LIBPD_ERR_ROUTE_CFG = -0x180003,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * invalid service or path
+	 */
+	LIBPD_ERR_ROUTE_PARAM = -0x180004,
+	/** 
+	 * @brief Error on libparodus_add_route
+	 * error adding to the route table
+	 * (add libpd_routes_add error)
+	 */
+	LIBPD_ERR_ROUTE_ADD = -0x190000,
 } __libpd_err_t;
 
 
@@ -465,6 +642,50 @@ int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
 int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg, 
     uint32_t ms, extra_err_info_t *err_info);
 
+/**
+ *  Receives the next message sent to one of the services of the instance.
+ *
+ *  @param instance instance object
+ *  @param service_name service_name or one of extra_service_names
+ *  @param msg the pointer to receive the next msg struct
+ *  @param ms the number of milliseconds to wait for the next message
+ *  @param err_info extra error information for debugging.
+ *
+ *  @return the same as libparodus_receive_service
+ *
+ * @note this is the same as libparodus_receive_service (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_receive_service_dbg (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms, 
+	extra_err_info_t *err_info);
+
+/**
+ *  Receives up to max messages from the queue in one call, waiting
+ *  the prescribed number of milliseconds for the first one.
+ *
+ *  @param instance instance object
+ *  @param msgs array of at least max pointers to receive the msg structs
+ *  @param max the maximum number of messages to receive
+ *  @param ms the number of milliseconds to wait for the first message
+ *  @param count receives the number of messages placed in msgs
+ *  @param err_info extra error information for debugging.
+ *
+ *  @return 0 on success, 2 if closed msg received, 1 if timed out, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive
+ *		LIBPD_ERROR_RCV_RCV = -204, receive error
+ *		LIBPD_ERROR_RCV_PARAM = -206, null msgs or count, or max is 0
+ *
+ * @note this is the same as libparodus_receive_batch (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_receive_batch_dbg (libpd_instance_t instance, wrp_msg_t **msgs,
+	size_t max, uint32_t ms, size_t *count, extra_err_info_t *err_info);
+
 /**
  * Sends a close message to the receiver
  *
@@ -525,10 +746,112 @@ int libparodus_shutdown_dbg (libpd_instance_t *instance,
 int libparodus_send_dbg (libpd_instance_t instance, wrp_msg_t *msg,
     extra_err_info_t *err_info);
 
+/**
+ * Queue a wrp message to be sent to the parodus service, without
+ * waiting on the socket.
+ *
+ * @param instance instance object
+ * @param msg wrp message to send
+ * @param callback completion callback, or NULL for fire-and-forget
+ * @param ctx passed to callback
+ * @param err_info extra error information for debugging.
+ *
+ * @return 0 when queued, else:
+ *		LIBPD_ERROR_SEND_NULL_INST = -401, null instance given
+ *		LIBPD_ERROR_SEND_STATE = -402, run state error, not running
+ *		LIBPD_ERROR_SEND_WRP_MSG = -403, invalid wrp message
+ *		LIBPD_ERROR_SEND_ASYNC_CFG = -406, send_queue_size not configured
+ *		LIBPD_ERROR_SEND_QUEUE_FULL = -407, send queue full
+ *		LIBPD_ERROR_SEND_QUEUE = -408, send queue error
+ *
+ * @note this is the same as libparodus_send_async (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_send_async_dbg (libpd_instance_t instance, wrp_msg_t *msg,
+	libpd_send_cb_t *callback, void *ctx, extra_err_info_t *err_info);
+
+/**
+ * Sends a request to the parodus service and waits for the response.
+ *
+ * @param instance instance object
+ * @param req REQ or CRUD msg to send, with a transaction_uuid
+ * @param resp receives the response
+ * @param timeout_ms how long to wait for the response
+ * @param err_info extra error information for debugging.
+ *
+ * @return the same as libparodus_request
+ *
+ * @note this is the same as libparodus_request (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_request_dbg (libpd_instance_t instance, wrp_msg_t *req,
+	wrp_msg_t **resp, uint32_t timeout_ms, extra_err_info_t *err_info);
+
+/**
+ * Sends a request to the parodus service without waiting for the response.
+ *
+ * @param instance instance object
+ * @param req REQ or CRUD msg to send, with a transaction_uuid
+ * @param timeout_ms how long to wait for the response
+ * @param callback response callback
+ * @param ctx passed to callback
+ * @param err_info extra error information for debugging.
+ *
+ * @return the same as libparodus_request_async
+ *
+ * @note this is the same as libparodus_request_async (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_request_async_dbg (libpd_instance_t instance, wrp_msg_t *req,
+	uint32_t timeout_ms, libpd_response_cb_t *callback, void *ctx,
+	extra_err_info_t *err_info);
+
+/**
+ * Adds a route for msgs directed to a dest path of this service.
+ *
+ * @param instance instance object
+ * @param path dest path following the service name
+ * @param handler msg handler for the route
+ * @param ctx passed to handler
+ * @param err_info extra error information for debugging.
+ *
+ * @return the same as libparodus_add_route
+ *
+ * @note this is the same as libparodus_add_route (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_add_route_dbg (libpd_instance_t instance, const char *path,
+	libpd_msg_handler_t *handler, void *ctx, extra_err_info_t *err_info);
+
+/**
+ * Adds a route for one of the services of the instance.
+ *
+ * @param instance instance object
+ * @param service_name service_name or one of extra_service_names
+ * @param path dest path following the service name
+ * @param handler msg handler for the route
+ * @param ctx passed to handler
+ * @param err_info extra error information for debugging.
+ *
+ * @return the same as libparodus_add_service_route
+ *
+ * @note this is the same as libparodus_add_service_route (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_add_service_route_dbg (libpd_instance_t instance, 
+	const char *service_name, const char *path,
+	libpd_msg_handler_t *handler, void *ctx, extra_err_info_t *err_info);
+
 
 /**
  * Config test flags
 */
 #define CFG_TEST_CONNECT_ON_EVERY_SEND	1 
+#define CFG_TEST_FIXED_RECONNECT_SEED	2	// reconnect jitter the same every run
 
 #endif
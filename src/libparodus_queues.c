@@ -17,29 +17,126 @@
 
 #include "libparodus_queues.h"
 #include "libparodus_time.h"
+#include "libparodus_latency.h"
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 #include "libparodus_log.h"
 
+#define QUEUE_CACHE_LINE 64
+
+/*
+ * Single producer / single consumer ring, used when the queue is created
+ * with LIBPD_QOPT_SPSC. head is only written by the consumer and tail
+ * only by the producer, so neither side needs the queue mutex unless it
+ * has to block. Each side keeps a cached copy of the other side's index
+ * on its own cache line.
+ */
+typedef struct {
+	unsigned mask;
+	void **slots;
+	char pad0[QUEUE_CACHE_LINE];
+	// consumer side
+	unsigned head;
+	unsigned tail_cache;
+	int rcv_waiting;
+	char pad1[QUEUE_CACHE_LINE];
+	// producer side
+	unsigned tail;
+	unsigned head_cache;
+	int snd_waiting;
+	char pad2[QUEUE_CACHE_LINE];
+} spsc_ring_t;
+
+// times kept for each msg slot when latency is recorded
+typedef struct {
+	uint64_t enq;
+	uint64_t origin;	// 0 if the msg is not timed
+} msg_stamp_t;
+
+/*
+ * A priority lane: a circular array of up to max_msgs msgs.
+ * Queues have one lane unless created with libpd_qcreate_prio.
+ * Receivers take from the first lane that isn't empty, so lane 0
+ * is the highest priority. An SPSC ring uses the single lane's
+ * msg_array as its slots.
+ */
+typedef struct {
+	void **msg_array;
+	msg_stamp_t *stamps;	// NULL unless libpd_qset_latency
+	int msg_count;
+	int head_index;
+	int tail_index;
+} lane_t;
+
 typedef struct queue {
 	const char *queue_name;
 	unsigned max_msgs;
-	int msg_count;
+	int msg_count;		// total over all lanes
 	pthread_mutex_t mutex;
 	pthread_cond_t not_empty_cond;
 	pthread_cond_t not_full_cond;
-	void **msg_array;
-	int head_index;
-	int tail_index;
+	lane_t *lanes;
+	unsigned num_lanes;
+	spsc_ring_t *ring;	// NULL unless LIBPD_QOPT_SPSC
+	void *post_msg;		// msg from libpd_qpost (SPSC only)
+	int efd;		// -1 unless LIBPD_QOPT_EVENTFD
+	libpd_lat_hist_t *wait_hist;
+	libpd_lat_hist_t *e2e_hist;
+	unsigned high_water;	// most msgs that have been on the queue
 } queue_t;
 
+// Timed waits use the monotonic clock, so they aren't stretched or
+// cut short when the wall clock is set. The deadline is only computed
+// the first time a call has to wait (ts starts out zeroed), and is
+// kept when the wait is woken up and has to wait again.
+static int get_deadline (unsigned timeout_ms, struct timespec *ts)
+{
+	if ((ts->tv_sec != 0) || (ts->tv_nsec != 0))
+		return 0;
+	return get_expire_time_mono (timeout_ms, ts);
+}
+
+static unsigned ring_size (unsigned max_msgs)
+{
+	unsigned size = 2;
+	while (size < max_msgs)
+		size <<= 1;
+	return size;
+}
+
 int libpd_qcreate (libpd_mq_t *mq, const char *queue_name, 
 	unsigned max_msgs, int *exterr)
+{
+	return libpd_qcreate_opt (mq, queue_name, max_msgs, 0, exterr);
+}
+
+int libpd_qcreate_opt (libpd_mq_t *mq, const char *queue_name, 
+	unsigned max_msgs, unsigned opts, int *exterr)
+{
+	return libpd_qcreate_prio (mq, queue_name, max_msgs, 1, opts, exterr);
+}
+
+static void free_lanes (queue_t *q)
+{
+	unsigned i;
+
+	for (i = 0; i < q->num_lanes; i++) {
+		free (q->lanes[i].msg_array);
+		free (q->lanes[i].stamps);
+	}
+	free (q->lanes);
+}
+
+int libpd_qcreate_prio (libpd_mq_t *mq, const char *queue_name, 
+	unsigned max_msgs, unsigned num_lanes, unsigned opts, int *exterr)
 {
 	int err;
-	unsigned array_size;
+	unsigned i, array_size;
 	queue_t *newq;
 
 	*exterr = 0;
@@ -50,8 +147,18 @@ int libpd_qcreate (libpd_mq_t *mq, const char *queue_name,
 			queue_name, max_msgs));
 		return LIBPD_QERR_CREATE_INVAL_SZ;
 	}
+	if ((num_lanes < 1) || 
+	    ((num_lanes > 1) && (opts & LIBPD_QOPT_SPSC))) {
+		libpd_log (LEVEL_ERROR, 
+			("Error creating queue %s: invalid number of lanes %u\n",
+			queue_name, num_lanes));
+		return LIBPD_QERR_CREATE_INVAL_OPT;
+	}
 		
-	array_size = max_msgs * sizeof(void*);
+	if (opts & LIBPD_QOPT_SPSC)
+		array_size = ring_size (max_msgs) * sizeof(void*);
+	else
+		array_size = max_msgs * sizeof(void*);
 	newq = (queue_t*) malloc (sizeof(queue_t));
 
 	if (NULL == newq) {
@@ -63,130 +170,533 @@ int libpd_qcreate (libpd_mq_t *mq, const char *queue_name,
 	newq->queue_name = queue_name;
 	newq->max_msgs = max_msgs;
 	newq->msg_count = 0;
-	newq->head_index = -1;
-	newq->tail_index = -1;
+	newq->lanes = NULL;
+	newq->num_lanes = 0;
+	newq->ring = NULL;
+	newq->post_msg = NULL;
+	newq->efd = -1;
+	newq->wait_hist = NULL;
+	newq->e2e_hist = NULL;
+	newq->high_water = 0;
+
+	if (opts & LIBPD_QOPT_SPSC) {
+		newq->ring = (spsc_ring_t*) malloc (sizeof(spsc_ring_t));
+		if (NULL == newq->ring) {
+			libpd_log (LEVEL_ERROR, ("Unable to allocate memory(3) for queue %s\n",
+				queue_name));
+			free (newq);
+			return LIBPD_QERR_CREATE_ALLOC_1;
+		}
+		memset ((void*) newq->ring, 0, sizeof(spsc_ring_t));
+		newq->ring->mask = ring_size (max_msgs) - 1;
+	}
 
 	err = pthread_mutex_init (&newq->mutex, NULL);
 	if (err != 0) {
 		*exterr = err;
 		libpd_log_err (LEVEL_ERROR, err, ("Error creating mutex for queue %s\n",
 			queue_name));
+		free (newq->ring);
 		free (newq);
 		return LIBPD_QERR_CREATE_MUTEX;
 	}
 
-	err = pthread_cond_init (&newq->not_empty_cond, NULL);
+	err = cond_init_monotonic (&newq->not_empty_cond);
 	if (err != 0) {
 		*exterr = err;
 		libpd_log_err (LEVEL_ERROR, err, ("Error creating not_empty_cond for queue %s\n",
 			queue_name));
 		pthread_mutex_destroy (&newq->mutex);
+		free (newq->ring);
 		free (newq);
 		return LIBPD_QERR_CREATE_NECOND;
 	}
 
-	err = pthread_cond_init (&newq->not_full_cond, NULL);
+	err = cond_init_monotonic (&newq->not_full_cond);
 	if (err != 0) {
 		*exterr = err;
 		libpd_log_err (LEVEL_ERROR, err, ("Error creating not_full_cond for queue %s\n",
 			queue_name));
 		pthread_mutex_destroy (&newq->mutex);
 		pthread_cond_destroy (&newq->not_empty_cond);
+		free (newq->ring);
 		free (newq);
 		return LIBPD_QERR_CREATE_NFCOND;
 	}
 
-	newq->msg_array = malloc (array_size);
-	if (NULL == newq->msg_array) {
+	newq->lanes = (lane_t*) calloc (num_lanes, sizeof(lane_t));
+	if (NULL != newq->lanes) {
+		newq->num_lanes = num_lanes;
+		for (i = 0; i < num_lanes; i++) {
+			newq->lanes[i].head_index = -1;
+			newq->lanes[i].tail_index = -1;
+			newq->lanes[i].msg_array = malloc (array_size);
+			if (NULL == newq->lanes[i].msg_array)
+				break;
+		}
+	}
+	if ((NULL == newq->lanes) || (i < num_lanes)) {
 		libpd_log (LEVEL_ERROR, ("Unable to allocate memory(2) for queue %s\n",
 			queue_name));
 		pthread_mutex_destroy (&newq->mutex);
 		pthread_cond_destroy (&newq->not_empty_cond);
 		pthread_cond_destroy (&newq->not_full_cond);
+		if (NULL != newq->lanes)
+			free_lanes (newq);
+		free (newq->ring);
 		free (newq);
 		return LIBPD_QERR_CREATE_ALLOC_2;
 	}
+	if (NULL != newq->ring)
+		newq->ring->slots = newq->lanes[0].msg_array;
+
+	if (opts & LIBPD_QOPT_EVENTFD) {
+		newq->efd = eventfd (0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+		if (newq->efd < 0) {
+			err = errno;
+			*exterr = err;
+			libpd_log_err (LEVEL_ERROR, err, ("Error creating eventfd for queue %s\n",
+				queue_name));
+			pthread_mutex_destroy (&newq->mutex);
+			pthread_cond_destroy (&newq->not_empty_cond);
+			pthread_cond_destroy (&newq->not_full_cond);
+			free_lanes (newq);
+			free (newq->ring);
+			free (newq);
+			return LIBPD_QERR_CREATE_EVENTFD;
+		}
+	}
 
 	*mq = (libpd_mq_t) newq;
 	return 0;
 }
 
+int libpd_qset_latency (libpd_mq_t mq, libpd_lat_hist_t *wait_hist,
+	libpd_lat_hist_t *e2e_hist)
+{
+	queue_t *q = (queue_t*) mq;
+	unsigned i, nslots;
 
+	if (NULL == mq)
+		return LIBPD_QERR_SEND_NULL;
+	nslots = (NULL != q->ring) ? (q->ring->mask + 1) : q->max_msgs;
+	for (i = 0; i < q->num_lanes; i++) {
+		q->lanes[i].stamps = (msg_stamp_t*) calloc (nslots, sizeof(msg_stamp_t));
+		if (NULL == q->lanes[i].stamps) {
+			libpd_log (LEVEL_ERROR, ("Unable to allocate timestamps for queue %s\n",
+				q->queue_name));
+			return LIBPD_QERR_CREATE_ALLOC_2;
+		}
+	}
+	q->wait_hist = wait_hist;
+	q->e2e_hist = e2e_hist;
+	return 0;
+}
 
-static bool enqueue_msg (queue_t *q, void *msg)
+static void set_stamp (lane_t *lane, unsigned index, uint64_t origin)
 {
-	if (q->msg_count == 0) {
-		q->msg_array[0] = msg;
-		q->head_index = 0;
-		q->tail_index = 0;
-		q->msg_count = 1;
-		return true;
-	}
-	if (q->msg_count >= (int)q->max_msgs)
+	if (NULL == lane->stamps)
+		return;
+	lane->stamps[index].origin = origin;
+	if (0 != origin)
+		lane->stamps[index].enq = libpd_lat_now ();
+}
+
+static void record_stamp (queue_t *q, lane_t *lane, unsigned index)
+{
+	uint64_t now;
+	msg_stamp_t *stamp;
+
+	if ((NULL == lane->stamps) || (NULL == q->wait_hist))
+		return;
+	stamp = &lane->stamps[index];
+	if (0 == stamp->origin)
+		return;
+	now = libpd_lat_now ();
+	libpd_lat_record (q->wait_hist, (now > stamp->enq) ? (now - stamp->enq) : 0);
+	libpd_lat_record (q->e2e_hist, (now > stamp->origin) ? (now - stamp->origin) : 0);
+}
+
+/*
+ * With LIBPD_QOPT_EVENTFD, the eventfd count tracks the number of msgs
+ * on the queue, so the fd is readable whenever the queue is not empty.
+ * Senders add to the count before the msg is enqueued, and take it back
+ * if the send fails, so a receiver that got a msg can always take one
+ * from the count. The fd may be readable for a moment before the msg
+ * can be received, but never stays readable when the queue is empty.
+ */
+static void efd_post (queue_t *q)
+{
+	if (q->efd >= 0)
+		eventfd_write (q->efd, 1);
+}
+
+static void efd_take (queue_t *q, unsigned count)
+{
+	eventfd_t val;
+	if (q->efd < 0)
+		return;
+	while (count--)
+		eventfd_read (q->efd, &val);
+}
+
+
+
+// high_water is only written by the producer (or under the mutex),
+// but may be read by any thread.
+static void update_high_water (queue_t *q, unsigned count)
+{
+	if (count > q->high_water)
+		__atomic_store_n (&q->high_water, count, __ATOMIC_RELAXED);
+}
+
+static bool enqueue_msg (queue_t *q, unsigned lane_no, void *msg, uint64_t origin)
+{
+	lane_t *lane = &q->lanes[lane_no];
+
+	if (lane->msg_count >= (int)q->max_msgs)
 		return false;
-	q->tail_index += 1;
-	if (q->tail_index >= (int)q->max_msgs)
-		q->tail_index = 0;
-	q->msg_array[q->tail_index] = msg;
+	if (lane->msg_count == 0) {
+		lane->head_index = 0;
+		lane->tail_index = 0;
+	} else {
+		lane->tail_index += 1;
+		if (lane->tail_index >= (int)q->max_msgs)
+			lane->tail_index = 0;
+	}
+	lane->msg_array[lane->tail_index] = msg;
+	set_stamp (lane, lane->tail_index, origin);
+	lane->msg_count += 1;
 	q->msg_count += 1;
+	update_high_water (q, q->msg_count);
 	return true;
 }
 
-static void *dequeue_msg (queue_t *q)
+// takes the oldest msg from the highest priority lane that has one.
+// was_full is set true if that lane was full.
+static void *dequeue_msg (queue_t *q, bool *was_full)
 {
 	void *msg;
+	lane_t *lane = q->lanes;
+
 	if (q->msg_count <= 0)
 		return NULL;
-	msg = q->msg_array[q->head_index];
-	q->head_index += 1;
-	if (q->head_index >= (int)q->max_msgs)
-		q->head_index = 0;
+	while (lane->msg_count <= 0)
+		lane++;
+	if (lane->msg_count == (int)q->max_msgs)
+		*was_full = true;
+	msg = lane->msg_array[lane->head_index];
+	record_stamp (q, lane, lane->head_index);
+	lane->head_index += 1;
+	if (lane->head_index >= (int)q->max_msgs)
+		lane->head_index = 0;
+	lane->msg_count -= 1;
 	q->msg_count -= 1;
 	return msg;
 }
 
-int libpd_qdestroy (libpd_mq_t *mq, free_msg_func_t *free_msg_func)
+// SPSC ring operations. ring_enqueue is only called by the producer
+// and ring_dequeue only by the consumer.
+static bool ring_enqueue (queue_t *q, void *msg, uint64_t origin)
 {
-	queue_t *q = (queue_t*) *mq;
+	spsc_ring_t *r = q->ring;
+	unsigned tail = r->tail;
+
+	if ((tail - r->head_cache) >= q->max_msgs) {
+		r->head_cache = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+		if ((tail - r->head_cache) >= q->max_msgs)
+			return false;
+	}
+	r->slots[tail & r->mask] = msg;
+	set_stamp (q->lanes, tail & r->mask, origin);
+	__atomic_store_n (&r->tail, tail + 1, __ATOMIC_RELEASE);
+	// head_cache may be stale, so check a new high water mark
+	// against the real head before recording it
+	if ((tail + 1 - r->head_cache) > q->high_water) {
+		r->head_cache = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+		update_high_water (q, tail + 1 - r->head_cache);
+	}
+	return true;
+}
+
+static void *ring_dequeue (queue_t *q)
+{
+	spsc_ring_t *r = q->ring;
+	unsigned head = r->head;
 	void *msg;
-	if (NULL == *mq)
+
+	if (head == r->tail_cache) {
+		r->tail_cache = __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE);
+		if (head == r->tail_cache)
+			return NULL;
+	}
+	msg = r->slots[head & r->mask];
+	record_stamp (q, q->lanes, head & r->mask);
+	__atomic_store_n (&r->head, head + 1, __ATOMIC_RELEASE);
+	return msg;
+}
+
+// Wake the other side only if it has announced that it is blocked.
+// The seq_cst fence pairs with the seq_cst store of the waiting flag
+// made under the mutex, so either the waiter sees our index update
+// or we see its flag. Broadcast, since libpd_qpost callers may also
+// be waiting on not_full_cond.
+static void ring_wake (queue_t *q, int *waiting, pthread_cond_t *cond)
+{
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (waiting, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock (&q->mutex);
+		pthread_cond_broadcast (cond);
+		pthread_mutex_unlock (&q->mutex);
+	}
+}
+
+// must be called with the mutex held
+static void *take_post_msg (queue_t *q)
+{
+	void *msg = q->post_msg;
+	if (NULL != msg) {
+		q->post_msg = NULL;
+		pthread_cond_broadcast (&q->not_full_cond);
+	}
+	return msg;
+}
+
+static int spsc_send (queue_t *q, void *msg, uint64_t origin,
+	unsigned timeout_ms, int *exterr)
+{
+	spsc_ring_t *r = q->ring;
+	struct timespec ts = {0, 0};
+	int rtn;
+
+	if (ring_enqueue (q, msg, origin)) {
+		ring_wake (q, &r->rcv_waiting, &q->not_empty_cond);
 		return 0;
+	}
 	pthread_mutex_lock (&q->mutex);
-	if (NULL != free_msg_func) {
-		msg = dequeue_msg (q);
-		while (NULL != msg) {
-			(*free_msg_func) (msg);
-			msg = dequeue_msg (q);
+	while (true) {
+		__atomic_store_n (&r->snd_waiting, 1, __ATOMIC_SEQ_CST);
+		if (ring_enqueue (q, msg, origin))
+			break;
+		rtn = get_deadline (timeout_ms, &ts);
+		if (rtn != 0) {
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("clock_gettime error waiting to send queue\n"));
+			__atomic_store_n (&r->snd_waiting, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock (&q->mutex);
+			return LIBPD_QERR_SEND_EXPTIME;
 		}
+		rtn = pthread_cond_timedwait (&q->not_full_cond, &q->mutex, &ts);
+		if (rtn != 0) {
+			__atomic_store_n (&r->snd_waiting, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock (&q->mutex);
+			if (rtn == ETIMEDOUT)
+				return 1;
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("pthread_cond_timedwait error waiting for not_full_cond\n"));
+			return LIBPD_QERR_SEND_CONDWAIT;
+		}
+	}
+	__atomic_store_n (&r->snd_waiting, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&q->mutex);
+	ring_wake (q, &r->rcv_waiting, &q->not_empty_cond);
+	return 0;
+}
+
+static int spsc_receive (queue_t *q, void **msg, unsigned timeout_ms, int *exterr)
+{
+	spsc_ring_t *r = q->ring;
+	struct timespec ts = {0, 0};
+	void *msg__;
+	int rtn;
+
+	msg__ = ring_dequeue (q);
+	if (NULL != msg__) {
+		*msg = msg__;
+		ring_wake (q, &r->snd_waiting, &q->not_full_cond);
+		return 0;
+	}
+	pthread_mutex_lock (&q->mutex);
+	while (true) {
+		__atomic_store_n (&r->rcv_waiting, 1, __ATOMIC_SEQ_CST);
+		msg__ = ring_dequeue (q);
+		if (NULL != msg__)
+			break;
+		msg__ = take_post_msg (q);
+		if (NULL != msg__)
+			break;
+		rtn = get_deadline (timeout_ms, &ts);
+		if (rtn != 0) {
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("clock_gettime error waiting to receive on queue\n"));
+			__atomic_store_n (&r->rcv_waiting, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock (&q->mutex);
+			return LIBPD_QERR_RCV_EXPTIME;
+		}
+		rtn = pthread_cond_timedwait (&q->not_empty_cond, &q->mutex, &ts);
+		if (rtn != 0) {
+			__atomic_store_n (&r->rcv_waiting, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock (&q->mutex);
+			if (rtn == ETIMEDOUT)
+				return 1;
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("pthread_cond_timedwait error waiting for not_empty_cond\n"));
+			return LIBPD_QERR_RCV_CONDWAIT;
+		}
+	}
+	__atomic_store_n (&r->rcv_waiting, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&q->mutex);
+	*msg = msg__;
+	ring_wake (q, &r->snd_waiting, &q->not_full_cond);
+	return 0;
+}
+
+// Copy the msgs on a lane, oldest first, to msgs and empty the lane.
+// Must be called with the mutex held.
+static unsigned lane_take_all (queue_t *q, lane_t *lane, void **msgs)
+{
+	unsigned count = (unsigned) lane->msg_count;
+	unsigned first = q->max_msgs - (unsigned) lane->head_index;
+
+	if (count == 0)
+		return 0;
+	if (first > count)
+		first = count;
+	memcpy (msgs, &lane->msg_array[lane->head_index], first * sizeof(void*));
+	memcpy (&msgs[first], lane->msg_array, (count - first) * sizeof(void*));
+	lane->msg_count = 0;
+	lane->head_index = 0;
+	lane->tail_index = 0;
+	return count;
+}
+
+// Copy a posted msg and everything on the ring to msgs and empty the
+// ring. Must be called by the consumer, with the mutex held.
+static unsigned ring_take_all (queue_t *q, void **msgs)
+{
+	spsc_ring_t *r = q->ring;
+	unsigned head = r->head;
+	unsigned tail = __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE);
+	unsigned count = 0;
+
+	if (NULL != q->post_msg)
+		msgs[count++] = take_post_msg (q);
+	while (head != tail)
+		msgs[count++] = r->slots[head++ & r->mask];
+	r->tail_cache = tail;
+	__atomic_store_n (&r->head, tail, __ATOMIC_RELEASE);
+	return count;
+}
+
+// Fallback when there's no memory to detach the msgs into: free them
+// one at a time under the mutex. Must be called with the mutex held.
+static unsigned free_all_locked (queue_t *q, free_msg_func_t *free_msg_func)
+{
+	libpd_lat_hist_t *wait_hist = q->wait_hist;
+	bool was_full;
+	unsigned count = 0;
+	void *msg;
+
+	q->wait_hist = NULL;	// don't time msgs that are being discarded
+	if ((NULL != q->ring) && (NULL != q->post_msg)) {
+		msg = take_post_msg (q);
+		if (NULL != free_msg_func)
+			(*free_msg_func) (msg);
+		count++;
+	}
+	while (true) {
+		if (NULL != q->ring)
+			msg = ring_dequeue (q);
+		else
+			msg = dequeue_msg (q, &was_full);
+		if (NULL == msg)
+			break;
+		if (NULL != free_msg_func)
+			(*free_msg_func) (msg);
+		count++;
+	}
+	q->wait_hist = wait_hist;
+	return count;
+}
+
+int libpd_qdrain (libpd_mq_t mq, free_msg_func_t *free_msg_func)
+{
+	queue_t *q = (queue_t*) mq;
+	void **msgs;
+	unsigned i, capacity, count = 0;
+
+	if (NULL == mq)
+		return 0;
+	if (NULL != q->ring)
+		capacity = q->ring->mask + 2;	// the ring plus a posted msg
+	else
+		capacity = q->max_msgs * q->num_lanes;
+	// allocated before taking the mutex, so it is only held
+	// while the msg pointers are copied out
+	msgs = (void**) malloc (capacity * sizeof(void*));
+	pthread_mutex_lock (&q->mutex);
+	if (NULL == msgs) {
+		libpd_log (LEVEL_ERROR, 
+			("Unable to allocate memory to drain queue %s\n", q->queue_name));
+		count = free_all_locked (q, free_msg_func);
+	} else if (NULL != q->ring) {
+		count = ring_take_all (q, msgs);
+	} else {
+		for (i = 0; i < q->num_lanes; i++)
+			count += lane_take_all (q, &q->lanes[i], &msgs[count]);
+		q->msg_count = 0;
 	}
-	free (q->msg_array);
+	if (count > 0)
+		pthread_cond_broadcast (&q->not_full_cond);
+	pthread_mutex_unlock (&q->mutex);
+	efd_take (q, count);
+	if ((NULL != msgs) && (NULL != free_msg_func))
+		for (i = 0; i < count; i++)
+			(*free_msg_func) (msgs[i]);
+	free (msgs);
+	return (int) count;
+}
+
+int libpd_qdestroy (libpd_mq_t *mq, free_msg_func_t *free_msg_func)
+{
+	queue_t *q = (queue_t*) *mq;
+	if (NULL == *mq)
+		return 0;
+	if (NULL != free_msg_func)
+		libpd_qdrain (*mq, free_msg_func);
+	pthread_mutex_lock (&q->mutex);
+	free_lanes (q);
+	free (q->ring);
 	pthread_cond_destroy (&q->not_empty_cond);
 	pthread_cond_destroy (&q->not_full_cond);
 	pthread_mutex_unlock (&q->mutex);
 	pthread_mutex_destroy (&q->mutex);
+	if (q->efd >= 0)
+		close (q->efd);
 	free (q);
 	*mq = NULL;
 	return 0;
 }
 
-int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr)
+static int queue_send (queue_t *q, unsigned lane, void *msg, uint64_t origin,
+	unsigned timeout_ms, int *exterr)
 {
-	queue_t *q = (queue_t*) mq;
-	struct timespec ts;
+	struct timespec ts = {0, 0};
 	int rtn;
 
-	*exterr = 0;
-	if (NULL == mq)
-		return LIBPD_QERR_SEND_NULL;
 	pthread_mutex_lock (&q->mutex);
 	while (true) {
-		if (enqueue_msg (q, msg))
+		if (enqueue_msg (q, lane, msg, origin))
 			break;
-		rtn = get_expire_time (timeout_ms, &ts);
+		rtn = get_deadline (timeout_ms, &ts);
 		if (rtn != 0) {
 			*exterr = rtn;
 			libpd_log_err (LEVEL_ERROR, rtn, 
-				("gettimeofday error waiting to send queue\n"));
+				("clock_gettime error waiting to send queue\n"));
 			pthread_mutex_unlock (&q->mutex);
 			return LIBPD_QERR_SEND_EXPTIME;
 		}
@@ -203,32 +713,139 @@ int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr)
 			return LIBPD_QERR_SEND_CONDWAIT;
 		}
 	}
-	if (q->msg_count == 1)
-		pthread_cond_signal (&q->not_empty_cond);
+	// signal every msg, not just the first, since a queue
+	// may have more than one receiver (the msg handler threads)
+	pthread_cond_signal (&q->not_empty_cond);
 	pthread_mutex_unlock (&q->mutex);
 	return 0;
 }
 
-int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr)
+int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr)
+{
+	return libpd_qsend_stamped (mq, msg, 0, timeout_ms, exterr);
+}
+
+int libpd_qsend_stamped (libpd_mq_t mq, void *msg, uint64_t origin,
+	unsigned timeout_ms, int *exterr)
+{
+	return libpd_qsend_prio (mq, msg, LIBPD_QLANE_LOWEST, origin, 
+		timeout_ms, exterr);
+}
+
+// lanes past the end are the lowest priority lane
+static unsigned lane_index (queue_t *q, unsigned lane)
+{
+	return (lane < q->num_lanes) ? lane : (q->num_lanes - 1);
+}
+
+int libpd_qsend_prio (libpd_mq_t mq, void *msg, unsigned lane, 
+	uint64_t origin, unsigned timeout_ms, int *exterr)
 {
 	queue_t *q = (queue_t*) mq;
-	struct timespec ts;
-	void *msg__;
 	int rtn;
 
 	*exterr = 0;
 	if (NULL == mq)
-		return LIBPD_QERR_RCV_NULL;
+		return LIBPD_QERR_SEND_NULL;
+	efd_post (q);
+	if (NULL != q->ring)
+		rtn = spsc_send (q, msg, origin, timeout_ms, exterr);
+	else
+		rtn = queue_send (q, lane_index (q, lane), msg, origin, 
+			timeout_ms, exterr);
+	if (rtn != 0)
+		efd_take (q, 1);
+	return rtn;
+}
+
+// Removes the msg at index, moving the msgs ahead of it up one slot
+// must be called with the mutex held
+static void remove_msg (queue_t *q, lane_t *lane, int index)
+{
+	int prev;
+
+	while (index != lane->head_index) {
+		prev = (index == 0) ? ((int)q->max_msgs - 1) : (index - 1);
+		lane->msg_array[index] = lane->msg_array[prev];
+		if (NULL != lane->stamps)
+			lane->stamps[index] = lane->stamps[prev];
+		index = prev;
+	}
+	lane->head_index += 1;
+	if (lane->head_index >= (int)q->max_msgs)
+		lane->head_index = 0;
+	lane->msg_count -= 1;
+	q->msg_count -= 1;
+}
+
+static int queue_send_evict (queue_t *q, unsigned lane_no, void *msg, 
+	uint64_t origin, evict_test_func_t *evict_test, void **evicted)
+{
+	lane_t *lane = &q->lanes[lane_no];
+	int i, index;
+
+	pthread_mutex_lock (&q->mutex);
+	// only evicting from the msg's own lane makes room for it
+	if (!enqueue_msg (q, lane_no, msg, origin)) {
+		index = lane->head_index;
+		for (i = 0; i < lane->msg_count; i++) {
+			if ((*evict_test) (lane->msg_array[index]))
+				break;
+			index += 1;
+			if (index >= (int)q->max_msgs)
+				index = 0;
+		}
+		if (i == lane->msg_count) {
+			pthread_mutex_unlock (&q->mutex);
+			return 1;
+		}
+		*evicted = lane->msg_array[index];
+		remove_msg (q, lane, index);
+		enqueue_msg (q, lane_no, msg, origin);
+	}
+	pthread_cond_signal (&q->not_empty_cond);
+	pthread_mutex_unlock (&q->mutex);
+	return 0;
+}
+
+int libpd_qsend_evict (libpd_mq_t mq, void *msg, unsigned lane, uint64_t origin,
+	evict_test_func_t *evict_test, void **evicted, int *exterr)
+{
+	queue_t *q = (queue_t*) mq;
+	int rtn;
+
+	*exterr = 0;
+	*evicted = NULL;
+	if (NULL == mq)
+		return LIBPD_QERR_SEND_NULL;
+	if (NULL != q->ring)
+		return LIBPD_QERR_SEND_SPSC;
+	efd_post (q);
+	rtn = queue_send_evict (q, lane_index (q, lane), msg, origin, 
+		evict_test, evicted);
+	// an evicted msg leaves the count where it was
+	if ((rtn != 0) || (NULL != *evicted))
+		efd_take (q, 1);
+	return rtn;
+}
+
+static int queue_receive (queue_t *q, void **msg, unsigned timeout_ms, int *exterr)
+{
+	struct timespec ts = {0, 0};
+	bool was_full = false;
+	void *msg__;
+	int rtn;
+
 	pthread_mutex_lock (&q->mutex);
 	while (true) {
-		msg__ = dequeue_msg (q);
+		msg__ = dequeue_msg (q, &was_full);
 		if (NULL != msg__)
 			break;
-		rtn = get_expire_time (timeout_ms, &ts);
+		rtn = get_deadline (timeout_ms, &ts);
 		if (rtn != 0) {
 			*exterr = rtn;
 			libpd_log_err (LEVEL_ERROR, rtn, 
-				("gettimeofday error waiting to receive on queue\n"));
+				("clock_gettime error waiting to receive on queue\n"));
 			pthread_mutex_unlock (&q->mutex);
 			return LIBPD_QERR_RCV_EXPTIME;
 		}
@@ -246,9 +863,202 @@ int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr)
 		}
 	}
 	*msg = msg__;
-	if ((q->msg_count+1) == (int)q->max_msgs)
+	// with more than one lane, the waiting senders may not all be
+	// waiting for the lane that now has room
+	if (was_full && (q->num_lanes > 1))
+		pthread_cond_broadcast (&q->not_full_cond);
+	else if (was_full)
 		pthread_cond_signal (&q->not_full_cond);
 	pthread_mutex_unlock (&q->mutex);
 	return 0;
 }
 
+int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr)
+{
+	queue_t *q = (queue_t*) mq;
+	int rtn;
+
+	*exterr = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_RCV_NULL;
+	if (NULL != q->ring)
+		rtn = spsc_receive (q, msg, timeout_ms, exterr);
+	else
+		rtn = queue_receive (q, msg, timeout_ms, exterr);
+	if (rtn == 0)
+		efd_take (q, 1);
+	return rtn;
+}
+
+// true if the msg ends a libpd_qreceive_until batch
+static bool is_stop_msg (stop_test_func_t *stop_test, void *msg)
+{
+	return (NULL != stop_test) && (*stop_test) (msg);
+}
+
+static int spsc_receive_many (queue_t *q, void **msgs, unsigned max_msgs,
+	stop_test_func_t *stop_test, unsigned timeout_ms, unsigned *count, 
+	int *exterr)
+{
+	spsc_ring_t *r = q->ring;
+	unsigned n;
+	int rtn;
+
+	// blocks (or takes the posted msg) only for the first one
+	rtn = spsc_receive (q, &msgs[0], timeout_ms, exterr);
+	if (rtn != 0)
+		return rtn;
+	for (n = 1; (n < max_msgs) && !is_stop_msg (stop_test, msgs[n-1]); n++) {
+		msgs[n] = ring_dequeue (q);
+		if (NULL == msgs[n])
+			break;
+	}
+	*count = n;
+	if (n > 1)
+		ring_wake (q, &r->snd_waiting, &q->not_full_cond);
+	return 0;
+}
+
+static int queue_receive_many (queue_t *q, void **msgs, unsigned max_msgs,
+	stop_test_func_t *stop_test, unsigned timeout_ms, unsigned *count, 
+	int *exterr)
+{
+	struct timespec ts = {0, 0};
+	bool was_full;
+	unsigned n;
+	int rtn;
+
+	pthread_mutex_lock (&q->mutex);
+	while (q->msg_count <= 0) {
+		rtn = get_deadline (timeout_ms, &ts);
+		if (rtn != 0) {
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("clock_gettime error waiting to receive on queue\n"));
+			pthread_mutex_unlock (&q->mutex);
+			return LIBPD_QERR_RCV_EXPTIME;
+		}
+		rtn = pthread_cond_timedwait (&q->not_empty_cond, &q->mutex, &ts);
+		if (rtn != 0) {
+			if (rtn == ETIMEDOUT) {
+				pthread_mutex_unlock (&q->mutex);
+				return 1;
+			}
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("pthread_cond_timedwait error waiting for not_empty_cond\n"));
+			pthread_mutex_unlock (&q->mutex);
+			return LIBPD_QERR_RCV_CONDWAIT;
+		}
+	}
+	was_full = false;
+	for (n = 0; n < max_msgs; n++) {
+		msgs[n] = dequeue_msg (q, &was_full);
+		if (NULL == msgs[n])
+			break;
+		if (is_stop_msg (stop_test, msgs[n])) {
+			n++;
+			break;
+		}
+	}
+	*count = n;
+	// more than one slot may have been freed, so wake all senders
+	if (was_full)
+		pthread_cond_broadcast (&q->not_full_cond);
+	pthread_mutex_unlock (&q->mutex);
+	return 0;
+}
+
+int libpd_qreceive_many (libpd_mq_t mq, void **msgs, unsigned max_msgs,
+	unsigned timeout_ms, unsigned *count, int *exterr)
+{
+	return libpd_qreceive_until (mq, msgs, max_msgs, NULL, timeout_ms,
+		count, exterr);
+}
+
+int libpd_qreceive_until (libpd_mq_t mq, void **msgs, unsigned max_msgs,
+	stop_test_func_t *stop_test, unsigned timeout_ms, unsigned *count, 
+	int *exterr)
+{
+	queue_t *q = (queue_t*) mq;
+	int rtn;
+
+	*exterr = 0;
+	*count = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_RCV_NULL;
+	if (0 == max_msgs)
+		return 0;
+	if (NULL != q->ring)
+		rtn = spsc_receive_many (q, msgs, max_msgs, stop_test, timeout_ms, 
+			count, exterr);
+	else
+		rtn = queue_receive_many (q, msgs, max_msgs, stop_test, timeout_ms, 
+			count, exterr);
+	if (rtn == 0)
+		efd_take (q, *count);
+	return rtn;
+}
+
+static int spsc_post (queue_t *q, void *msg, unsigned timeout_ms, int *exterr)
+{
+	struct timespec ts = {0, 0};
+	int rtn;
+
+	pthread_mutex_lock (&q->mutex);
+	while (NULL != q->post_msg) {
+		rtn = get_deadline (timeout_ms, &ts);
+		if (rtn != 0) {
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("clock_gettime error waiting to post to queue\n"));
+			pthread_mutex_unlock (&q->mutex);
+			return LIBPD_QERR_SEND_EXPTIME;
+		}
+		rtn = pthread_cond_timedwait (&q->not_full_cond, &q->mutex, &ts);
+		if (rtn != 0) {
+			pthread_mutex_unlock (&q->mutex);
+			if (rtn == ETIMEDOUT)
+				return 1;
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("pthread_cond_timedwait error waiting to post to queue\n"));
+			return LIBPD_QERR_SEND_CONDWAIT;
+		}
+	}
+	q->post_msg = msg;
+	pthread_cond_signal (&q->not_empty_cond);
+	pthread_mutex_unlock (&q->mutex);
+	return 0;
+}
+
+int libpd_qpost (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr)
+{
+	queue_t *q = (queue_t*) mq;
+	int rtn;
+
+	*exterr = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_SEND_NULL;
+	if (NULL == q->ring)
+		return libpd_qsend (mq, msg, timeout_ms, exterr);
+	efd_post (q);
+	rtn = spsc_post (q, msg, timeout_ms, exterr);
+	if (rtn != 0)
+		efd_take (q, 1);
+	return rtn;
+}
+
+unsigned libpd_qhigh_water (libpd_mq_t mq)
+{
+	if (NULL == mq)
+		return 0;
+	return __atomic_load_n (&((queue_t*) mq)->high_water, __ATOMIC_RELAXED);
+}
+
+int libpd_qfd (libpd_mq_t mq)
+{
+	if (NULL == mq)
+		return -1;
+	return ((queue_t*) mq)->efd;
+}
@@ -18,6 +18,9 @@
 #define  _LIBPARODUS_QUEUES_H
 
 #include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "libparodus_latency.h"
 
 typedef void *libpd_mq_t;
 
@@ -45,6 +48,11 @@ typedef enum {
 	 * unable to allocate q msg array
 	 */
 	LIBPD_QERR_CREATE_ALLOC_2 = -0x1003,
+	/** 
+	 * @brief Error on libpd_qcreate
+	 * invalid options
+	 */
+	LIBPD_QERR_CREATE_INVAL_OPT = -0x1004,
 	/** 
 	 * @brief Error on libpd_qcreate
 	 * unable to create mutex
@@ -60,6 +68,11 @@ typedef enum {
 	 * unable to create not_full cond var
 	 */
 	LIBPD_QERR_CREATE_NFCOND = -0x10C0,
+	/** 
+	 * @brief Error on libpd_qcreate
+	 * unable to create eventfd
+	 */
+	LIBPD_QERR_CREATE_EVENTFD = -0x1100,
 	/** 
 	 * @brief Error on libpd_qsend
 	 */
@@ -69,6 +82,11 @@ typedef enum {
 	 * null queue id provided
 	 */
 	LIBPD_QERR_SEND_NULL = -0x2001,
+	/** 
+	 * @brief Error on libpd_qsend_evict
+	 * not supported on a LIBPD_QOPT_SPSC queue
+	 */
+	LIBPD_QERR_SEND_SPSC = -0x2002,
 	/** 
 	 * @brief Error on libpd_qsend
 	 * error on cond wait
@@ -76,7 +94,7 @@ typedef enum {
 	LIBPD_QERR_SEND_CONDWAIT = -0x2040,
 	/** 
 	 * @brief Error on libpd_qsend
-	 * error on get_expire_time
+	 * error getting the time
 	 */
 	LIBPD_QERR_SEND_EXPTIME = -0x2041,
 	/** 
@@ -95,7 +113,7 @@ typedef enum {
 	LIBPD_QERR_RCV_CONDWAIT = -0x3040,
 	/** 
 	 * @brief Error on libpd_qreceive
-	 * error on get_expire_time
+	 * error getting the time
 	 */
 	LIBPD_QERR_RCV_EXPTIME = -0x3041
 
@@ -115,11 +133,94 @@ typedef enum {
 int libpd_qcreate (libpd_mq_t *mq, const char *queue_name, 
 	unsigned max_msgs, int *exterr);
 
+/**
+ * Queue options for libpd_qcreate_opt
+ *
+ * LIBPD_QOPT_SPSC: single producer / single consumer queue.
+ *   libpd_qsend must only be called from one thread and libpd_qreceive
+ *   from one (other) thread. Messages are passed through a lock-free ring
+ *   and the mutex is only taken when a side has to block.
+ *   Other threads may still send with libpd_qpost.
+ *
+ * LIBPD_QOPT_EVENTFD: keep an eventfd that is readable whenever the
+ *   queue is not empty (see libpd_qfd), so a receiver can wait for
+ *   messages with poll/epoll.
+ */
+#define LIBPD_QOPT_SPSC	1
+#define LIBPD_QOPT_EVENTFD	2
+
+/**
+ * Create a queue with options
+ *
+ * @param mq pointer to receive queue object that must be provided
+ *   to all subsequent API calls.
+ * @param queue_name name of queue
+ * @param max_msgs maximum number of messages queue can hold
+ * @param opts LIBPD_QOPT_ flags
+ * @param exterr extra error info
+ * @return 0 on success, valid libpd_qerror_t (LIBPD_QERR_CREATE_ ...)  otherwise. 
+ */
+int libpd_qcreate_opt (libpd_mq_t *mq, const char *queue_name, 
+	unsigned max_msgs, unsigned opts, int *exterr);
+
+/**
+ * Record latency of msgs sent with libpd_qsend_stamped
+ *
+ * Must be called right after the queue is created, before it is used.
+ *
+ * @param mq queue object
+ * @param wait_hist receives the time each msg waits on the queue
+ * @param e2e_hist receives the time from each msg's origin until it is received
+ * @return 0 on success, LIBPD_QERR_CREATE_ALLOC_2 if out of memory
+ */
+int libpd_qset_latency (libpd_mq_t mq, libpd_lat_hist_t *wait_hist,
+	libpd_lat_hist_t *e2e_hist);
+
+/**
+ * Create a queue with priority lanes
+ *
+ * Each lane holds up to max_msgs messages. libpd_qreceive takes the
+ * oldest message from the highest priority lane (lane 0) that isn't
+ * empty, so a full low priority lane never holds up a higher one.
+ * All lanes share one mutex and wakeup.
+ *
+ * @param mq pointer to receive queue object that must be provided
+ *   to all subsequent API calls.
+ * @param queue_name name of queue
+ * @param max_msgs maximum number of messages each lane can hold
+ * @param num_lanes number of lanes, must be 1 for a LIBPD_QOPT_SPSC queue
+ * @param opts LIBPD_QOPT_ flags
+ * @param exterr extra error info
+ * @return 0 on success, valid libpd_qerror_t (LIBPD_QERR_CREATE_ ...)  otherwise. 
+ */
+int libpd_qcreate_prio (libpd_mq_t *mq, const char *queue_name, 
+	unsigned max_msgs, unsigned num_lanes, unsigned opts, int *exterr);
+
+// sends to the lowest priority lane, whatever the number of lanes
+#define LIBPD_QLANE_LOWEST	((unsigned) -1)
+
 typedef void free_msg_func_t (void *msg);
 
+/**
+ * Remove and free every message on a queue
+ *
+ * The messages are detached from the queue in one critical section
+ * and freed after the queue's lock is released, so senders are not
+ * held up while they are freed, and their latencies are not recorded.
+ * With LIBPD_QOPT_SPSC, only the consumer may drain the queue.
+ *
+ * @param mq queue object
+ * @param free_msg_func pointer to function that frees a message. can be 'free',
+ *   or NULL if the messages are not to be freed
+ * @return the number of messages removed
+ */
+int libpd_qdrain (libpd_mq_t mq, free_msg_func_t *free_msg_func);
+
 /**
  * Destroy queue
  *
+ * Any messages still on the queue are drained (libpd_qdrain) first.
+ *
  * @param mq pointer to queue object
  * @param free_msg_func pointer to function that frees the queue. can be 'free'
  * @return always returns 0
@@ -137,6 +238,84 @@ int libpd_qdestroy (libpd_mq_t *mq, free_msg_func_t *free_msg_func);
  */
 int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr);
 
+/**
+ * Send message on one lane of a queue, recording its latency when it
+ * is received
+ *
+ * libpd_qsend and libpd_qsend_stamped send to the lowest priority lane.
+ *
+ * @param mq queue object
+ * @param msg pointer to message to be sent
+ * @param lane priority lane, 0 is highest. Lanes past the last are
+ *   the last (lowest priority) lane.
+ * @param origin as for libpd_qsend_stamped
+ * @param timeout_ms maximum wait time for message to be placed on the queue
+ * @param exterr extra error info
+ * @return 0 on success, valid libpd_qerror_t (LIBPD_QERR_SEND_ ...)  otherwise. 
+ */
+int libpd_qsend_prio (libpd_mq_t mq, void *msg, unsigned lane, 
+	uint64_t origin, unsigned timeout_ms, int *exterr);
+
+/**
+ * Send message on queue, recording its latency when it is received
+ *
+ * If latency recording is set up (libpd_qset_latency), the time the msg
+ * waits on the queue and the time from origin until it is received are
+ * recorded when it is received. Msgs sent with libpd_qsend or libpd_qpost
+ * are not timed.
+ *
+ * @param mq queue object
+ * @param msg pointer to message to be sent
+ * @param origin time (from libpd_lat_now) the msg's latency is measured
+ *   from, or 0 if the msg should not be timed
+ * @param timeout_ms maximum wait time for message to be placed on the queue
+ * @param exterr extra error info
+ * @return 0 on success, valid libpd_qerror_t (LIBPD_QERR_SEND_ ...)  otherwise. 
+ */
+int libpd_qsend_stamped (libpd_mq_t mq, void *msg, uint64_t origin,
+	unsigned timeout_ms, int *exterr);
+
+typedef bool evict_test_func_t (void *msg);
+
+/**
+ * Send message on queue, evicting a queued message if the queue is full
+ *
+ * Never waits. If the lane is full, the oldest message in the lane that
+ * evict_test returns true for is removed from the queue and returned
+ * in evicted, and msg is placed at the end of the lane.
+ * Not supported on LIBPD_QOPT_SPSC queues, since only the consumer
+ * may take messages off of those.
+ *
+ * @param mq queue object
+ * @param msg pointer to message to be sent
+ * @param lane priority lane, as for libpd_qsend_prio
+ * @param origin as for libpd_qsend_stamped
+ * @param evict_test returns true for queued messages that may be evicted
+ * @param evicted receives the evicted message, which the caller must
+ *   free, or NULL if there was room on the queue
+ * @param exterr extra error info
+ * @return 0 on success, 1 if the queue is full and no message could be
+ *   evicted, valid libpd_qerror_t (LIBPD_QERR_SEND_ ...)  otherwise. 
+ */
+int libpd_qsend_evict (libpd_mq_t mq, void *msg, unsigned lane, uint64_t origin,
+	evict_test_func_t *evict_test, void **evicted, int *exterr);
+
+/**
+ * Send message on queue from a thread that is not the queue's producer
+ *
+ * Same as libpd_qsend for ordinary queues. For a LIBPD_QOPT_SPSC queue,
+ * the message is placed in a single mutex protected slot that the consumer
+ * picks up once the ring is empty.
+ *
+ * @param mq queue object
+ * @param msg pointer to message to be sent
+ * @param timeout_ms maximum wait time for message to be placed on the queue
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out, 
+ *   valid libpd_qerror_t (LIBPD_QERR_SEND_ ...)  otherwise. 
+ */
+int libpd_qpost (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr);
+
 /**
  * Receive message from queue
  *
@@ -149,4 +328,70 @@ int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr);
  */
 int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr);
 
+/**
+ * Receive up to max_msgs messages from queue
+ *
+ * Waits for the first message like libpd_qreceive, then takes
+ * whatever else is on the queue (up to max_msgs) in the same
+ * critical section.
+ *
+ * @param mq queue object  
+ * @param msgs array of at least max_msgs pointers to receive the messages
+ *    these messages must be freed
+ * @param max_msgs maximum number of messages to receive
+ * @param timeout_ms maximum wait time for the first message
+ * @param count receives the number of messages placed in msgs
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out, 
+ *   valid libpd_qerror_t (LIBPD_QERR_RCV_ ...)  otherwise. 
+ */
+int libpd_qreceive_many (libpd_mq_t mq, void **msgs, unsigned max_msgs,
+	unsigned timeout_ms, unsigned *count, int *exterr);
+
+typedef bool stop_test_func_t (void *msg);
+
+/**
+ * Receive up to max_msgs messages from queue, stopping at a message
+ *
+ * The same as libpd_qreceive_many, except that the batch ends with
+ * the first message stop_test returns true for. That message is the
+ * last one placed in msgs, and the messages behind it stay queued.
+ *
+ * @param mq queue object  
+ * @param msgs array of at least max_msgs pointers to receive the messages
+ *    these messages must be freed
+ * @param max_msgs maximum number of messages to receive
+ * @param stop_test returns true for a message that ends the batch,
+ *    or NULL to never stop early
+ * @param timeout_ms maximum wait time for the first message
+ * @param count receives the number of messages placed in msgs
+ * @param exterr extra error info
+ * @return the same as libpd_qreceive_many
+ */
+int libpd_qreceive_until (libpd_mq_t mq, void **msgs, unsigned max_msgs,
+	stop_test_func_t *stop_test, unsigned timeout_ms, unsigned *count, 
+	int *exterr);
+
+/**
+ * Get the eventfd of a queue created with LIBPD_QOPT_EVENTFD
+ *
+ * The fd is readable while the queue is not empty. It is owned by
+ * the queue and closed by libpd_qdestroy. Don't read from it.
+ *
+ * @param mq queue object
+ * @return the eventfd, or -1 if the queue doesn't have one
+ */
+int libpd_qfd (libpd_mq_t mq);
+
+/**
+ * Get the high water mark of a queue
+ *
+ * May be called from any thread.
+ *
+ * @param mq queue object
+ * @return the most msgs that have been on the queue at once
+ *   (not counting a msg from libpd_qpost)
+ */
+unsigned libpd_qhigh_water (libpd_mq_t mq);
+
 #endif
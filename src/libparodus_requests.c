@@ -0,0 +1,538 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "libparodus_requests.h"
+#include "libparodus_time.h"
+#include "libparodus_latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "libparodus_log.h"
+
+#define REQS_INITIAL_BUCKETS 64	// power of 2
+#define REQS_INITIAL_HEAP 16
+
+// request status while it is still in the table
+#define REQ_PENDING -1
+
+struct pending_req {
+	pending_req_t *next;	// hash chain
+	char *uuid;
+	uint32_t hash;
+	uint64_t deadline;	// monotonic ns
+	libpd_response_cb_t *callback;	// NULL for a sync request
+	void *ctx;
+	unsigned heap_index;	// async requests only
+	pthread_cond_t done_cond;	// sync requests only
+	bool held;	// async request not yet passed to libpd_reqs_start
+	int status;
+	wrp_msg_t *resp;
+};
+
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t timer_cond;	// timer thread waits for the next deadline
+	pthread_cond_t idle_cond;	// destroy waits for senders to be done with requests
+	libpd_instance_t instance;
+	void (*free_msg) (libpd_instance_t instance, wrp_msg_t *msg);
+	pending_req_t **buckets;
+	unsigned num_buckets;
+	unsigned count;
+	// async requests, in a min heap by deadline
+	pending_req_t **heap;
+	unsigned heap_len;
+	unsigned heap_size;
+	unsigned sync_count;	// sync requests not yet freed by libpd_reqs_wait
+	unsigned held_count;	// async requests their senders still hold
+	bool closed;
+	bool timer_running;
+	pthread_t timer_tid;
+} reqs_t;
+
+static void *timer_thread (void *arg);
+
+// FNV-1a
+static uint32_t uuid_hash (const char *uuid)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*uuid != '\0') {
+		hash ^= (uint8_t) *uuid++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void ns_to_timespec (uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = (time_t) (ns / 1000000000ULL);
+	ts->tv_nsec = (long) (ns % 1000000000ULL);
+}
+
+const char *libpd_reqs_msg_uuid (wrp_msg_t *msg)
+{
+	switch (msg->msg_type) {
+		case WRP_MSG_TYPE__REQ:
+			return msg->u.req.transaction_uuid;
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			return msg->u.crud.transaction_uuid;
+		default:
+			return NULL;
+	}
+}
+
+int libpd_reqs_create (libpd_reqs_t *reqs, libpd_instance_t instance,
+	void (*free_msg) (libpd_instance_t instance, wrp_msg_t *msg))
+{
+	reqs_t *r = (reqs_t *) calloc (1, sizeof (reqs_t));
+
+	*reqs = NULL;
+	if (NULL == r) {
+		libpd_log (LEVEL_ERROR, ("Unable to allocate request table\n"));
+		return LIBPD_REQERR_CREATE_ALLOC;
+	}
+	r->buckets = (pending_req_t **)
+		calloc (REQS_INITIAL_BUCKETS, sizeof (pending_req_t *));
+	if (NULL == r->buckets) {
+		libpd_log (LEVEL_ERROR, ("Unable to allocate request table\n"));
+		free (r);
+		return LIBPD_REQERR_CREATE_ALLOC;
+	}
+	if (pthread_mutex_init (&r->mutex, NULL) != 0) {
+		free (r->buckets);
+		free (r);
+		return LIBPD_REQERR_CREATE_SYNC;
+	}
+	if (cond_init_monotonic (&r->timer_cond) != 0) {
+		pthread_mutex_destroy (&r->mutex);
+		free (r->buckets);
+		free (r);
+		return LIBPD_REQERR_CREATE_SYNC;
+	}
+	if (pthread_cond_init (&r->idle_cond, NULL) != 0) {
+		pthread_cond_destroy (&r->timer_cond);
+		pthread_mutex_destroy (&r->mutex);
+		free (r->buckets);
+		free (r);
+		return LIBPD_REQERR_CREATE_SYNC;
+	}
+	r->num_buckets = REQS_INITIAL_BUCKETS;
+	r->instance = instance;
+	r->free_msg = free_msg;
+	*reqs = (libpd_reqs_t) r;
+	return 0;
+}
+
+static pending_req_t **find_req (reqs_t *r, const char *uuid, uint32_t hash)
+{
+	pending_req_t **link = &r->buckets[hash & (r->num_buckets - 1)];
+
+	while (NULL != *link) {
+		if (((*link)->hash == hash) && (strcmp ((*link)->uuid, uuid) == 0))
+			break;
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+// doubles the buckets once there are more than 2 requests per bucket.
+// If there isn't memory for it, the chains just get longer.
+static void grow_buckets (reqs_t *r)
+{
+	unsigned i, new_size = r->num_buckets * 2;
+	pending_req_t **new_buckets;
+	pending_req_t *req, *next;
+
+	if (r->count <= (r->num_buckets * 2))
+		return;
+	new_buckets = (pending_req_t **) calloc (new_size, sizeof (pending_req_t *));
+	if (NULL == new_buckets)
+		return;
+	for (i = 0; i < r->num_buckets; i++) {
+		for (req = r->buckets[i]; NULL != req; req = next) {
+			next = req->next;
+			req->next = new_buckets[req->hash & (new_size - 1)];
+			new_buckets[req->hash & (new_size - 1)] = req;
+		}
+	}
+	free (r->buckets);
+	r->buckets = new_buckets;
+	r->num_buckets = new_size;
+}
+
+static void heap_swap (reqs_t *r, unsigned i, unsigned j)
+{
+	pending_req_t *tmp = r->heap[i];
+
+	r->heap[i] = r->heap[j];
+	r->heap[j] = tmp;
+	r->heap[i]->heap_index = i;
+	r->heap[j]->heap_index = j;
+}
+
+static void heap_up (reqs_t *r, unsigned i)
+{
+	unsigned parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (r->heap[parent]->deadline <= r->heap[i]->deadline)
+			break;
+		heap_swap (r, i, parent);
+		i = parent;
+	}
+}
+
+static void heap_down (reqs_t *r, unsigned i)
+{
+	unsigned child;
+
+	while (true) {
+		child = (2 * i) + 1;
+		if (child >= r->heap_len)
+			break;
+		if (((child + 1) < r->heap_len) &&
+		    (r->heap[child + 1]->deadline < r->heap[child]->deadline))
+			child++;
+		if (r->heap[i]->deadline <= r->heap[child]->deadline)
+			break;
+		heap_swap (r, i, child);
+		i = child;
+	}
+}
+
+static bool heap_add (reqs_t *r, pending_req_t *req)
+{
+	unsigned new_size;
+	pending_req_t **new_heap;
+
+	if (r->heap_len == r->heap_size) {
+		new_size = (r->heap_size == 0) ? REQS_INITIAL_HEAP : (r->heap_size * 2);
+		new_heap = (pending_req_t **)
+			realloc (r->heap, new_size * sizeof (pending_req_t *));
+		if (NULL == new_heap)
+			return false;
+		r->heap = new_heap;
+		r->heap_size = new_size;
+	}
+	req->heap_index = r->heap_len;
+	r->heap[r->heap_len++] = req;
+	heap_up (r, req->heap_index);
+	return true;
+}
+
+static void heap_remove (reqs_t *r, pending_req_t *req)
+{
+	unsigned i = req->heap_index;
+	pending_req_t *moved;
+
+	r->heap_len--;
+	if (i == r->heap_len)
+		return;
+	heap_swap (r, i, r->heap_len);
+	moved = r->heap[i];
+	heap_up (r, i);
+	heap_down (r, moved->heap_index);
+}
+
+// takes a request out of the hash table and, if async, the heap.
+// must be called with the mutex held
+static void unlink_req (reqs_t *r, pending_req_t *req)
+{
+	pending_req_t **link = find_req (r, req->uuid, req->hash);
+
+	if (*link == req)
+		*link = req->next;
+	r->count--;
+	if (NULL != req->callback)
+		heap_remove (r, req);
+}
+
+// the sender is done with the table for this request. Called with
+// the mutex held.
+static void sender_done (reqs_t *r, pending_req_t *req)
+{
+	if (NULL == req->callback)
+		r->sync_count--;
+	else
+		r->held_count--;
+	if ((r->sync_count == 0) && (r->held_count == 0))
+		pthread_cond_broadcast (&r->idle_cond);
+}
+
+static void free_req (pending_req_t *req)
+{
+	if (NULL == req->callback)
+		pthread_cond_destroy (&req->done_cond);
+	free (req->uuid);
+	free (req);
+}
+
+int libpd_reqs_add (libpd_reqs_t reqs, const char *uuid, uint32_t timeout_ms,
+	libpd_response_cb_t *callback, void *ctx, pending_req_t **req)
+{
+	reqs_t *r = (reqs_t *) reqs;
+	pending_req_t *new_req;
+	pending_req_t **link;
+	int rtn = 0;
+
+	new_req = (pending_req_t *) calloc (1, sizeof (pending_req_t));
+	if (NULL == new_req)
+		return LIBPD_REQERR_ADD_ALLOC;
+	new_req->uuid = strdup (uuid);
+	if (NULL == new_req->uuid) {
+		free (new_req);
+		return LIBPD_REQERR_ADD_ALLOC;
+	}
+	if ((NULL == callback) && (cond_init_monotonic (&new_req->done_cond) != 0)) {
+		free (new_req->uuid);
+		free (new_req);
+		return LIBPD_REQERR_ADD_COND;
+	}
+	new_req->hash = uuid_hash (uuid);
+	new_req->deadline = libpd_lat_now () + ((uint64_t) timeout_ms * 1000000ULL);
+	new_req->callback = callback;
+	new_req->ctx = ctx;
+	new_req->status = REQ_PENDING;
+	new_req->held = (NULL != callback);
+
+	pthread_mutex_lock (&r->mutex);
+	link = find_req (r, uuid, new_req->hash);
+	if (r->closed)
+		rtn = LIBPD_REQERR_ADD_CLOSED;
+	else if (NULL != *link)
+		rtn = LIBPD_REQERR_ADD_DUP;
+	else if ((NULL != callback) && !r->timer_running) {
+		if (pthread_create (&r->timer_tid, NULL, timer_thread, r) != 0)
+			rtn = LIBPD_REQERR_ADD_THREAD;
+		else
+			r->timer_running = true;
+	}
+	if ((rtn == 0) && (NULL != callback) && !heap_add (r, new_req))
+		rtn = LIBPD_REQERR_ADD_ALLOC;
+	if (rtn != 0) {
+		pthread_mutex_unlock (&r->mutex);
+		free_req (new_req);
+		return rtn;
+	}
+	*link = new_req;
+	r->count++;
+	if (NULL == callback)
+		r->sync_count++;
+	else {
+		r->held_count++;
+		if (new_req->heap_index == 0)
+			pthread_cond_signal (&r->timer_cond);	// new earliest deadline
+	}
+	grow_buckets (r);
+	pthread_mutex_unlock (&r->mutex);
+	*req = new_req;
+	return 0;
+}
+
+int libpd_reqs_wait (libpd_reqs_t reqs, pending_req_t *req, wrp_msg_t **resp)
+{
+	reqs_t *r = (reqs_t *) reqs;
+	struct timespec ts;
+	int rtn;
+
+	ns_to_timespec (req->deadline, &ts);
+	pthread_mutex_lock (&r->mutex);
+	while (req->status == REQ_PENDING) {
+		rtn = pthread_cond_timedwait (&req->done_cond, &r->mutex, &ts);
+		if ((rtn != 0) && (req->status == REQ_PENDING)) {
+			if (rtn != ETIMEDOUT) {
+				libpd_log_err (LEVEL_ERROR, rtn,
+					("Error waiting for response to %s\n", req->uuid));
+			}
+			unlink_req (r, req);
+			req->status = 1;
+		}
+	}
+	rtn = req->status;
+	*resp = req->resp;
+	sender_done (r, req);
+	pthread_mutex_unlock (&r->mutex);
+	free_req (req);
+	return rtn;
+}
+
+// Completes an async request, unless its sender still holds it, in which
+// case libpd_reqs_start or libpd_reqs_cancel will. Called with the mutex
+// held and the request already unlinked; returns with the mutex released.
+static void complete_async (reqs_t *r, pending_req_t *req)
+{
+	if (req->held) {
+		pthread_mutex_unlock (&r->mutex);
+		return;
+	}
+	pthread_mutex_unlock (&r->mutex);
+	(*req->callback) (r->instance, req->status, req->resp, req->ctx);
+	free_req (req);
+}
+
+void libpd_reqs_start (libpd_reqs_t reqs, pending_req_t *req)
+{
+	reqs_t *r = (reqs_t *) reqs;
+	libpd_instance_t instance = r->instance;
+
+	pthread_mutex_lock (&r->mutex);
+	req->held = false;
+	// once closed, destroy has already taken the request out with a
+	// status of 2, and waits for this call before freeing the table
+	if (!r->closed && (req->status == REQ_PENDING)) {
+		sender_done (r, req);
+		pthread_mutex_unlock (&r->mutex);
+		return;
+	}
+	// completed, timed out or closed while the sender held it.
+	// Still counted as held, so destroy waits for the callback.
+	pthread_mutex_unlock (&r->mutex);
+	(*req->callback) (instance, req->status, req->resp, req->ctx);
+	pthread_mutex_lock (&r->mutex);
+	sender_done (r, req);
+	pthread_mutex_unlock (&r->mutex);
+	free_req (req);
+}
+
+void libpd_reqs_cancel (libpd_reqs_t reqs, pending_req_t *req)
+{
+	reqs_t *r = (reqs_t *) reqs;
+
+	pthread_mutex_lock (&r->mutex);
+	if (req->status == REQ_PENDING)
+		unlink_req (r, req);
+	sender_done (r, req);
+	pthread_mutex_unlock (&r->mutex);
+	if ((NULL != req->resp) && (NULL != r->free_msg))
+		(*r->free_msg) (r->instance, req->resp);
+	free_req (req);
+}
+
+bool libpd_reqs_complete (libpd_reqs_t reqs, wrp_msg_t *msg)
+{
+	reqs_t *r = (reqs_t *) reqs;
+	const char *uuid = libpd_reqs_msg_uuid (msg);
+	pending_req_t *req;
+	uint32_t hash;
+
+	if ((NULL == r) || (NULL == uuid))
+		return false;
+	hash = uuid_hash (uuid);
+	pthread_mutex_lock (&r->mutex);
+	if (r->count == 0) {
+		pthread_mutex_unlock (&r->mutex);
+		return false;
+	}
+	req = *find_req (r, uuid, hash);
+	if (NULL == req) {
+		pthread_mutex_unlock (&r->mutex);
+		return false;
+	}
+	unlink_req (r, req);
+	req->status = 0;
+	req->resp = msg;
+	if (NULL == req->callback) {
+		pthread_cond_signal (&req->done_cond);
+		pthread_mutex_unlock (&r->mutex);
+		return true;
+	}
+	complete_async (r, req);
+	return true;
+}
+
+static void *timer_thread (void *arg)
+{
+	reqs_t *r = (reqs_t *) arg;
+	pending_req_t *req;
+	struct timespec ts;
+
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Starting request timer thread\n"));
+	pthread_mutex_lock (&r->mutex);
+	while (!r->closed) {
+		if (r->heap_len == 0) {
+			pthread_cond_wait (&r->timer_cond, &r->mutex);
+			continue;
+		}
+		req = r->heap[0];
+		if (req->deadline > libpd_lat_now ()) {
+			ns_to_timespec (req->deadline, &ts);
+			pthread_cond_timedwait (&r->timer_cond, &r->mutex, &ts);
+			continue;
+		}
+		unlink_req (r, req);
+		req->status = 1;
+		complete_async (r, req);
+		pthread_mutex_lock (&r->mutex);
+	}
+	pthread_mutex_unlock (&r->mutex);
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Ended request timer thread\n"));
+	return NULL;
+}
+
+void libpd_reqs_destroy (libpd_reqs_t *reqs)
+{
+	reqs_t *r = (reqs_t *) *reqs;
+	pending_req_t *closed_list = NULL;
+	pending_req_t *req;
+	unsigned i;
+
+	if (NULL == r)
+		return;
+	pthread_mutex_lock (&r->mutex);
+	r->closed = true;
+	for (i = 0; i < r->num_buckets; i++) {
+		while (NULL != (req = r->buckets[i])) {
+			unlink_req (r, req);
+			req->status = 2;
+			if (NULL == req->callback) {
+				pthread_cond_signal (&req->done_cond);
+			} else if (!req->held) {
+				req->next = closed_list;
+				closed_list = req;
+			}
+			// a held request gets its callback, with status 2,
+			// from libpd_reqs_start
+		}
+	}
+	pthread_cond_signal (&r->timer_cond);
+	pthread_mutex_unlock (&r->mutex);
+
+	while (NULL != closed_list) {
+		req = closed_list;
+		closed_list = req->next;
+		(*req->callback) (r->instance, 2, NULL, req->ctx);
+		free_req (req);
+	}
+	pthread_mutex_lock (&r->mutex);
+	while ((r->sync_count > 0) || (r->held_count > 0))
+		pthread_cond_wait (&r->idle_cond, &r->mutex);
+	pthread_mutex_unlock (&r->mutex);
+	if (r->timer_running)
+		pthread_join (r->timer_tid, NULL);
+	pthread_cond_destroy (&r->idle_cond);
+	pthread_cond_destroy (&r->timer_cond);
+	pthread_mutex_destroy (&r->mutex);
+	free (r->heap);
+	free (r->buckets);
+	free (r);
+	*reqs = NULL;
+}
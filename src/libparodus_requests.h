@@ -0,0 +1,168 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_REQUESTS_H
+#define  _LIBPARODUS_REQUESTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "libparodus.h"
+
+/*
+ * Table of requests waiting for a response, keyed by transaction_uuid.
+ *
+ * The wrp receiver thread hands each received msg to libpd_reqs_complete,
+ * which looks it up in a hash table and completes the request directly,
+ * so responses never go through the receive queue. Sync requests
+ * wait on a cond var of their own, async requests are timed out by a
+ * timer thread that is started with the first one.
+ */
+
+typedef void *libpd_reqs_t;
+typedef struct pending_req pending_req_t;
+
+/**
+ * @brief request table error rtn codes
+ *
+ */
+typedef enum {
+	/**
+	 * @brief Error on libpd_reqs_create
+	 * unable to allocate table
+	 */
+	LIBPD_REQERR_CREATE_ALLOC = -0x8001,
+	/**
+	 * @brief Error on libpd_reqs_create
+	 * unable to create mutex or cond var
+	 */
+	LIBPD_REQERR_CREATE_SYNC = -0x8040,
+	/**
+	 * @brief Error on libpd_reqs_add
+	 * table has been closed
+	 */
+	LIBPD_REQERR_ADD_CLOSED = -0x8101,
+	/**
+	 * @brief Error on libpd_reqs_add
+	 * a request with the same transaction_uuid is pending
+	 */
+	LIBPD_REQERR_ADD_DUP = -0x8102,
+	/**
+	 * @brief Error on libpd_reqs_add
+	 * unable to allocate request
+	 */
+	LIBPD_REQERR_ADD_ALLOC = -0x8103,
+	/**
+	 * @brief Error on libpd_reqs_add
+	 * unable to create cond var
+	 */
+	LIBPD_REQERR_ADD_COND = -0x8140,
+	/**
+	 * @brief Error on libpd_reqs_add
+	 * unable to create timer thread
+	 */
+	LIBPD_REQERR_ADD_THREAD = -0x8180
+} libpd_reqerror_t;
+
+/**
+ * Create a request table
+ *
+ * @param reqs receives the table
+ * @param instance passed to response callbacks
+ * @param free_msg frees a response nobody is waiting for any more
+ * @return 0 on success, valid libpd_reqerror_t otherwise.
+ */
+int libpd_reqs_create (libpd_reqs_t *reqs, libpd_instance_t instance,
+	void (*free_msg) (libpd_instance_t instance, wrp_msg_t *msg));
+
+/**
+ * Add a pending request, before sending it
+ *
+ * @param reqs request table
+ * @param uuid transaction_uuid of the request, copied
+ * @param timeout_ms how long to wait for the response
+ * @param callback called with the response, or NULL for a sync request
+ *   that is waited on with libpd_reqs_wait
+ * @param ctx passed to callback
+ * @param req receives the pending request
+ * @return 0 on success, valid libpd_reqerror_t otherwise.
+ */
+int libpd_reqs_add (libpd_reqs_t reqs, const char *uuid, uint32_t timeout_ms,
+	libpd_response_cb_t *callback, void *ctx, pending_req_t **req);
+
+/**
+ * Start waiting for the response to an async request, once it has been sent
+ *
+ * Until then the callback isn't called, even if the response arrives,
+ * the request times out or the table is destroyed, so that
+ * libpd_reqs_cancel can still be used if the send fails. If any of
+ * those has happened, the callback is called from here.
+ *
+ * @param reqs request table
+ * @param req request from libpd_reqs_add
+ */
+void libpd_reqs_start (libpd_reqs_t reqs, pending_req_t *req);
+
+/**
+ * Wait for the response to a sync request, then free the request
+ *
+ * @param reqs request table
+ * @param req request from libpd_reqs_add
+ * @param resp receives the response
+ * @return 0 if the response was received, 1 if timed out,
+ *   2 if the table was closed
+ */
+int libpd_reqs_wait (libpd_reqs_t reqs, pending_req_t *req, wrp_msg_t **resp);
+
+/**
+ * Remove a request that could not be sent, without completing it
+ * or calling its callback
+ *
+ * @param reqs request table
+ * @param req request from libpd_reqs_add
+ */
+void libpd_reqs_cancel (libpd_reqs_t reqs, pending_req_t *req);
+
+/**
+ * Complete the request a received msg is the response to, if any
+ *
+ * @param reqs request table
+ * @param msg received msg
+ * @return true if msg was a response, in which case the request
+ *   now owns it, false otherwise
+ */
+bool libpd_reqs_complete (libpd_reqs_t reqs, wrp_msg_t *msg);
+
+/**
+ * Destroy a request table
+ *
+ * Pending requests are completed with a status of 2 (closed), async
+ * ones by calling their callback before they are freed. Waits for sync
+ * requests to stop waiting, for async requests still held by their
+ * senders to be started or cancelled, and for the timer thread to end.
+ *
+ * @param reqs request table, set to NULL
+ */
+void libpd_reqs_destroy (libpd_reqs_t *reqs);
+
+/**
+ * Get the transaction_uuid of a wrp msg
+ *
+ * @param msg wrp msg
+ * @return the uuid, or NULL if the msg type doesn't have one
+ */
+const char *libpd_reqs_msg_uuid (wrp_msg_t *msg);
+
+#endif
@@ -0,0 +1,226 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "libparodus_routes.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "libparodus_log.h"
+
+typedef struct route {
+	libpd_msg_handler_t *handler;	// set last, NULL until then
+	void *ctx;
+} route_t;
+
+typedef struct route_node {
+	struct route_node *children;	// newest first
+	struct route_node *sibling;
+	char *segment;
+	size_t seg_len;
+	route_t exact;	// the path ends here
+	route_t rest;	// "*", the path continues past here
+} route_node_t;
+
+typedef struct {
+	pthread_mutex_t add_mutex;	// serializes libpd_routes_add
+	route_node_t root;
+} routes_t;
+
+int libpd_routes_create (libpd_routes_t *routes)
+{
+	routes_t *r = (routes_t *) calloc (1, sizeof (routes_t));
+
+	*routes = NULL;
+	if (NULL == r) {
+		libpd_log (LEVEL_ERROR, ("Unable to allocate route table\n"));
+		return LIBPD_ROUTEERR_ALLOC;
+	}
+	pthread_mutex_init (&r->add_mutex, NULL);
+	*routes = (libpd_routes_t) r;
+	return 0;
+}
+
+// gets the next segment of path, skipping empty ones.
+// returns false at the end of path.
+static bool next_segment (const char **path, const char *end,
+	const char **seg, size_t *seg_len)
+{
+	const char *p = *path;
+	const char *slash;
+
+	while ((p < end) && (*p == '/'))
+		p++;
+	if (p >= end)
+		return false;
+	slash = (const char *) memchr (p, '/', end - p);
+	if (NULL == slash)
+		slash = end;
+	*seg = p;
+	*seg_len = slash - p;
+	*path = slash;
+	return true;
+}
+
+static route_node_t *find_child (route_node_t *node, const char *seg,
+	size_t seg_len)
+{
+	route_node_t *child = __atomic_load_n (&node->children, __ATOMIC_ACQUIRE);
+
+	for (; NULL != child; child = child->sibling) {
+		if ((child->seg_len == seg_len) &&
+		    (memcmp (child->segment, seg, seg_len) == 0))
+			return child;
+	}
+	return NULL;
+}
+
+static route_node_t *add_child (route_node_t *node, const char *seg,
+	size_t seg_len)
+{
+	route_node_t *child = (route_node_t *) calloc (1, sizeof (route_node_t));
+
+	if (NULL == child)
+		return NULL;
+	child->segment = (char *) malloc (seg_len + 1);
+	if (NULL == child->segment) {
+		free (child);
+		return NULL;
+	}
+	memcpy (child->segment, seg, seg_len);
+	child->segment[seg_len] = '\0';
+	child->seg_len = seg_len;
+	child->sibling = node->children;
+	__atomic_store_n (&node->children, child, __ATOMIC_RELEASE);
+	return child;
+}
+
+static void set_route (route_t *route, libpd_msg_handler_t *handler, void *ctx)
+{
+	route->ctx = ctx;
+	__atomic_store_n (&route->handler, handler, __ATOMIC_RELEASE);
+}
+
+static libpd_msg_handler_t *get_route (route_t *route, void **ctx)
+{
+	libpd_msg_handler_t *handler =
+		__atomic_load_n (&route->handler, __ATOMIC_ACQUIRE);
+
+	if (NULL != handler)
+		*ctx = route->ctx;
+	return handler;
+}
+
+int libpd_routes_add (libpd_routes_t routes, const char *path,
+	libpd_msg_handler_t *handler, void *ctx)
+{
+	routes_t *r = (routes_t *) routes;
+	const char *end, *seg;
+	size_t seg_len;
+	route_node_t *node, *child;
+	route_t *route = NULL;
+	int rtn = 0;
+
+	if ((NULL == path) || (NULL == handler))
+		return LIBPD_ROUTEERR_PATH;
+	end = path + strlen (path);
+	pthread_mutex_lock (&r->add_mutex);
+	node = &r->root;
+	while (next_segment (&path, end, &seg, &seg_len)) {
+		if ((seg_len == 1) && (seg[0] == '*')) {
+			// "*" must be the last segment
+			if (next_segment (&path, end, &seg, &seg_len))
+				rtn = LIBPD_ROUTEERR_PATH;
+			else
+				route = &node->rest;
+			break;
+		}
+		child = find_child (node, seg, seg_len);
+		if (NULL == child)
+			child = add_child (node, seg, seg_len);
+		if (NULL == child) {
+			rtn = LIBPD_ROUTEERR_ALLOC;
+			break;
+		}
+		node = child;
+	}
+	if ((rtn == 0) && (NULL == route))
+		route = &node->exact;
+	if ((rtn == 0) && (NULL != route->handler))
+		rtn = LIBPD_ROUTEERR_DUP;
+	if (rtn == 0)
+		set_route (route, handler, ctx);
+	pthread_mutex_unlock (&r->add_mutex);
+	return rtn;
+}
+
+libpd_msg_handler_t *libpd_routes_find (libpd_routes_t routes,
+	const char *path, size_t len, void **ctx)
+{
+	routes_t *r = (routes_t *) routes;
+	const char *end = path + len;
+	const char *seg;
+	size_t seg_len;
+	route_node_t *node;
+	libpd_msg_handler_t *handler, *rest_handler = NULL;
+	void *rest_ctx = NULL;
+
+	if (NULL == r)
+		return NULL;
+	node = &r->root;
+	while (next_segment (&path, end, &seg, &seg_len)) {
+		// remember the longest "*" route that covers the rest of the path
+		handler = get_route (&node->rest, &rest_ctx);
+		if (NULL != handler)
+			rest_handler = handler;
+		node = find_child (node, seg, seg_len);
+		if (NULL == node)
+			break;
+	}
+	if (NULL != node) {
+		handler = get_route (&node->exact, ctx);
+		if (NULL != handler)
+			return handler;
+	}
+	if (NULL != rest_handler)
+		*ctx = rest_ctx;
+	return rest_handler;
+}
+
+static void free_nodes (route_node_t *node)
+{
+	route_node_t *child, *next;
+
+	for (child = node->children; NULL != child; child = next) {
+		next = child->sibling;
+		free_nodes (child);
+		free (child->segment);
+		free (child);
+	}
+}
+
+void libpd_routes_destroy (libpd_routes_t *routes)
+{
+	routes_t *r = (routes_t *) *routes;
+
+	if (NULL == r)
+		return;
+	free_nodes (&r->root);
+	pthread_mutex_destroy (&r->add_mutex);
+	free (r);
+	*routes = NULL;
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_ROUTES_H
+#define  _LIBPARODUS_ROUTES_H
+
+#include <stddef.h>
+#include "libparodus.h"
+
+/*
+ * Route table: a trie of the '/' separated segments of the dest path
+ * that follows the service name, so finding the handler for a msg
+ * takes one step per path segment however many routes there are.
+ *
+ * Routes are only ever added, and a node is fully built before it is
+ * linked into the trie, so libpd_routes_find doesn't take a lock and
+ * can run while routes are being added.
+ */
+
+typedef void *libpd_routes_t;
+
+/**
+ * @brief route table error rtn codes
+ *
+ */
+typedef enum {
+	/**
+	 * @brief Error on libpd_routes_create or libpd_routes_add
+	 * unable to allocate memory
+	 */
+	LIBPD_ROUTEERR_ALLOC = -0x4001,
+	/**
+	 * @brief Error on libpd_routes_add
+	 * invalid path
+	 */
+	LIBPD_ROUTEERR_PATH = -0x4002,
+	/**
+	 * @brief Error on libpd_routes_add
+	 * path already has a route
+	 */
+	LIBPD_ROUTEERR_DUP = -0x4003
+} libpd_routeerror_t;
+
+/**
+ * Create an empty route table
+ *
+ * @param routes receives the table
+ * @return 0 on success, valid libpd_routeerror_t otherwise.
+ */
+int libpd_routes_create (libpd_routes_t *routes);
+
+/**
+ * Add a route
+ *
+ * @param routes route table
+ * @param path '/' separated segments, with an optional leading '/'.
+ *   A last segment of "*" matches one or more segments, so "/config/"
+ *   then "*" matches "config/wifi" and "config/wifi/ssid" but not "config",
+ *   and a path of just "*" matches every non empty path.
+ *   "/" matches an empty path.
+ * @param handler called with each msg the route matches
+ * @param ctx passed to handler
+ * @return 0 on success, valid libpd_routeerror_t otherwise.
+ */
+int libpd_routes_add (libpd_routes_t routes, const char *path,
+	libpd_msg_handler_t *handler, void *ctx);
+
+/**
+ * Find the route for a dest path
+ *
+ * An exact route wins over a "*" route, and a longer "*" route wins
+ * over a shorter one.
+ *
+ * @param routes route table, may be NULL
+ * @param path dest path following the service name
+ * @param len length of path
+ * @param ctx receives the ctx of the route
+ * @return the handler, or NULL if no route matches
+ */
+libpd_msg_handler_t *libpd_routes_find (libpd_routes_t routes,
+	const char *path, size_t len, void **ctx);
+
+/**
+ * Destroy a route table
+ *
+ * @param routes route table, set to NULL
+ */
+void libpd_routes_destroy (libpd_routes_t *routes);
+
+#endif
@@ -0,0 +1,489 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "libparodus_shm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <nanomsg/nn.h>
+#include "libparodus_log.h"
+
+/*
+ * Segment layout: a header page, then the up ring, then the down ring.
+ *
+ * A ring is a run of records, each a uint32_t length followed by the
+ * msg bytes, padded to 4 bytes. A record never wraps; if it doesn't
+ * fit before the end of the ring, the producer writes WRAP_MARK and
+ * starts it over at the beginning. head and tail count bytes, and run
+ * on past the ring size, so head - tail is the number of bytes in use.
+ *
+ * A msg too big for one record is sent as fragments, each record but
+ * the last with REC_MORE set in its length. The first fragment starts
+ * with the uint32_t length of the whole msg, so the consumer can
+ * allocate the msg once and copy each fragment in as it is taken.
+ *
+ * The producer only writes head, and the consumer only writes tail.
+ * Each also sets its waiting flag before it sleeps on the other's
+ * counter, and only then checks the counter again, so a side that
+ * moves its counter and then sees the flag clear knows there is
+ * nobody to wake.
+ */
+
+#define SHM_MAGIC 0x4c504453
+#define SHM_VERSION 2
+#define SHM_CACHE_LINE 64
+#define SHM_HDR_SIZE 0x1000
+#define WRAP_MARK 0xFFFFFFFFu
+#define REC_HDR_SIZE 4u
+#define REC_MORE 0x80000000u	// a fragment, with more of the msg to follow
+#define REC_ALIGN(n) (((n) + 3u) & ~3u)
+
+// longest futex wait, so a waiter sees a close that raced with its wait
+#define SHM_CLOSE_CHECK_MS 200
+
+typedef struct {
+	uint32_t head;	// bytes produced
+	char pad1[SHM_CACHE_LINE - 4];
+	uint32_t tail;	// bytes consumed
+	char pad2[SHM_CACHE_LINE - 4];
+	uint32_t rd_waiting;	// consumer is waiting on head
+	uint32_t wr_waiting;	// producer is waiting on tail
+	char pad3[SHM_CACHE_LINE - 8];
+} shm_ring_hdr_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ring_size;
+	uint32_t closed;
+	char pad[SHM_CACHE_LINE - 16];
+	shm_ring_hdr_t rings[2];
+} shm_seg_hdr_t;
+
+// a fragmented msg the consumer has taken part of
+typedef struct {
+	unsigned char *buf;	// from nn_allocmsg, NULL if none
+	uint32_t len;		// length of the whole msg
+	uint32_t got;		// bytes taken so far
+} shm_frag_t;
+
+typedef struct {
+	shm_seg_hdr_t *hdr;
+	unsigned char *data[2];
+	shm_frag_t frag[2];
+	size_t map_size;
+	uint32_t ring_size;
+	int fd;
+	char path[48];
+} shm_t;
+
+static uint64_t now_ms (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static bool valid_ring_size (uint32_t ring_size)
+{
+	return (ring_size >= LIBPD_SHM_MIN_RING_SIZE) &&
+		(ring_size <= LIBPD_SHM_MAX_RING_SIZE) &&
+		((ring_size & (ring_size - 1)) == 0);
+}
+
+static size_t seg_size (uint32_t ring_size)
+{
+	return SHM_HDR_SIZE + (2 * (size_t) ring_size);
+}
+
+// maps fd, which the new shm takes over
+static int map_seg (shm_t *s, int fd, size_t map_size, int *oserr)
+{
+	void *base = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (MAP_FAILED == base) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to map shm segment\n"));
+		return LIBPD_SHMERR_MAP;
+	}
+	s->hdr = (shm_seg_hdr_t *) base;
+	s->map_size = map_size;
+	s->fd = fd;
+	return 0;
+}
+
+static void set_rings (shm_t *s, uint32_t ring_size)
+{
+	s->ring_size = ring_size;
+	s->data[LIBPD_SHM_UP] = (unsigned char *) s->hdr + SHM_HDR_SIZE;
+	s->data[LIBPD_SHM_DOWN] = s->data[LIBPD_SHM_UP] + ring_size;
+}
+
+int libpd_shm_create (libpd_shm_t *shm, unsigned ring_size, int *oserr)
+{
+	shm_t *s;
+	int fd, err;
+
+	*shm = NULL;
+	*oserr = 0;
+	if (!valid_ring_size (ring_size)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid shm ring size %u\n", ring_size));
+		return LIBPD_SHMERR_CREATE_INVAL_SZ;
+	}
+	s = (shm_t *) calloc (1, sizeof (shm_t));
+	if (NULL == s) {
+		*oserr = ENOMEM;
+		return LIBPD_SHMERR_ALLOC;
+	}
+	fd = memfd_create (LIBPD_SHM_NAME, MFD_CLOEXEC);
+	if (fd < 0) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to create shm segment\n"));
+		free (s);
+		return LIBPD_SHMERR_CREATE_MEMFD;
+	}
+	if (ftruncate (fd, (off_t) seg_size (ring_size)) != 0) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to size shm segment\n"));
+		close (fd);
+		free (s);
+		return LIBPD_SHMERR_CREATE_MEMFD;
+	}
+	err = map_seg (s, fd, seg_size (ring_size), oserr);
+	if (err != 0) {
+		close (fd);
+		free (s);
+		return err;
+	}
+	// the new pages are all zero, so only the header needs filling in
+	s->hdr->ring_size = ring_size;
+	s->hdr->version = SHM_VERSION;
+	__atomic_store_n (&s->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+	set_rings (s, ring_size);
+	sprintf (s->path, "/proc/%d/fd/%d", (int) getpid (), fd);
+	*shm = (libpd_shm_t) s;
+	return 0;
+}
+
+int libpd_shm_open (libpd_shm_t *shm, const char *path, int *oserr)
+{
+	shm_t *s;
+	struct stat st;
+	uint32_t ring_size;
+	int fd, err;
+
+	*shm = NULL;
+	*oserr = 0;
+	if (strlen (path) >= sizeof (s->path)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid shm path %s\n", path));
+		return LIBPD_SHMERR_OPEN_INVAL;
+	}
+	fd = open (path, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to open shm segment %s\n", path));
+		return LIBPD_SHMERR_OPEN;
+	}
+	if ((fstat (fd, &st) != 0) || (st.st_size < SHM_HDR_SIZE)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not a shm segment: %s\n", path));
+		close (fd);
+		return LIBPD_SHMERR_OPEN_INVAL;
+	}
+	s = (shm_t *) calloc (1, sizeof (shm_t));
+	if (NULL == s) {
+		close (fd);
+		*oserr = ENOMEM;
+		return LIBPD_SHMERR_ALLOC;
+	}
+	err = map_seg (s, fd, (size_t) st.st_size, oserr);
+	if (err != 0) {
+		close (fd);
+		free (s);
+		return err;
+	}
+	ring_size = s->hdr->ring_size;
+	if ((__atomic_load_n (&s->hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) ||
+	    (s->hdr->version != SHM_VERSION) || !valid_ring_size (ring_size) ||
+	    (seg_size (ring_size) != (size_t) st.st_size)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not a shm segment: %s\n", path));
+		munmap (s->hdr, s->map_size);
+		close (fd);
+		free (s);
+		return LIBPD_SHMERR_OPEN_INVAL;
+	}
+	set_rings (s, ring_size);
+	strcpy (s->path, path);
+	*shm = (libpd_shm_t) s;
+	return 0;
+}
+
+const char *libpd_shm_path (libpd_shm_t shm)
+{
+	return ((shm_t *) shm)->path;
+}
+
+unsigned libpd_shm_max_msg (libpd_shm_t shm)
+{
+	return (((shm_t *) shm)->ring_size / 2) - REC_HDR_SIZE;
+}
+
+bool libpd_shm_is_closed (libpd_shm_t shm)
+{
+	return __atomic_load_n (&((shm_t *) shm)->hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+static void futex_wait (uint32_t *word, uint32_t val, uint64_t ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t) (ms / 1000);
+	ts.tv_nsec = (long) (ms % 1000) * 1000000L;
+	// EAGAIN (word already changed), EINTR and ETIMEDOUT all just
+	// send the caller back to check again
+	syscall (SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void futex_wake (uint32_t *word, int count)
+{
+	syscall (SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+// Moves our counter, and wakes the other side if it is waiting on it.
+static void publish (uint32_t *word, uint32_t val, uint32_t *waiting)
+{
+	__atomic_store_n (word, val, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (waiting, __ATOMIC_SEQ_CST) != 0)
+		futex_wake (word, 1);
+}
+
+// Waits for the other side to move its counter off of val.
+// Returns 1 if the deadline has passed, else 0 to check again.
+static int wait_move (shm_t *s, uint32_t *word, uint32_t val,
+	uint32_t *waiting, uint64_t deadline)
+{
+	uint64_t now = now_ms ();
+
+	if (now >= deadline)
+		return 1;
+	__atomic_store_n (waiting, 1, __ATOMIC_SEQ_CST);
+	if ((__atomic_load_n (word, __ATOMIC_SEQ_CST) == val) &&
+	    !libpd_shm_is_closed ((libpd_shm_t) s))
+		futex_wait (word, val, (deadline - now < SHM_CLOSE_CHECK_MS) ?
+			deadline - now : SHM_CLOSE_CHECK_MS);
+	__atomic_store_n (waiting, 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+// Copies one record, pre followed by msg, into a ring, waiting until
+// deadline for room. flags are or'ed into the record length.
+static int put_record (shm_t *s, libpd_shm_ring_t ring, uint32_t flags,
+	const void *pre, uint32_t pre_len, const void *msg, uint32_t len,
+	uint64_t deadline)
+{
+	shm_ring_hdr_t *r = &s->hdr->rings[ring];
+	unsigned char *data = s->data[ring];
+	uint32_t size = s->ring_size;
+	uint32_t head, tail, pos, rec, skip;
+	uint32_t rec_word = (pre_len + len) | flags;
+
+	head = __atomic_load_n (&r->head, __ATOMIC_RELAXED);
+	pos = head & (size - 1);
+	rec = REC_HDR_SIZE + REC_ALIGN (pre_len + len);
+	skip = ((size - pos) < rec) ? (size - pos) : 0;
+	while (true) {
+		if (libpd_shm_is_closed ((libpd_shm_t) s))
+			return LIBPD_SHMERR_CLOSED;
+		tail = __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE);
+		if ((size - (head - tail)) >= (skip + rec))
+			break;
+		if (wait_move (s, &r->tail, tail, &r->wr_waiting, deadline) == 1)
+			return 1;
+	}
+	if (skip != 0) {
+		memcpy (data + pos, &(uint32_t) {WRAP_MARK}, REC_HDR_SIZE);
+		pos = 0;
+	}
+	memcpy (data + pos, &rec_word, REC_HDR_SIZE);
+	if (pre_len > 0)
+		memcpy (data + pos + REC_HDR_SIZE, pre, pre_len);
+	memcpy (data + pos + REC_HDR_SIZE + pre_len, msg, len);
+	publish (&r->head, head + skip + rec, &r->rd_waiting);
+	return 0;
+}
+
+int libpd_shm_send (libpd_shm_t shm, libpd_shm_ring_t ring,
+	const void *msg, unsigned len, uint32_t timeout_ms)
+{
+	shm_t *s = (shm_t *) shm;
+	const unsigned char *p = (const unsigned char *) msg;
+	uint32_t max = libpd_shm_max_msg (shm);
+	uint32_t total = (uint32_t) len;
+	uint32_t chunk;
+	uint64_t deadline = now_ms () + timeout_ms;
+	int rtn;
+
+	if (len > LIBPD_SHM_MAX_MSG)
+		return LIBPD_SHMERR_TOO_BIG;
+	if (len <= max)
+		return put_record (s, ring, 0, NULL, 0, msg, len, deadline);
+
+	chunk = max - sizeof (total);
+	rtn = put_record (s, ring, REC_MORE, &total, sizeof (total), p, chunk,
+		deadline);
+	if (rtn != 0)
+		return rtn;	// nothing sent yet
+	p += chunk;
+	len -= chunk;
+	while (len > 0) {
+		chunk = (len > max) ? max : len;
+		len -= chunk;
+		rtn = put_record (s, ring, (len > 0) ? REC_MORE : 0, NULL, 0,
+			p, chunk, deadline);
+		if (rtn != 0) {
+			// the consumer has part of the msg, and there is no way to
+			// tell it to drop that, so the segment is done for
+			libpd_log (LEVEL_ERROR, ("LIBPARODUS: shm ring stalled mid msg, closing\n"));
+			libpd_shm_close (shm);
+			return LIBPD_SHMERR_CLOSED;
+		}
+		p += chunk;
+	}
+	return 0;
+}
+
+static void drop_frag (shm_frag_t *f)
+{
+	if (NULL != f->buf)
+		nn_freemsg (f->buf);
+	f->buf = NULL;
+}
+
+int libpd_shm_receive (libpd_shm_t shm, libpd_shm_ring_t ring,
+	void **msg, unsigned *len, uint32_t timeout_ms)
+{
+	shm_t *s = (shm_t *) shm;
+	shm_ring_hdr_t *r = &s->hdr->rings[ring];
+	shm_frag_t *f = &s->frag[ring];
+	unsigned char *data = s->data[ring];
+	unsigned char *rec_data;
+	uint32_t size = s->ring_size;
+	uint32_t max = libpd_shm_max_msg (shm);
+	uint32_t head, tail, pos, rec_word, rec_len, rec, total;
+	uint64_t deadline = now_ms () + timeout_ms;
+
+	*msg = NULL;
+	*len = 0;
+	tail = __atomic_load_n (&r->tail, __ATOMIC_RELAXED);
+	while (true) {
+		head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (libpd_shm_is_closed (shm)) {
+				drop_frag (f);
+				return LIBPD_SHMERR_CLOSED;
+			}
+			if (wait_move (s, &r->head, head, &r->rd_waiting, deadline) == 1)
+				return 1;
+			continue;
+		}
+		pos = tail & (size - 1);
+		memcpy (&rec_word, data + pos, REC_HDR_SIZE);
+		if (rec_word == WRAP_MARK) {
+			tail += size - pos;
+			publish (&r->tail, tail, &r->wr_waiting);
+			continue;
+		}
+		// the other side is another process, so check what it wrote
+		rec_len = rec_word & ~REC_MORE;
+		rec = REC_HDR_SIZE + REC_ALIGN (rec_len);
+		if ((rec_len > max) || (rec > (head - tail)) || (rec > (size - pos)))
+			break;
+		rec_data = data + pos + REC_HDR_SIZE;
+		if (NULL == f->buf) {
+			// a whole msg, or the first fragment, which starts with
+			// the length of the msg
+			total = rec_len;
+			if (rec_word & REC_MORE) {
+				if (rec_len < sizeof (total))
+					break;
+				memcpy (&total, rec_data, sizeof (total));
+				if ((total <= max) || (total > LIBPD_SHM_MAX_MSG))
+					break;
+				rec_data += sizeof (total);
+				rec_len -= sizeof (total);
+			}
+			f->buf = (unsigned char *) nn_allocmsg ((total > 0) ? total : 1, 0);
+			if (NULL == f->buf) {
+				libpd_log (LEVEL_ERROR, ("LIBPARODUS: unable to allocate shm msg\n"));
+				return LIBPD_SHMERR_RCV_ALLOC;
+			}
+			f->len = total;
+			f->got = 0;
+		}
+		if ((rec_len > (f->len - f->got)) ||
+		    (!(rec_word & REC_MORE) && ((f->got + rec_len) != f->len))) {
+			drop_frag (f);
+			break;
+		}
+		memcpy (f->buf + f->got, rec_data, rec_len);
+		f->got += rec_len;
+		tail += rec;
+		publish (&r->tail, tail, &r->wr_waiting);
+		if (!(rec_word & REC_MORE)) {
+			*msg = f->buf;
+			*len = f->len;
+			f->buf = NULL;
+			return 0;
+		}
+	}
+	libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid shm record\n"));
+	return LIBPD_SHMERR_CORRUPT;
+}
+
+void libpd_shm_close (libpd_shm_t shm)
+{
+	shm_t *s = (shm_t *) shm;
+	unsigned i;
+
+	__atomic_store_n (&s->hdr->closed, 1, __ATOMIC_SEQ_CST);
+	for (i = 0; i < 2; i++) {
+		futex_wake (&s->hdr->rings[i].head, INT_MAX);
+		futex_wake (&s->hdr->rings[i].tail, INT_MAX);
+	}
+}
+
+void libpd_shm_destroy (libpd_shm_t *shm)
+{
+	shm_t *s;
+
+	if ((NULL == shm) || (NULL == *shm))
+		return;
+	s = (shm_t *) *shm;
+	drop_frag (&s->frag[LIBPD_SHM_UP]);
+	drop_frag (&s->frag[LIBPD_SHM_DOWN]);
+	munmap (s->hdr, s->map_size);
+	close (s->fd);
+	free (s);
+	*shm = NULL;
+}
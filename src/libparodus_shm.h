@@ -0,0 +1,228 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_SHM_H
+#define  _LIBPARODUS_SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Shared memory transport: a memfd segment holding two single producer,
+ * single consumer byte rings, one for each direction.
+ *
+ * libparodus creates the segment, and offers its path to parodus in
+ * the registration msg. parodus opens it by that path, and says so in
+ * its AUTH reply. From then on encoded wrp msgs go through the rings
+ * with no syscall at all while the peer is busy. A side only makes a
+ * futex call when it has to wait, or when the other side is waiting
+ * on it.
+ *
+ * Each ring has one producer and one consumer thread; callers that
+ * send from more than one thread must serialize their sends.
+ *
+ * A msg too big for one record (libpd_shm_max_msg) is sent through
+ * the ring in fragments, and received whole, so every msg can take
+ * the same path and msgs stay in the order they were sent.
+ */
+
+// segment name shown in /proc/<pid>/fd
+#define LIBPD_SHM_NAME "libparodus"
+
+// wrp field holding the segment path, in the registration msg that
+// offers it and the AUTH msg that accepts it
+#define LIBPD_SHM_FIELD "shm"
+
+// ring_size limits for libpd_shm_create. records are at most half a ring
+#define LIBPD_SHM_MIN_RING_SIZE 0x1000
+#define LIBPD_SHM_MAX_RING_SIZE 0x4000000
+
+// largest msg libpd_shm_send takes, in fragments if need be
+#define LIBPD_SHM_MAX_MSG 0x7FFFFFFFu
+
+typedef void *libpd_shm_t;
+
+/**
+ * The two rings of a segment
+ */
+typedef enum {
+	LIBPD_SHM_UP = 0,	// libparodus to parodus
+	LIBPD_SHM_DOWN	// parodus to libparodus
+} libpd_shm_ring_t;
+
+/**
+ * @brief shared memory error rtn codes
+ *
+ */
+typedef enum {
+	/**
+	 * @brief Error on libpd_shm_create
+	 * ring size is not a power of two in range
+	 */
+	LIBPD_SHMERR_CREATE_INVAL_SZ = -0x7001,
+	/**
+	 * @brief Error on libpd_shm_create or libpd_shm_open
+	 * unable to allocate
+	 */
+	LIBPD_SHMERR_ALLOC = -0x7002,
+	/**
+	 * @brief Error on libpd_shm_create
+	 * unable to create the memfd
+	 */
+	LIBPD_SHMERR_CREATE_MEMFD = -0x7040,
+	/**
+	 * @brief Error on libpd_shm_open
+	 * unable to open the path
+	 */
+	LIBPD_SHMERR_OPEN = -0x7080,
+	/**
+	 * @brief Error on libpd_shm_open
+	 * the path is not a libparodus segment
+	 */
+	LIBPD_SHMERR_OPEN_INVAL = -0x7081,
+	/**
+	 * @brief Error on libpd_shm_create or libpd_shm_open
+	 * unable to map the segment
+	 */
+	LIBPD_SHMERR_MAP = -0x70C0,
+	/**
+	 * @brief Error on libpd_shm_send
+	 * msg is larger than LIBPD_SHM_MAX_MSG
+	 */
+	LIBPD_SHMERR_TOO_BIG = -0x7101,
+	/**
+	 * @brief Error on libpd_shm_send or libpd_shm_receive
+	 * one side has closed the segment
+	 */
+	LIBPD_SHMERR_CLOSED = -0x7102,
+	/**
+	 * @brief Error on libpd_shm_receive
+	 * the ring holds an invalid record
+	 */
+	LIBPD_SHMERR_CORRUPT = -0x7103,
+	/**
+	 * @brief Error on libpd_shm_receive
+	 * unable to allocate the msg buffer
+	 */
+	LIBPD_SHMERR_RCV_ALLOC = -0x7104
+} libpd_shmerror_t;
+
+/**
+ * Create a segment
+ *
+ * @param shm receives the segment
+ * @param ring_size size of each ring, a power of two from
+ *   LIBPD_SHM_MIN_RING_SIZE to LIBPD_SHM_MAX_RING_SIZE
+ * @param oserr receives the OS error code on failure
+ * @return 0 on success, valid libpd_shmerror_t otherwise.
+ */
+int libpd_shm_create (libpd_shm_t *shm, unsigned ring_size, int *oserr);
+
+/**
+ * Open a segment created by another process
+ *
+ * @param shm receives the segment
+ * @param path path from libpd_shm_path of the creator
+ * @param oserr receives the OS error code on failure
+ * @return 0 on success, valid libpd_shmerror_t otherwise.
+ */
+int libpd_shm_open (libpd_shm_t *shm, const char *path, int *oserr);
+
+/**
+ * Get the path the peer opens a segment by
+ *
+ * The path is /proc/<pid>/fd/<fd> of the creating process, so the peer
+ * needs the same access to it as to any other file of that process.
+ *
+ * @param shm segment
+ * @return the path
+ */
+const char *libpd_shm_path (libpd_shm_t shm);
+
+/**
+ * Get the largest msg that fits in one record of a ring
+ *
+ * Larger msgs are sent in fragments.
+ *
+ * @param shm segment
+ * @return max record length
+ */
+unsigned libpd_shm_max_msg (libpd_shm_t shm);
+
+/**
+ * Copy a msg into a ring
+ *
+ * A msg larger than libpd_shm_max_msg goes in fragments, as the
+ * consumer makes room for them. If the ring stays full before the
+ * first fragment, nothing is sent and 1 is returned. If it stays full
+ * part way through, the consumer can't be told to drop what it has,
+ * so the segment is closed and LIBPD_SHMERR_CLOSED is returned.
+ *
+ * @param shm segment
+ * @param ring ring to send on
+ * @param msg msg bytes
+ * @param len length of msg
+ * @param timeout_ms how long to wait for room for the whole msg, may be 0
+ * @return 0 on success, 1 if the ring stayed full,
+ *   valid libpd_shmerror_t otherwise.
+ */
+int libpd_shm_send (libpd_shm_t shm, libpd_shm_ring_t ring,
+	const void *msg, unsigned len, uint32_t timeout_ms);
+
+/**
+ * Take the next msg off of a ring
+ *
+ * @param shm segment
+ * @param ring ring to receive on
+ * @param msg receives a buffer from nn_allocmsg holding the msg,
+ *   to be freed with nn_freemsg
+ * @param len receives the length of msg
+ * @param timeout_ms how long to wait for a msg, may be 0
+ * @return 0 on success, 1 if timed out,
+ *   valid libpd_shmerror_t otherwise.
+ */
+int libpd_shm_receive (libpd_shm_t shm, libpd_shm_ring_t ring,
+	void **msg, unsigned *len, uint32_t timeout_ms);
+
+/**
+ * Close a segment for both sides
+ *
+ * Threads waiting in libpd_shm_send or libpd_shm_receive, on either
+ * side, return LIBPD_SHMERR_CLOSED, and so does every call after.
+ * msgs already in the rings can still be received.
+ *
+ * @param shm segment
+ */
+void libpd_shm_close (libpd_shm_t shm);
+
+/**
+ * Find out if a segment has been closed, by either side
+ *
+ * @param shm segment
+ * @return true if closed
+ */
+bool libpd_shm_is_closed (libpd_shm_t shm);
+
+/**
+ * Unmap a segment
+ *
+ * Nothing may be waiting on the segment in this process.
+ *
+ * @param shm segment, set to NULL
+ */
+void libpd_shm_destroy (libpd_shm_t *shm);
+
+#endif
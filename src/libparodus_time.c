@@ -153,6 +153,70 @@ int get_expire_time (uint32_t ms, struct timespec *ts)
 	return 0;
 }
 
+#ifdef CLOCK_MONOTONIC_COARSE
+// resolution of CLOCK_MONOTONIC_COARSE in ns, 0 until first needed
+static long coarse_res_ns = 0;
+
+// The coarse clock is read without a syscall or a hardware counter,
+// but lags CLOCK_MONOTONIC by up to its resolution (a scheduler tick).
+// Adding the resolution means a deadline is never early, and at most
+// a tick late, which is plenty for ms timeouts.
+static int get_mono_coarse (struct timespec *ts)
+{
+	struct timespec res;
+	long res_ns = __atomic_load_n (&coarse_res_ns, __ATOMIC_RELAXED);
+
+	if (0 == res_ns) {
+		if (clock_getres (CLOCK_MONOTONIC_COARSE, &res) != 0)
+			return -1;
+		res_ns = (long) res.tv_sec * 1000000000L + res.tv_nsec;
+		__atomic_store_n (&coarse_res_ns, res_ns, __ATOMIC_RELAXED);
+	}
+	if (clock_gettime (CLOCK_MONOTONIC_COARSE, ts) != 0)
+		return -1;
+	ts->tv_nsec += res_ns;
+	while (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= 1000000000L;
+	}
+	return 0;
+}
+#endif
+
+int get_expire_time_mono (uint32_t ms, struct timespec *ts)
+{
+	int err;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	if (get_mono_coarse (ts) != 0)
+#endif
+	if (clock_gettime (CLOCK_MONOTONIC, ts) != 0) {
+		err = errno;
+		libpd_log_err (LEVEL_ERROR, err, ("Error getting monotonic time\n"));
+		return err;
+	}
+	ts->tv_sec += ms/1000;
+	ts->tv_nsec += (long) (ms%1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= 1000000000L;
+	}
+	return 0;
+}
+
+int cond_init_monotonic (pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+	int err = pthread_condattr_init (&attr);
+	if (err != 0)
+		return err;
+	err = pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+	if (err == 0)
+		err = pthread_cond_init (cond, &attr);
+	pthread_condattr_destroy (&attr);
+	return err;
+}
+
 void delay_ms(unsigned msecs)
 {
   struct timespec ts;
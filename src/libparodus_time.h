@@ -21,6 +21,7 @@
 #include <sys/time.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 #define TIMESTAMP_LEN 19
 #define TIMESTAMP_BUFLEN (TIMESTAMP_LEN+1)
@@ -87,6 +88,28 @@ int make_current_timestamp (char *timestamp);
  */
 int get_expire_time (uint32_t ms, struct timespec *ts);
 
+/**
+ * Get absolute expiration timespec on the monotonic clock, given delay in ms
+ *
+ * For use with condition variables set to CLOCK_MONOTONIC
+ * (see cond_init_monotonic), so timeouts are not affected when
+ * the wall clock is set. Read from CLOCK_MONOTONIC_COARSE where there
+ * is one, so the expiration may be up to a scheduler tick late.
+ *
+ * @param ms  delay in msecs
+ * @param ts  expiration time
+ * @return 0 on success, valid errno otherwise.
+ */
+int get_expire_time_mono (uint32_t ms, struct timespec *ts);
+
+/**
+ * Initialize a condition variable that uses CLOCK_MONOTONIC for timed waits
+ *
+ * @param cond  condition variable
+ * @return 0 on success, valid errno otherwise.
+ */
+int cond_init_monotonic (pthread_cond_t *cond);
+
 /**
  * Delay
  *
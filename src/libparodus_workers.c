@@ -0,0 +1,448 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#include "libparodus_workers.h"
+#include "libparodus_time.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "libparodus_log.h"
+
+typedef struct work_item {
+	struct work_item *next;
+	void *msg;
+	uint64_t origin;
+	uint64_t queued;
+} work_item_t;
+
+// the msgs waiting for one key hash
+typedef struct strand {
+	struct strand *hash_next;
+	struct strand *run_next;
+	uint32_t key;
+	work_item_t *head;
+	work_item_t *tail;
+} strand_t;
+
+struct workers;
+
+typedef struct {
+	struct workers *pool;
+	pthread_t tid;
+	pthread_cond_t cond;	// signalled when idle is cleared
+	strand_t *run_head;
+	strand_t *run_tail;
+	bool idle;	// waiting on cond for work
+} worker_t;
+
+typedef struct workers {
+	// one mutex for the pool, the per-worker run queues included, so
+	// stealing needs no lock of its own. Handling a msg takes much
+	// longer than moving it between lists, so it is held only briefly.
+	pthread_mutex_t mutex;
+	pthread_cond_t not_full_cond;
+	worker_t *workers;
+	unsigned num_workers;
+	unsigned num_started;
+	// items and strands are all allocated up front. Each strand in use
+	// has a msg waiting or is being handled, so there are never more
+	// than max_msgs + num_workers of them.
+	work_item_t *items;
+	work_item_t *free_items;
+	strand_t *strands;
+	strand_t *free_strands;
+	strand_t **buckets;
+	uint32_t bucket_mask;
+	unsigned count;
+	unsigned high_water;
+	bool closed;
+	libpd_work_fn_t *fn;
+	void *arg;
+	libpd_lat_hist_t *wait_hist;
+	libpd_lat_hist_t *total_hist;
+} workers_t;
+
+static void *worker_thread (void *arg);
+
+// FNV-1a
+uint32_t libpd_workers_key (const char *s)
+{
+	uint32_t hash = 2166136261u;
+
+	if (NULL == s)
+		return 0;
+	while (*s != '\0') {
+		hash ^= (uint8_t) *s++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static unsigned num_buckets (unsigned n)
+{
+	unsigned size = 16;
+
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+static void free_pool (workers_t *p)
+{
+	free (p->workers);
+	free (p->items);
+	free (p->strands);
+	free (p->buckets);
+	free (p);
+}
+
+static void destroy_sync (workers_t *p, unsigned num_conds)
+{
+	unsigned i;
+
+	for (i = 0; i < num_conds; i++)
+		pthread_cond_destroy (&p->workers[i].cond);
+	pthread_cond_destroy (&p->not_full_cond);
+	pthread_mutex_destroy (&p->mutex);
+}
+
+// stops and joins the threads that have been started
+static void stop_workers (workers_t *p)
+{
+	unsigned i;
+	int rtn;
+
+	pthread_mutex_lock (&p->mutex);
+	p->closed = true;
+	for (i = 0; i < p->num_workers; i++) {
+		p->workers[i].idle = false;
+		pthread_cond_signal (&p->workers[i].cond);
+	}
+	pthread_mutex_unlock (&p->mutex);
+	for (i = 0; i < p->num_started; i++) {
+		rtn = pthread_join (p->workers[i].tid, NULL);
+		if (rtn != 0) {
+			libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating worker thread\n"));
+		}
+	}
+	p->num_started = 0;
+}
+
+int libpd_workers_create (libpd_workers_t *workers, unsigned threads,
+	unsigned max_msgs, libpd_work_fn_t *fn, void *arg,
+	libpd_lat_hist_t *wait_hist, libpd_lat_hist_t *total_hist, int *oserr)
+{
+	workers_t *p;
+	unsigned i, num_strands;
+	int err;
+
+	*workers = NULL;
+	if ((threads == 0) || (max_msgs == 0)) {
+		libpd_log (LEVEL_ERROR, ("Invalid worker pool size %u threads, %u msgs\n",
+			threads, max_msgs));
+		return LIBPD_WORKERR_CREATE_INVAL_SZ;
+	}
+	num_strands = max_msgs + threads;
+	p = (workers_t *) calloc (1, sizeof (workers_t));
+	if (NULL != p) {
+		p->workers = (worker_t *) calloc (threads, sizeof (worker_t));
+		p->items = (work_item_t *) calloc (max_msgs, sizeof (work_item_t));
+		p->strands = (strand_t *) calloc (num_strands, sizeof (strand_t));
+		p->buckets = (strand_t **)
+			calloc (num_buckets (num_strands), sizeof (strand_t *));
+	}
+	if ((NULL == p) || (NULL == p->workers) || (NULL == p->items) ||
+	    (NULL == p->strands) || (NULL == p->buckets)) {
+		libpd_log (LEVEL_ERROR, ("Unable to allocate worker pool\n"));
+		if (NULL != p)
+			free_pool (p);
+		return LIBPD_WORKERR_CREATE_ALLOC;
+	}
+	for (i = 0; i < max_msgs; i++) {
+		p->items[i].next = p->free_items;
+		p->free_items = &p->items[i];
+	}
+	for (i = 0; i < num_strands; i++) {
+		p->strands[i].hash_next = p->free_strands;
+		p->free_strands = &p->strands[i];
+	}
+	p->bucket_mask = num_buckets (num_strands) - 1;
+	p->num_workers = threads;
+	p->fn = fn;
+	p->arg = arg;
+	p->wait_hist = wait_hist;
+	p->total_hist = total_hist;
+
+	err = pthread_mutex_init (&p->mutex, NULL);
+	if (err != 0) {
+		*oserr = err;
+		free_pool (p);
+		return LIBPD_WORKERR_CREATE_SYNC;
+	}
+	err = cond_init_monotonic (&p->not_full_cond);
+	if (err != 0) {
+		*oserr = err;
+		pthread_mutex_destroy (&p->mutex);
+		free_pool (p);
+		return LIBPD_WORKERR_CREATE_SYNC;
+	}
+	for (i = 0; i < threads; i++) {
+		p->workers[i].pool = p;
+		err = pthread_cond_init (&p->workers[i].cond, NULL);
+		if (err != 0) {
+			*oserr = err;
+			destroy_sync (p, i);
+			free_pool (p);
+			return LIBPD_WORKERR_CREATE_SYNC;
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		err = pthread_create (&p->workers[i].tid, NULL, worker_thread,
+			&p->workers[i]);
+		if (err != 0) {
+			*oserr = err;
+			libpd_log_err (LEVEL_ERROR, err, ("Error creating worker thread\n"));
+			stop_workers (p);
+			destroy_sync (p, threads);
+			free_pool (p);
+			return LIBPD_WORKERR_CREATE_THREAD;
+		}
+		p->num_started++;
+	}
+	*workers = (libpd_workers_t) p;
+	return 0;
+}
+
+static strand_t *find_strand (workers_t *p, uint32_t key)
+{
+	strand_t *s = p->buckets[key & p->bucket_mask];
+
+	while ((NULL != s) && (s->key != key))
+		s = s->hash_next;
+	return s;
+}
+
+static void remove_strand (workers_t *p, strand_t *s)
+{
+	strand_t **link = &p->buckets[s->key & p->bucket_mask];
+
+	while (*link != s)
+		link = &(*link)->hash_next;
+	*link = s->hash_next;
+	s->hash_next = p->free_strands;
+	p->free_strands = s;
+}
+
+// wakes one idle worker, if there is one
+static void wake_idle_worker (workers_t *p)
+{
+	unsigned i;
+
+	for (i = 0; i < p->num_workers; i++) {
+		if (p->workers[i].idle) {
+			p->workers[i].idle = false;
+			pthread_cond_signal (&p->workers[i].cond);
+			return;
+		}
+	}
+}
+
+static void append_strand (worker_t *w, strand_t *s)
+{
+	s->run_next = NULL;
+	if (NULL == w->run_tail)
+		w->run_head = s;
+	else
+		w->run_tail->run_next = s;
+	w->run_tail = s;
+}
+
+// puts a strand with msgs waiting on a worker's run queue. If that worker
+// is busy, another one that is idle gets woken to steal it.
+static void run_strand (workers_t *p, strand_t *s, worker_t *w)
+{
+	append_strand (w, s);
+	if (w->idle) {
+		w->idle = false;
+		pthread_cond_signal (&w->cond);
+	} else {
+		wake_idle_worker (p);
+	}
+}
+
+static strand_t *pop_strand (worker_t *w)
+{
+	strand_t *s = w->run_head;
+
+	if (NULL != s) {
+		w->run_head = s->run_next;
+		if (NULL == w->run_head)
+			w->run_tail = NULL;
+	}
+	return s;
+}
+
+// takes the next strand from the worker's own run queue,
+// or else steals one from another worker's. Called with the pool mutex.
+static strand_t *take_strand (workers_t *p, worker_t *w)
+{
+	strand_t *s = pop_strand (w);
+	unsigned i, n = p->num_workers;
+	unsigned self = (unsigned) (w - p->workers);
+
+	for (i = 1; (NULL == s) && (i < n); i++)
+		s = pop_strand (&p->workers[(self + i) % n]);
+	return s;
+}
+
+int libpd_workers_submit (libpd_workers_t workers, uint32_t key, void *msg,
+	uint64_t origin, uint32_t timeout_ms)
+{
+	workers_t *p = (workers_t *) workers;
+	struct timespec ts;
+	work_item_t *item;
+	strand_t *s;
+	int rtn;
+
+	pthread_mutex_lock (&p->mutex);
+	if ((NULL == p->free_items) && (timeout_ms > 0))
+		get_expire_time_mono (timeout_ms, &ts);
+	while (!p->closed && (NULL == p->free_items)) {
+		if (timeout_ms == 0) {
+			pthread_mutex_unlock (&p->mutex);
+			return 1;
+		}
+		rtn = pthread_cond_timedwait (&p->not_full_cond, &p->mutex, &ts);
+		if (rtn == ETIMEDOUT)
+			timeout_ms = 0;
+		else if (rtn != 0) {
+			pthread_mutex_unlock (&p->mutex);
+			libpd_log_err (LEVEL_ERROR, rtn, ("Error waiting for worker pool\n"));
+			return LIBPD_WORKERR_SUBMIT_TIMEDWAIT;
+		}
+	}
+	if (p->closed) {
+		pthread_mutex_unlock (&p->mutex);
+		return LIBPD_WORKERR_SUBMIT_CLOSED;
+	}
+	item = p->free_items;
+	p->free_items = item->next;
+	item->next = NULL;
+	item->msg = msg;
+	item->origin = origin;
+	item->queued = (NULL != p->wait_hist) ? libpd_lat_now () : 0;
+	p->count++;
+	if (p->count > p->high_water)
+		p->high_water = p->count;
+
+	s = find_strand (p, key);
+	if (NULL != s) {
+		// already on a run queue or being handled
+		if (NULL == s->tail)
+			s->head = item;
+		else
+			s->tail->next = item;
+		s->tail = item;
+	} else {
+		s = p->free_strands;
+		p->free_strands = s->hash_next;
+		s->key = key;
+		s->head = s->tail = item;
+		s->hash_next = p->buckets[key & p->bucket_mask];
+		p->buckets[key & p->bucket_mask] = s;
+		run_strand (p, s, &p->workers[key % p->num_workers]);
+	}
+	pthread_mutex_unlock (&p->mutex);
+	return 0;
+}
+
+static void *worker_thread (void *arg)
+{
+	worker_t *w = (worker_t *) arg;
+	workers_t *p = w->pool;
+	work_item_t *item;
+	strand_t *s;
+
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Starting worker thread\n"));
+	pthread_mutex_lock (&p->mutex);
+	while (true) {
+		s = take_strand (p, w);
+		if (NULL == s) {
+			// once closed, nothing more gets submitted, and the worker
+			// handling a strand requeues it on its own run queue
+			if (p->closed)
+				break;
+			w->idle = true;
+			while (w->idle)
+				pthread_cond_wait (&w->cond, &p->mutex);
+			continue;
+		}
+		item = s->head;
+		s->head = item->next;
+		if (NULL == s->head)
+			s->tail = NULL;
+		pthread_mutex_unlock (&p->mutex);
+
+		if (NULL != p->wait_hist)
+			libpd_lat_record_since (p->wait_hist, item->queued);
+		if (NULL != p->total_hist)
+			libpd_lat_record_since (p->total_hist, item->origin);
+		(*p->fn) (item->msg, p->arg);
+
+		pthread_mutex_lock (&p->mutex);
+		item->next = p->free_items;
+		p->free_items = item;
+		p->count--;
+		pthread_cond_signal (&p->not_full_cond);
+		if (NULL == s->head)
+			remove_strand (p, s);
+		else if (NULL == w->run_head)
+			append_strand (w, s);	// this worker takes it next
+		else
+			run_strand (p, s, w);
+	}
+	pthread_mutex_unlock (&p->mutex);
+	libpd_log (LEVEL_DEBUG, ("Ended worker thread\n"));
+	return NULL;
+}
+
+uint32_t libpd_workers_high_water (libpd_workers_t workers)
+{
+	workers_t *p = (workers_t *) workers;
+	uint32_t high_water;
+
+	if (NULL == p)
+		return 0;
+	pthread_mutex_lock (&p->mutex);
+	high_water = p->high_water;
+	pthread_mutex_unlock (&p->mutex);
+	return high_water;
+}
+
+void libpd_workers_destroy (libpd_workers_t *workers)
+{
+	workers_t *p = (workers_t *) *workers;
+
+	if (NULL == p)
+		return;
+	stop_workers (p);
+	destroy_sync (p, p->num_workers);
+	free_pool (p);
+	*workers = NULL;
+}
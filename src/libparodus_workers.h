@@ -0,0 +1,149 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_WORKERS_H
+#define  _LIBPARODUS_WORKERS_H
+
+#include <stdint.h>
+#include "libparodus_latency.h"
+
+/*
+ * Worker pool that keeps msgs with the same key in order.
+ *
+ * Msgs with the same key form a strand, handled one msg at a time in
+ * the order they were submitted, so msgs with different keys run in
+ * parallel and a slow msg only holds up the msgs with its own key.
+ * Each worker has its own run queue of strands, and a strand goes to
+ * the run queue picked by its key. A worker with nothing on its run
+ * queue steals a strand from another worker's.
+ *
+ * The run queues only spread the strands over the workers. The whole
+ * pool, run queues included, is under a single mutex, so submitting,
+ * taking and stealing all contend on one lock. It is held only to move
+ * a msg between lists, never while a msg is handled.
+ *
+ * Keys are 32 bit FNV-1a hashes (libpd_workers_key), and strands are
+ * matched on the hash alone, not the string it came from. Two keys with
+ * the same hash share a strand, so their msgs are handled one at a
+ * time, in submit order. That only costs some parallelism, never
+ * ordering.
+ */
+
+typedef void *libpd_workers_t;
+
+/**
+ * Handles one msg on a worker thread
+ *
+ * @param msg submitted msg
+ * @param arg arg given to libpd_workers_create
+ */
+typedef void libpd_work_fn_t (void *msg, void *arg);
+
+/**
+ * @brief worker pool error rtn codes
+ *
+ */
+typedef enum {
+	/**
+	 * @brief Error on libpd_workers_create
+	 * invalid number of threads or msgs
+	 */
+	LIBPD_WORKERR_CREATE_INVAL_SZ = -0x5001,
+	/**
+	 * @brief Error on libpd_workers_create
+	 * unable to allocate pool
+	 */
+	LIBPD_WORKERR_CREATE_ALLOC = -0x5002,
+	/**
+	 * @brief Error on libpd_workers_create
+	 * unable to create mutex or cond var
+	 */
+	LIBPD_WORKERR_CREATE_SYNC = -0x5040,
+	/**
+	 * @brief Error on libpd_workers_create
+	 * unable to create worker thread
+	 */
+	LIBPD_WORKERR_CREATE_THREAD = -0x5080,
+	/**
+	 * @brief Error on libpd_workers_submit
+	 * pool is being destroyed
+	 */
+	LIBPD_WORKERR_SUBMIT_CLOSED = -0x5101,
+	/**
+	 * @brief Error on libpd_workers_submit
+	 * error waiting for room
+	 */
+	LIBPD_WORKERR_SUBMIT_TIMEDWAIT = -0x5140
+} libpd_workerror_t;
+
+/**
+ * Create a worker pool and start its threads
+ *
+ * @param workers receives the pool
+ * @param threads number of worker threads
+ * @param max_msgs max msgs waiting to be handled
+ * @param fn called with each msg
+ * @param arg passed to fn
+ * @param wait_hist if not NULL, records how long each msg waits in the pool
+ * @param total_hist if not NULL, records the time from each msg's origin
+ *   until it is handled
+ * @param oserr receives the OS error code on failure
+ * @return 0 on success, valid libpd_workerror_t otherwise.
+ */
+int libpd_workers_create (libpd_workers_t *workers, unsigned threads,
+	unsigned max_msgs, libpd_work_fn_t *fn, void *arg,
+	libpd_lat_hist_t *wait_hist, libpd_lat_hist_t *total_hist, int *oserr);
+
+/**
+ * Submit a msg
+ *
+ * @param workers worker pool
+ * @param key msgs with the same key are handled in order, one at a time
+ * @param msg msg, passed to fn
+ * @param origin libpd_lat_now time the msg started out, for total_hist
+ * @param timeout_ms how long to wait if the pool is full, may be 0
+ * @return 0 on success, 1 if the pool stayed full,
+ *   valid libpd_workerror_t otherwise.
+ */
+int libpd_workers_submit (libpd_workers_t workers, uint32_t key, void *msg,
+	uint64_t origin, uint32_t timeout_ms);
+
+/**
+ * Get the most msgs that have been waiting in the pool at once
+ *
+ * @param workers worker pool, may be NULL
+ * @return the high water mark, 0 if workers is NULL
+ */
+uint32_t libpd_workers_high_water (libpd_workers_t workers);
+
+/**
+ * Make a key from a string
+ *
+ * @param s string, may be NULL
+ * @return key
+ */
+uint32_t libpd_workers_key (const char *s);
+
+/**
+ * Destroy a worker pool
+ *
+ * Msgs already submitted are all handled before the threads end.
+ *
+ * @param workers worker pool, set to NULL
+ */
+void libpd_workers_destroy (libpd_workers_t *workers);
+
+#endif
@@ -0,0 +1,933 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "libparodus_wrp.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <nanomsg/nn.h>
+
+// The same writer is used to measure (buf == NULL) and to encode,
+// so the size estimate always matches what gets written.
+typedef struct {
+	unsigned char *buf;
+	size_t buf_size;
+	size_t len;
+	bool overflow;
+} wrp_writer_t;
+
+// the parts of a wrp msg that get encoded, whatever the msg type
+typedef struct {
+	const char *source;
+	const char *dest;
+	const char *transaction_uuid;
+	const char *content_type;
+	const char *accept;
+	const char *path;
+	const char *service_name;
+	const char *url;
+	partners_t *partner_ids;
+	headers_t *headers;
+	data_t *metadata;
+	const void *payload;
+	size_t payload_size;
+	bool has_status;
+	int status;
+	bool has_rdr;
+	int rdr;
+	const char *ext_key;	// extra string field, see libpd_wrp_encode_ext
+	const char *ext_val;
+} wrp_fields_t;
+
+static void put_bytes (wrp_writer_t *w, const void *data, size_t n)
+{
+	if (NULL != w->buf) {
+		if ((w->buf_size - w->len) < n) {
+			w->overflow = true;
+			return;
+		}
+		memcpy (w->buf + w->len, data, n);
+	}
+	w->len += n;
+}
+
+static void put_be (wrp_writer_t *w, uint8_t code, uint64_t val, unsigned nbytes)
+{
+	unsigned char tmp[9];
+	unsigned i;
+
+	tmp[0] = code;
+	for (i = 0; i < nbytes; i++)
+		tmp[nbytes - i] = (unsigned char) (val >> (8 * i));
+	put_bytes (w, tmp, nbytes + 1);
+}
+
+static void put_int (wrp_writer_t *w, int64_t val)
+{
+	if (val >= 0) {
+		if (val < 0x80) {
+			unsigned char c = (unsigned char) val;
+			put_bytes (w, &c, 1);
+		} else if (val <= UINT8_MAX)
+			put_be (w, 0xcc, (uint64_t) val, 1);
+		else if (val <= UINT16_MAX)
+			put_be (w, 0xcd, (uint64_t) val, 2);
+		else if (val <= UINT32_MAX)
+			put_be (w, 0xce, (uint64_t) val, 4);
+		else
+			put_be (w, 0xcf, (uint64_t) val, 8);
+	} else {
+		if (val >= -32) {
+			unsigned char c = (unsigned char) (int8_t) val;
+			put_bytes (w, &c, 1);
+		} else if (val >= INT8_MIN)
+			put_be (w, 0xd0, (uint64_t) val, 1);
+		else if (val >= INT16_MIN)
+			put_be (w, 0xd1, (uint64_t) val, 2);
+		else if (val >= INT32_MIN)
+			put_be (w, 0xd2, (uint64_t) val, 4);
+		else
+			put_be (w, 0xd3, (uint64_t) val, 8);
+	}
+}
+
+static void put_str (wrp_writer_t *w, const char *str)
+{
+	size_t len = strlen (str);
+
+	if (len < 32) {
+		unsigned char c = (unsigned char) (0xa0 | len);
+		put_bytes (w, &c, 1);
+	} else if (len <= UINT8_MAX)
+		put_be (w, 0xd9, len, 1);
+	else if (len <= UINT16_MAX)
+		put_be (w, 0xda, len, 2);
+	else
+		put_be (w, 0xdb, len, 4);
+	put_bytes (w, str, len);
+}
+
+static void put_bin (wrp_writer_t *w, const void *data, size_t len)
+{
+	if (len <= UINT8_MAX)
+		put_be (w, 0xc4, len, 1);
+	else if (len <= UINT16_MAX)
+		put_be (w, 0xc5, len, 2);
+	else
+		put_be (w, 0xc6, len, 4);
+	put_bytes (w, data, len);
+}
+
+static void put_container (wrp_writer_t *w, bool map, size_t count)
+{
+	if (count < 16) {
+		unsigned char c = (unsigned char) ((map ? 0x80 : 0x90) | count);
+		put_bytes (w, &c, 1);
+	} else if (count <= UINT16_MAX)
+		put_be (w, map ? 0xde : 0xdc, count, 2);
+	else
+		put_be (w, map ? 0xdf : 0xdd, count, 4);
+}
+
+static void put_str_field (wrp_writer_t *w, const char *key, const char *val)
+{
+	put_str (w, key);
+	put_str (w, val);
+}
+
+// false if any of the strings in a list is missing
+static bool list_complete (char **strs, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		if (NULL == strs[i])
+			return false;
+	return true;
+}
+
+static bool metadata_complete (const data_t *metadata)
+{
+	size_t i;
+
+	if (NULL == metadata)
+		return true;
+	for (i = 0; i < metadata->count; i++)
+		if ((NULL == metadata->data_items[i].name) ||
+		    (NULL == metadata->data_items[i].value))
+			return false;
+	return true;
+}
+
+// returns false if the msg is not one we encode here, so that the
+// caller encodes it with wrp_struct_to rather than get part of it
+static bool get_fields (const wrp_msg_t *msg, wrp_fields_t *f)
+{
+	memset ((void*) f, 0, sizeof(wrp_fields_t));
+	switch (msg->msg_type) {
+		case WRP_MSG_TYPE__AUTH:
+			f->has_status = true;
+			f->status = msg->u.auth.status;
+			return true;
+		case WRP_MSG_TYPE__REQ:
+			if ((NULL == msg->u.req.transaction_uuid) ||
+			    msg->u.req.include_spans || (0 != msg->u.req.spans.count))
+				return false;
+			f->source = msg->u.req.source;
+			f->dest = msg->u.req.dest;
+			f->transaction_uuid = msg->u.req.transaction_uuid;
+			f->content_type = msg->u.req.content_type;
+			f->accept = msg->u.req.accept;
+			f->partner_ids = msg->u.req.partner_ids;
+			f->headers = msg->u.req.headers;
+			f->metadata = msg->u.req.metadata;
+			f->payload = msg->u.req.payload;
+			f->payload_size = msg->u.req.payload_size;
+			break;
+		case WRP_MSG_TYPE__EVENT:
+			f->source = msg->u.event.source;
+			f->dest = msg->u.event.dest;
+			f->content_type = msg->u.event.content_type;
+			f->partner_ids = msg->u.event.partner_ids;
+			f->headers = msg->u.event.headers;
+			f->metadata = msg->u.event.metadata;
+			f->payload = msg->u.event.payload;
+			f->payload_size = msg->u.event.payload_size;
+			break;
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			if (msg->u.crud.include_spans || (0 != msg->u.crud.spans.count))
+				return false;
+			f->source = msg->u.crud.source;
+			f->dest = msg->u.crud.dest;
+			f->transaction_uuid = msg->u.crud.transaction_uuid;
+			f->content_type = msg->u.crud.content_type;
+			f->accept = msg->u.crud.accept;
+			f->path = msg->u.crud.path;
+			f->partner_ids = msg->u.crud.partner_ids;
+			f->headers = msg->u.crud.headers;
+			f->metadata = msg->u.crud.metadata;
+			f->payload = msg->u.crud.payload;
+			f->payload_size = msg->u.crud.payload_size;
+			f->has_status = true;
+			f->status = msg->u.crud.status;
+			f->has_rdr = true;
+			f->rdr = msg->u.crud.rdr;
+			break;
+		case WRP_MSG_TYPE__SVC_REGISTRATION:
+			if ((NULL == msg->u.reg.service_name) || (NULL == msg->u.reg.url))
+				return false;
+			f->service_name = msg->u.reg.service_name;
+			f->url = msg->u.reg.url;
+			return true;
+		case WRP_MSG_TYPE__SVC_ALIVE:
+			return true;
+		default:
+			return false;
+	}
+	// req, event and crud msgs must have a source and dest, and
+	// every string of their lists
+	return (NULL != f->source) && (NULL != f->dest) &&
+		((NULL == f->partner_ids) ||
+		 list_complete (f->partner_ids->partner_ids, f->partner_ids->count)) &&
+		((NULL == f->headers) ||
+		 list_complete (f->headers->headers, f->headers->count)) &&
+		metadata_complete (f->metadata);
+}
+
+static void put_msg (wrp_writer_t *w, const wrp_msg_t *msg, wrp_fields_t *f)
+{
+	size_t i, count = 1;
+	bool has_partners = (NULL != f->partner_ids) && (f->partner_ids->count > 0);
+	bool has_headers = (NULL != f->headers) && (f->headers->count > 0);
+	bool has_metadata = (NULL != f->metadata) && (f->metadata->count > 0);
+
+	count += (NULL != f->source) + (NULL != f->dest) +
+		(NULL != f->transaction_uuid) + (NULL != f->content_type) +
+		(NULL != f->accept) + (NULL != f->path) +
+		(NULL != f->service_name) + (NULL != f->url) +
+		has_partners + has_headers + has_metadata +
+		(NULL != f->payload) + f->has_status + f->has_rdr +
+		(NULL != f->ext_key);
+	put_container (w, true, count);
+
+	put_str (w, "msg_type");
+	put_int (w, msg->msg_type);
+	if (NULL != f->service_name)
+		put_str_field (w, "service_name", f->service_name);
+	if (NULL != f->url)
+		put_str_field (w, "url", f->url);
+	if (f->has_status) {
+		put_str (w, "status");
+		put_int (w, f->status);
+	}
+	if (f->has_rdr) {
+		put_str (w, "rdr");
+		put_int (w, f->rdr);
+	}
+	if (NULL != f->source)
+		put_str_field (w, "source", f->source);
+	if (NULL != f->dest)
+		put_str_field (w, "dest", f->dest);
+	if (NULL != f->transaction_uuid)
+		put_str_field (w, "transaction_uuid", f->transaction_uuid);
+	if (NULL != f->content_type)
+		put_str_field (w, "content_type", f->content_type);
+	if (NULL != f->accept)
+		put_str_field (w, "accept", f->accept);
+	if (NULL != f->path)
+		put_str_field (w, "path", f->path);
+	if (has_partners) {
+		put_str (w, "partner_ids");
+		put_container (w, false, f->partner_ids->count);
+		for (i = 0; i < f->partner_ids->count; i++)
+			put_str (w, f->partner_ids->partner_ids[i]);
+	}
+	if (has_headers) {
+		put_str (w, "headers");
+		put_container (w, false, f->headers->count);
+		for (i = 0; i < f->headers->count; i++)
+			put_str (w, f->headers->headers[i]);
+	}
+	if (has_metadata) {
+		put_str (w, "metadata");
+		put_container (w, true, f->metadata->count);
+		for (i = 0; i < f->metadata->count; i++)
+			put_str_field (w, f->metadata->data_items[i].name,
+				f->metadata->data_items[i].value);
+	}
+	if (NULL != f->payload) {
+		put_str (w, "payload");
+		put_bin (w, f->payload, f->payload_size);
+	}
+	if (NULL != f->ext_key)
+		put_str_field (w, f->ext_key, f->ext_val);
+}
+
+size_t libpd_wrp_encoded_size_ext (const wrp_msg_t *msg,
+	const char *ext_key, const char *ext_val)
+{
+	wrp_fields_t fields;
+	wrp_writer_t w = {NULL, 0, 0, false};
+
+	if ((NULL == msg) || !get_fields (msg, &fields))
+		return 0;
+	if ((NULL != ext_key) && (NULL != ext_val)) {
+		fields.ext_key = ext_key;
+		fields.ext_val = ext_val;
+	}
+	put_msg (&w, msg, &fields);
+	return w.len;
+}
+
+size_t libpd_wrp_encoded_size (const wrp_msg_t *msg)
+{
+	return libpd_wrp_encoded_size_ext (msg, NULL, NULL);
+}
+
+ssize_t libpd_wrp_encode_ext (const wrp_msg_t *msg, const char *ext_key,
+	const char *ext_val, void *buf, size_t buf_size)
+{
+	wrp_fields_t fields;
+	wrp_writer_t w = {(unsigned char *) buf, buf_size, 0, false};
+
+	if ((NULL == msg) || (NULL == buf) || !get_fields (msg, &fields))
+		return -1;
+	if ((NULL != ext_key) && (NULL != ext_val)) {
+		fields.ext_key = ext_key;
+		fields.ext_val = ext_val;
+	}
+	put_msg (&w, msg, &fields);
+	if (w.overflow)
+		return -1;
+	return (ssize_t) w.len;
+}
+
+ssize_t libpd_wrp_encode (const wrp_msg_t *msg, void *buf, size_t buf_size)
+{
+	return libpd_wrp_encode_ext (msg, NULL, NULL, buf, buf_size);
+}
+
+/*
+ * Borrowing decoder.
+ *
+ * The decoded msg points into the nanomsg buffer for its strings and
+ * payload. Strings are null terminated in place by overwriting the
+ * byte that follows them, which is always the type byte of the next
+ * msgpack element; the reader keeps the overwritten value so that
+ * element can still be read. A string that ends at the very end of
+ * the buffer has nowhere to put its null, so it is copied.
+ *
+ * The msg, its partner_ids/headers/metadata arrays and any copied
+ * string share one allocation, laid out by a first, read only, pass.
+ * It comes from the caller's pool cache, so decoding a msg normally
+ * doesn't call malloc at all.
+ */
+
+#define BORROW_ALIGN(n) (((n) + 15) & ~((size_t) 15))
+
+typedef struct {
+	void *nn_buf;		// NULL if decoded with wrp_to_struct
+	wrp_msg_t *owned;	// the wrp_to_struct msg, or NULL
+	libpd_pool_t *pool;	// held until the msg is freed, or NULL
+	wrp_msg_t msg;
+} borrowed_msg_t;
+
+static borrowed_msg_t *borrowed_of (wrp_msg_t *msg)
+{
+	return (borrowed_msg_t *) ((char *) msg - offsetof (borrowed_msg_t, msg));
+}
+
+typedef struct {
+	unsigned char *p;
+	unsigned char *end;
+	unsigned char *saved_pos;	// byte overwritten by a null terminator
+	unsigned char saved_val;
+	bool write;			// second pass, terminate strings
+	bool err;
+	char *copy_area;		// for a string at the end of the buffer
+	size_t copy_len;		// first pass: length of that string + 1
+} wrp_reader_t;
+
+typedef struct {
+	int msg_type;
+	char *source;
+	char *dest;
+	char *transaction_uuid;
+	char *content_type;
+	char *accept;
+	char *path;
+	char *service_name;
+	char *url;
+	void *payload;
+	size_t payload_size;
+	int64_t status;
+	int64_t rdr;
+	size_t num_partners;
+	size_t num_headers;
+	size_t num_metadata;
+	partners_t *partner_ids;
+	headers_t *headers;
+	data_t *metadata;
+	bool unhandled;		// has fields we can't borrow (spans)
+} wrp_decode_t;
+
+static unsigned get_byte (wrp_reader_t *r)
+{
+	unsigned c;
+	if (r->p >= r->end) {
+		r->err = true;
+		return 0;
+	}
+	c = (r->p == r->saved_pos) ? r->saved_val : *r->p;
+	r->p++;
+	return c;
+}
+
+static uint64_t get_be (wrp_reader_t *r, unsigned nbytes)
+{
+	uint64_t val = 0;
+	while (nbytes--)
+		val = (val << 8) | get_byte (r);
+	return val;
+}
+
+// Reads a str or bin header. Returns false if the element is not one.
+static bool get_raw_hdr (unsigned c, wrp_reader_t *r, size_t *len, bool *is_str)
+{
+	*is_str = true;
+	if ((c & 0xe0) == 0xa0) {
+		*len = c & 0x1f;
+		return true;
+	}
+	switch (c) {
+		case 0xd9: *len = get_be (r, 1); return true;
+		case 0xda: *len = get_be (r, 2); return true;
+		case 0xdb: *len = get_be (r, 4); return true;
+	}
+	*is_str = false;
+	switch (c) {
+		case 0xc4: *len = get_be (r, 1); return true;
+		case 0xc5: *len = get_be (r, 2); return true;
+		case 0xc6: *len = get_be (r, 4); return true;
+	}
+	return false;
+}
+
+// Reads a str or bin, returning a pointer into the buffer.
+// With null_term, strings are null terminated (on the second pass).
+static char *get_raw (wrp_reader_t *r, size_t *len, bool null_term)
+{
+	unsigned char *data;
+	bool is_str;
+	unsigned c = get_byte (r);
+
+	if (r->err || !get_raw_hdr (c, r, len, &is_str) || r->err ||
+	    ((size_t) (r->end - r->p) < *len)) {
+		r->err = true;
+		return NULL;
+	}
+	data = r->p;
+	r->p += *len;
+	if (!null_term)
+		return (char *) data;
+	if (r->p == r->end) {
+		if (!r->write) {
+			r->copy_len = *len + 1;
+			return (char *) data;
+		}
+		memcpy (r->copy_area, data, *len);
+		r->copy_area[*len] = '\0';
+		return r->copy_area;
+	}
+	if (r->write) {
+		r->saved_pos = r->p;
+		r->saved_val = *r->p;
+		*r->p = '\0';
+	}
+	return (char *) data;
+}
+
+static char *get_str (wrp_reader_t *r)
+{
+	size_t len;
+	return get_raw (r, &len, true);
+}
+
+static int64_t get_int (wrp_reader_t *r)
+{
+	unsigned c = get_byte (r);
+	if (c < 0x80)
+		return c;
+	if (c >= 0xe0)
+		return (int8_t) c;
+	switch (c) {
+		case 0xcc: return (int64_t) get_be (r, 1);
+		case 0xcd: return (int64_t) get_be (r, 2);
+		case 0xce: return (int64_t) get_be (r, 4);
+		case 0xcf: return (int64_t) get_be (r, 8);
+		case 0xd0: return (int8_t) get_be (r, 1);
+		case 0xd1: return (int16_t) get_be (r, 2);
+		case 0xd2: return (int32_t) get_be (r, 4);
+		case 0xd3: return (int64_t) get_be (r, 8);
+	}
+	r->err = true;
+	return 0;
+}
+
+static size_t get_container (wrp_reader_t *r, bool map)
+{
+	unsigned c = get_byte (r);
+	if ((c & 0xf0) == (map ? 0x80u : 0x90u))
+		return c & 0x0f;
+	if (c == (map ? 0xde : 0xdc))
+		return (size_t) get_be (r, 2);
+	if (c == (map ? 0xdf : 0xdd))
+		return (size_t) get_be (r, 4);
+	r->err = true;
+	return 0;
+}
+
+static void skip_element (wrp_reader_t *r, unsigned depth)
+{
+	size_t len, i, n = 0;
+	bool is_str;
+	unsigned c = get_byte (r);
+
+	if (r->err)
+		return;
+	if (depth > 32) {
+		r->err = true;
+		return;
+	}
+	if ((c < 0x80) || (c >= 0xe0) || (c == 0xc0) || (c == 0xc2) || (c == 0xc3))
+		return;
+	if (get_raw_hdr (c, r, &len, &is_str)) {
+		if ((size_t) (r->end - r->p) < len)
+			r->err = true;
+		else
+			r->p += len;
+		return;
+	}
+	if ((c & 0xf0) == 0x80)
+		n = 2 * (c & 0x0f);
+	else if ((c & 0xf0) == 0x90)
+		n = c & 0x0f;
+	else switch (c) {
+		case 0xcc: case 0xd0: r->p += 1; break;
+		case 0xcd: case 0xd1: r->p += 2; break;
+		case 0xce: case 0xd2: case 0xca: r->p += 4; break;
+		case 0xcf: case 0xd3: case 0xcb: r->p += 8; break;
+		case 0xdc: n = (size_t) get_be (r, 2); break;
+		case 0xdd: n = (size_t) get_be (r, 4); break;
+		case 0xde: n = 2 * (size_t) get_be (r, 2); break;
+		case 0xdf: n = 2 * (size_t) get_be (r, 4); break;
+		default: r->err = true; return;
+	}
+	if (r->p > r->end) {
+		r->err = true;
+		return;
+	}
+	for (i = 0; (i < n) && !r->err; i++)
+		skip_element (r, depth + 1);
+}
+
+static bool key_is (const char *key, size_t key_len, const char *name)
+{
+	return (strlen (name) == key_len) && (memcmp (key, name, key_len) == 0);
+}
+
+// One pass over the msgpack map. On the first pass (r->write false)
+// only the array sizes are filled in; on the second the arrays in d
+// have been allocated and everything is filled in.
+static void decode_map (wrp_reader_t *r, wrp_decode_t *d)
+{
+	size_t i, j, n, key_len;
+	char *key;
+
+	n = get_container (r, true);
+	for (i = 0; (i < n) && !r->err; i++) {
+		key = get_raw (r, &key_len, false);
+		if (r->err)
+			break;
+		if (key_is (key, key_len, "msg_type"))
+			d->msg_type = (int) get_int (r);
+		else if (key_is (key, key_len, "source"))
+			d->source = get_str (r);
+		else if (key_is (key, key_len, "dest"))
+			d->dest = get_str (r);
+		else if (key_is (key, key_len, "transaction_uuid"))
+			d->transaction_uuid = get_str (r);
+		else if (key_is (key, key_len, "content_type"))
+			d->content_type = get_str (r);
+		else if (key_is (key, key_len, "accept"))
+			d->accept = get_str (r);
+		else if (key_is (key, key_len, "path"))
+			d->path = get_str (r);
+		else if (key_is (key, key_len, "service_name"))
+			d->service_name = get_str (r);
+		else if (key_is (key, key_len, "url"))
+			d->url = get_str (r);
+		else if (key_is (key, key_len, "status"))
+			d->status = get_int (r);
+		else if (key_is (key, key_len, "rdr"))
+			d->rdr = get_int (r);
+		else if (key_is (key, key_len, "payload"))
+			d->payload = get_raw (r, &d->payload_size, false);
+		else if (key_is (key, key_len, "partner_ids")) {
+			if (!r->write && (0 != d->num_partners))
+				d->unhandled = true;	// sized for one list only
+			d->num_partners = get_container (r, false);
+			for (j = 0; (j < d->num_partners) && !r->err; j++) {
+				char *s = get_str (r);
+				if (r->write)
+					d->partner_ids->partner_ids[j] = s;
+			}
+		} else if (key_is (key, key_len, "headers")) {
+			if (!r->write && (0 != d->num_headers))
+				d->unhandled = true;	// sized for one list only
+			d->num_headers = get_container (r, false);
+			for (j = 0; (j < d->num_headers) && !r->err; j++) {
+				char *s = get_str (r);
+				if (r->write)
+					d->headers->headers[j] = s;
+			}
+		} else if (key_is (key, key_len, "metadata")) {
+			if (!r->write && (0 != d->num_metadata))
+				d->unhandled = true;	// sized for one list only
+			d->num_metadata = get_container (r, true);
+			for (j = 0; (j < d->num_metadata) && !r->err; j++) {
+				char *name = get_str (r);
+				char *value = get_str (r);
+				if (r->write) {
+					d->metadata->data_items[j].name = name;
+					d->metadata->data_items[j].value = value;
+				}
+			}
+		} else {
+			if (key_is (key, key_len, "spans") ||
+			    key_is (key, key_len, "include_spans"))
+				d->unhandled = true;
+			skip_element (r, 0);
+		}
+	}
+}
+
+static bool fill_msg (wrp_decode_t *d, wrp_msg_t *msg)
+{
+	msg->msg_type = (enum wrp_msg_type) d->msg_type;
+	switch (d->msg_type) {
+		case WRP_MSG_TYPE__AUTH:
+			msg->u.auth.status = (int) d->status;
+			return true;
+		case WRP_MSG_TYPE__REQ:
+			msg->u.req.transaction_uuid = d->transaction_uuid;
+			msg->u.req.content_type = d->content_type;
+			msg->u.req.accept = d->accept;
+			msg->u.req.source = d->source;
+			msg->u.req.dest = d->dest;
+			msg->u.req.partner_ids = d->partner_ids;
+			msg->u.req.headers = d->headers;
+			msg->u.req.metadata = d->metadata;
+			msg->u.req.payload = d->payload;
+			msg->u.req.payload_size = d->payload_size;
+			return true;
+		case WRP_MSG_TYPE__EVENT:
+			msg->u.event.content_type = d->content_type;
+			msg->u.event.source = d->source;
+			msg->u.event.dest = d->dest;
+			msg->u.event.partner_ids = d->partner_ids;
+			msg->u.event.headers = d->headers;
+			msg->u.event.metadata = d->metadata;
+			msg->u.event.payload = d->payload;
+			msg->u.event.payload_size = d->payload_size;
+			return true;
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			msg->u.crud.transaction_uuid = d->transaction_uuid;
+			msg->u.crud.content_type = d->content_type;
+			msg->u.crud.accept = d->accept;
+			msg->u.crud.source = d->source;
+			msg->u.crud.dest = d->dest;
+			msg->u.crud.partner_ids = d->partner_ids;
+			msg->u.crud.headers = d->headers;
+			msg->u.crud.metadata = d->metadata;
+			msg->u.crud.status = (int) d->status;
+			msg->u.crud.rdr = (int) d->rdr;
+			msg->u.crud.path = d->path;
+			msg->u.crud.payload = d->payload;
+			msg->u.crud.payload_size = d->payload_size;
+			return true;
+		case WRP_MSG_TYPE__SVC_REGISTRATION:
+			msg->u.reg.service_name = d->service_name;
+			msg->u.reg.url = d->url;
+			return true;
+		case WRP_MSG_TYPE__SVC_ALIVE:
+			return true;
+	}
+	return false;
+}
+
+// decode a msg that can't be borrowed with wrp_to_struct. It's
+// wrapped like a borrowed msg, so it's freed the same way.
+static ssize_t decode_owned (void *buf, size_t len, 
+	libpd_pool_cache_t *cache, wrp_msg_t **msg)
+{
+	borrowed_msg_t *bmsg;
+	wrp_msg_t *owned = NULL;
+	ssize_t rtn = wrp_to_struct (buf, len, WRP_BYTES, &owned);
+
+	if (rtn < 1)
+		return -1;
+	bmsg = (borrowed_msg_t *) libpd_pool_alloc (cache, sizeof (borrowed_msg_t));
+	if (NULL == bmsg) {
+		wrp_free_struct (owned);
+		return -1;
+	}
+	memset ((void*) bmsg, 0, sizeof (borrowed_msg_t));
+	bmsg->owned = owned;
+	bmsg->msg = *owned;
+	if (NULL != cache) {
+		bmsg->pool = cache->pool;
+		libpd_pool_hold (bmsg->pool);
+	}
+	nn_freemsg (buf);
+	*msg = &bmsg->msg;
+	return rtn;
+}
+
+ssize_t libpd_wrp_decode_pooled (void *buf, size_t len, 
+	libpd_pool_cache_t *cache, wrp_msg_t **msg)
+{
+	wrp_reader_t r;
+	wrp_decode_t d;
+	wrp_msg_t probe;
+	borrowed_msg_t *bmsg;
+	size_t partners_off, headers_off, metadata_off, copy_off, block_size;
+	char *block;
+
+	*msg = NULL;
+	if ((NULL == buf) || (0 == len))
+		return -1;
+
+	// first pass: validate and size things
+	memset ((void*) &r, 0, sizeof(r));
+	r.p = (unsigned char *) buf;
+	r.end = r.p + len;
+	memset ((void*) &d, 0, sizeof(d));
+	d.msg_type = -1;
+	decode_map (&r, &d);
+	if (r.err || d.unhandled || !fill_msg (&d, &probe))
+		return decode_owned (buf, len, cache, msg);
+
+	partners_off = BORROW_ALIGN (sizeof (borrowed_msg_t));
+	headers_off = partners_off;
+	if (d.num_partners > 0)
+		headers_off += BORROW_ALIGN (sizeof (partners_t) + d.num_partners * sizeof (char *));
+	metadata_off = headers_off;
+	if (d.num_headers > 0)
+		metadata_off += BORROW_ALIGN (sizeof (headers_t) + d.num_headers * sizeof (char *));
+	copy_off = metadata_off;
+	// data_items starts after the aligned data_t, see the second pass
+	if (d.num_metadata > 0)
+		copy_off += BORROW_ALIGN (sizeof (data_t)) + 
+			BORROW_ALIGN (d.num_metadata * sizeof (struct data));
+	block_size = copy_off + r.copy_len;
+
+	block = (char *) libpd_pool_alloc (cache, block_size);
+	if (NULL == block)
+		return -1;
+	bmsg = (borrowed_msg_t *) block;
+	memset ((void*) bmsg, 0, sizeof (borrowed_msg_t));
+	bmsg->nn_buf = buf;
+
+	// second pass: fill in the msg, terminating strings in place
+	memset ((void*) &d, 0, sizeof(d));
+	d.msg_type = -1;
+	if (headers_off != partners_off)
+		d.partner_ids = (partners_t *) (block + partners_off);
+	if (metadata_off != headers_off)
+		d.headers = (headers_t *) (block + headers_off);
+	if (copy_off != metadata_off) {
+		d.metadata = (data_t *) (block + metadata_off);
+		d.metadata->data_items = (struct data *) (block + metadata_off +
+			BORROW_ALIGN (sizeof (data_t)));
+	}
+	memset ((void*) &r, 0, sizeof(r));
+	r.p = (unsigned char *) buf;
+	r.end = r.p + len;
+	r.write = true;
+	r.copy_area = block + copy_off;
+	decode_map (&r, &d);
+	if (NULL != d.partner_ids)
+		d.partner_ids->count = d.num_partners;
+	if (NULL != d.headers)
+		d.headers->count = d.num_headers;
+	if (NULL != d.metadata)
+		d.metadata->count = d.num_metadata;
+	fill_msg (&d, &bmsg->msg);
+	// the msg holds the pool, so it can be freed after the
+	// pool is destroyed
+	if (NULL != cache) {
+		bmsg->pool = cache->pool;
+		libpd_pool_hold (bmsg->pool);
+	}
+	*msg = &bmsg->msg;
+	return (ssize_t) len;
+}
+
+ssize_t libpd_wrp_decode_borrowed (void *buf, size_t len, wrp_msg_t **msg)
+{
+	return libpd_wrp_decode_pooled (buf, len, NULL, msg);
+}
+
+void libpd_wrp_free_msg (wrp_msg_t *msg)
+{
+	borrowed_msg_t *bmsg;
+	libpd_pool_t *pool;
+
+	if (NULL == msg)
+		return;
+	bmsg = borrowed_of (msg);
+	pool = bmsg->pool;
+	if (NULL != bmsg->owned)
+		wrp_free_struct (bmsg->owned);
+	else
+		nn_freemsg (bmsg->nn_buf);
+	libpd_pool_free (bmsg);
+	libpd_pool_drop (pool);
+}
+
+int libpd_wrp_peek (const void *buf, size_t len, int *msg_type,
+	const char **dest, size_t *dest_len)
+{
+	wrp_reader_t r;
+	size_t i, n, key_len;
+	char *key;
+	bool have_type = false;
+
+	*msg_type = -1;
+	*dest = NULL;
+	*dest_len = 0;
+	if ((NULL == buf) || (0 == len))
+		return -1;
+	memset ((void*) &r, 0, sizeof(r));
+	r.p = (unsigned char *) buf;
+	r.end = r.p + len;
+	n = get_container (&r, true);
+	for (i = 0; (i < n) && !r.err; i++) {
+		key = get_raw (&r, &key_len, false);
+		if (r.err)
+			break;
+		if (key_is (key, key_len, "msg_type")) {
+			*msg_type = (int) get_int (&r);
+			have_type = true;
+		} else if (key_is (key, key_len, "dest")) {
+			*dest = get_raw (&r, dest_len, false);
+		} else {
+			skip_element (&r, 0);
+		}
+		if (have_type && (NULL != *dest))
+			break;
+	}
+	if (r.err || !have_type) {
+		*dest = NULL;
+		*dest_len = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int libpd_wrp_peek_str (const void *buf, size_t len, const char *key,
+	const char **val, size_t *val_len)
+{
+	wrp_reader_t r;
+	size_t i, n, key_len;
+	char *k;
+
+	*val = NULL;
+	*val_len = 0;
+	if ((NULL == buf) || (0 == len))
+		return -1;
+	memset ((void*) &r, 0, sizeof(r));
+	r.p = (unsigned char *) buf;
+	r.end = r.p + len;
+	n = get_container (&r, true);
+	for (i = 0; (i < n) && !r.err; i++) {
+		k = get_raw (&r, &key_len, false);
+		if (r.err)
+			break;
+		if (key_is (k, key_len, key)) {
+			*val = get_raw (&r, val_len, false);
+			break;
+		}
+		skip_element (&r, 0);
+	}
+	if (r.err || (NULL == *val)) {
+		*val = NULL;
+		*val_len = 0;
+		return -1;
+	}
+	return 0;
+}
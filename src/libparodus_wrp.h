@@ -0,0 +1,159 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_WRP_H
+#define  _LIBPARODUS_WRP_H
+
+#include <sys/types.h>
+#include <wrp-c/wrp-c.h>
+#include "libparodus_pool.h"
+
+/*
+ * msgpack encoding of wrp messages into a caller supplied buffer,
+ * so that libparodus can encode straight into a nanomsg buffer.
+ * The encoding is the same msgpack map that wrp_struct_to (WRP_BYTES)
+ * produces, and can be decoded with wrp_to_struct.
+ */
+
+/**
+ * Get the encoded size of a wrp message
+ *
+ * @param msg wrp message
+ * @return number of bytes libpd_wrp_encode will write, or 0 if
+ *   the message is not handled here (unknown msg type, invalid message,
+ *   a NULL string in one of its lists, or money trace spans) and
+ *   wrp_struct_to should be used instead.
+ */
+size_t libpd_wrp_encoded_size (const wrp_msg_t *msg);
+
+/**
+ * Encode a wrp message into a buffer
+ *
+ * @param msg wrp message
+ * @param buf buffer to encode into
+ * @param buf_size size of buf, normally from libpd_wrp_encoded_size
+ * @return number of bytes written, or -1 if the message is not
+ *   handled here or buf is too small.
+ */
+ssize_t libpd_wrp_encode (const wrp_msg_t *msg, void *buf, size_t buf_size);
+
+/**
+ * Get the encoded size of a wrp message with an extra string field
+ *
+ * @param msg wrp message
+ * @param ext_key key of the extra field, or NULL for none
+ * @param ext_val value of the extra field, or NULL for none
+ * @return the same as libpd_wrp_encoded_size
+ */
+size_t libpd_wrp_encoded_size_ext (const wrp_msg_t *msg,
+	const char *ext_key, const char *ext_val);
+
+/**
+ * Encode a wrp message with an extra string field
+ *
+ * The extra field goes last in the msgpack map. wrp_to_struct, and
+ * the decoder here, skip keys they don't know, so it is only seen
+ * by a peer that looks for it with libpd_wrp_peek_str.
+ *
+ * @param msg wrp message
+ * @param ext_key key of the extra field, or NULL for none
+ * @param ext_val value of the extra field, or NULL for none
+ * @param buf buffer to encode into
+ * @param buf_size size of buf, normally from libpd_wrp_encoded_size_ext
+ * @return the same as libpd_wrp_encode
+ */
+ssize_t libpd_wrp_encode_ext (const wrp_msg_t *msg, const char *ext_key,
+	const char *ext_val, void *buf, size_t buf_size);
+
+/**
+ * Decode a wrp message from a nanomsg buffer without copying
+ *
+ * The strings and payload of the decoded message point into buf,
+ * which the message takes ownership of. Messages this decoder can't
+ * borrow from (money trace spans) are decoded with wrp_to_struct,
+ * wrapped the same way, and buf is freed. Either way the message must
+ * be freed with libpd_wrp_free_msg. The payload is not null terminated.
+ *
+ * @param buf buffer from nn_recv (NN_MSG)
+ * @param len length of buf
+ * @param msg decoded message
+ * @return len, or -1 if the message could not be decoded, in
+ *   which case the caller still owns buf.
+ */
+ssize_t libpd_wrp_decode_borrowed (void *buf, size_t len, wrp_msg_t **msg);
+
+/**
+ * Decode a wrp message without copying, allocating from a pool
+ *
+ * The same as libpd_wrp_decode_borrowed, except that the message is
+ * allocated through a pool cache. It is still freed with
+ * libpd_wrp_free_msg, from any thread. The message holds the pool
+ * until it is freed, so it may be freed after the pool is destroyed.
+ *
+ * @param buf buffer from nn_recv (NN_MSG)
+ * @param len length of buf
+ * @param cache pool cache of the calling thread, or NULL to use malloc
+ * @param msg decoded message
+ * @return the same as libpd_wrp_decode_borrowed
+ */
+ssize_t libpd_wrp_decode_pooled (void *buf, size_t len, 
+	libpd_pool_cache_t *cache, wrp_msg_t **msg);
+
+/**
+ * Free a message from libpd_wrp_decode_borrowed
+ *
+ * Only messages from libpd_wrp_decode_borrowed or
+ * libpd_wrp_decode_pooled may be freed here. A message from
+ * wrp_to_struct must be freed with wrp_free_struct.
+ *
+ * @param msg message to free, or NULL
+ */
+void libpd_wrp_free_msg (wrp_msg_t *msg);
+
+/**
+ * Get the msg type and dest of an encoded wrp message without decoding it
+ *
+ * Nothing is allocated, so the receiver can drop keep alives and
+ * messages for other services before paying for a full decode.
+ *
+ * @param buf encoded message
+ * @param len length of buf
+ * @param msg_type receives the msg type
+ * @param dest receives a pointer to the dest in buf (not null
+ *   terminated), or NULL if the message has no dest
+ * @param dest_len receives the length of dest
+ * @return 0 on success, or -1 if the message could not be scanned
+ *   and must be decoded to find out.
+ */
+int libpd_wrp_peek (const void *buf, size_t len, int *msg_type,
+	const char **dest, size_t *dest_len);
+
+/**
+ * Find a string field of an encoded wrp message without decoding it
+ *
+ * @param buf encoded message
+ * @param len length of buf
+ * @param key key of the field
+ * @param val receives a pointer to the value in buf (not null
+ *   terminated), or NULL
+ * @param val_len receives the length of val
+ * @return 0 if found, or -1 if the message has no such field or
+ *   could not be scanned.
+ */
+int libpd_wrp_peek_str (const void *buf, size_t len, const char *key,
+	const char **val, size_t *val_len);
+
+#endif
@@ -31,7 +31,20 @@
 #include "../src/libparodus_private.h"
 #include "../src/libparodus_time.h"
 #include "../src/libparodus_queues.h"
+#include "../src/libparodus_wrp.h"
+#include "../src/libparodus_latency.h"
+#include "../src/libparodus_routes.h"
+#include "../src/libparodus_workers.h"
+#include "../src/libparodus_ipc.h"
+#include "../src/libparodus_shm.h"
+#include "../src/libparodus_pool.h"
+#include "../src/libparodus_requests.h"
 #include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
 
 
 #define MOCK_MSG_COUNT 10
@@ -50,6 +63,7 @@
 #define BAD_CLIENT_URL "tcp://127.0.0.1:X006"
 #define GOOD_CLIENT_URL "tcp://127.0.0.1:6667"
 #define GOOD_CLIENT_URL2 "tcp://127.0.0.1:6665"
+#define ZERO_COPY_CLIENT_URL "tcp://127.0.0.1:6664"
 //#define PARODUS_URL "ipc:///tmp/parodus_server.ipc"
 //#define UNAVAIL_PARODUS_URL "tcp://10.172.47.109:6666"
 #define TEST_SEND_URL  "tcp://127.0.0.1:6007"
@@ -57,6 +71,15 @@
 #define BAD_PARODUS_URL "tcp://127.0.0.1:x007"
 #define GOOD_PARODUS_URL "tcp://127.0.0.1:6666"
 #define CONNECT_ON_EVERY_SEND_URL "test:tcp://127.0.0.1:6666"
+#define REQUEST_PARODUS_URL "tcp://127.0.0.1:6686"
+#define MULTI_PARODUS_URL "tcp://127.0.0.1:6687"
+#define LOCAL_PARODUS_URL "tcp://127.0.0.1:6688"
+#define IPC_PARODUS_URL "ipc:///tmp/libpd_test_parodus.ipc"
+#define IPC_TEST_PATH "/tmp/libpd_test_ipc.ipc"
+#define SHM_PARODUS_URL "tcp://127.0.0.1:6689"
+#define RECONNECT_PARODUS_URL "tcp://127.0.0.1:6690"
+#define WATCHDOG_PARODUS_URL "tcp://127.0.0.1:6691"
+#define SHUTDOWN_PARODUS_URL "tcp://127.0.0.1:6692"
 //#define CLIENT_URL "ipc:///tmp/parodus_client.ipc"
 
 static char current_dir_buf[256];
@@ -110,7 +133,7 @@ static libpd_instance_t test_instance2;
 
 // libparodus functions to be tested
 extern void test_set_cfg (libpd_cfg_t *new_cfg);
-extern int flush_wrp_queue (libpd_mq_t wrp_queue, uint32_t delay_ms, int *oserr);
+extern int flush_wrp_queue (libpd_mq_t wrp_queue);
 extern int connect_receiver 
 	(const char *rcv_url, int keepalive_timeout_secs, int *oserr);
 extern int connect_sender (const char *send_url, int *oserr);
@@ -119,6 +142,8 @@ extern void shutdown_socket (int *sock);
 extern bool is_auth_received (void);
 extern int libparodus_receive__ (libpd_mq_t wrp_queue, 
 	wrp_msg_t **msg, uint32_t ms, int *oserr);
+extern int libparodus_receive_batch__ (libpd_mq_t wrp_queue, 
+	wrp_msg_t **msgs, size_t max, uint32_t ms, size_t *count, int *oserr);
 
 // libparodus_log functions to be tested
 extern int get_valid_file_num (const char *file_name, const char *date);
@@ -410,272 +435,3181 @@ int send_event_msgs (unsigned *msg_num, unsigned *event_num, int count,
 	return 0;
 }
 
+static unsigned async_done_count = 0;
+static unsigned async_err_count = 0;
+
+static void async_send_done (int rtn, void *ctx)
+{
+	unsigned *event_num = (unsigned *) ctx;
+	if (rtn == 0)
+		async_done_count++;
+	else
+		async_err_count++;
+	free (event_num);
+}
+
+void test_send_async (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance;
+	libpd_cfg_t async_cfg = *cfg;
+	char payload_buf[64];
+	unsigned *event_num;
+	unsigned i, queued = 0;
+	wrp_msg_t msg;
+	int rtn;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Send Async Test\n"));
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "---LIBPARODUS---";
+	msg.u.event.dest = "---ParodusService---";
+	msg.u.event.payload = (void*) payload_buf;
+
+	async_cfg.receive = false;
+	async_cfg.send_queue_size = 0;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &async_cfg) == 0);
+	CU_ASSERT (libparodus_send_async (instance, &msg, NULL, NULL) 
+		== LIBPD_ERROR_SEND_ASYNC_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	async_cfg.send_queue_size = 10;
+	async_done_count = 0;
+	async_err_count = 0;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &async_cfg) == 0);
+	for (i=0; i<50; i++) {
+		sprintf (payload_buf, "---AsyncEventPayload %u", i);
+		msg.u.event.payload_size = strlen (payload_buf) + 1;
+		if ((i % 5) == 0) {
+			rtn = libparodus_send_async (instance, &msg, NULL, NULL);
+			CU_ASSERT ((rtn == 0) || (rtn == LIBPD_ERROR_SEND_QUEUE_FULL));
+			continue;
+		}
+		event_num = (unsigned *) malloc (sizeof (unsigned));
+		*event_num = i;
+		rtn = libparodus_send_async (instance, &msg, async_send_done, event_num);
+		if (rtn == LIBPD_ERROR_SEND_QUEUE_FULL) {
+			delay_ms (10);
+			rtn = libparodus_send_async (instance, &msg, async_send_done, event_num);
+		}
+		if (rtn == 0)
+			queued++;
+		else
+			free (event_num);
+	}
+	CU_ASSERT (queued > 0);
+	// shutdown sends whatever is still on the send queue
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (async_done_count == queued);
+	CU_ASSERT (async_err_count == 0);
+	CU_ASSERT (libparodus_send_async (instance, &msg, NULL, NULL) 
+		== LIBPD_ERROR_SEND_NULL_INST);
+}
+
+static bool fd_readable (int fd)
+{
+	struct pollfd pfd = {.fd = fd, .events = POLLIN};
+	return poll (&pfd, 1, 0) == 1;
+}
+
+void test_receive_fd (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance;
+	libpd_cfg_t fd_cfg = *cfg;
+	wrp_msg_t *wrp_msg;
+	int fd, rtn, i;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Receive FD Test\n"));
+	CU_ASSERT (libparodus_get_fd (NULL) == LIBPD_ERROR_RCV_NULL_INST);
+	fd_cfg.receive = true;
+	fd_cfg.receive_fd = false;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &fd_cfg) == 0);
+	CU_ASSERT (libparodus_get_fd (instance) == LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	fd_cfg.receive_fd = true;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &fd_cfg) == 0);
+	fd = libparodus_get_fd (instance);
+	CU_ASSERT_FATAL (fd >= 0);
+	CU_ASSERT (libparodus_close_receiver (instance) == 0);
+	CU_ASSERT (fd_readable (fd));
+	// anything parodus sent us comes ahead of the closed msg
+	for (i=0; i<100; i++) {
+		rtn = libparodus_try_receive (instance, &wrp_msg);
+		if (rtn != 0)
+			break;
+		libparodus_free_msg (instance, wrp_msg);
+	}
+	CU_ASSERT (rtn == 2);
+	CU_ASSERT (!fd_readable (fd));
+	CU_ASSERT (libparodus_try_receive (instance, &wrp_msg) == 1);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+}
+
+static pthread_mutex_t handler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handler_cond = PTHREAD_COND_INITIALIZER;
+static unsigned handler_count = 0;
+static bool check_handler_order = false;
+
+static int client_msg_num (wrp_msg_t *msg);
+
+static void test_msg_handler_cb (libpd_instance_t instance, wrp_msg_t *msg, void *ctx)
+{
+	int num;
+
+	CU_ASSERT (ctx == (void *) &handler_count);
+	CU_ASSERT (msg->msg_type == WRP_MSG_TYPE__REQ);
+	num = client_msg_num (msg);
+	libparodus_free_msg (instance, msg);
+	pthread_mutex_lock (&handler_mutex);
+	if (check_handler_order)
+		CU_ASSERT (num == (int) handler_count);
+	handler_count++;
+	pthread_cond_broadcast (&handler_cond);
+	pthread_mutex_unlock (&handler_mutex);
+}
+
+// plays the part of parodus, sending a request (or an event)
+// straight to the client
+static int send_msg_to_client (int sock, int msg_type, const char *dest, 
+	unsigned num)
+{
+	wrp_msg_t msg;
+	char uuid[32];
+	size_t len;
+	void *buf;
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	sprintf (uuid, "handler-test-%u", num);
+	msg.msg_type = msg_type;
+	if (msg_type == WRP_MSG_TYPE__EVENT) {
+		msg.u.event.source = "dns:mock-parodus/test";
+		msg.u.event.dest = (char *) dest;
+		msg.u.event.content_type = uuid;
+		msg.u.event.payload = "---HandlerPayload---";
+		msg.u.event.payload_size = 20;
+	} else {
+		msg.u.req.transaction_uuid = uuid;
+		msg.u.req.source = "dns:mock-parodus/test";
+		msg.u.req.dest = (char *) dest;
+		msg.u.req.payload = "---HandlerPayload---";
+		msg.u.req.payload_size = 20;
+	}
+	len = libpd_wrp_encoded_size (&msg);
+	buf = nn_allocmsg (len, 0);
+	if (NULL == buf)
+		return -1;
+	libpd_wrp_encode (&msg, buf, len);
+	if (nn_send (sock, &buf, NN_MSG, 0) != (int) len) {
+		nn_freemsg (buf);
+		return -1;
+	}
+	return 0;
+}
+
+static int send_req_to_client (int sock, const char *dest, unsigned num)
+{
+	return send_msg_to_client (sock, WRP_MSG_TYPE__REQ, dest, num);
+}
+
+// the number in the uuid (or content type) of a msg from send_msg_to_client
+static int client_msg_num (wrp_msg_t *msg)
+{
+	const char *id = (msg->msg_type == WRP_MSG_TYPE__EVENT) ?
+		msg->u.event.content_type : msg->u.req.transaction_uuid;
+	if (strncmp (id, "handler-test-", 13) != 0)
+		return -1;
+	return atoi (id + 13);
+}
+
+void test_msg_handler (libpd_cfg_t *cfg, unsigned threads, 
+	libpd_handler_order_t order)
+{
+	#define NUM_HANDLER_MSGS 20
+	libpd_instance_t instance;
+	libpd_cfg_t handler_cfg = *cfg;
+	wrp_msg_t *wrp_msg;
+	char dest[64];
+	struct timespec ts;
+	libpd_latency_stats_t stats;
+	libpd_stats_t counts;
+	unsigned i;
+	int sock;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Msg Handler Test, %u threads, order %d\n", 
+		threads, order));
+	handler_cfg.receive = true;
+	handler_cfg.client_url = GOOD_CLIENT_URL;
+	handler_cfg.msg_handler = test_msg_handler_cb;
+	handler_cfg.msg_handler_ctx = (void *) &handler_count;
+	handler_cfg.msg_handler_threads = threads;
+	if (order != LIBPD_ORDER_NONE) {
+		libpd_priority_rule_t rule = {.msg_type = 0, .dest_prefix = NULL, .priority = 0};
+		handler_cfg.msg_handler_order = (libpd_handler_order_t) 99;
+		CU_ASSERT (libparodus_init (&instance, &handler_cfg) == LIBPD_ERROR_INIT_CFG);
+		CU_ASSERT (libparodus_shutdown (&instance) == 0);
+		handler_cfg.msg_handler_order = order;
+		handler_cfg.priority_rules = &rule;
+		handler_cfg.num_priority_rules = 1;
+		CU_ASSERT (libparodus_init (&instance, &handler_cfg) == LIBPD_ERROR_INIT_CFG);
+		CU_ASSERT (libparodus_shutdown (&instance) == 0);
+		handler_cfg.num_priority_rules = 0;
+		handler_cfg.receive_overflow = LIBPD_OVERFLOW_DROP_OLDEST;
+		CU_ASSERT (libparodus_init (&instance, &handler_cfg) == LIBPD_ERROR_INIT_CFG);
+		CU_ASSERT (libparodus_shutdown (&instance) == 0);
+		handler_cfg.receive_overflow = LIBPD_OVERFLOW_BLOCK;
+	}
+	// all the msgs have the same dest, so they are handled in order
+	// unless they go to a pool without an order
+	check_handler_order = (threads == 0) || (order == LIBPD_ORDER_BY_DEST);
+	handler_count = 0;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &handler_cfg) == 0);
+	CU_ASSERT (libparodus_receive (instance, &wrp_msg, 0) == LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_close_receiver (instance) == LIBPD_ERROR_CLOSE_RCV_CFG);
+
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	// not for us, so dropped by the receiver ahead of the msgs that are
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566/other", 
+		NUM_HANDLER_MSGS) == 0);
+	sprintf (dest, "mac:112233445566/%s/handler", handler_cfg.service_name);
+	for (i=0; i<NUM_HANDLER_MSGS; i++)
+		CU_ASSERT (send_req_to_client (sock, dest, i) == 0);
+
+	get_expire_time (5000, &ts);
+	pthread_mutex_lock (&handler_mutex);
+	while (handler_count < NUM_HANDLER_MSGS) {
+		if (pthread_cond_timedwait (&handler_cond, &handler_mutex, &ts) != 0)
+			break;
+	}
+	pthread_mutex_unlock (&handler_mutex);
+	CU_ASSERT (handler_count == NUM_HANDLER_MSGS);
+	CU_ASSERT (libparodus_get_latency_stats (instance, NULL) == LIBPD_ERROR_STATS_PARAM);
+	CU_ASSERT (libparodus_get_latency_stats (instance, &stats) == 0);
+	// the msg for another service isn't timed
+	CU_ASSERT (stats.receive.count == NUM_HANDLER_MSGS);
+	CU_ASSERT (stats.queue_wait.count == ((threads > 0) ? NUM_HANDLER_MSGS : 0));
+	CU_ASSERT (stats.receive.p50_ns <= stats.receive.p99_ns);
+	CU_ASSERT (stats.receive.p99_ns <= stats.receive.max_ns);
+	CU_ASSERT (stats.encode.count > 0); // registration msg
+	CU_ASSERT (stats.send.count > 0);
+	CU_ASSERT (libparodus_get_stats (instance, NULL) == LIBPD_ERROR_STATS_PARAM);
+	CU_ASSERT (libparodus_get_stats (instance, &counts) == 0);
+	CU_ASSERT (counts.msgs_received == NUM_HANDLER_MSGS);
+	CU_ASSERT (counts.msgs_dropped >= 1);
+	CU_ASSERT (counts.bytes_received > 0);
+	CU_ASSERT (counts.decode_errors == 0);
+	CU_ASSERT (counts.queue_full == 0);
+	CU_ASSERT (counts.msgs_sent >= 1); // registration msg
+	CU_ASSERT (counts.bytes_sent > 0);
+	if (threads > 0) {
+		CU_ASSERT (counts.queue_high_water >= 1);
+		CU_ASSERT (counts.queue_high_water <= counts.queue_size);
+	} else {
+		CU_ASSERT (counts.queue_high_water == 0);
+		CU_ASSERT (counts.queue_size == 0);
+	}
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (libparodus_get_stats (instance, &counts) == LIBPD_ERROR_STATS_NULL_INST);
+	CU_ASSERT (libparodus_get_latency_stats (instance, &stats) == LIBPD_ERROR_STATS_NULL_INST);
+	CU_ASSERT (handler_count == NUM_HANDLER_MSGS);
+	nn_close (sock);
+}
+
+static void test_route_cb (libpd_instance_t instance, wrp_msg_t *msg, void *ctx)
+{
+	libparodus_free_msg (instance, msg);
+	pthread_mutex_lock (&handler_mutex);
+	(*(unsigned *) ctx)++;
+	handler_count++;
+	pthread_cond_broadcast (&handler_cond);
+	pthread_mutex_unlock (&handler_mutex);
+}
+
+static void test_route_find (libpd_routes_t routes, const char *path,
+	libpd_msg_handler_t *handler, void *ctx)
+{
+	void *found_ctx = NULL;
+
+	CU_ASSERT (libpd_routes_find (routes, path, strlen (path), &found_ctx) 
+		== handler);
+	if (NULL != handler)
+		CU_ASSERT (found_ctx == ctx);
+}
+
+void test_routes (void)
+{
+	libpd_routes_t routes;
+	unsigned counts[4];
+
+	CU_ASSERT_FATAL (libpd_routes_create (&routes) == 0);
+	test_route_find (routes, "/config", NULL, NULL);
+	CU_ASSERT (libpd_routes_add (routes, "/config/*", test_route_cb, &counts[0]) == 0);
+	CU_ASSERT (libpd_routes_add (routes, "config/wifi", test_route_cb, &counts[1]) == 0);
+	CU_ASSERT (libpd_routes_add (routes, "/", test_route_cb, &counts[2]) == 0);
+	CU_ASSERT (libpd_routes_add (routes, "/config/wifi/", test_route_cb, &counts[3]) 
+		== LIBPD_ROUTEERR_DUP);
+	CU_ASSERT (libpd_routes_add (routes, "/*/wifi", test_route_cb, &counts[3]) 
+		== LIBPD_ROUTEERR_PATH);
+	CU_ASSERT (libpd_routes_add (routes, NULL, test_route_cb, &counts[3]) 
+		== LIBPD_ROUTEERR_PATH);
+	CU_ASSERT (libpd_routes_add (routes, "/status", NULL, &counts[3]) 
+		== LIBPD_ROUTEERR_PATH);
+	test_route_find (routes, "/config/wifi", test_route_cb, &counts[1]);
+	test_route_find (routes, "/config//wifi/", test_route_cb, &counts[1]);
+	test_route_find (routes, "/config/wifi/ssid", test_route_cb, &counts[0]);
+	test_route_find (routes, "/config/lan", test_route_cb, &counts[0]);
+	test_route_find (routes, "/config", NULL, NULL);
+	test_route_find (routes, "/configs/wifi", NULL, NULL);
+	test_route_find (routes, "", test_route_cb, &counts[2]);
+	test_route_find (routes, "/", test_route_cb, &counts[2]);
+	// "/*" is the catch all, but doesn't match the empty path
+	CU_ASSERT (libpd_routes_add (routes, "/*", test_route_cb, &counts[3]) == 0);
+	test_route_find (routes, "/configs/wifi", test_route_cb, &counts[3]);
+	test_route_find (routes, "/config", test_route_cb, &counts[3]);
+	test_route_find (routes, "/config/lan", test_route_cb, &counts[0]);
+	test_route_find (routes, "/", test_route_cb, &counts[2]);
+	libpd_routes_destroy (&routes);
+	CU_ASSERT (NULL == routes);
+	test_route_find (routes, "/config/lan", NULL, NULL);
+}
+
+void test_route_handler (libpd_cfg_t *cfg, unsigned threads)
+{
+	#define NUM_ROUTE_MSGS 5
+	static const char *paths[NUM_ROUTE_MSGS] = {"/config/wifi", 
+		"/config/wifi/ssid", "/config/lan", "", "/status"};
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t route_cfg = *cfg;
+	unsigned counts[3] = {0, 0, 0};
+	wrp_msg_t *wrp_msg;
+	char dest[64];
+	struct timespec ts;
+	unsigned i;
+	int sock;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Route Handler Test, %u threads\n", threads));
+	CU_ASSERT (libparodus_add_route (NULL, "/config/*", test_route_cb, &counts[0]) 
+		== LIBPD_ERROR_ROUTE_NULL_INST);
+	CU_ASSERT (strcmp (libparodus_strerror (LIBPD_ERROR_ROUTE_DUP), 
+		"Error on libparodus add route. Path already has a route.") == 0);
+	route_cfg.receive = false;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &route_cfg) == 0);
+	CU_ASSERT (libparodus_add_route (instance, "/config/*", test_route_cb, &counts[0]) 
+		== LIBPD_ERROR_ROUTE_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	route_cfg.receive = true;
+	route_cfg.client_url = GOOD_CLIENT_URL;
+	route_cfg.msg_handler_threads = threads;
+	handler_count = 0;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &route_cfg) == 0);
+	CU_ASSERT (libparodus_add_route (instance, "/config/*", test_route_cb, &counts[0]) == 0);
+	CU_ASSERT (libparodus_add_route (instance, "/config/wifi", test_route_cb, &counts[1]) == 0);
+	CU_ASSERT (libparodus_add_route (instance, "/", test_route_cb, &counts[2]) == 0);
+	CU_ASSERT (libparodus_add_route (instance, "/config/*", test_route_cb, &counts[2]) 
+		== LIBPD_ERROR_ROUTE_DUP);
+	CU_ASSERT (libparodus_add_route (instance, "/*/wifi", test_route_cb, &counts[2]) 
+		== LIBPD_ERROR_ROUTE_PARAM);
+	CU_ASSERT (libparodus_add_route (instance, "/status", NULL, NULL) 
+		== LIBPD_ERROR_ROUTE_PARAM);
+
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	for (i=0; i<NUM_ROUTE_MSGS; i++) {
+		sprintf (dest, "mac:112233445566/%s%s", route_cfg.service_name, paths[i]);
+		CU_ASSERT (send_req_to_client (sock, dest, i) == 0);
+	}
+	// with no msg_handler, msgs that match no route are received as usual
+	CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 4);
+	libparodus_free_msg (instance, wrp_msg);
+
+	get_expire_time (5000, &ts);
+	pthread_mutex_lock (&handler_mutex);
+	while (handler_count < NUM_ROUTE_MSGS - 1) {
+		if (pthread_cond_timedwait (&handler_cond, &handler_mutex, &ts) != 0)
+			break;
+	}
+	pthread_mutex_unlock (&handler_mutex);
+	CU_ASSERT (handler_count == NUM_ROUTE_MSGS - 1);
+	CU_ASSERT (counts[0] == 2);
+	CU_ASSERT (counts[1] == 1);
+	CU_ASSERT (counts[2] == 1);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (libparodus_add_route (instance, "/status", test_route_cb, &counts[0]) 
+		== LIBPD_ERROR_ROUTE_NULL_INST);
+	nn_close (sock);
+}
+
+// receives a registration msg on the parodus side. Returns the service
+// name, or NULL, and sets *url to the registered url unless url is NULL.
+// Both must be freed.
+static char *receive_registration (int sock, char **url)
+{
+	wrp_msg_t *msg;
+	char *name = NULL;
+	void *buf = NULL;
+	int rtn = nn_recv (sock, &buf, NN_MSG, 0);
+
+	if (rtn < 0)
+		return NULL;
+	rtn = (int) wrp_to_struct (buf, rtn, WRP_BYTES, &msg);
+	nn_freemsg (buf);
+	if (rtn < 1)
+		return NULL;
+	if (msg->msg_type == WRP_MSG_TYPE__SVC_REGISTRATION) {
+		name = strdup (msg->u.reg.service_name);
+		if (NULL != url)
+			*url = strdup (msg->u.reg.url);
+	}
+	wrp_free_struct (msg);
+	return name;
+}
+
+void test_multi_service (libpd_cfg_t *cfg)
+{
+	// "conf" is a prefix of the primary service name
+	static const char *extra_names[3] = {"svc-a", "svc-b", "conf"};
+	static const char *bad_names[1] = {"svc/a"};
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t multi_cfg = *cfg;
+	libpd_stats_t stats;
+	unsigned route_count = 0;
+	wrp_msg_t *wrp_msg;
+	struct timespec ts;
+	char *name;
+	char dest[64];
+	int parodus_sock, sock, i;
+	int timeout = 1000;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Multi Service Test\n"));
+	multi_cfg.receive = false;
+	multi_cfg.extra_service_names = extra_names;
+	multi_cfg.num_extra_services = 2;
+	CU_ASSERT (libparodus_init (&instance, &multi_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	multi_cfg.receive = true;
+	multi_cfg.extra_service_names = bad_names;
+	multi_cfg.num_extra_services = 1;
+	CU_ASSERT (libparodus_init (&instance, &multi_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	parodus_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (parodus_sock >= 0);
+	CU_ASSERT (nn_setsockopt (parodus_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (parodus_sock, MULTI_PARODUS_URL) >= 0);
+	multi_cfg.parodus_url = MULTI_PARODUS_URL;
+	multi_cfg.client_url = GOOD_CLIENT_URL;
+	multi_cfg.service_name = "config";
+	multi_cfg.extra_service_names = extra_names;
+	multi_cfg.num_extra_services = 3;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &multi_cfg) == 0);
+	// every service is registered at the one client url
+	for (i=0; i<4; i++) {
+		name = receive_registration (parodus_sock, NULL);
+		CU_ASSERT_FATAL (NULL != name);
+		CU_ASSERT (strcmp (name, (i == 0) ? multi_cfg.service_name : extra_names[i-1]) == 0);
+		free (name);
+	}
+	CU_ASSERT (libparodus_add_service_route (instance, "svc-b", "/cfg", 
+		test_route_cb, &route_count) == 0);
+	CU_ASSERT (libparodus_add_service_route (instance, "svc-c", "/cfg", 
+		test_route_cb, &route_count) == LIBPD_ERROR_ROUTE_PARAM);
+	CU_ASSERT (libparodus_receive_service (instance, "svc-c", &wrp_msg, 0) 
+		== LIBPD_ERROR_RCV_PARAM);
+	CU_ASSERT (libparodus_receive_service (NULL, "svc-a", &wrp_msg, 0) 
+		== LIBPD_ERROR_RCV_NULL_INST);
+
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	sprintf (dest, "mac:112233445566/%s/x", multi_cfg.service_name);
+	CU_ASSERT (send_req_to_client (sock, dest, 0) == 0);
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566/svc-a/x", 1) == 0);
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566/svc-b/cfg", 2) == 0);
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566/svc-c/x", 3) == 0);
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566/svc-a/y", 4) == 0);
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566//x", 5) == 0);
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566/configx/x", 6) == 0);
+	CU_ASSERT (send_req_to_client (sock, "mac:112233445566/conf/x", 7) == 0);
+
+	CU_ASSERT_FATAL (libparodus_receive_service (instance, "svc-a", &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 1);
+	libparodus_free_msg (instance, wrp_msg);
+	CU_ASSERT_FATAL (libparodus_receive_service (instance, "svc-a", &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 4);
+	libparodus_free_msg (instance, wrp_msg);
+	CU_ASSERT_FATAL (libparodus_receive_service (instance, "conf", &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 7);
+	libparodus_free_msg (instance, wrp_msg);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 0);
+	libparodus_free_msg (instance, wrp_msg);
+	// the empty service and the one the primary name is a prefix of
+	// are dropped, along with svc-c
+	CU_ASSERT (libparodus_receive (instance, &wrp_msg, 100) == 1);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.msgs_dropped == 3);
+	CU_ASSERT (libparodus_receive_service (instance, "svc-b", &wrp_msg, 100) == 1);
+
+	get_expire_time (5000, &ts);
+	pthread_mutex_lock (&handler_mutex);
+	while (route_count < 1) {
+		if (pthread_cond_timedwait (&handler_cond, &handler_mutex, &ts) != 0)
+			break;
+	}
+	pthread_mutex_unlock (&handler_mutex);
+	CU_ASSERT (route_count == 1);
+
+	CU_ASSERT (libparodus_close_receiver (instance) == 0);
+	CU_ASSERT (libparodus_receive_service (instance, "svc-b", &wrp_msg, 500) == 2);
+	CU_ASSERT (libparodus_receive_service (instance, multi_cfg.service_name, 
+		&wrp_msg, 500) == 2);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	nn_close (sock);
+	nn_close (parodus_sock);
+}
+
+// makes a unix domain socket file at path, either listening, or left
+// behind by a socket that is gone
+static int make_ipc_socket (const char *path, bool listening)
+{
+	struct sockaddr_un addr;
+	int sock = socket (AF_UNIX, SOCK_STREAM, 0);
+
+	if (sock < 0)
+		return -1;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+	if ((bind (sock, (struct sockaddr *) &addr, sizeof (addr)) != 0) ||
+	    (listening && (listen (sock, 1) != 0))) {
+		close (sock);
+		return -1;
+	}
+	if (listening)
+		return sock;
+	close (sock);
+	return 0;
+}
+
+void test_ipc (void)
+{
+	char long_path[sizeof (((struct sockaddr_un *) NULL)->sun_path) + 1];
+	struct stat st;
+	char *url;
+	mode_t old_mask;
+	unsigned mask;
+	int oserr, sock, fd;
+
+	CU_ASSERT (libpd_ipc_path (NULL) == NULL);
+	CU_ASSERT (libpd_ipc_path ("tcp://127.0.0.1:6667") == NULL);
+	CU_ASSERT (strcmp (libpd_ipc_path ("ipc:///tmp/x.ipc"), "/tmp/x.ipc") == 0);
+	url = libpd_ipc_client_url ("/tmp", "config/svc 1");
+	CU_ASSERT_FATAL (NULL != url);
+	CU_ASSERT (strcmp (url, "ipc:///tmp/parodus_client_config_svc_1.ipc") == 0);
+	free (url);
+
+	unlink (IPC_TEST_PATH);
+	CU_ASSERT (libpd_ipc_clean (IPC_TEST_PATH, &oserr) == 0);
+	// a socket file nobody is listening on is removed
+	CU_ASSERT_FATAL (make_ipc_socket (IPC_TEST_PATH, false) == 0);
+	CU_ASSERT (access (IPC_TEST_PATH, F_OK) == 0);
+	CU_ASSERT (libpd_ipc_clean (IPC_TEST_PATH, &oserr) == 0);
+	CU_ASSERT (access (IPC_TEST_PATH, F_OK) != 0);
+	// one somebody is listening on is not
+	sock = make_ipc_socket (IPC_TEST_PATH, true);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (libpd_ipc_clean (IPC_TEST_PATH, &oserr) == LIBPD_IPCERR_IN_USE);
+	CU_ASSERT (oserr == EADDRINUSE);
+	CU_ASSERT (libpd_ipc_set_mode (IPC_TEST_PATH, 0600, &oserr) == 0);
+	CU_ASSERT (stat (IPC_TEST_PATH, &st) == 0);
+	CU_ASSERT ((st.st_mode & 0777) == 0600);
+	close (sock);
+	unlink (IPC_TEST_PATH);
+	// a socket bound under the tightened umask never has more than mode
+	old_mask = umask (022);
+	mask = libpd_ipc_tighten_umask (0640);
+	CU_ASSERT (mask == 022);
+	sock = make_ipc_socket (IPC_TEST_PATH, true);
+	libpd_ipc_restore_umask (mask);
+	CU_ASSERT (umask (old_mask) == 022);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (stat (IPC_TEST_PATH, &st) == 0);
+	CU_ASSERT ((st.st_mode & 0777) == 0640);
+	close (sock);
+	unlink (IPC_TEST_PATH);
+	// and anything that isn't a socket is left alone
+	fd = open (IPC_TEST_PATH, O_CREAT | O_WRONLY, 0644);
+	CU_ASSERT_FATAL (fd >= 0);
+	close (fd);
+	CU_ASSERT (libpd_ipc_clean (IPC_TEST_PATH, &oserr) == LIBPD_IPCERR_NOT_SOCK);
+	CU_ASSERT (access (IPC_TEST_PATH, F_OK) == 0);
+	unlink (IPC_TEST_PATH);
+	CU_ASSERT (libpd_ipc_set_mode (IPC_TEST_PATH, 0600, &oserr) == LIBPD_IPCERR_CHMOD);
+	CU_ASSERT (oserr == ENOENT);
+	memset (long_path, 'x', sizeof (long_path) - 1);
+	long_path[0] = '/';
+	long_path[sizeof (long_path) - 1] = '\0';
+	CU_ASSERT (libpd_ipc_clean (long_path, &oserr) == LIBPD_IPCERR_LONG);
+}
+
+void test_ipc_transport (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance = NULL;
+	libpd_instance_t instance2 = NULL;
+	libpd_cfg_t ipc_cfg = *cfg;
+	wrp_msg_t *wrp_msg;
+	struct stat st;
+	char *client_url, *url = NULL;
+	const char *path;
+	char *name;
+	char dest[64];
+	int parodus_sock, sock;
+	int timeout = 1000;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin IPC Transport Test\n"));
+	ipc_cfg.transport = LIBPD_TRANSPORT_IPC + 1;
+	CU_ASSERT (libparodus_init (&instance, &ipc_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	parodus_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (parodus_sock >= 0);
+	CU_ASSERT (nn_setsockopt (parodus_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (parodus_sock, IPC_PARODUS_URL) >= 0);
+	ipc_cfg.receive = true;
+	ipc_cfg.parodus_url = IPC_PARODUS_URL;
+	ipc_cfg.client_url = NULL;
+	ipc_cfg.transport = LIBPD_TRANSPORT_IPC;
+	client_url = libpd_ipc_client_url (LIBPD_IPC_DIR, ipc_cfg.service_name);
+	CU_ASSERT_FATAL (NULL != client_url);
+	path = libpd_ipc_path (client_url);
+	// left over from an instance that is gone
+	unlink (path);
+	CU_ASSERT (make_ipc_socket (path, false) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &ipc_cfg) == 0);
+	name = receive_registration (parodus_sock, &url);
+	CU_ASSERT_FATAL (NULL != name);
+	CU_ASSERT (strcmp (name, ipc_cfg.service_name) == 0);
+	CU_ASSERT (strcmp (url, client_url) == 0);
+	free (name);
+	free (url);
+	CU_ASSERT (stat (path, &st) == 0);
+	CU_ASSERT (S_ISSOCK (st.st_mode));
+	CU_ASSERT ((st.st_mode & 0777) == LIBPD_IPC_DEFAULT_MODE);
+
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, client_url) >= 0);
+	sprintf (dest, "mac:112233445566/%s/ipc", ipc_cfg.service_name);
+	CU_ASSERT (send_req_to_client (sock, dest, 1) == 0);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 1);
+	libparodus_free_msg (instance, wrp_msg);
+	// another instance can't take the socket file over
+	CU_ASSERT (libparodus_init (&instance2, &ipc_cfg) == LIBPD_ERROR_INIT_CONNECT);
+	CU_ASSERT (libparodus_shutdown (&instance2) == 0);
+	CU_ASSERT (access (path, F_OK) == 0);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (access (path, F_OK) != 0);
+	nn_close (sock);
+
+	ipc_cfg.ipc_mode = 0600;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &ipc_cfg) == 0);
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT (NULL != name);
+	free (name);
+	CU_ASSERT (stat (path, &st) == 0);
+	CU_ASSERT ((st.st_mode & 0777) == 0600);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (access (path, F_OK) != 0);
+	free (client_url);
+	nn_close (parodus_sock);
+}
+
+typedef struct {
+	libpd_shm_t shm;
+	const char *msg;
+	unsigned len;
+	int rtn;
+} shm_send_arg_t;
+
+static void *shm_send_thread (void *arg)
+{
+	shm_send_arg_t *a = (shm_send_arg_t *) arg;
+	a->rtn = libpd_shm_send (a->shm, LIBPD_SHM_UP, a->msg, a->len, 5000);
+	return NULL;
+}
+
+void test_shm (void)
+{
+	libpd_shm_t shm = NULL;
+	libpd_shm_t peer = NULL;
+	char msg[64], big[2048];
+	char *huge;
+	void *buf;
+	unsigned len, max_msg, i, sent;
+	shm_send_arg_t send_arg;
+	pthread_t send_tid;
+	int oserr;
+
+	CU_ASSERT (libpd_shm_create (&shm, 0x1001, &oserr) == LIBPD_SHMERR_CREATE_INVAL_SZ);
+	CU_ASSERT (libpd_shm_create (&shm, 0x800, &oserr) == LIBPD_SHMERR_CREATE_INVAL_SZ);
+	CU_ASSERT (libpd_shm_open (&peer, "/tmp/libpd_no_such_shm", &oserr) == LIBPD_SHMERR_OPEN);
+	CU_ASSERT (oserr == ENOENT);
+	CU_ASSERT (libpd_shm_open (&peer, "/dev/null", &oserr) == LIBPD_SHMERR_OPEN_INVAL);
+	CU_ASSERT_FATAL (libpd_shm_create (&shm, 0x1000, &oserr) == 0);
+	CU_ASSERT (strncmp (libpd_shm_path (shm), "/proc/", 6) == 0);
+	max_msg = libpd_shm_max_msg (shm);
+	CU_ASSERT (max_msg == 0x1000/2 - 4);
+	// the peer is normally another process, but may as well be this one
+	CU_ASSERT_FATAL (libpd_shm_open (&peer, libpd_shm_path (shm), &oserr) == 0);
+	CU_ASSERT (libpd_shm_max_msg (peer) == max_msg);
+
+	CU_ASSERT (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 0) == 1);
+	CU_ASSERT (libpd_shm_receive (shm, LIBPD_SHM_DOWN, &buf, &len, 10) == 1);
+	CU_ASSERT (libpd_shm_send (shm, LIBPD_SHM_UP, "up-msg", 6, 0) == 0);
+	CU_ASSERT (libpd_shm_send (peer, LIBPD_SHM_DOWN, "down-msg", 8, 0) == 0);
+	CU_ASSERT_FATAL (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 0) == 0);
+	CU_ASSERT ((len == 6) && (memcmp (buf, "up-msg", 6) == 0));
+	nn_freemsg (buf);
+	CU_ASSERT_FATAL (libpd_shm_receive (shm, LIBPD_SHM_DOWN, &buf, &len, 0) == 0);
+	CU_ASSERT ((len == 8) && (memcmp (buf, "down-msg", 8) == 0));
+	nn_freemsg (buf);
+
+	// odd sizes, many times around the ring
+	for (i=0; i<500; i++) {
+		sprintf (msg, "wrap-msg-%u-%.*s", i, (int) (i % 17), "abcdefghijklmnopq");
+		CU_ASSERT_FATAL (libpd_shm_send (shm, LIBPD_SHM_UP, msg, strlen (msg), 0) == 0);
+		CU_ASSERT_FATAL (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 0) == 0);
+		CU_ASSERT ((len == strlen (msg)) && (memcmp (buf, msg, len) == 0));
+		nn_freemsg (buf);
+	}
+	memset (big, 'b', sizeof (big));
+	CU_ASSERT (libpd_shm_send (shm, LIBPD_SHM_UP, big, LIBPD_SHM_MAX_MSG + 1u, 0) == LIBPD_SHMERR_TOO_BIG);
+
+	// larger than a record, so it goes in fragments
+	big[sizeof (big) - 1] = 'e';
+	CU_ASSERT_FATAL (libpd_shm_send (shm, LIBPD_SHM_UP, "before", 6, 0) == 0);
+	CU_ASSERT_FATAL (libpd_shm_send (shm, LIBPD_SHM_UP, big, sizeof (big), 0) == 0);
+	CU_ASSERT_FATAL (libpd_shm_send (shm, LIBPD_SHM_UP, "after", 5, 0) == 0);
+	CU_ASSERT_FATAL (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 0) == 0);
+	CU_ASSERT ((len == 6) && (memcmp (buf, "before", 6) == 0));
+	nn_freemsg (buf);
+	CU_ASSERT_FATAL (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 0) == 0);
+	CU_ASSERT ((len == sizeof (big)) && (memcmp (buf, big, len) == 0));
+	nn_freemsg (buf);
+	CU_ASSERT_FATAL (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 0) == 0);
+	CU_ASSERT ((len == 5) && (memcmp (buf, "after", 5) == 0));
+	nn_freemsg (buf);
+	big[sizeof (big) - 1] = 'b';
+
+	// larger than the whole ring, so the sender waits for the receiver
+	// to make room, and the receiver for the rest of the msg
+	huge = malloc (5 * 0x1000 + 3);
+	CU_ASSERT_FATAL (NULL != huge);
+	for (i=0; i<5 * 0x1000 + 3; i++)
+		huge[i] = (char) ('a' + (i % 26));
+	send_arg.shm = shm;
+	send_arg.msg = huge;
+	send_arg.len = 5 * 0x1000 + 3;
+	send_arg.rtn = -1;
+	CU_ASSERT_FATAL (pthread_create (&send_tid, NULL, shm_send_thread, &send_arg) == 0);
+	CU_ASSERT (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 5000) == 0);
+	pthread_join (send_tid, NULL);
+	CU_ASSERT (send_arg.rtn == 0);
+	CU_ASSERT ((len == send_arg.len) && (NULL != buf) && (memcmp (buf, huge, len) == 0));
+	if (NULL != buf)
+		nn_freemsg (buf);
+	free (huge);
+
+	// fill the ring
+	for (sent=0; sent<100; sent++) {
+		if (libpd_shm_send (shm, LIBPD_SHM_UP, big, 200, 0) != 0)
+			break;
+	}
+	CU_ASSERT (sent > 0);
+	CU_ASSERT (sent < 100);
+	CU_ASSERT (libpd_shm_send (shm, LIBPD_SHM_UP, big, 200, 20) == 1);
+	CU_ASSERT (libpd_shm_send (shm, LIBPD_SHM_UP, big, max_msg, 0) == 1);
+	// no room for the first fragment, so none of it is sent
+	CU_ASSERT (libpd_shm_send (shm, LIBPD_SHM_UP, big, sizeof (big), 0) == 1);
+
+	// what was sent can still be received after close
+	CU_ASSERT (!libpd_shm_is_closed (peer));
+	libpd_shm_close (shm);
+	CU_ASSERT (libpd_shm_is_closed (peer));
+	CU_ASSERT (libpd_shm_send (shm, LIBPD_SHM_UP, big, 10, 0) == LIBPD_SHMERR_CLOSED);
+	CU_ASSERT (libpd_shm_send (peer, LIBPD_SHM_DOWN, big, 10, 0) == LIBPD_SHMERR_CLOSED);
+	for (i=0; i<sent; i++) {
+		CU_ASSERT_FATAL (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 0) == 0);
+		CU_ASSERT ((len == 200) && (memcmp (buf, big, len) == 0));
+		nn_freemsg (buf);
+	}
+	CU_ASSERT (libpd_shm_receive (peer, LIBPD_SHM_UP, &buf, &len, 1000) == LIBPD_SHMERR_CLOSED);
+	CU_ASSERT (libpd_shm_receive (shm, LIBPD_SHM_DOWN, &buf, &len, 0) == LIBPD_SHMERR_CLOSED);
+	libpd_shm_destroy (&peer);
+	CU_ASSERT (NULL == peer);
+	libpd_shm_destroy (&shm);
+	CU_ASSERT (NULL == shm);
+}
+
+// receives a registration msg on the parodus side, and opens the shm
+// segment it offers
+static int accept_shm_offer (int sock, libpd_shm_t *shm)
+{
+	const char *path;
+	size_t path_len;
+	char path_buf[128];
+	void *buf = NULL;
+	int oserr;
+	int rtn = nn_recv (sock, &buf, NN_MSG, 0);
+
+	*shm = NULL;
+	if (rtn < 0)
+		return -1;
+	if ((libpd_wrp_peek_str (buf, rtn, LIBPD_SHM_FIELD, &path, &path_len) != 0) ||
+	    (path_len >= sizeof (path_buf))) {
+		nn_freemsg (buf);
+		return -1;
+	}
+	memcpy (path_buf, path, path_len);
+	path_buf[path_len] = '\0';
+	nn_freemsg (buf);
+	return libpd_shm_open (shm, path_buf, &oserr);
+}
+
+// plays the part of parodus, sending an AUTH msg that accepts the
+// shm segment if shm is not NULL
+static int send_auth_to_client (int sock, libpd_shm_t shm)
+{
+	wrp_msg_t msg;
+	const char *shm_path = (NULL == shm) ? NULL : libpd_shm_path (shm);
+	size_t len;
+	void *buf;
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__AUTH;
+	msg.u.auth.status = 200;
+	len = libpd_wrp_encoded_size_ext (&msg, LIBPD_SHM_FIELD, shm_path);
+	buf = nn_allocmsg (len, 0);
+	if (NULL == buf)
+		return -1;
+	libpd_wrp_encode_ext (&msg, LIBPD_SHM_FIELD, shm_path, buf, len);
+	if (nn_send (sock, &buf, NN_MSG, 0) != (int) len) {
+		nn_freemsg (buf);
+		return -1;
+	}
+	return 0;
+}
+
+static bool wait_auth_stats (libpd_instance_t instance)
+{
+	libpd_stats_t stats;
+	int i;
+
+	for (i=0; i<100; i++) {
+		if ((libparodus_get_stats (instance, &stats) == 0) && (stats.auth_msgs > 0))
+			return true;
+		usleep (20000);
+	}
+	return false;
+}
+
+static int send_event_to_parodus (libpd_instance_t instance, const char *payload,
+	size_t payload_size)
+{
+	wrp_msg_t msg;
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/shm";
+	msg.u.event.dest = "event:device-status/shm";
+	msg.u.event.payload = (void *) payload;
+	msg.u.event.payload_size = payload_size;
+	return libparodus_send (instance, &msg);
+}
+
+void test_shm_transport (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t shm_cfg = *cfg;
+	libpd_stats_t stats;
+	libpd_shm_t shm = NULL;
+	wrp_msg_t req;
+	wrp_msg_t *wrp_msg;
+	char big[3000];
+	char uuid[32];
+	char dest[64];
+	void *buf;
+	unsigned len;
+	uint64_t sock_sent;
+	int parodus_sock, sock, rtn, i;
+	int timeout = 1000;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin SHM Transport Test\n"));
+	shm_cfg.receive = true;
+	shm_cfg.shm_ring_size = 0x1800;
+	CU_ASSERT (libparodus_init (&instance, &shm_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	shm_cfg.receive = false;
+	shm_cfg.shm_ring_size = 0x1000;
+	CU_ASSERT (libparodus_init (&instance, &shm_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	parodus_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (parodus_sock >= 0);
+	CU_ASSERT (nn_setsockopt (parodus_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (parodus_sock, SHM_PARODUS_URL) >= 0);
+	shm_cfg.receive = true;
+	shm_cfg.parodus_url = SHM_PARODUS_URL;
+	shm_cfg.client_url = GOOD_CLIENT_URL;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &shm_cfg) == 0);
+	CU_ASSERT_FATAL (accept_shm_offer (parodus_sock, &shm) == 0);
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	CU_ASSERT (send_auth_to_client (sock, shm) == 0);
+	CU_ASSERT_FATAL (wait_auth_stats (instance));
+	// the registration went over the socket
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	sock_sent = stats.msgs_sent;
+
+	CU_ASSERT (send_event_to_parodus (instance, "shm-event", 9) == 0);
+	CU_ASSERT_FATAL (libpd_shm_receive (shm, LIBPD_SHM_UP, &buf, &len, 2000) == 0);
+	CU_ASSERT_FATAL (wrp_to_struct (buf, len, WRP_BYTES, &wrp_msg) > 0);
+	CU_ASSERT (wrp_msg->msg_type == WRP_MSG_TYPE__EVENT);
+	CU_ASSERT (memcmp (wrp_msg->u.event.payload, "shm-event", 9) == 0);
+	wrp_free_struct (wrp_msg);
+	nn_freemsg (buf);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.shm_msgs_sent == 1);
+	CU_ASSERT (stats.msgs_sent == sock_sent + 1);
+	// too big for one record, so it goes through the ring in
+	// fragments, and stays behind the msg sent before it
+	memset (big, 'x', sizeof (big));
+	CU_ASSERT (send_event_to_parodus (instance, "small-event", 11) == 0);
+	CU_ASSERT (send_event_to_parodus (instance, big, sizeof (big)) == 0);
+	CU_ASSERT_FATAL (libpd_shm_receive (shm, LIBPD_SHM_UP, &buf, &len, 2000) == 0);
+	CU_ASSERT_FATAL (wrp_to_struct (buf, len, WRP_BYTES, &wrp_msg) > 0);
+	CU_ASSERT (wrp_msg->u.event.payload_size == 11);
+	wrp_free_struct (wrp_msg);
+	nn_freemsg (buf);
+	CU_ASSERT_FATAL (libpd_shm_receive (shm, LIBPD_SHM_UP, &buf, &len, 2000) == 0);
+	CU_ASSERT (len > sizeof (big));
+	CU_ASSERT_FATAL (wrp_to_struct (buf, len, WRP_BYTES, &wrp_msg) > 0);
+	CU_ASSERT ((wrp_msg->u.event.payload_size == sizeof (big)) &&
+		(memcmp (wrp_msg->u.event.payload, big, sizeof (big)) == 0));
+	wrp_free_struct (wrp_msg);
+	nn_freemsg (buf);
+	rtn = nn_recv (parodus_sock, &buf, NN_MSG, NN_DONTWAIT);
+	CU_ASSERT (rtn < 0);
+	if (rtn >= 0)
+		nn_freemsg (buf);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.shm_msgs_sent == 3);
+	CU_ASSERT (stats.msgs_sent == sock_sent + 3);
+
+	// requests come down the ring, and over the socket too
+	sprintf (dest, "mac:112233445566/%s/shm", shm_cfg.service_name);
+	for (i=1; i<=2; i++) {
+		memset ((void*) &req, 0, sizeof(wrp_msg_t));
+		sprintf (uuid, "handler-test-%d", i);
+		req.msg_type = WRP_MSG_TYPE__REQ;
+		req.u.req.transaction_uuid = uuid;
+		req.u.req.source = "dns:mock-parodus/test";
+		req.u.req.dest = dest;
+		req.u.req.payload = "---ShmPayload---";
+		req.u.req.payload_size = 16;
+		len = (unsigned) libpd_wrp_encoded_size (&req);
+		buf = malloc (len);
+		CU_ASSERT_FATAL (NULL != buf);
+		libpd_wrp_encode (&req, buf, len);
+		CU_ASSERT (libpd_shm_send (shm, LIBPD_SHM_DOWN, buf, len, 1000) == 0);
+		free (buf);
+		CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+		CU_ASSERT (client_msg_num (wrp_msg) == i);
+		libparodus_free_msg (instance, wrp_msg);
+	}
+	CU_ASSERT (send_req_to_client (sock, dest, 3) == 0);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 3);
+	libparodus_free_msg (instance, wrp_msg);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.shm_msgs_received == 2);
+	CU_ASSERT (stats.msgs_received == 3);
+	// shutdown closes the segment for parodus too
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (libpd_shm_is_closed (shm));
+	CU_ASSERT (libpd_shm_receive (shm, LIBPD_SHM_UP, &buf, &len, 0) == LIBPD_SHMERR_CLOSED);
+	libpd_shm_destroy (&shm);
+
+	// parodus that doesn't know about shm leaves everything on the sockets
+	CU_ASSERT_FATAL (libparodus_init (&instance, &shm_cfg) == 0);
+	CU_ASSERT_FATAL (accept_shm_offer (parodus_sock, &shm) == 0);
+	CU_ASSERT (send_auth_to_client (sock, NULL) == 0);
+	CU_ASSERT_FATAL (wait_auth_stats (instance));
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	sock_sent = stats.msgs_sent;
+	CU_ASSERT (send_event_to_parodus (instance, "sock-event", 10) == 0);
+	rtn = nn_recv (parodus_sock, &buf, NN_MSG, 0);
+	CU_ASSERT (rtn > 0);
+	if (rtn >= 0)
+		nn_freemsg (buf);
+	CU_ASSERT (libpd_shm_receive (shm, LIBPD_SHM_UP, &buf, &len, 0) == 1);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.shm_msgs_sent == 0);
+	CU_ASSERT (stats.msgs_sent == sock_sent + 1);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	libpd_shm_destroy (&shm);
+	nn_close (sock);
+	nn_close (parodus_sock);
+}
+
+static long timespec_diff_ms (struct timespec *start, struct timespec *end);
+
+// true if the stats have got to n of something
+typedef bool stats_test_t (const libpd_stats_t *stats, uint64_t n);
+
+// polls the stats until test passes, or timeout_ms is up
+static bool wait_stats (libpd_instance_t instance, stats_test_t *test,
+	uint64_t n, libpd_stats_t *stats, long timeout_ms)
+{
+	struct timespec start, now;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	while (true) {
+		if ((libparodus_get_stats (instance, stats) == 0) && test (stats, n))
+			return true;
+		clock_gettime (CLOCK_MONOTONIC, &now);
+		if (timespec_diff_ms (&start, &now) >= timeout_ms)
+			return false;
+		usleep (10000);
+	}
+}
+
+static bool reconnected (const libpd_stats_t *stats, uint64_t n)
+{
+	return (stats->reconnects >= n) && (stats->link_state == LIBPD_LINK_UP);
+}
+
+static bool reconnect_attempts (const libpd_stats_t *stats, uint64_t n)
+{
+	return stats->reconnect_attempts >= n;
+}
+
+void test_reconnect (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t rc_cfg = *cfg;
+	libpd_stats_t stats;
+	wrp_msg_t *wrp_msg;
+	struct timespec start, end;
+	uint64_t attempts, reconnects;
+	char *name;
+	char dest[64];
+	int parodus_sock, sock;
+	int timeout = 3000;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Reconnect Test\n"));
+	parodus_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (parodus_sock >= 0);
+	CU_ASSERT (nn_setsockopt (parodus_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (parodus_sock, RECONNECT_PARODUS_URL) >= 0);
+	rc_cfg.receive = true;
+	rc_cfg.keepalive_timeout_secs = 1;
+	rc_cfg.parodus_url = RECONNECT_PARODUS_URL;
+	rc_cfg.client_url = GOOD_CLIENT_URL;
+	// the same retry delays every run
+	rc_cfg.test_flags |= CFG_TEST_FIXED_RECONNECT_SEED;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &rc_cfg) == 0);
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT_FATAL (NULL != name);
+	free (name);
+	// no keep alives, so it registers again, right away
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT_FATAL (NULL != name);
+	free (name);
+	CU_ASSERT_FATAL (wait_stats (instance, reconnected, 1, &stats, 3000));
+	// with parodus there, every try works, though one may be under way.
+	// More keep alives may have been missed since the first.
+	CU_ASSERT (stats.reconnect_attempts <= stats.reconnects + 1);
+	CU_ASSERT (stats.last_reconnect_ms < 1000);
+	reconnects = stats.reconnects;
+
+	// parodus goes away, and msgs still get through while reconnecting
+	nn_close (parodus_sock);
+	CU_ASSERT (wait_stats (instance, reconnect_attempts, reconnects + 2, 
+		&stats, 10000));
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	sprintf (dest, "mac:112233445566/%s/reconnect", rc_cfg.service_name);
+	CU_ASSERT (send_req_to_client (sock, dest, 1) == 0);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 5000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 1);
+	libparodus_free_msg (instance, wrp_msg);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.reconnects == reconnects);
+	CU_ASSERT (stats.reconnect_attempts >= reconnects + 2);
+	attempts = stats.reconnect_attempts;
+
+	// when it comes back, a msg from it gets a registration out now
+	parodus_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (parodus_sock >= 0);
+	CU_ASSERT (nn_setsockopt (parodus_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (parodus_sock, RECONNECT_PARODUS_URL) >= 0);
+	CU_ASSERT (send_req_to_client (sock, dest, 2) == 0);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 5000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 2);
+	libparodus_free_msg (instance, wrp_msg);
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT (NULL != name);
+	free (name);
+	CU_ASSERT (wait_stats (instance, reconnected, reconnects + 1, &stats, 3000));
+	CU_ASSERT (stats.reconnect_attempts >= attempts);
+	CU_ASSERT (stats.last_reconnect_ms >= 1000);
+	CU_ASSERT (stats.max_reconnect_ms >= 1000);
+	CU_ASSERT (stats.reconnect_ms >= stats.max_reconnect_ms);
+
+	// shutdown doesn't wait behind the retry delays, or behind a
+	// registration with nobody to take it
+	nn_close (parodus_sock);
+	sleep (2);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	CU_ASSERT (timespec_diff_ms (&start, &end) < 1000);
+	nn_close (sock);
+}
+
+#define MAX_LINK_STATES 16
+static libpd_link_state_t link_states[MAX_LINK_STATES];
+static unsigned link_state_count = 0;
+
+static void test_link_state_cb (libpd_instance_t instance, 
+	libpd_link_state_t state, void *ctx)
+{
+	(void) instance;
+	(void) ctx;
+	pthread_mutex_lock (&handler_mutex);
+	if (link_state_count < MAX_LINK_STATES)
+		link_states[link_state_count] = state;
+	link_state_count++;
+	pthread_mutex_unlock (&handler_mutex);
+}
+
+static libpd_link_state_t last_link_state (void)
+{
+	libpd_link_state_t state = LIBPD_LINK_UP;
+
+	pthread_mutex_lock (&handler_mutex);
+	if ((link_state_count > 0) && (link_state_count <= MAX_LINK_STATES))
+		state = link_states[link_state_count-1];
+	pthread_mutex_unlock (&handler_mutex);
+	return state;
+}
+
+// plays the part of parodus, sending a keep alive to the client
+static int send_keepalive_to_client (int sock)
+{
+	wrp_msg_t msg;
+	size_t len;
+	void *buf;
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+	len = libpd_wrp_encoded_size (&msg);
+	buf = nn_allocmsg (len, 0);
+	if (NULL == buf)
+		return -1;
+	libpd_wrp_encode (&msg, buf, len);
+	if (nn_send (sock, &buf, NN_MSG, 0) != (int) len) {
+		nn_freemsg (buf);
+		return -1;
+	}
+	return 0;
+}
+
+static bool keepalives_at_least (const libpd_stats_t *stats, uint64_t n)
+{
+	return stats->keep_alive_msgs >= n;
+}
+
+static bool link_idle (const libpd_stats_t *stats, uint64_t misses)
+{
+	return (stats->keepalive_misses >= misses) && (stats->link_state == LIBPD_LINK_IDLE);
+}
+
+static bool link_up (const libpd_stats_t *stats, uint64_t n)
+{
+	(void) n;
+	return stats->link_state == LIBPD_LINK_UP;
+}
+
+void test_keepalive_watchdog (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t ka_cfg = *cfg;
+	libpd_stats_t stats;
+	wrp_msg_t *wrp_msg;
+	char *name;
+	char dest[64];
+	int parodus_sock, sock, i;
+	int timeout = 5000;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Keep Alive Watchdog Test\n"));
+	parodus_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (parodus_sock >= 0);
+	CU_ASSERT (nn_setsockopt (parodus_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (parodus_sock, WATCHDOG_PARODUS_URL) >= 0);
+	ka_cfg.receive = true;
+	ka_cfg.keepalive_timeout_secs = 1;
+	ka_cfg.keepalive_miss_limit = 3;
+	ka_cfg.link_state_cb = test_link_state_cb;
+	ka_cfg.parodus_url = WATCHDOG_PARODUS_URL;
+	ka_cfg.client_url = GOOD_CLIENT_URL;
+	link_state_count = 0;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &ka_cfg) == 0);
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT_FATAL (NULL != name);
+	free (name);
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+
+	// keep alives on time. The sleeps only space them out, and may
+	// run long on a loaded machine, so the stats are polled for.
+	for (i=0; i<5; i++) {
+		CU_ASSERT (send_keepalive_to_client (sock) == 0);
+		usleep (400000);
+	}
+	CU_ASSERT (wait_stats (instance, keepalives_at_least, 5, &stats, 2000));
+	CU_ASSERT (stats.keepalive_misses == 0);
+	CU_ASSERT (stats.link_state == LIBPD_LINK_UP);
+	CU_ASSERT (link_state_count == 0);
+
+	// other msgs don't count as keep alives, but one miss isn't enough
+	// to reconnect
+	sprintf (dest, "mac:112233445566/%s/watchdog", ka_cfg.service_name);
+	for (i=1; i<=5; i++) {
+		usleep (300000);
+		CU_ASSERT (send_req_to_client (sock, dest, i) == 0);
+		CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+		libparodus_free_msg (instance, wrp_msg);
+	}
+	CU_ASSERT (wait_stats (instance, link_idle, 1, &stats, 2000));
+	CU_ASSERT (stats.reconnects == 0);
+	CU_ASSERT (last_link_state () == LIBPD_LINK_IDLE);
+	CU_ASSERT (send_keepalive_to_client (sock) == 0);
+	CU_ASSERT (wait_stats (instance, link_up, 0, &stats, 2000));
+	CU_ASSERT (last_link_state () == LIBPD_LINK_UP);
+
+	// three misses in a row, and it registers again
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT (NULL != name);
+	free (name);
+	CU_ASSERT (wait_stats (instance, reconnected, 1, &stats, 2000));
+	CU_ASSERT (stats.reconnects >= 1);
+	CU_ASSERT (stats.keepalive_misses >= 4);
+	CU_ASSERT (stats.link_state_changes >= 5);
+	CU_ASSERT_FATAL (link_state_count >= 5);
+	CU_ASSERT ((link_states[0] == LIBPD_LINK_IDLE) && (link_states[1] == LIBPD_LINK_UP));
+	CU_ASSERT ((link_states[2] == LIBPD_LINK_IDLE) && 
+		(link_states[3] == LIBPD_LINK_DEAD) && (link_states[4] == LIBPD_LINK_UP));
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	nn_close (sock);
+	nn_close (parodus_sock);
+}
+
+static volatile bool flood_running = false;
+
+// plays the part of parodus, sending requests to the client as fast
+// as it can until told to stop
+static void *flood_client_thread (void *arg)
+{
+	int sock = *(int *) arg;
+	unsigned num = 0;
+
+	while (flood_running) {
+		if (send_req_to_client (sock, "mac:112233445566/iot/flood", num++) != 0)
+			break;
+	}
+	return NULL;
+}
+
+static long time_shutdown (libpd_instance_t *instance)
+{
+	struct timespec start, end;
+
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	CU_ASSERT (libparodus_shutdown (instance) == 0);
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	return timespec_diff_ms (&start, &end);
+}
+
+void test_shutdown_latency (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t sd_cfg = *cfg;
+	pthread_t flood_tid;
+	wrp_msg_t *wrp_msg;
+	char *name;
+	long ms;
+	int parodus_sock, sock;
+	int timeout = 2000;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Shutdown Latency Test\n"));
+	parodus_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (parodus_sock >= 0);
+	CU_ASSERT (nn_setsockopt (parodus_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (parodus_sock, SHUTDOWN_PARODUS_URL) >= 0);
+	sd_cfg.receive = true;
+	sd_cfg.keepalive_timeout_secs = 0;
+	sd_cfg.service_name = "iot";
+	sd_cfg.receive_overflow = LIBPD_OVERFLOW_DROP_NEWEST;
+	sd_cfg.parodus_url = SHUTDOWN_PARODUS_URL;
+	sd_cfg.client_url = GOOD_CLIENT_URL;
+
+	// idle, with the receiver waiting with no timeout
+	CU_ASSERT_FATAL (libparodus_init (&instance, &sd_cfg) == 0);
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT (NULL != name);
+	free (name);
+	ms = time_shutdown (&instance);
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: idle shutdown took %ld ms\n", ms));
+	CU_ASSERT (ms < 200);
+
+	// and with the receive socket never idle
+	CU_ASSERT_FATAL (libparodus_init (&instance, &sd_cfg) == 0);
+	name = receive_registration (parodus_sock, NULL);
+	CU_ASSERT (NULL != name);
+	free (name);
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	// so the flood thread can't get stuck once the client is gone
+	CU_ASSERT (nn_setsockopt (sock, NN_SOL_SOCKET, NN_SNDTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	flood_running = true;
+	CU_ASSERT_FATAL (pthread_create (&flood_tid, NULL, flood_client_thread, &sock) == 0);
+	CU_ASSERT (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+	libparodus_free_msg (instance, wrp_msg);
+	ms = time_shutdown (&instance);
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: busy shutdown took %ld ms\n", ms));
+	CU_ASSERT (ms < 500);
+	flood_running = false;
+	pthread_join (flood_tid, NULL);
+	nn_close (sock);
+	nn_close (parodus_sock);
+}
+
+#define ZERO_COPY_SERVICE "zcopy"
+
+// Registers a zero copy instance of its own with mock_parodus. It stays
+// up through the receive loop, so it gets the mock's auth msg and keep
+// alives, and is checked by test_zero_copy_mock at the end.
+static void start_zero_copy_mock (libpd_cfg_t *cfg, libpd_instance_t *instance)
+{
+	libpd_cfg_t zc_cfg = *cfg;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Zero Copy Mock Test\n"));
+	zc_cfg.receive = true;
+	zc_cfg.zero_copy_receive = true;
+	zc_cfg.keepalive_timeout_secs = 0;
+	zc_cfg.service_name = ZERO_COPY_SERVICE;
+	zc_cfg.client_url = ZERO_COPY_CLIENT_URL;
+	CU_ASSERT_FATAL (libparodus_init (instance, &zc_cfg) == 0);
+}
+
+void test_zero_copy_mock (libpd_instance_t *instance)
+{
+	libpd_stats_t stats;
+	wrp_msg_t *wrp_msg;
+	int sock;
+
+	// the mock's auth msg was decoded from the pool
+	CU_ASSERT (libparodus_get_stats (*instance, &stats) == 0);
+	CU_ASSERT (stats.auth_msgs == 1);
+	CU_ASSERT (stats.decode_errors == 0);
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, ZERO_COPY_CLIENT_URL) >= 0);
+	CU_ASSERT (send_req_to_client (sock, 
+		"mac:112233445566/" ZERO_COPY_SERVICE "/x", 1) == 0);
+	CU_ASSERT_FATAL (libparodus_receive (*instance, &wrp_msg, 2000) == 0);
+	CU_ASSERT (client_msg_num (wrp_msg) == 1);
+	CU_ASSERT (libparodus_get_stats (*instance, &stats) == 0);
+	CU_ASSERT (stats.pool_bytes > 0);
+	CU_ASSERT (stats.pool_fallbacks == 0);
+	CU_ASSERT (libparodus_shutdown (instance) == 0);
+	// a zero copy msg may be freed after shutdown
+	CU_ASSERT (client_msg_num (wrp_msg) == 1);
+	libparodus_free_msg (*instance, wrp_msg);
+	nn_close (sock);
+}
+
+static unsigned handlers_active = 0;
+static unsigned handlers_max_active = 0;
+
+// waits (up to 2 secs) for the other handlers to be running too,
+// so handlers_max_active shows how many ran at the same time
+static void test_parallel_handler_cb (libpd_instance_t instance, wrp_msg_t *msg, 
+	void *ctx)
+{
+	unsigned threads = *(unsigned *) ctx;
+	struct timespec ts;
+
+	libparodus_free_msg (instance, msg);
+	get_expire_time (2000, &ts);
+	pthread_mutex_lock (&handler_mutex);
+	handlers_active++;
+	if (handlers_active > handlers_max_active)
+		handlers_max_active = handlers_active;
+	pthread_cond_broadcast (&handler_cond);
+	while (handlers_max_active < threads) {
+		if (pthread_cond_timedwait (&handler_cond, &handler_mutex, &ts) != 0)
+			break;
+	}
+	handlers_active--;
+	handler_count++;
+	pthread_cond_broadcast (&handler_cond);
+	pthread_mutex_unlock (&handler_mutex);
+}
+
+void test_parallel_handlers (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance;
+	libpd_cfg_t handler_cfg = *cfg;
+	unsigned threads = 3;
+	char dest[64];
+	struct timespec ts;
+	unsigned i;
+	long ms;
+	int sock;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Parallel Msg Handler Test\n"));
+	handler_cfg.receive = true;
+	handler_cfg.client_url = GOOD_CLIENT_URL;
+	handler_cfg.msg_handler = test_parallel_handler_cb;
+	handler_cfg.msg_handler_ctx = (void *) &threads;
+	handler_cfg.msg_handler_threads = threads;
+	handler_count = 0;
+	handlers_active = 0;
+	handlers_max_active = 0;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &handler_cfg) == 0);
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	// sent in a burst, so they are all queued before a handler wakes up
+	sprintf (dest, "mac:112233445566/%s/handler", handler_cfg.service_name);
+	for (i=0; i<threads; i++)
+		CU_ASSERT (send_req_to_client (sock, dest, i) == 0);
+
+	get_expire_time (5000, &ts);
+	pthread_mutex_lock (&handler_mutex);
+	while (handler_count < threads) {
+		if (pthread_cond_timedwait (&handler_cond, &handler_mutex, &ts) != 0)
+			break;
+	}
+	pthread_mutex_unlock (&handler_mutex);
+	CU_ASSERT (handler_count == threads);
+	CU_ASSERT (handlers_max_active == threads);
+
+	// every idle handler thread has to be woken to stop it
+	ms = time_shutdown (&instance);
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: handler pool shutdown took %ld ms\n", ms));
+	CU_ASSERT (ms < 500);
+	nn_close (sock);
+}
+
 void test_send_blocking (void)
 {
-	unsigned event_num = 0;
-	unsigned suspend_time = 15;
-	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Send Blocking Test\n"));
-	int rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
-			"---SuspendReceive ####", suspend_time, 0);
+	unsigned event_num = 0;
+	unsigned suspend_time = 15;
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Send Blocking Test\n"));
+	int rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
+			"---SuspendReceive ####", suspend_time, 0);
+	CU_ASSERT (rtn == 0);
+	if (rtn != 0)
+		return;
+	while (true) {
+		event_num++;
+		rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
+			"---SendBlockTest ####", event_num, 100);
+		if (rtn != 0)
+			break;
+	}
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: End Send Blocking Test\n"));
+	sleep (5);
+}
+
+void test_send_disconnect (void)
+{
+	unsigned event_num = 0;
+	unsigned disconnect_time = 15;
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Send Disconnect Test\n"));
+	int rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
+			"---DisconnectReceive ####", disconnect_time, 0);
+	CU_ASSERT (rtn == 0);
+	if (rtn != 0)
+		return;
+	while (true) {
+		event_num++;
+		rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
+			"---SendBlockTest ####", event_num, 100);
+		if (rtn != 0)
+			break;
+	}
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: End Send Disconnect Test\n"));
+	sleep (5);
+}
+
+int start_mock_parodus ()
+{
+	int pid;
+	const char *mock_parodus_path = MOCK_PARODUS_PATH();
+	const char *test_msgs_path = TEST_MSGS_PATH();
+
+	pid = fork ();
+	if (pid == -1) {
+		libpd_log_err (LEVEL_ERROR, errno, ("Fork failed\n"));
+		CU_ASSERT_FATAL (-1 != pid);
+	}
+	if (pid == 0) {
+		// child
+		int err = execlp (mock_parodus_path, mock_parodus_path, 
+			"-f", test_msgs_path, "-d", "3",
+#ifdef MOCK_MSG_COUNT
+			"-c", MOCK_MSG_COUNT_STR,
+#endif
+			(char*)NULL);
+		if (err != 0) {
+			libpd_log_err (LEVEL_ERROR, errno, ("Failed execlp of mock_parodus\n"));
+		}
+		libpd_log (LEVEL_ERROR, ("Child finished\n"));
+	}
+	return pid;	
+}
+
+static int64_t timespec_diff_ns (struct timespec *start, struct timespec *end)
+{
+	return ((int64_t) (end->tv_sec - start->tv_sec) * 1000000000LL) +
+		(int64_t) (end->tv_nsec - start->tv_nsec);
+}
+
+static long timespec_diff_ms (struct timespec *start, struct timespec *end)
+{
+	return (long) (timespec_diff_ns (start, end) / 1000000LL);
+}
+
+void test_time (void)
+{
+	int rtn;
+	char timestamp[20];
+	struct timespec ts1;
+	struct timespec ts2;
+	struct timespec ts3;
+	bool ts2_greater;
+
+	rtn = make_current_timestamp (timestamp);
+	if (rtn == 0)
+		printf ("LIBPD_TEST: Current time is %s\n", timestamp);
+	else
+		printf ("LIBPD_TEST: make timestamp error %d\n", rtn);
+	CU_ASSERT (rtn == 0);
+	rtn = get_expire_time (500, &ts1);
+	CU_ASSERT (rtn == 0);
+	rtn = get_expire_time (500, &ts2);
+	CU_ASSERT (rtn == 0);
+	printf ("ts1: (%u, %u), ts2: (%u, %u)\n", 
+		(unsigned)ts1.tv_sec, (unsigned)ts1.tv_nsec,
+		(unsigned)ts2.tv_sec, (unsigned)ts2.tv_nsec);
+	if (ts2.tv_sec != ts1.tv_sec)
+		ts2_greater = (bool) (ts2.tv_sec > ts1.tv_sec);
+	else
+		ts2_greater = (bool) (ts2.tv_nsec >= ts1.tv_nsec);
+	CU_ASSERT (ts2_greater);
+	rtn = get_expire_time (5000, &ts1);
+	CU_ASSERT (rtn == 0);
+	rtn = get_expire_time (500, &ts2);
+	CU_ASSERT (rtn == 0);
+	if (ts2.tv_sec != ts1.tv_sec)
+		ts2_greater = (bool) (ts2.tv_sec > ts1.tv_sec);
+	else
+		ts2_greater = (bool) (ts2.tv_nsec >= ts1.tv_nsec);
+	CU_ASSERT (!ts2_greater);
+
+	// a monotonic expire time is exactly the delay past the clock
+	// reading taken inside the call
+	CU_ASSERT (clock_gettime (CLOCK_MONOTONIC, &ts1) == 0);
+	CU_ASSERT (get_expire_time_mono (50, &ts2) == 0);
+	CU_ASSERT (clock_gettime (CLOCK_MONOTONIC, &ts3) == 0);
+	CU_ASSERT (timespec_diff_ns (&ts1, &ts2) >= 50000000LL);
+	CU_ASSERT (timespec_diff_ns (&ts3, &ts2) <= 50000000LL);
+	CU_ASSERT (clock_gettime (CLOCK_MONOTONIC, &ts1) == 0);
+	CU_ASSERT (get_expire_time_mono (5000, &ts2) == 0);
+	CU_ASSERT (clock_gettime (CLOCK_MONOTONIC, &ts3) == 0);
+	CU_ASSERT (timespec_diff_ns (&ts1, &ts2) >= 5000000000LL);
+	CU_ASSERT (timespec_diff_ns (&ts3, &ts2) <= 5000000000LL);
+}
+
+void test_queue_send_msg (libpd_mq_t q, unsigned timeout_ms, int n)
+{
+	void *msg;
+	int msgsize, exterr;
+	char msgbuf[100];
+
+	sprintf (msgbuf, "Test Message # %d\n", n);
+	msgsize = strlen(msgbuf) + 1;
+	msg = malloc (msgsize);
+	CU_ASSERT_FATAL (msg != NULL);
+	strncpy ((char*)msg, msgbuf, msgsize);
+	CU_ASSERT (libpd_qsend (q, msg, timeout_ms, &exterr) == 0);
+}
+
+int get_msg_num (const char *msg)
+{
+	int num = -1;
+	bool found_pound = false;
+	int i;
+	char c;
+
+	for (i=0; (c=msg[i]) != 0; i++)
+	{
+		if (!found_pound) {
+			if (c == '#')
+				found_pound = true;
+			continue;
+		}
+		if ((c>='0') && (c<='9')) {
+			if (num == -1)
+				num = c - '0';
+			else
+				num = 10*num + (c - '0');
+		}
+	}
+	return num;
+}
+
+void test_queue_rcv_msg (libpd_mq_t q, unsigned timeout_ms, int n)
+{
+	int err, msg_num, exterr;
+	void *msg;
+	err = libpd_qreceive (q, &msg, timeout_ms, &exterr);
+	CU_ASSERT (err == 0);
+	if (err != 0)
+		return;
+	fputs ((char*) msg, stdout);
+	if (n < 0) {
+		free (msg);
+		return;
+	}
+	msg_num = get_msg_num ((char*)msg);
+	free (msg);
+	CU_ASSERT (msg_num >= 0);
+	if (msg_num < 0)
+		return;
+	CU_ASSERT (msg_num == n);
+}
+
+static int flush_queue_count = 0;
+
+void qfree (void * msg)
+{
+	flush_queue_count++;
+	free (msg);
+}
+
+typedef struct {
+	libpd_mq_t queue;
+	unsigned initial_wait_ms;
+	unsigned num_msgs;
+	unsigned send_interval_ms;
+} test_queue_info_t;
+
+static bool evict_odd_msg (void *msg)
+{
+	return (get_msg_num ((char *) msg) % 2) == 1;
+}
+
+static void *test_queue_sender_thread (void *arg)
+{
+	test_queue_info_t *qinfo = (test_queue_info_t *) arg;
+	unsigned i;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: started test_queue_sender_thread\n"));
+	if (qinfo->initial_wait_ms != 0)
+		delay_ms (qinfo->initial_wait_ms);
+
+	for (i=0; i<qinfo->num_msgs; i++)
+	{
+		test_queue_send_msg (qinfo->queue, qinfo->send_interval_ms, i);
+	}
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: ended test_queue_sender_thread\n"));
+	return NULL;
+}
+
+void test_queues (unsigned opts)
+{
+	test_queue_info_t qinfo;
+	int i, rtn, exterr;
+	void *msg;
+	pthread_t sender_test_tid;
+
+	qinfo.initial_wait_ms = 2000;
+	qinfo.num_msgs = 5;
+	qinfo.send_interval_ms = 500;
+
+	CU_ASSERT (libpd_qcreate_opt (&qinfo.queue, "//TEST_QUEUE", 5, opts, &exterr) == 0);
+	for (i=0; i< 5; i++)
+		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	CU_ASSERT (libpd_qsend (qinfo.queue, "extra message", 
+		qinfo.send_interval_ms, &exterr) == 1); // timed out
+	for (i=0; i< 5; i++)
+		test_queue_rcv_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	CU_ASSERT (libpd_qreceive (qinfo.queue, &msg, 
+		qinfo.send_interval_ms, &exterr) == 1); // timed out
+	for (i=0; i< 5; i++)
+	{
+		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
+		test_queue_rcv_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	}
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 0);
+
+	CU_ASSERT (libpd_qcreate_opt (&qinfo.queue, "//TEST_QUEUE", 5, opts, &exterr) == 0);
+	for (i=0; i< 5; i++)
+		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 5);
+
+	CU_ASSERT (libpd_qcreate_opt (&qinfo.queue, "//TEST_QUEUE", 
+		qinfo.num_msgs, opts, &exterr) == 0);
+	rtn = pthread_create 
+		(&sender_test_tid, NULL, test_queue_sender_thread, (void*) &qinfo);
 	CU_ASSERT (rtn == 0);
-	if (rtn != 0)
-		return;
-	while (true) {
-		event_num++;
-		rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
-			"---SendBlockTest ####", event_num, 100);
-		if (rtn != 0)
+	if (rtn == 0) {
+		for (i=0; i< (int)qinfo.num_msgs; i++)
+			test_queue_rcv_msg (qinfo.queue, 4000, -1);
+		pthread_join (sender_test_tid, NULL);
+	}
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 0);
+
+	CU_ASSERT (libpd_qcreate_opt (&qinfo.queue, "//TEST_QUEUE", 
+		qinfo.num_msgs, opts, &exterr) == 0);
+	qinfo.initial_wait_ms = 0;
+	qinfo.num_msgs += 5;
+	qinfo.send_interval_ms = 5000;
+	rtn = pthread_create 
+		(&sender_test_tid, NULL, test_queue_sender_thread, (void*) &qinfo);
+	CU_ASSERT (rtn == 0);
+	if (rtn == 0) {
+		delay_ms (2000);
+		for (i=0; i< (int)qinfo.num_msgs; i++) {
+			test_queue_rcv_msg (qinfo.queue, 4000, -1);
+			delay_ms (500);
+		}
+		pthread_join (sender_test_tid, NULL);
+	}
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 0);
+}
+
+void test_spsc_post (void)
+{
+	libpd_mq_t queue;
+	int i, exterr;
+
+	CU_ASSERT_FATAL (libpd_qcreate_opt (&queue, "//TEST_QUEUE", 5, 
+		LIBPD_QOPT_SPSC, &exterr) == 0);
+	for (i=0; i< 3; i++)
+		test_queue_send_msg (queue, 500, i);
+	CU_ASSERT (libpd_qpost (queue, strdup ("Posted Message # 3\n"), 
+		500, &exterr) == 0);
+	CU_ASSERT (libpd_qpost (queue, "extra post", 500, &exterr) == 1); // timed out
+	for (i=0; i< 4; i++)
+		test_queue_rcv_msg (queue, 500, i);
+	CU_ASSERT (libpd_qpost (queue, strdup ("Posted Message # 4\n"), 
+		500, &exterr) == 0);
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 1);
+}
+
+static bool is_msg_2 (void *msg)
+{
+	return get_msg_num ((char *) msg) == 2;
+}
+
+void test_queue_rcv_many (unsigned opts)
+{
+	libpd_mq_t queue;
+	void *msgs[4];
+	unsigned i, count;
+	int exterr;
+
+	CU_ASSERT_FATAL (libpd_qcreate_opt (&queue, "//TEST_QUEUE", 5, 
+		opts, &exterr) == 0);
+	CU_ASSERT (libpd_qreceive_many (queue, msgs, 4, 500, &count, &exterr) == 1);
+	CU_ASSERT (count == 0);
+	for (i=0; i< 5; i++)
+		test_queue_send_msg (queue, 500, i);
+	CU_ASSERT (libpd_qreceive_many (queue, msgs, 4, 500, &count, &exterr) == 0);
+	CU_ASSERT (count == 4);
+	for (i=0; i<count; i++) {
+		CU_ASSERT (get_msg_num ((char*)msgs[i]) == (int)i);
+		free (msgs[i]);
+	}
+	// queue was full, so there is room for one more send
+	test_queue_send_msg (queue, 500, 5);
+	CU_ASSERT (libpd_qreceive_many (queue, msgs, 4, 500, &count, &exterr) == 0);
+	CU_ASSERT (count == 2);
+	for (i=0; i<count; i++) {
+		CU_ASSERT (get_msg_num ((char*)msgs[i]) == (int)i+4);
+		free (msgs[i]);
+	}
+	// the batch ends at msg 2, leaving the msgs behind it queued
+	for (i=0; i< 4; i++)
+		test_queue_send_msg (queue, 500, i);
+	CU_ASSERT (libpd_qreceive_until (queue, msgs, 4, is_msg_2, 500, 
+		&count, &exterr) == 0);
+	CU_ASSERT (count == 3);
+	for (i=0; i<count; i++) {
+		CU_ASSERT (get_msg_num ((char*)msgs[i]) == (int)i);
+		free (msgs[i]);
+	}
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 1);
+	CU_ASSERT (libpd_qreceive_many (queue, msgs, 4, 500, &count, &exterr)
+		== LIBPD_QERR_RCV_NULL);
+}
+
+// sends msgs to an instance that isn't receiving them,
+// then checks which were kept on its receive queue
+static void run_overflow_test (libpd_cfg_t *cfg, libpd_overflow_t policy,
+	const int *msg_types, unsigned num_msgs, const int *expected, 
+	unsigned num_expected)
+{
+	libpd_instance_t instance;
+	libpd_cfg_t overflow_cfg = *cfg;
+	libpd_stats_t stats;
+	wrp_msg_t *wrp_msg, *held_msg = NULL;
+	char dest[64];
+	unsigned i;
+	int sock, rtn;
+
+	overflow_cfg.receive = true;
+	overflow_cfg.client_url = GOOD_CLIENT_URL;
+	overflow_cfg.receive_queue_size = 4;
+	overflow_cfg.receive_overflow = policy;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &overflow_cfg) == 0);
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	sprintf (dest, "mac:112233445566/%s/overflow", overflow_cfg.service_name);
+	for (i=0; i<num_msgs; i++)
+		CU_ASSERT (send_msg_to_client (sock, msg_types[i], dest, i) == 0);
+	// wait for the receiver to get through them all. A dropped msg
+	// is taken off msgs_received before it is counted in queue_full.
+	for (i=0; i<500; i++) {
+		CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+		if ((stats.msgs_received == num_expected) &&
+		    (stats.queue_full == (num_msgs - num_expected)))
 			break;
+		delay_ms (10);
 	}
-	libpd_log (LEVEL_INFO, ("LIBPD_TEST: End Send Blocking Test\n"));
-	sleep (5);
+	CU_ASSERT (stats.msgs_received == num_expected);
+	CU_ASSERT (stats.queue_full == (num_msgs - num_expected));
+	CU_ASSERT (stats.queue_size == 4);
+	CU_ASSERT (stats.queue_high_water == 4);
+	if (cfg->zero_copy_receive) {
+		CU_ASSERT (stats.pool_bytes > 0);
+		CU_ASSERT (stats.pool_fallbacks == 0);
+	} else {
+		CU_ASSERT (stats.pool_bytes == 0);
+	}
+	for (i=0; i<num_expected; i++) {
+		rtn = libparodus_receive (instance, &wrp_msg, 500);
+		CU_ASSERT_FATAL (rtn == 0);
+		CU_ASSERT (client_msg_num (wrp_msg) == expected[i]);
+		// a zero copy msg may outlive the instance
+		if (cfg->zero_copy_receive && (i == num_expected-1))
+			held_msg = wrp_msg;
+		else
+			libparodus_free_msg (instance, wrp_msg);
+	}
+	CU_ASSERT (libparodus_receive (instance, &wrp_msg, 100) == 1);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	if (NULL != held_msg) {
+		CU_ASSERT (client_msg_num (held_msg) == expected[num_expected-1]);
+		// shutdown cleared the handle, which the msg doesn't need
+		CU_ASSERT (NULL == instance);
+		libparodus_free_msg (instance, held_msg);
+	}
+	nn_close (sock);
 }
 
-void test_send_disconnect (void)
+void test_receive_overflow (libpd_cfg_t *cfg)
 {
-	unsigned event_num = 0;
-	unsigned disconnect_time = 15;
-	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Send Disconnect Test\n"));
-	int rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
-			"---DisconnectReceive ####", disconnect_time, 0);
-	CU_ASSERT (rtn == 0);
-	if (rtn != 0)
-		return;
-	while (true) {
-		event_num++;
-		rtn =	send_event_msg ("---LIBPARODUS---", "---ParodusService---",
-			"---SendBlockTest ####", event_num, 100);
-		if (rtn != 0)
+	#define REQ_ WRP_MSG_TYPE__REQ
+	#define EVT_ WRP_MSG_TYPE__EVENT
+	static const int reqs[6] = {REQ_, REQ_, REQ_, REQ_, REQ_, REQ_};
+	static const int mixed[8] = {EVT_, REQ_, EVT_, REQ_, REQ_, REQ_, REQ_, EVT_};
+	static const int first4[4] = {0, 1, 2, 3};
+	static const int last4[4] = {2, 3, 4, 5};
+	static const int no_events[4] = {1, 3, 4, 5};
+	libpd_instance_t instance;
+	libpd_cfg_t bad_cfg = *cfg;
+	libpd_cfg_t zc_cfg = *cfg;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Receive Overflow Test\n"));
+	bad_cfg.receive_queue_size = 1;
+	CU_ASSERT (libparodus_init (&instance, &bad_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	bad_cfg.receive_queue_size = 0;
+	bad_cfg.receive_overflow = (libpd_overflow_t) 99;
+	CU_ASSERT (libparodus_init (&instance, &bad_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	run_overflow_test (cfg, LIBPD_OVERFLOW_DROP_NEWEST, reqs, 6, first4, 4);
+	run_overflow_test (cfg, LIBPD_OVERFLOW_DROP_OLDEST, reqs, 6, last4, 4);
+	// events are dropped first, then new msgs once there are no more events
+	run_overflow_test (cfg, LIBPD_OVERFLOW_DROP_BY_TYPE, mixed, 8, no_events, 4);
+	// dropped msgs go back to the receive pool
+	zc_cfg.zero_copy_receive = true;
+	run_overflow_test (&zc_cfg, LIBPD_OVERFLOW_DROP_OLDEST, reqs, 6, last4, 4);
+	#undef REQ_
+	#undef EVT_
+}
+
+// the receiver thread is started before init finishes with the send
+// queue, and must keep running once the instance is
+void test_receive_after_init (libpd_cfg_t *cfg)
+{
+	libpd_instance_t instance;
+	libpd_cfg_t init_cfg = *cfg;
+	wrp_msg_t *wrp_msg;
+	char dest[64];
+	unsigned i;
+	int sock;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Receive After Init Test\n"));
+	sprintf (dest, "mac:112233445566/%s/after-init", init_cfg.service_name);
+	init_cfg.receive = true;
+	init_cfg.client_url = GOOD_CLIENT_URL;
+	init_cfg.send_queue_size = 10;
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	for (i=0; i<5; i++) {
+		CU_ASSERT_FATAL (libparodus_init (&instance, &init_cfg) == 0);
+		CU_ASSERT (send_req_to_client (sock, dest, i) == 0);
+		CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 2000) == 0);
+		CU_ASSERT (client_msg_num (wrp_msg) == (int) i);
+		libparodus_free_msg (instance, wrp_msg);
+		CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	}
+	nn_close (sock);
+}
+
+void test_receive_priority (libpd_cfg_t *cfg)
+{
+	#define REQ_ WRP_MSG_TYPE__REQ
+	#define EVT_ WRP_MSG_TYPE__EVENT
+	static const int msg_types[6] = {EVT_, REQ_, EVT_, EVT_, REQ_, EVT_};
+	static const bool alarm[6] = {false, false, false, true, false, true};
+	static const int expected[6] = {3, 5, 1, 4, 0, 2};
+	libpd_priority_rule_t rules[2] = {
+		{.msg_type = EVT_, .priority = 0},
+		{.msg_type = REQ_, .dest_prefix = NULL, .priority = 1}
+	};
+	libpd_instance_t instance;
+	libpd_cfg_t prio_cfg = *cfg;
+	libpd_stats_t stats;
+	wrp_msg_t *wrp_msg;
+	char dest[64], alarm_dest[64];
+	unsigned i;
+	int sock;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Receive Priority Test\n"));
+	sprintf (dest, "mac:112233445566/%s/priority", prio_cfg.service_name);
+	sprintf (alarm_dest, "mac:112233445566/%s/alarm", prio_cfg.service_name);
+	rules[0].dest_prefix = alarm_dest;
+	prio_cfg.receive = true;
+	prio_cfg.client_url = GOOD_CLIENT_URL;
+	prio_cfg.single_receiver = true;
+	prio_cfg.priority_rules = rules;
+	prio_cfg.num_priority_rules = 2;
+	rules[1].priority = LIBPD_MAX_PRIORITY + 1;
+	CU_ASSERT (libparodus_init (&instance, &prio_cfg) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	rules[1].priority = 1;
+
+	CU_ASSERT_FATAL (libparodus_init (&instance, &prio_cfg) == 0);
+	sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (sock >= 0);
+	CU_ASSERT (nn_connect (sock, GOOD_CLIENT_URL) >= 0);
+	for (i=0; i<6; i++)
+		CU_ASSERT (send_msg_to_client (sock, msg_types[i], 
+			alarm[i] ? alarm_dest : dest, i) == 0);
+	for (i=0; i<500; i++) {
+		CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+		if (stats.msgs_received >= 6)
+			break;
+		delay_ms (10);
+	}
+	CU_ASSERT (stats.msgs_received == 6);
+	for (i=0; i<6; i++) {
+		CU_ASSERT_FATAL (libparodus_receive (instance, &wrp_msg, 500) == 0);
+		CU_ASSERT (client_msg_num (wrp_msg) == expected[i]);
+		libparodus_free_msg (instance, wrp_msg);
+	}
+	CU_ASSERT (libparodus_receive (instance, &wrp_msg, 100) == 1);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	nn_close (sock);
+	#undef REQ_
+	#undef EVT_
+}
+
+// plays the part of parodus and the cloud for test_request,
+// replying to each request unless its uuid starts with "no-reply"
+typedef struct {
+	int pull_sock;
+	int push_sock;
+	volatile bool stop;
+	unsigned replies;
+} responder_t;
+
+static void *request_responder (void *arg)
+{
+	responder_t *responder = (responder_t *) arg;
+	wrp_msg_t *req, resp;
+	void *buf;
+	size_t len;
+	int rtn;
+
+	while (!responder->stop) {
+		buf = NULL;
+		rtn = nn_recv (responder->pull_sock, &buf, NN_MSG, 0);
+		if (rtn < 0)
+			continue;
+		rtn = (int) wrp_to_struct (buf, rtn, WRP_BYTES, &req);
+		nn_freemsg (buf);
+		if (rtn < 1)
+			continue;
+		if ((req->msg_type != WRP_MSG_TYPE__REQ) ||
+		    (strncmp (req->u.req.transaction_uuid, "no-reply", 8) == 0)) {
+			wrp_free_struct (req);
+			continue;
+		}
+		memset ((void*) &resp, 0, sizeof(wrp_msg_t));
+		resp.msg_type = WRP_MSG_TYPE__REQ;
+		resp.u.req.transaction_uuid = req->u.req.transaction_uuid;
+		resp.u.req.source = req->u.req.dest;
+		resp.u.req.dest = req->u.req.source;
+		resp.u.req.payload = "---ResponsePayload---";
+		resp.u.req.payload_size = 21;
+		len = libpd_wrp_encoded_size (&resp);
+		buf = nn_allocmsg (len, 0);
+		if (NULL != buf) {
+			libpd_wrp_encode (&resp, buf, len);
+			if (nn_send (responder->push_sock, &buf, NN_MSG, 0) == (int) len)
+				responder->replies++;
+			else
+				nn_freemsg (buf);
+		}
+		wrp_free_struct (req);
+	}
+	return NULL;
+}
+
+static pthread_mutex_t response_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned response_counts[3];
+
+static void test_response_cb (libpd_instance_t instance, int rtn,
+	wrp_msg_t *resp, void *ctx)
+{
+	const char *uuid = (const char *) ctx;
+
+	if (rtn == 0) {
+		CU_ASSERT_FATAL (NULL != resp);
+		CU_ASSERT (strcmp (resp->u.req.transaction_uuid, uuid) == 0);
+		libparodus_free_msg (instance, resp);
+	} else {
+		CU_ASSERT (NULL == resp);
+	}
+	if ((rtn >= 0) && (rtn <= 2)) {
+		pthread_mutex_lock (&response_mutex);
+		response_counts[rtn]++;
+		pthread_mutex_unlock (&response_mutex);
+	}
+}
+
+static unsigned get_response_count (int rtn)
+{
+	unsigned count;
+
+	pthread_mutex_lock (&response_mutex);
+	count = response_counts[rtn];
+	pthread_mutex_unlock (&response_mutex);
+	return count;
+}
+
+void test_request (libpd_cfg_t *cfg)
+{
+	#define NUM_ASYNC_REQS 8
+	static const char *uuids[NUM_ASYNC_REQS] = {"req-a0", "req-a1", "req-a2",
+		"req-a3", "req-a4", "req-a5", "req-a6", "req-a7"};
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t req_cfg = *cfg;
+	responder_t responder;
+	pthread_t responder_tid;
+	wrp_msg_t req, *resp;
+	char source[64];
+	unsigned i;
+	int timeout = 100;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Request Test\n"));
+	memset ((void*) &req, 0, sizeof(wrp_msg_t));
+	sprintf (source, "mac:112233445566/%s/req", req_cfg.service_name);
+	req.msg_type = WRP_MSG_TYPE__REQ;
+	req.u.req.source = source;
+	req.u.req.dest = "dns:cloud/config";
+	req.u.req.payload = "---RequestPayload---";
+	req.u.req.payload_size = 20;
+
+	CU_ASSERT (libparodus_request (NULL, &req, &resp, 100) 
+		== LIBPD_ERROR_REQUEST_NULL_INST);
+	CU_ASSERT (strcmp (libparodus_strerror (LIBPD_ERROR_REQUEST_NULL_INST), 
+		"Error on libparodus request. Null instance given.") == 0);
+	req_cfg.receive = false;
+	req_cfg.parodus_url = REQUEST_PARODUS_URL;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &req_cfg) == 0);
+	req.u.req.transaction_uuid = "req-0";
+	CU_ASSERT (libparodus_request (instance, &req, &resp, 100) 
+		== LIBPD_ERROR_REQUEST_CFG);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	responder.pull_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (responder.pull_sock >= 0);
+	CU_ASSERT (nn_setsockopt (responder.pull_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+		&timeout, sizeof (timeout)) >= 0);
+	CU_ASSERT_FATAL (nn_bind (responder.pull_sock, REQUEST_PARODUS_URL) >= 0);
+	responder.push_sock = nn_socket (AF_SP, NN_PUSH);
+	CU_ASSERT_FATAL (responder.push_sock >= 0);
+	CU_ASSERT (nn_connect (responder.push_sock, GOOD_CLIENT_URL) >= 0);
+	responder.stop = false;
+	responder.replies = 0;
+	CU_ASSERT_FATAL (pthread_create (&responder_tid, NULL, 
+		request_responder, &responder) == 0);
+
+	req_cfg.receive = true;
+	req_cfg.client_url = GOOD_CLIENT_URL;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &req_cfg) == 0);
+	CU_ASSERT (libparodus_request (instance, &req, NULL, 100) 
+		== LIBPD_ERROR_REQUEST_PARAM);
+	CU_ASSERT (libparodus_request_async (instance, &req, 100, NULL, NULL) 
+		== LIBPD_ERROR_REQUEST_PARAM);
+	req.u.req.transaction_uuid = NULL;
+	CU_ASSERT (libparodus_request (instance, &req, &resp, 100) 
+		== LIBPD_ERROR_REQUEST_PARAM);
+
+	req.u.req.transaction_uuid = "req-1";
+	CU_ASSERT_FATAL (libparodus_request (instance, &req, &resp, 2000) == 0);
+	CU_ASSERT (resp->msg_type == WRP_MSG_TYPE__REQ);
+	CU_ASSERT (strcmp (resp->u.req.transaction_uuid, "req-1") == 0);
+	CU_ASSERT (strcmp (resp->u.req.dest, source) == 0);
+	libparodus_free_msg (instance, resp);
+	req.u.req.transaction_uuid = "no-reply-1";
+	CU_ASSERT (libparodus_request (instance, &req, &resp, 100) == 1);
+	CU_ASSERT (NULL == resp);
+
+	memset (response_counts, 0, sizeof (response_counts));
+	for (i=0; i<NUM_ASYNC_REQS; i++) {
+		req.u.req.transaction_uuid = (char *) uuids[i];
+		CU_ASSERT (libparodus_request_async (instance, &req, 2000, 
+			test_response_cb, (void *) uuids[i]) == 0);
+	}
+	// a short timeout behind a long one still times out first
+	req.u.req.transaction_uuid = "no-reply-long";
+	CU_ASSERT (libparodus_request_async (instance, &req, 30000, 
+		test_response_cb, (void *) "no-reply-long") == 0);
+	CU_ASSERT (libparodus_request (instance, &req, &resp, 100) 
+		== LIBPD_ERROR_REQUEST_DUP);
+	req.u.req.transaction_uuid = "no-reply-short";
+	CU_ASSERT (libparodus_request_async (instance, &req, 100, 
+		test_response_cb, (void *) "no-reply-short") == 0);
+	for (i=0; i<300; i++) {
+		if ((get_response_count (0) == NUM_ASYNC_REQS) && (get_response_count (1) == 1))
 			break;
+		delay_ms (10);
+	}
+	CU_ASSERT (get_response_count (0) == NUM_ASYNC_REQS);
+	CU_ASSERT (get_response_count (1) == 1);
+	CU_ASSERT (get_response_count (2) == 0);
+	// responses never go to libparodus_receive
+	CU_ASSERT (libparodus_receive (instance, &resp, 100) == 1);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (get_response_count (2) == 1);
+	CU_ASSERT (responder.replies == NUM_ASYNC_REQS + 1);
+
+	responder.stop = true;
+	pthread_join (responder_tid, NULL);
+	nn_close (responder.push_sock);
+	nn_close (responder.pull_sock);
+	#undef NUM_ASYNC_REQS
+}
+
+static void *destroy_reqs_thread (void *arg)
+{
+	libpd_reqs_destroy ((libpd_reqs_t *) arg);
+	return NULL;
+}
+
+// an async request its sender still holds at shutdown gets its callback,
+// and the table isn't freed under the sender
+void test_reqs_destroy_held (void)
+{
+	libpd_reqs_t reqs = NULL;
+	pending_req_t *held, *started;
+	pthread_t destroy_tid;
+
+	memset (response_counts, 0, sizeof (response_counts));
+	CU_ASSERT_FATAL (libpd_reqs_create (&reqs, NULL, NULL) == 0);
+	CU_ASSERT_FATAL (libpd_reqs_add (reqs, "held-1", 30000, test_response_cb,
+		(void *) "held-1", &held) == 0);
+	CU_ASSERT_FATAL (libpd_reqs_add (reqs, "started-1", 30000, test_response_cb,
+		(void *) "started-1", &started) == 0);
+	libpd_reqs_start (reqs, started);
+	CU_ASSERT_FATAL (pthread_create (&destroy_tid, NULL, 
+		destroy_reqs_thread, &reqs) == 0);
+	// destroy completes the started request, and waits on the held one
+	delay_ms (200);
+	CU_ASSERT (get_response_count (2) == 1);
+	CU_ASSERT (NULL != reqs);
+	libpd_reqs_start (reqs, held);
+	pthread_join (destroy_tid, NULL);
+	CU_ASSERT (get_response_count (2) == 2);
+	CU_ASSERT (NULL == reqs);
+}
+
+void test_queue_evict (unsigned opts)
+{
+	libpd_mq_t queue;
+	void *evicted;
+	int exterr;
+
+	CU_ASSERT_FATAL (libpd_qcreate_opt (&queue, "//TEST_QUEUE", 3, 
+		opts, &exterr) == 0);
+	if (opts & LIBPD_QOPT_SPSC) {
+		CU_ASSERT (libpd_qsend_evict (queue, "Test Message # 0\n", 0, 0, 
+			evict_odd_msg, &evicted, &exterr) == LIBPD_QERR_SEND_SPSC);
+		libpd_qdestroy (&queue, NULL);
+		return;
+	}
+	CU_ASSERT (libpd_qsend_evict (NULL, "Test Message # 0\n", 0, 0, 
+		evict_odd_msg, &evicted, &exterr) == LIBPD_QERR_SEND_NULL);
+	test_queue_send_msg (queue, 500, 0);
+	CU_ASSERT (libpd_qsend_evict (queue, strdup ("Test Message # 1\n"), 0, 0, 
+		evict_odd_msg, &evicted, &exterr) == 0);
+	CU_ASSERT (NULL == evicted);
+	test_queue_send_msg (queue, 500, 2);
+	// full, so #1 makes room for #3
+	CU_ASSERT (libpd_qsend_evict (queue, strdup ("Test Message # 3\n"), 0, 0, 
+		evict_odd_msg, &evicted, &exterr) == 0);
+	CU_ASSERT_FATAL (NULL != evicted);
+	CU_ASSERT (get_msg_num ((char *) evicted) == 1);
+	free (evicted);
+	CU_ASSERT (libpd_qsend_evict (queue, strdup ("Test Message # 4\n"), 0, 0, 
+		evict_odd_msg, &evicted, &exterr) == 0);
+	CU_ASSERT_FATAL (NULL != evicted);
+	CU_ASSERT (get_msg_num ((char *) evicted) == 3);
+	free (evicted);
+	// nothing left that can be evicted
+	CU_ASSERT (libpd_qsend_evict (queue, "Test Message # 6\n", 0, 0, 
+		evict_odd_msg, &evicted, &exterr) == 1);
+	CU_ASSERT (NULL == evicted);
+	test_queue_rcv_msg (queue, 500, 0);
+	test_queue_rcv_msg (queue, 500, 2);
+	CU_ASSERT (libpd_qreceive (queue, &evicted, 500, &exterr) == 0);
+	CU_ASSERT (get_msg_num ((char *) evicted) == 4);
+	free (evicted);
+	if (opts & LIBPD_QOPT_EVENTFD)
+		CU_ASSERT (!fd_readable (libpd_qfd (queue)));
+	CU_ASSERT (libpd_qreceive (queue, &evicted, 0, &exterr) == 1);
+	CU_ASSERT (libpd_qdestroy (&queue, &qfree) == 0);
+}
+
+static void test_queue_send_prio (libpd_mq_t q, unsigned lane, int n, int expected)
+{
+	char msgbuf[100];
+	int exterr;
+	char *msg;
+
+	sprintf (msgbuf, "Test Message # %d\n", n);
+	msg = strdup (msgbuf);
+	CU_ASSERT_FATAL (msg != NULL);
+	CU_ASSERT (libpd_qsend_prio (q, msg, lane, 0, 0, &exterr) == expected);
+	if (expected != 0)
+		free (msg);
+}
+
+typedef struct {
+	uint32_t key;
+	unsigned seq;
+} work_msg_t;
+
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned work_next_seq[3];
+static unsigned work_done;
+static unsigned work_done_before_slow;
+
+// the first msg for key 0 is slow, which should only hold up key 0
+static void test_work_fn (void *msg, void *arg)
+{
+	work_msg_t *m = (work_msg_t *) msg;
+
+	CU_ASSERT (arg == (void *) &work_done);
+	if ((m->key == 0) && (m->seq == 0))
+		delay_ms (300);
+	pthread_mutex_lock (&work_mutex);
+	CU_ASSERT (m->seq == work_next_seq[m->key]);
+	work_next_seq[m->key]++;
+	work_done++;
+	if ((m->key != 0) && (work_next_seq[0] == 0))
+		work_done_before_slow++;
+	pthread_mutex_unlock (&work_mutex);
+}
+
+void test_workers (void)
+{
+	libpd_workers_t workers;
+	work_msg_t msgs[12];
+	libpd_lat_hist_t wait_hist;
+	libpd_latency_t summary;
+	unsigned i;
+	int oserr;
+
+	CU_ASSERT (libpd_workers_create (&workers, 0, 16, test_work_fn, &work_done,
+		NULL, NULL, &oserr) == LIBPD_WORKERR_CREATE_INVAL_SZ);
+	CU_ASSERT (NULL == workers);
+	CU_ASSERT (libpd_workers_key ("config/wifi") == libpd_workers_key ("config/wifi"));
+	CU_ASSERT (libpd_workers_key ("config/wifi") != libpd_workers_key ("config/lan"));
+
+	memset ((void *) work_next_seq, 0, sizeof (work_next_seq));
+	work_done = work_done_before_slow = 0;
+	memset ((void *) &wait_hist, 0, sizeof (wait_hist));
+	CU_ASSERT_FATAL (libpd_workers_create (&workers, 3, 16, test_work_fn, &work_done,
+		&wait_hist, NULL, &oserr) == 0);
+	for (i = 0; i < 12; i++) {
+		msgs[i].key = i / 4;
+		msgs[i].seq = i % 4;
+		CU_ASSERT (libpd_workers_submit (workers, msgs[i].key, &msgs[i], 0, 0) == 0);
+	}
+	CU_ASSERT (libpd_workers_high_water (workers) >= 4);
+	libpd_workers_destroy (&workers);
+	CU_ASSERT (NULL == workers);
+	CU_ASSERT (work_done == 12);
+	CU_ASSERT (work_done_before_slow == 8);
+	libpd_lat_summary (&wait_hist, &summary);
+	CU_ASSERT (summary.count == 12);
+
+	// one thread, room for one msg
+	memset ((void *) work_next_seq, 0, sizeof (work_next_seq));
+	work_done = work_done_before_slow = 0;
+	CU_ASSERT_FATAL (libpd_workers_create (&workers, 1, 1, test_work_fn, &work_done,
+		NULL, NULL, &oserr) == 0);
+	CU_ASSERT (libpd_workers_submit (workers, 0, &msgs[0], 0, 0) == 0);
+	CU_ASSERT (libpd_workers_submit (workers, 1, &msgs[4], 0, 0) == 1);
+	CU_ASSERT (libpd_workers_submit (workers, 1, &msgs[4], 0, 100) == 1);
+	CU_ASSERT (libpd_workers_submit (workers, 1, &msgs[4], 0, 2000) == 0);
+	CU_ASSERT (libpd_workers_high_water (workers) == 1);
+	libpd_workers_destroy (&workers);
+	CU_ASSERT (work_done == 2);
+	CU_ASSERT (libpd_workers_high_water (workers) == 0);
+}
+
+void test_queue_prio (void)
+{
+	libpd_mq_t queue;
+	void *msgs[4];
+	unsigned i, count;
+	int exterr;
+
+	CU_ASSERT (libpd_qcreate_prio (&queue, "//TEST_QUEUE", 2, 0, 
+		0, &exterr) == LIBPD_QERR_CREATE_INVAL_OPT);
+	CU_ASSERT (libpd_qcreate_prio (&queue, "//TEST_QUEUE", 2, 3, 
+		LIBPD_QOPT_SPSC, &exterr) == LIBPD_QERR_CREATE_INVAL_OPT);
+	CU_ASSERT_FATAL (libpd_qcreate_prio (&queue, "//TEST_QUEUE", 2, 3, 
+		LIBPD_QOPT_EVENTFD, &exterr) == 0);
+	test_queue_send_msg (queue, 0, 0);
+	test_queue_send_prio (queue, 9, 1, 0);
+	// lowest lane is full, but the others still have room
+	test_queue_send_prio (queue, LIBPD_QLANE_LOWEST, 2, 1);
+	test_queue_send_prio (queue, 1, 3, 0);
+	test_queue_send_prio (queue, 0, 4, 0);
+	test_queue_send_prio (queue, 0, 5, 0);
+	test_queue_send_prio (queue, 0, 6, 1);
+	test_queue_rcv_msg (queue, 0, 4);
+	test_queue_send_prio (queue, 0, 6, 0);
+	test_queue_rcv_msg (queue, 0, 5);
+	test_queue_rcv_msg (queue, 0, 6);
+	test_queue_send_prio (queue, 2, 7, 1);
+	CU_ASSERT (libpd_qreceive_many (queue, msgs, 4, 0, &count, &exterr) == 0);
+	CU_ASSERT_FATAL (count == 3);
+	CU_ASSERT (get_msg_num ((char *) msgs[0]) == 3);
+	CU_ASSERT (get_msg_num ((char *) msgs[1]) == 0);
+	CU_ASSERT (get_msg_num ((char *) msgs[2]) == 1);
+	for (i=0; i<count; i++)
+		free (msgs[i]);
+	CU_ASSERT (!fd_readable (libpd_qfd (queue)));
+	CU_ASSERT (libpd_qreceive (queue, msgs, 0, &exterr) == 1);
+	CU_ASSERT (libpd_qdestroy (&queue, &qfree) == 0);
+}
+
+void test_queue_eventfd (unsigned opts)
+{
+	libpd_mq_t queue;
+	void *msgs[4];
+	void *msg;
+	unsigned i, count;
+	int fd, rtn, exterr;
+
+	CU_ASSERT_FATAL (libpd_qcreate_opt (&queue, "//TEST_QUEUE", 3, 
+		opts, &exterr) == 0);
+	CU_ASSERT (libpd_qfd (queue) == -1);
+	libpd_qdestroy (&queue, &qfree);
+	CU_ASSERT (libpd_qfd (queue) == -1);
+
+	CU_ASSERT_FATAL (libpd_qcreate_opt (&queue, "//TEST_QUEUE", 3, 
+		opts | LIBPD_QOPT_EVENTFD, &exterr) == 0);
+	fd = libpd_qfd (queue);
+	CU_ASSERT_FATAL (fd >= 0);
+	CU_ASSERT (!fd_readable (fd));
+	test_queue_send_msg (queue, 500, 0);
+	CU_ASSERT (fd_readable (fd));
+	test_queue_rcv_msg (queue, 500, 0);
+	CU_ASSERT (!fd_readable (fd));
+	CU_ASSERT (libpd_qhigh_water (queue) == 1);
+	for (i=0; i<3; i++)
+		test_queue_send_msg (queue, 500, i);
+	CU_ASSERT (libpd_qhigh_water (queue) == 3);
+	// a send that times out on the full queue doesn't count
+	CU_ASSERT (libpd_qsend (queue, "extra", 100, &exterr) == 1);
+	msg = strdup ("Posted Message # 3\n");
+	rtn = libpd_qpost (queue, msg, 100, &exterr);
+	if (opts & LIBPD_QOPT_SPSC) {
+		CU_ASSERT (rtn == 0);
+	} else {
+		CU_ASSERT (rtn == 1);
+		free (msg);
 	}
-	libpd_log (LEVEL_INFO, ("LIBPD_TEST: End Send Disconnect Test\n"));
-	sleep (5);
+	CU_ASSERT (libpd_qreceive_many (queue, msgs, 4, 500, &count, &exterr) == 0);
+	CU_ASSERT (count == 3);
+	for (i=0; i<count; i++)
+		free (msgs[i]);
+	if (opts & LIBPD_QOPT_SPSC) {
+		CU_ASSERT (fd_readable (fd));
+		CU_ASSERT (libpd_qreceive (queue, &msg, 500, &exterr) == 0);
+		free (msg);
+	}
+	CU_ASSERT (!fd_readable (fd));
+	CU_ASSERT (libpd_qreceive (queue, &msg, 0, &exterr) == 1);
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 0);
 }
 
-int start_mock_parodus ()
+void test_queue_drain (unsigned opts)
 {
-	int pid;
-	const char *mock_parodus_path = MOCK_PARODUS_PATH();
-	const char *test_msgs_path = TEST_MSGS_PATH();
+	libpd_mq_t queue;
+	unsigned num_lanes = (opts & LIBPD_QOPT_SPSC) ? 1 : 2;
+	int fd, exterr;
 
-	pid = fork ();
-	if (pid == -1) {
-		libpd_log_err (LEVEL_ERROR, errno, ("Fork failed\n"));
-		CU_ASSERT_FATAL (-1 != pid);
+	CU_ASSERT (libpd_qdrain (NULL, &qfree) == 0);
+	CU_ASSERT_FATAL (libpd_qcreate_prio (&queue, "//TEST_QUEUE", 3, num_lanes,
+		opts | LIBPD_QOPT_EVENTFD, &exterr) == 0);
+	fd = libpd_qfd (queue);
+	CU_ASSERT (libpd_qdrain (queue, &qfree) == 0);
+	// wrap around the end of the msg array
+	test_queue_send_msg (queue, 500, 0);
+	test_queue_send_msg (queue, 500, 1);
+	test_queue_rcv_msg (queue, 500, 0);
+	test_queue_send_msg (queue, 500, 2);
+	test_queue_send_msg (queue, 500, 3);
+	if (opts & LIBPD_QOPT_SPSC) {
+		CU_ASSERT (libpd_qpost (queue, strdup ("Posted Message # 4\n"), 
+			500, &exterr) == 0);
+	} else {
+		CU_ASSERT (libpd_qsend_prio (queue, strdup ("Test Message # 4\n"), 0,
+			0, 500, &exterr) == 0);
 	}
-	if (pid == 0) {
-		// child
-		int err = execlp (mock_parodus_path, mock_parodus_path, 
-			"-f", test_msgs_path, "-d", "3",
-#ifdef MOCK_MSG_COUNT
-			"-c", MOCK_MSG_COUNT_STR,
-#endif
-			(char*)NULL);
-		if (err != 0) {
-			libpd_log_err (LEVEL_ERROR, errno, ("Failed execlp of mock_parodus\n"));
-		}
-		libpd_log (LEVEL_ERROR, ("Child finished\n"));
-	}
-	return pid;	
+	CU_ASSERT (fd_readable (fd));
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdrain (queue, &qfree) == 4);
+	CU_ASSERT (flush_queue_count == 4);
+	CU_ASSERT (!fd_readable (fd));
+	CU_ASSERT (libpd_qdrain (queue, &qfree) == 0);
+	// the queue is still usable, with all its room
+	test_queue_send_msg (queue, 500, 5);
+	test_queue_send_msg (queue, 500, 6);
+	test_queue_send_msg (queue, 500, 7);
+	test_queue_rcv_msg (queue, 500, 5);
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 2);
 }
 
-void test_time (void)
+void test_latency_hist (void)
 {
-	int rtn;
-	char timestamp[20];
-	struct timespec ts1;
-	struct timespec ts2;
-	bool ts2_greater;
+	libpd_lat_hist_t hist;
+	libpd_latency_t lat;
+	libpd_mq_t queue;
+	void *msg;
+	uint64_t i;
+	int exterr;
 
-	rtn = make_current_timestamp (timestamp);
-	if (rtn == 0)
-		printf ("LIBPD_TEST: Current time is %s\n", timestamp);
-	else
-		printf ("LIBPD_TEST: make timestamp error %d\n", rtn);
-	CU_ASSERT (rtn == 0);
-	rtn = get_expire_time (500, &ts1);
-	CU_ASSERT (rtn == 0);
-	rtn = get_expire_time (500, &ts2);
-	CU_ASSERT (rtn == 0);
-	printf ("ts1: (%u, %u), ts2: (%u, %u)\n", 
-		(unsigned)ts1.tv_sec, (unsigned)ts1.tv_nsec,
-		(unsigned)ts2.tv_sec, (unsigned)ts2.tv_nsec);
-	if (ts2.tv_sec != ts1.tv_sec)
-		ts2_greater = (bool) (ts2.tv_sec > ts1.tv_sec);
-	else
-		ts2_greater = (bool) (ts2.tv_nsec >= ts1.tv_nsec);
-	CU_ASSERT (ts2_greater);
-	rtn = get_expire_time (5000, &ts1);
-	CU_ASSERT (rtn == 0);
-	rtn = get_expire_time (500, &ts2);
-	CU_ASSERT (rtn == 0);
-	if (ts2.tv_sec != ts1.tv_sec)
-		ts2_greater = (bool) (ts2.tv_sec > ts1.tv_sec);
-	else
-		ts2_greater = (bool) (ts2.tv_nsec >= ts1.tv_nsec);
-	CU_ASSERT (!ts2_greater);
+	memset ((void*) &hist, 0, sizeof(hist));
+	libpd_lat_summary (&hist, &lat);
+	CU_ASSERT (lat.count == 0);
+	CU_ASSERT (lat.p50_ns == 0);
+	CU_ASSERT (lat.max_ns == 0);
+
+	// small values each get their own bucket
+	for (i=0; i<4; i++)
+		libpd_lat_record (&hist, i);
+	libpd_lat_summary (&hist, &lat);
+	CU_ASSERT (lat.count == 4);
+	CU_ASSERT (lat.p50_ns == 1);
+	CU_ASSERT (lat.p99_ns == 3);
+	CU_ASSERT (lat.max_ns == 3);
+
+	// buckets are at most 25% wide, and never reported above the max
+	memset ((void*) &hist, 0, sizeof(hist));
+	for (i=1; i<=1000; i++)
+		libpd_lat_record (&hist, i);
+	libpd_lat_summary (&hist, &lat);
+	CU_ASSERT (lat.count == 1000);
+	CU_ASSERT ((lat.p50_ns >= 500) && (lat.p50_ns < 625));
+	CU_ASSERT (lat.p99_ns == 1000);
+	CU_ASSERT (lat.p999_ns == 1000);
+	CU_ASSERT (lat.max_ns == 1000);
+	libpd_lat_record (&hist, 1ULL << 50);
+	libpd_lat_summary (&hist, &lat);
+	CU_ASSERT (lat.count == 1001);
+	CU_ASSERT (lat.p50_ns < 625);
+	CU_ASSERT ((lat.p999_ns >= 1000) && (lat.p999_ns < 1250));
+	CU_ASSERT (lat.max_ns == (1ULL << 50));
+
+	// only stamped msgs are timed by the queue
+	memset ((void*) &hist, 0, sizeof(hist));
+	CU_ASSERT_FATAL (libpd_qcreate (&queue, "//TEST_QUEUE", 3, &exterr) == 0);
+	CU_ASSERT (libpd_qset_latency (queue, &hist, &hist) == 0);
+	CU_ASSERT (libpd_qsend (queue, "untimed", 100, &exterr) == 0);
+	CU_ASSERT (libpd_qsend_stamped (queue, "timed", libpd_lat_now (), 
+		100, &exterr) == 0);
+	CU_ASSERT (libpd_qreceive (queue, &msg, 100, &exterr) == 0);
+	CU_ASSERT (strcmp ((char *) msg, "untimed") == 0);
+	CU_ASSERT (libpd_qreceive (queue, &msg, 100, &exterr) == 0);
+	CU_ASSERT (strcmp ((char *) msg, "timed") == 0);
+	libpd_lat_summary (&hist, &lat);
+	CU_ASSERT (lat.count == 2);	// queue wait and end to end
+	CU_ASSERT (libpd_qdestroy (&queue, NULL) == 0);
 }
 
-void test_queue_send_msg (libpd_mq_t q, unsigned timeout_ms, int n)
+// encode with libpd_wrp_encode, decode with wrp_to_struct
+static wrp_msg_t *wrp_encode_decode (wrp_msg_t *msg)
 {
-	void *msg;
-	int msgsize, exterr;
-	char msgbuf[100];
+	wrp_msg_t *decoded = NULL;
+	size_t buf_size = libpd_wrp_encoded_size (msg);
+	void *buf;
+	ssize_t len;
 
-	sprintf (msgbuf, "Test Message # %d\n", n);
-	msgsize = strlen(msgbuf) + 1;
-	msg = malloc (msgsize);
-	CU_ASSERT_FATAL (msg != NULL);
-	strncpy ((char*)msg, msgbuf, msgsize);
-	CU_ASSERT (libpd_qsend (q, msg, timeout_ms, &exterr) == 0);
+	CU_ASSERT (buf_size > 0);
+	if (buf_size == 0)
+		return NULL;
+	buf = malloc (buf_size);
+	CU_ASSERT_FATAL (NULL != buf);
+	CU_ASSERT (libpd_wrp_encode (msg, buf, buf_size-1) == -1);
+	len = libpd_wrp_encode (msg, buf, buf_size);
+	CU_ASSERT (len == (ssize_t) buf_size);
+	if (len > 0)
+		CU_ASSERT (wrp_to_struct (buf, len, WRP_BYTES, &decoded) > 0);
+	free (buf);
+	return decoded;
 }
 
-int get_msg_num (const char *msg)
+// true if libpd_wrp_encode gives the same bytes as wrp_struct_to
+static bool wrp_encode_matches (wrp_msg_t *msg)
 {
-	int num = -1;
-	bool found_pound = false;
-	int i;
-	char c;
+	size_t buf_size = libpd_wrp_encoded_size (msg);
+	void *buf, *bytes = NULL;
+	ssize_t len, wrp_len;
+	bool match;
 
-	for (i=0; (c=msg[i]) != 0; i++)
-	{
-		if (!found_pound) {
-			if (c == '#')
-				found_pound = true;
-			continue;
-		}
-		if ((c>='0') && (c<='9')) {
-			if (num == -1)
-				num = c - '0';
-			else
-				num = 10*num + (c - '0');
-		}
-	}
-	return num;
+	if (buf_size == 0)
+		return false;
+	buf = malloc (buf_size);
+	CU_ASSERT_FATAL (NULL != buf);
+	len = libpd_wrp_encode (msg, buf, buf_size);
+	wrp_len = wrp_struct_to (msg, WRP_BYTES, &bytes);
+	match = (len > 0) && (len == wrp_len) && (memcmp (buf, bytes, len) == 0);
+	free (bytes);
+	free (buf);
+	return match;
 }
 
-void test_queue_rcv_msg (libpd_mq_t q, unsigned timeout_ms, int n)
+void test_wrp_encode (void)
 {
-	int err, msg_num, exterr;
-	void *msg;
-	err = libpd_qreceive (q, &msg, timeout_ms, &exterr);
-	CU_ASSERT (err == 0);
-	if (err != 0)
-		return;
-	fputs ((char*) msg, stdout);
-	if (n < 0) {
-		free (msg);
-		return;
+	wrp_msg_t msg, *decoded;
+	char *big_payload;
+	const size_t big_size = 40000;
+	size_t i;
+	struct {
+		size_t count;
+		char *partner_ids[2];
+	} partners = {2, {"comcast", "xfinity"}};
+	struct {
+		size_t count;
+		char *headers[2];
+	} headers = {2, {"X-Webpa-Device-Name: mac:112233445566", "X-Midt-Span: 1"}};
+	struct data items[2] = {{"/boot-time", "1542914180"}, {"/hw-model", "TG1682G"}};
+	data_t metadata = {2, items};
+	const enum wrp_msg_type crud_types[4] = {WRP_MSG_TYPE__CREATE,
+		WRP_MSG_TYPE__RETREIVE, WRP_MSG_TYPE__UPDATE, WRP_MSG_TYPE__DELETE};
+
+	big_payload = (char *) malloc (big_size);
+	CU_ASSERT_FATAL (NULL != big_payload);
+	for (i=0; i<big_size; i++)
+		big_payload[i] = (char) (i & 0xff);
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__REQ;
+	msg.u.req.transaction_uuid = "c07ee5e1-70be-444c-a156-097c767ad8aa";
+	msg.u.req.source = "dns:talaria.xmidt.comcast.net/config";
+	msg.u.req.dest = "mac:112233445566/config/names";
+	msg.u.req.content_type = "application/json";
+	msg.u.req.partner_ids = (partners_t *) &partners;
+	msg.u.req.metadata = &metadata;
+	msg.u.req.payload = big_payload;
+	msg.u.req.payload_size = big_size;
+	decoded = wrp_encode_decode (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__REQ);
+	CU_ASSERT (strcmp (decoded->u.req.transaction_uuid, msg.u.req.transaction_uuid) == 0);
+	CU_ASSERT (strcmp (decoded->u.req.source, msg.u.req.source) == 0);
+	CU_ASSERT (strcmp (decoded->u.req.dest, msg.u.req.dest) == 0);
+	CU_ASSERT (strcmp (decoded->u.req.content_type, msg.u.req.content_type) == 0);
+	CU_ASSERT (decoded->u.req.payload_size == big_size);
+	CU_ASSERT (memcmp (decoded->u.req.payload, big_payload, big_size) == 0);
+	CU_ASSERT_FATAL (NULL != decoded->u.req.partner_ids);
+	CU_ASSERT (decoded->u.req.partner_ids->count == 2);
+	CU_ASSERT (strcmp (decoded->u.req.partner_ids->partner_ids[1], "xfinity") == 0);
+	CU_ASSERT_FATAL (NULL != decoded->u.req.metadata);
+	CU_ASSERT (decoded->u.req.metadata->count == 2);
+	CU_ASSERT (strcmp (decoded->u.req.metadata->data_items[1].value, "TG1682G") == 0);
+	CU_ASSERT (NULL == decoded->u.req.accept);
+	wrp_free_struct (decoded);
+
+	msg.u.req.accept = "application/msgpack";
+	CU_ASSERT (wrp_encode_matches (&msg));
+	decoded = wrp_encode_decode (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT_FATAL (NULL != decoded->u.req.accept);
+	CU_ASSERT (strcmp (decoded->u.req.accept, "application/msgpack") == 0);
+	wrp_free_struct (decoded);
+	msg.u.req.accept = NULL;
+	CU_ASSERT (wrp_encode_matches (&msg));
+
+	// money trace spans are left to wrp_struct_to
+	msg.u.req.include_spans = true;
+	CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
+	msg.u.req.include_spans = false;
+	msg.u.req.transaction_uuid = NULL;
+	CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/iot";
+	msg.u.event.dest = "event:device-status";
+	msg.u.event.payload = "online";
+	msg.u.event.payload_size = 6;
+	decoded = wrp_encode_decode (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__EVENT);
+	CU_ASSERT (strcmp (decoded->u.event.dest, msg.u.event.dest) == 0);
+	CU_ASSERT (decoded->u.event.payload_size == 6);
+	CU_ASSERT (memcmp (decoded->u.event.payload, "online", 6) == 0);
+	wrp_free_struct (decoded);
+	CU_ASSERT (wrp_encode_matches (&msg));
+	msg.u.event.content_type = "text/plain";
+	msg.u.event.partner_ids = (partners_t *) &partners;
+	msg.u.event.headers = (headers_t *) &headers;
+	msg.u.event.metadata = &metadata;
+	CU_ASSERT (wrp_encode_matches (&msg));
+	msg.u.event.payload = NULL;
+	msg.u.event.payload_size = 0;
+	CU_ASSERT (wrp_encode_matches (&msg));
+	// a list with a NULL string is left to wrp_struct_to
+	partners.partner_ids[1] = NULL;
+	CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
+	partners.partner_ids[1] = "xfinity";
+	items[1].value = NULL;
+	CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
+	items[1].value = "TG1682G";
+	msg.u.event.source = NULL;
+	CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
+
+	// every crud type, with the optional fields unset and set
+	for (i=0; i<4; i++) {
+		memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+		msg.msg_type = crud_types[i];
+		msg.u.crud.source = "dns:xmidt/crud";
+		msg.u.crud.dest = "mac:112233445566/iot";
+		CU_ASSERT (wrp_encode_matches (&msg));
+		msg.u.crud.transaction_uuid = "1234";
+		msg.u.crud.content_type = "application/json";
+		msg.u.crud.accept = "application/json";
+		msg.u.crud.path = "/tags/location";
+		msg.u.crud.status = 200;
+		msg.u.crud.rdr = -1;
+		msg.u.crud.partner_ids = (partners_t *) &partners;
+		msg.u.crud.headers = (headers_t *) &headers;
+		msg.u.crud.metadata = &metadata;
+		msg.u.crud.payload = "{\"location\":\"den\"}";
+		msg.u.crud.payload_size = 18;
+		CU_ASSERT (wrp_encode_matches (&msg));
+		msg.u.crud.include_spans = true;
+		CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
 	}
-	msg_num = get_msg_num ((char*)msg);
-	free (msg);
-	CU_ASSERT (msg_num >= 0);
-	if (msg_num < 0)
-		return;
-	CU_ASSERT (msg_num == n);
-}
 
-static int flush_queue_count = 0;
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__UPDATE;
+	msg.u.crud.transaction_uuid = "1234";
+	msg.u.crud.source = "dns:xmidt/crud";
+	msg.u.crud.dest = "mac:112233445566/iot";
+	msg.u.crud.path = "/tags/location";
+	msg.u.crud.status = 200;
+	msg.u.crud.rdr = -1;
+	msg.u.crud.accept = "application/json";
+	decoded = wrp_encode_decode (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__UPDATE);
+	CU_ASSERT (strcmp (decoded->u.crud.path, "/tags/location") == 0);
+	CU_ASSERT_FATAL (NULL != decoded->u.crud.accept);
+	CU_ASSERT (strcmp (decoded->u.crud.accept, "application/json") == 0);
+	CU_ASSERT (decoded->u.crud.status == 200);
+	CU_ASSERT (decoded->u.crud.rdr == -1);
+	wrp_free_struct (decoded);
 
-void qfree (void * msg)
-{
-	flush_queue_count++;
-	free (msg);
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__SVC_REGISTRATION;
+	msg.u.reg.service_name = "iot";
+	msg.u.reg.url = GOOD_CLIENT_URL;
+	decoded = wrp_encode_decode (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__SVC_REGISTRATION);
+	CU_ASSERT (strcmp (decoded->u.reg.service_name, "iot") == 0);
+	CU_ASSERT (strcmp (decoded->u.reg.url, GOOD_CLIENT_URL) == 0);
+	wrp_free_struct (decoded);
+	CU_ASSERT (wrp_encode_matches (&msg));
+	msg.u.reg.url = NULL;
+	CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__AUTH;
+	msg.u.auth.status = 200;
+	CU_ASSERT (wrp_encode_matches (&msg));
+	msg.u.auth.status = 403;
+	CU_ASSERT (wrp_encode_matches (&msg));
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+	decoded = wrp_encode_decode (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__SVC_ALIVE);
+	wrp_free_struct (decoded);
+	CU_ASSERT (wrp_encode_matches (&msg));
+
+	msg.msg_type = WRP_MSG_TYPE__UNKNOWN;
+	CU_ASSERT (libpd_wrp_encoded_size (&msg) == 0);
+	CU_ASSERT (libpd_wrp_encode (&msg, big_payload, big_size) == -1);
+	free (big_payload);
 }
 
-typedef struct {
-	libpd_mq_t queue;
-	unsigned initial_wait_ms;
-	unsigned num_msgs;
-	unsigned send_interval_ms;
-} test_queue_info_t;
+// encode into a nanomsg buffer, then decode borrowing from it
+static wrp_msg_t *wrp_encode_borrow (wrp_msg_t *msg)
+{
+	wrp_msg_t *decoded = NULL;
+	size_t buf_size = libpd_wrp_encoded_size (msg);
+	void *buf;
 
-static void *test_queue_sender_thread (void *arg)
+	CU_ASSERT (buf_size > 0);
+	if (buf_size == 0)
+		return NULL;
+	buf = nn_allocmsg (buf_size, 0);
+	CU_ASSERT_FATAL (NULL != buf);
+	CU_ASSERT (libpd_wrp_encode (msg, buf, buf_size) == (ssize_t) buf_size);
+	// truncated msg is rejected, and the buffer is still ours
+	CU_ASSERT (libpd_wrp_decode_borrowed (buf, buf_size-1, &decoded) == -1);
+	CU_ASSERT (NULL == decoded);
+	CU_ASSERT (libpd_wrp_decode_borrowed (buf, buf_size, &decoded) 
+		== (ssize_t) buf_size);
+	return decoded;
+}
+
+void test_wrp_decode_borrowed (void)
 {
-	test_queue_info_t *qinfo = (test_queue_info_t *) arg;
-	unsigned i;
+	wrp_msg_t msg, *decoded;
+	char *big_payload;
+	const size_t big_size = 40000;
+	size_t i;
+	struct {
+		size_t count;
+		char *partner_ids[2];
+	} partners = {2, {"comcast", "xfinity"}};
+	struct {
+		size_t count;
+		char *headers[1];
+	} headers = {1, {"X-Webpa-Device-Name: mac:112233445566"}};
+	struct data items[3] = {{"/boot-time", "1542914180"}, {"/hw-model", "TG1682G"},
+		{"/fw-name", "TG1682_3.3p8s1_PROD_sey"}};
+	data_t metadata = {2, items};
+	size_t n;
+	ssize_t len;
+	void *buf, *nn_buf;
 
-	libpd_log (LEVEL_INFO, ("LIBPD_TEST: started test_queue_sender_thread\n"));
-	if (qinfo->initial_wait_ms != 0)
-		delay_ms (qinfo->initial_wait_ms);
+	big_payload = (char *) malloc (big_size);
+	CU_ASSERT_FATAL (NULL != big_payload);
+	for (i=0; i<big_size; i++)
+		big_payload[i] = (char) (i & 0xff);
 
-	for (i=0; i<qinfo->num_msgs; i++)
-	{
-		test_queue_send_msg (qinfo->queue, qinfo->send_interval_ms, i);
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__REQ;
+	msg.u.req.transaction_uuid = "c07ee5e1-70be-444c-a156-097c767ad8aa";
+	msg.u.req.source = "dns:talaria.xmidt.comcast.net/config";
+	msg.u.req.dest = "mac:112233445566/config/names";
+	msg.u.req.content_type = "application/json";
+	msg.u.req.accept = "application/msgpack";
+	msg.u.req.partner_ids = (partners_t *) &partners;
+	msg.u.req.headers = (headers_t *) &headers;
+	msg.u.req.metadata = &metadata;
+	msg.u.req.payload = big_payload;
+	msg.u.req.payload_size = big_size;
+	decoded = wrp_encode_borrow (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__REQ);
+	CU_ASSERT (strcmp (decoded->u.req.transaction_uuid, msg.u.req.transaction_uuid) == 0);
+	CU_ASSERT (strcmp (decoded->u.req.source, msg.u.req.source) == 0);
+	CU_ASSERT (strcmp (decoded->u.req.dest, msg.u.req.dest) == 0);
+	CU_ASSERT (strcmp (decoded->u.req.content_type, msg.u.req.content_type) == 0);
+	CU_ASSERT_FATAL (NULL != decoded->u.req.accept);
+	CU_ASSERT (strcmp (decoded->u.req.accept, msg.u.req.accept) == 0);
+	CU_ASSERT (decoded->u.req.payload_size == big_size);
+	CU_ASSERT (memcmp (decoded->u.req.payload, big_payload, big_size) == 0);
+	CU_ASSERT_FATAL (NULL != decoded->u.req.partner_ids);
+	CU_ASSERT (decoded->u.req.partner_ids->count == 2);
+	CU_ASSERT (strcmp (decoded->u.req.partner_ids->partner_ids[0], "comcast") == 0);
+	CU_ASSERT (strcmp (decoded->u.req.partner_ids->partner_ids[1], "xfinity") == 0);
+	CU_ASSERT_FATAL (NULL != decoded->u.req.headers);
+	CU_ASSERT (decoded->u.req.headers->count == 1);
+	CU_ASSERT (strcmp (decoded->u.req.headers->headers[0], headers.headers[0]) == 0);
+	CU_ASSERT_FATAL (NULL != decoded->u.req.metadata);
+	CU_ASSERT (decoded->u.req.metadata->count == 2);
+	CU_ASSERT (strcmp (decoded->u.req.metadata->data_items[0].name, "/boot-time") == 0);
+	CU_ASSERT (strcmp (decoded->u.req.metadata->data_items[1].value, "TG1682G") == 0);
+	libpd_wrp_free_msg (decoded);
+
+	// no payload, so the msg ends with a string
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/iot";
+	msg.u.event.dest = "event:device-status";
+	msg.u.event.metadata = &metadata;
+	decoded = wrp_encode_borrow (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__EVENT);
+	CU_ASSERT (strcmp (decoded->u.event.source, msg.u.event.source) == 0);
+	CU_ASSERT (strcmp (decoded->u.event.dest, msg.u.event.dest) == 0);
+	CU_ASSERT (NULL == decoded->u.event.partner_ids);
+	CU_ASSERT (NULL == decoded->u.event.payload);
+	CU_ASSERT_FATAL (NULL != decoded->u.event.metadata);
+	CU_ASSERT (strcmp (decoded->u.event.metadata->data_items[1].name, "/hw-model") == 0);
+	CU_ASSERT (strcmp (decoded->u.event.metadata->data_items[1].value, "TG1682G") == 0);
+	libpd_wrp_free_msg (decoded);
+
+	// odd metadata counts, followed by a copied string
+	for (n=1; n<=3; n+=2) {
+		metadata.count = n;
+		decoded = wrp_encode_borrow (&msg);
+		CU_ASSERT_FATAL (NULL != decoded);
+		CU_ASSERT_FATAL (NULL != decoded->u.event.metadata);
+		CU_ASSERT (decoded->u.event.metadata->count == n);
+		for (i=0; i<n; i++) {
+			CU_ASSERT (strcmp (decoded->u.event.metadata->data_items[i].name, 
+				items[i].name) == 0);
+			CU_ASSERT (strcmp (decoded->u.event.metadata->data_items[i].value, 
+				items[i].value) == 0);
+		}
+		CU_ASSERT (strcmp (decoded->u.event.dest, msg.u.event.dest) == 0);
+		libpd_wrp_free_msg (decoded);
 	}
-	libpd_log (LEVEL_INFO, ("LIBPD_TEST: ended test_queue_sender_thread\n"));
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__DELETE;
+	msg.u.crud.transaction_uuid = "1234";
+	msg.u.crud.source = "dns:xmidt/crud";
+	msg.u.crud.dest = "mac:112233445566/iot";
+	msg.u.crud.path = "/tags/location";
+	msg.u.crud.accept = "application/json";
+	msg.u.crud.status = 200;
+	msg.u.crud.rdr = -1;
+	msg.u.crud.payload = "x";
+	msg.u.crud.payload_size = 1;
+	decoded = wrp_encode_borrow (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__DELETE);
+	CU_ASSERT (strcmp (decoded->u.crud.path, "/tags/location") == 0);
+	CU_ASSERT (decoded->u.crud.status == 200);
+	CU_ASSERT (decoded->u.crud.rdr == -1);
+	CU_ASSERT (decoded->u.crud.payload_size == 1);
+	CU_ASSERT_FATAL (NULL != decoded->u.crud.accept);
+	CU_ASSERT (strcmp (decoded->u.crud.accept, "application/json") == 0);
+	libpd_wrp_free_msg (decoded);
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+	decoded = wrp_encode_borrow (&msg);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__SVC_ALIVE);
+	libpd_wrp_free_msg (decoded);
+
+	// a msg with spans is decoded by wrp_to_struct, but is still
+	// freed with libpd_wrp_free_msg
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__REQ;
+	msg.u.req.transaction_uuid = "c07ee5e1-70be-444c-a156-097c767ad8aa";
+	msg.u.req.source = "dns:talaria.xmidt.comcast.net/config";
+	msg.u.req.dest = "mac:112233445566/config/names";
+	msg.u.req.include_spans = true;
+	len = wrp_struct_to (&msg, WRP_BYTES, &buf);
+	CU_ASSERT_FATAL (len > 0);
+	nn_buf = nn_allocmsg ((size_t) len, 0);
+	CU_ASSERT_FATAL (NULL != nn_buf);
+	memcpy (nn_buf, buf, (size_t) len);
+	free (buf);
+	decoded = NULL;
+	CU_ASSERT (libpd_wrp_decode_borrowed (nn_buf, (size_t) len, &decoded) == len);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__REQ);
+	CU_ASSERT (strcmp (decoded->u.req.dest, msg.u.req.dest) == 0);
+	libpd_wrp_free_msg (decoded);
+
+	libpd_wrp_free_msg (NULL);
+	free (big_payload);
+}
+
+static void *pool_free_thread (void *arg)
+{
+	void **blocks = (void **) arg;
+	unsigned i;
+
+	for (i=0; i<16; i++)
+		libpd_pool_free (blocks[i]);
 	return NULL;
 }
 
-void test_queues (void)
+static void pool_release (void *arg)
 {
-	test_queue_info_t qinfo;
-	int i, rtn, exterr;
-	void *msg;
-	pthread_t sender_test_tid;
+	(*(int *) arg)++;
+}
 
-	qinfo.initial_wait_ms = 2000;
-	qinfo.num_msgs = 5;
-	qinfo.send_interval_ms = 500;
+void test_pool (void)
+{
+	libpd_pool_t *pool;
+	libpd_pool_cache_t cache;
+	wrp_msg_t msg, *decoded = NULL;
+	void *blocks[16];
+	void *block, *buf;
+	size_t slab_bytes, buf_size;
+	pthread_t tid;
+	unsigned i;
+	int released = 0;
 
-	CU_ASSERT (libpd_qcreate (&qinfo.queue, "//TEST_QUEUE", 5, &exterr) == 0);
-	for (i=0; i< 5; i++)
-		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
-	CU_ASSERT (libpd_qsend (qinfo.queue, "extra message", 
-		qinfo.send_interval_ms, &exterr) == 1); // timed out
-	for (i=0; i< 5; i++)
-		test_queue_rcv_msg (qinfo.queue, qinfo.send_interval_ms, i);
-	CU_ASSERT (libpd_qreceive (qinfo.queue, &msg, 
-		qinfo.send_interval_ms, &exterr) == 1); // timed out
-	for (i=0; i< 5; i++)
-	{
-		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
-		test_queue_rcv_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	CU_ASSERT (libpd_pool_bytes (NULL) == 0);
+	CU_ASSERT (libpd_pool_fallbacks (NULL) == 0);
+	// room for one slab of the smallest chunks
+	pool = libpd_pool_create (4096);
+	CU_ASSERT_FATAL (NULL != pool);
+	libpd_pool_cache_init (&cache, pool);
+	for (i=0; i<16; i++) {
+		blocks[i] = libpd_pool_alloc (&cache, 100);
+		CU_ASSERT_FATAL (NULL != blocks[i]);
+		memset (blocks[i], (int) i, 100);
 	}
-	flush_queue_count = 0;
-	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
-	CU_ASSERT (flush_queue_count == 0);
+	slab_bytes = libpd_pool_bytes (pool);
+	CU_ASSERT ((slab_bytes > (16 * 128)) && (slab_bytes < 4096));
+	CU_ASSERT (libpd_pool_fallbacks (pool) == 0);
+	// the slab is used up, and there is no room for another
+	block = libpd_pool_alloc (&cache, 100);
+	CU_ASSERT_FATAL (NULL != block);
+	CU_ASSERT (libpd_pool_fallbacks (pool) == 1);
+	libpd_pool_free (block);
+	// nor for anything bigger than the largest class
+	block = libpd_pool_alloc (&cache, 4000);
+	CU_ASSERT_FATAL (NULL != block);
+	memset (block, 0, 4000);
+	CU_ASSERT (libpd_pool_fallbacks (pool) == 2);
+	libpd_pool_free (block);
+	// freed by another thread, then reused without a new slab
+	CU_ASSERT_FATAL (pthread_create (&tid, NULL, pool_free_thread, 
+		(void *) blocks) == 0);
+	pthread_join (tid, NULL);
+	for (i=0; i<16; i++) {
+		blocks[i] = libpd_pool_alloc (&cache, 64 + i);
+		CU_ASSERT_FATAL (NULL != blocks[i]);
+	}
+	CU_ASSERT (libpd_pool_bytes (pool) == slab_bytes);
+	CU_ASSERT (libpd_pool_fallbacks (pool) == 2);
+	for (i=0; i<16; i++)
+		libpd_pool_free (blocks[i]);
+	// without a cache it's just malloc
+	block = libpd_pool_alloc (NULL, 100);
+	CU_ASSERT_FATAL (NULL != block);
+	libpd_pool_free (block);
+	CU_ASSERT (libpd_pool_fallbacks (pool) == 2);
+	libpd_pool_cache_flush (&cache);
+	libpd_pool_destroy (pool, NULL, NULL);
+	libpd_pool_destroy (NULL, NULL, NULL);
 
-	CU_ASSERT (libpd_qcreate (&qinfo.queue, "//TEST_QUEUE", 5, &exterr) == 0);
-	for (i=0; i< 5; i++)
-		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
-	flush_queue_count = 0;
-	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
-	CU_ASSERT (flush_queue_count == 5);
+	// a decoded msg takes one chunk
+	pool = libpd_pool_create (64 * 1024);
+	CU_ASSERT_FATAL (NULL != pool);
+	libpd_pool_cache_init (&cache, pool);
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/iot";
+	msg.u.event.dest = "event:device-status";
+	msg.u.event.payload = "online";
+	msg.u.event.payload_size = 6;
+	buf_size = libpd_wrp_encoded_size (&msg);
+	CU_ASSERT_FATAL (buf_size > 0);
+	buf = nn_allocmsg (buf_size, 0);
+	CU_ASSERT_FATAL (NULL != buf);
+	CU_ASSERT (libpd_wrp_encode (&msg, buf, buf_size) == (ssize_t) buf_size);
+	CU_ASSERT (libpd_wrp_decode_pooled (buf, buf_size, &cache, &decoded)
+		== (ssize_t) buf_size);
+	CU_ASSERT_FATAL (NULL != decoded);
+	CU_ASSERT (strcmp (decoded->u.event.dest, msg.u.event.dest) == 0);
+	CU_ASSERT (libpd_pool_bytes (pool) > 0);
+	CU_ASSERT (libpd_pool_fallbacks (pool) == 0);
+	// the msg holds the pool past libpd_pool_destroy
+	libpd_pool_destroy (pool, pool_release, &released);
+	CU_ASSERT (released == 0);
+	CU_ASSERT (strcmp (decoded->u.event.dest, msg.u.event.dest) == 0);
+	libpd_wrp_free_msg (decoded);
+	CU_ASSERT (released == 1);
+}
 
-	CU_ASSERT (libpd_qcreate (&qinfo.queue, "//TEST_QUEUE", 
-		qinfo.num_msgs, &exterr) == 0);
-	rtn = pthread_create 
-		(&sender_test_tid, NULL, test_queue_sender_thread, (void*) &qinfo);
-	CU_ASSERT (rtn == 0);
-	if (rtn == 0) {
-		for (i=0; i< (int)qinfo.num_msgs; i++)
-			test_queue_rcv_msg (qinfo.queue, 4000, -1);
-		pthread_join (sender_test_tid, NULL);
-	}
-	flush_queue_count = 0;
-	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
-	CU_ASSERT (flush_queue_count == 0);
+// encode msg and check what libpd_wrp_peek finds in it
+static void wrp_encode_peek (wrp_msg_t *msg, const char *expected_dest)
+{
+	size_t buf_size = libpd_wrp_encoded_size (msg);
+	void *buf;
+	int msg_type;
+	const char *dest;
+	size_t dest_len;
 
-	CU_ASSERT (libpd_qcreate (&qinfo.queue, "//TEST_QUEUE", 
-		qinfo.num_msgs, &exterr) == 0);
-	qinfo.initial_wait_ms = 0;
-	qinfo.num_msgs += 5;
-	qinfo.send_interval_ms = 5000;
-	rtn = pthread_create 
-		(&sender_test_tid, NULL, test_queue_sender_thread, (void*) &qinfo);
-	CU_ASSERT (rtn == 0);
-	if (rtn == 0) {
-		delay_ms (2000);
-		for (i=0; i< (int)qinfo.num_msgs; i++) {
-			test_queue_rcv_msg (qinfo.queue, 4000, -1);
-			delay_ms (500);
-		}
-		pthread_join (sender_test_tid, NULL);
+	CU_ASSERT_FATAL (buf_size > 0);
+	buf = malloc (buf_size);
+	CU_ASSERT_FATAL (NULL != buf);
+	CU_ASSERT (libpd_wrp_encode (msg, buf, buf_size) == (ssize_t) buf_size);
+	CU_ASSERT (libpd_wrp_peek (buf, buf_size, &msg_type, &dest, &dest_len) == 0);
+	CU_ASSERT (msg_type == (int) msg->msg_type);
+	if (NULL == expected_dest) {
+		CU_ASSERT (NULL == dest);
+	} else {
+		CU_ASSERT_FATAL (NULL != dest);
+		CU_ASSERT (dest_len == strlen (expected_dest));
+		CU_ASSERT (memcmp (dest, expected_dest, dest_len) == 0);
 	}
-	flush_queue_count = 0;
-	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
-	CU_ASSERT (flush_queue_count == 0);
+	// msg_type comes first, so it can't be found in a truncated map header
+	CU_ASSERT (libpd_wrp_peek (buf, 1, &msg_type, &dest, &dest_len) == -1);
+	free (buf);
+}
+
+void test_wrp_peek (void)
+{
+	wrp_msg_t msg;
+	wrp_msg_t *decoded;
+	char buf[128];
+	int msg_type;
+	const char *dest;
+	size_t dest_len, len;
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+	wrp_encode_peek (&msg, NULL);
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__AUTH;
+	msg.u.auth.status = 200;
+	wrp_encode_peek (&msg, NULL);
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__REQ;
+	msg.u.req.transaction_uuid = "c07ee5e1-70be-444c-a156-097c767ad8aa";
+	msg.u.req.source = "dns:talaria.xmidt.comcast.net/config";
+	msg.u.req.dest = "mac:112233445566/config/names";
+	msg.u.req.payload = "payload";
+	msg.u.req.payload_size = 7;
+	wrp_encode_peek (&msg, msg.u.req.dest);
+
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__RETREIVE;
+	msg.u.crud.source = "dns:xmidt/crud";
+	msg.u.crud.dest = "mac:112233445566/iot";
+	msg.u.crud.path = "/tags";
+	wrp_encode_peek (&msg, msg.u.crud.dest);
+
+	CU_ASSERT (libpd_wrp_peek ("*** Invalid WRP message\n", 24,
+		&msg_type, &dest, &dest_len) == -1);
+	CU_ASSERT (libpd_wrp_peek (NULL, 0, &msg_type, &dest, &dest_len) == -1);
+
+	// an extra field is found by libpd_wrp_peek_str, and skipped by the decoder
+	memset ((void*) &msg, 0, sizeof(wrp_msg_t));
+	msg.msg_type = WRP_MSG_TYPE__SVC_REGISTRATION;
+	msg.u.reg.service_name = "iot";
+	msg.u.reg.url = "tcp://127.0.0.1:6667";
+	len = libpd_wrp_encoded_size_ext (&msg, "shm", "/proc/1/fd/3");
+	CU_ASSERT (len > libpd_wrp_encoded_size (&msg));
+	CU_ASSERT_FATAL (len < sizeof (buf));
+	CU_ASSERT (libpd_wrp_encode_ext (&msg, "shm", "/proc/1/fd/3", buf, len) == (ssize_t) len);
+	CU_ASSERT (libpd_wrp_peek_str (buf, len, "shm", &dest, &dest_len) == 0);
+	CU_ASSERT ((dest_len == 12) && (memcmp (dest, "/proc/1/fd/3", 12) == 0));
+	CU_ASSERT (libpd_wrp_peek_str (buf, len, "url", &dest, &dest_len) == 0);
+	CU_ASSERT ((dest_len == 20) && (memcmp (dest, msg.u.reg.url, 20) == 0));
+	CU_ASSERT (libpd_wrp_peek_str (buf, len, "dest", &dest, &dest_len) == -1);
+	CU_ASSERT_FATAL (wrp_to_struct (buf, len, WRP_BYTES, &decoded) > 0);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__SVC_REGISTRATION);
+	CU_ASSERT (strcmp (decoded->u.reg.service_name, "iot") == 0);
+	wrp_free_struct (decoded);
 }
 
 void wait_auth_received (void)
@@ -714,6 +3648,52 @@ void test_send_only (void)
 
 }
 
+// inits with one bad cfg field, and checks the detail that names it
+static void init_bad_cfg (libpd_cfg_t *cfg, int expected_detail)
+{
+	libpd_instance_t instance = NULL;
+	extra_err_info_t err_info;
+
+	CU_ASSERT (libparodus_init_dbg (&instance, cfg, &err_info) 
+		== LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (err_info.err_detail == expected_detail);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+}
+
+void test_init_cfg_errors (libpd_cfg_t *cfg)
+{
+	static const char *bad_names[1] = {""};
+	libpd_priority_rule_t bad_rule = {.priority = LIBPD_MAX_PRIORITY + 1};
+	libpd_cfg_t bad_cfg;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: Begin Init Cfg Errors Test\n"));
+	bad_cfg = *cfg;
+	bad_cfg.receive_overflow = (libpd_overflow_t) 99;
+	init_bad_cfg (&bad_cfg, LIBPD_ERR_INIT_CFG_OVERFLOW);
+	bad_cfg = *cfg;
+	bad_cfg.receive_queue_size = 1;
+	init_bad_cfg (&bad_cfg, LIBPD_ERR_INIT_CFG_QUEUE_SIZE);
+	bad_cfg = *cfg;
+	bad_cfg.priority_rules = &bad_rule;
+	bad_cfg.num_priority_rules = 1;
+	init_bad_cfg (&bad_cfg, LIBPD_ERR_INIT_CFG_PRIORITY);
+	bad_cfg = *cfg;
+	bad_cfg.msg_handler_order = (libpd_handler_order_t) 99;
+	init_bad_cfg (&bad_cfg, LIBPD_ERR_INIT_CFG_ORDER);
+	bad_cfg = *cfg;
+	bad_cfg.receive = true;
+	bad_cfg.extra_service_names = bad_names;
+	bad_cfg.num_extra_services = 1;
+	init_bad_cfg (&bad_cfg, LIBPD_ERR_INIT_CFG_SERVICES);
+	bad_cfg = *cfg;
+	bad_cfg.transport = (libpd_transport_t) 99;
+	init_bad_cfg (&bad_cfg, LIBPD_ERR_INIT_CFG_TRANSPORT);
+	bad_cfg = *cfg;
+	bad_cfg.receive = true;
+	bad_cfg.shm_ring_size = LIBPD_SHM_MIN_RING_SIZE + 1;
+	init_bad_cfg (&bad_cfg, LIBPD_ERR_INIT_CFG_SHM);
+}
+
 void test_multiple_inits (void)
 {
 	#define NUM_INSTANCES 1000
@@ -778,7 +3758,7 @@ static void *SecondReceiverTask()
 		if (wrp_msg->msg_type == WRP_MSG_TYPE__REQ)
 			if (send_reply (test_instance1, wrp_msg) != 0)
 				reply_error_count++;
-		wrp_free_struct (wrp_msg);
+		libparodus_free_msg (test_instance1, wrp_msg);
 		msgs_received_count++;
 	}
 	CU_ASSERT (reply_error_count == 0);
@@ -800,20 +3780,46 @@ void test_1(void)
 	int test_sock, dup_sock;
 	libpd_mq_t test_queue;
 	wrp_msg_t *wrp_msg;
+	wrp_msg_t *wrp_msgs[4];
+	size_t i, batch_count;
 	unsigned event_num = 0;
 	unsigned msg_num = 0;
 	libpd_instance_t current_instance;
 	libpd_instance_t null_instance = NULL;
+	libpd_instance_t zc_instance = NULL;
 	libpd_cfg_t cfg1 = {.service_name = service_name1,
 		.receive = true, .keepalive_timeout_secs = 0};
 	libpd_cfg_t cfg2 = {.service_name = service_name2,
 		.receive = true, .keepalive_timeout_secs = 0};
+	libpd_cfg_t local_cfg;
+	int local_sock;
 
 	test_time ();
 
 	CU_ASSERT_FATAL (check_current_dir() == 0);
 
-	test_queues ();
+	test_queues (0);
+	test_queues (LIBPD_QOPT_SPSC);
+	test_spsc_post ();
+	test_queue_rcv_many (0);
+	test_queue_rcv_many (LIBPD_QOPT_SPSC);
+	test_queue_eventfd (0);
+	test_queue_eventfd (LIBPD_QOPT_SPSC);
+	test_queue_drain (0);
+	test_queue_drain (LIBPD_QOPT_SPSC);
+	test_queue_evict (0);
+	test_queue_evict (LIBPD_QOPT_EVENTFD);
+	test_queue_evict (LIBPD_QOPT_SPSC);
+	test_queue_prio ();
+	test_routes ();
+	test_workers ();
+	test_ipc ();
+	test_shm ();
+	test_latency_hist ();
+	test_wrp_encode ();
+	test_wrp_decode_borrowed ();
+	test_pool ();
+	test_wrp_peek ();
 
 	//test_set_cfg (&cfg);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test connect receiver, good IP\n"));
@@ -849,13 +3855,13 @@ void test_1(void)
 	test_send_wrp_queue_ok (test_queue, &oserr);
 	test_send_wrp_queue_ok (test_queue, &oserr);
 	test_send_wrp_queue_ok (test_queue, &oserr);
-	CU_ASSERT (flush_wrp_queue (test_queue, 500, &oserr) == 3);
-	CU_ASSERT (flush_wrp_queue (test_queue, 500, &oserr) == 0);
+	CU_ASSERT (flush_wrp_queue (test_queue) == 3);
+	CU_ASSERT (flush_wrp_queue (test_queue) == 0);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test wrp_flush_queue with close msg\n"));
 	test_send_wrp_queue_ok (test_queue, &oserr);
 	test_send_wrp_queue_ok (test_queue, &oserr);
 	test_close_receiver (test_queue, &oserr);
-	CU_ASSERT (flush_wrp_queue (test_queue, 500, &oserr) == 3);
+	CU_ASSERT (flush_wrp_queue (test_queue) == 3);
 
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test libparodus receive timeout\n"));
 	CU_ASSERT (libparodus_receive__ (test_queue, &wrp_msg, 500, &oserr) == 1);
@@ -867,6 +3873,42 @@ void test_1(void)
 	}
 	CU_ASSERT (rtn == 2);
 
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test libparodus receive batch\n"));
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, wrp_msgs, 4, 500, 
+		&batch_count, &oserr) == 1);
+	CU_ASSERT (batch_count == 0);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, wrp_msgs, 2, 500, 
+		&batch_count, &oserr) == 0);
+	CU_ASSERT (batch_count == 2);
+	for (i=0; i<batch_count; i++)
+		wrp_free_struct (wrp_msgs[i]);
+	CU_ASSERT (test_close_receiver (test_queue, &oserr) == 0);
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, wrp_msgs, 4, 500, 
+		&batch_count, &oserr) == 2);
+	CU_ASSERT (batch_count == 1);
+	for (i=0; i<batch_count; i++)
+		wrp_free_struct (wrp_msgs[i]);
+	// the closed msg ends the batch, and msgs behind it stay queued
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	CU_ASSERT (test_close_receiver (test_queue, &oserr) == 0);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, wrp_msgs, 4, 500, 
+		&batch_count, &oserr) == 2);
+	CU_ASSERT (batch_count == 1);
+	for (i=0; i<batch_count; i++)
+		wrp_free_struct (wrp_msgs[i]);
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, wrp_msgs, 4, 500, 
+		&batch_count, &oserr) == 0);
+	CU_ASSERT (batch_count == 2);
+	for (i=0; i<batch_count; i++)
+		wrp_free_struct (wrp_msgs[i]);
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, wrp_msgs, 4, 100, 
+		&batch_count, &oserr) == 1);
+
 	test_close_wrp_queue (&test_queue); 
 
 	CU_ASSERT (libparodus_receive__ 
@@ -874,6 +3916,8 @@ void test_1(void)
 
 	rtn = libparodus_receive (null_instance, &wrp_msg, 500);
 	CU_ASSERT (rtn == LIBPD_ERROR_RCV_NULL_INST);
+	rtn = libparodus_receive_batch (null_instance, wrp_msgs, 4, 500, &batch_count);
+	CU_ASSERT (rtn == LIBPD_ERROR_RCV_NULL_INST);
   CU_ASSERT (strcmp (libparodus_strerror (rtn), 
 			"Error on libparodus receive. Null instance given.") == 0);
 	rtn = libparodus_close_receiver (null_instance);
@@ -931,6 +3975,36 @@ void test_1(void)
 	else if (do_send_disconnect_test)
 		test_send_disconnect ();
 	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
+	test_send_async (&cfg1);
+
+	// the receiver tests register with a local sink rather than the mock,
+	// so the mock sends its keep alive msgs to the instance that counts them
+	local_sock = nn_socket (AF_SP, NN_PULL);
+	CU_ASSERT_FATAL (local_sock >= 0);
+	CU_ASSERT_FATAL (nn_bind (local_sock, LOCAL_PARODUS_URL) >= 0);
+	local_cfg = cfg1;
+	local_cfg.parodus_url = LOCAL_PARODUS_URL;
+	test_receive_fd (&local_cfg);
+	test_msg_handler (&local_cfg, 0, LIBPD_ORDER_NONE);
+	test_msg_handler (&local_cfg, 3, LIBPD_ORDER_NONE);
+	test_msg_handler (&local_cfg, 3, LIBPD_ORDER_BY_DEST);
+	test_msg_handler (&local_cfg, 3, LIBPD_ORDER_BY_UUID);
+	test_parallel_handlers (&local_cfg);
+	test_route_handler (&local_cfg, 0);
+	test_route_handler (&local_cfg, 2);
+	test_receive_overflow (&local_cfg);
+	test_receive_priority (&local_cfg);
+	test_receive_after_init (&local_cfg);
+	test_init_cfg_errors (&local_cfg);
+	nn_close (local_sock);
+	test_request (&cfg1);
+	test_reqs_destroy_held ();
+	test_multi_service (&cfg1);
+	test_ipc_transport (&cfg1);
+	test_shm_transport (&cfg1);
+	test_reconnect (&cfg1);
+	test_keepalive_watchdog (&cfg1);
+	test_shutdown_latency (&cfg1);
 
 	if (do_multiple_inits_test)
 		test_multiple_inits();  // this test won't work with valgrind
@@ -944,6 +4018,8 @@ void test_1(void)
 		cfg1.service_name = cfg2.service_name;
 		cfg2.service_name = tmp;
 	}
+	if (using_mock)
+		start_zero_copy_mock (&cfg1, &zc_instance);
 	rtn = libparodus_init(&test_instance1, &cfg1);
 	CU_ASSERT_FATAL (rtn == 0);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: libparodus_init 1 successful\n"));
@@ -1010,7 +4086,7 @@ void test_1(void)
 		if (wrp_msg->msg_type == WRP_MSG_TYPE__REQ)
 			if (send_reply (current_instance, wrp_msg) != 0)
 				reply_error_count++;
-		wrp_free_struct (wrp_msg);
+		libparodus_free_msg (current_instance, wrp_msg);
 		if (current_instance == test_instance1) {
 			timeout_cnt = 0;
 			msgs_received_count++;
@@ -1048,6 +4124,8 @@ void test_1(void)
 	if (do_multiple_inst_test) {
 		CU_ASSERT (libparodus_shutdown (&test_instance2) == 0);
 	}
+	if (NULL != zc_instance)
+		test_zero_copy_mock (&zc_instance);
 }
 
 /*
@@ -36,6 +36,8 @@
 #include <nanomsg/pipeline.h>
 
 #include "dbg_err.h"
+#include "../src/libparodus_wrp.h"
+#include "../src/libparodus_shm.h"
 
 /*----------------------------------------------------------------------------*/
 /*                                   Macros                                   */
@@ -86,6 +88,8 @@ typedef struct reg_client__
 	int sock;
 	char service_name[32];
 	char url[100];
+	libpd_shm_t shm;	// NULL unless the client offered a shm segment
+	pthread_t shm_tid;	// reads the client's upstream shm ring
 } reg_client;
 
 
@@ -149,6 +153,9 @@ static void processUpStreamTask();
 static void *processUpStreamHandler();
 static void handleUpStreamEvents();
 static void handleUpstreamMessage(wrp_msg_t *msg);
+static void queue_upstream_msg (void *buf, int bytes);
+static const char *accept_shm (reg_client *client, void *reg_bytes, size_t reg_len);
+static int make_auth_bytes (wrp_msg_t *auth_msg, const char *shm_path, void **auth_bytes);
 
 static bool make_end_pipe_name (void)
 {
@@ -295,7 +302,6 @@ static void *handle_upstream()
 
 	printf("******** Start of handle_upstream ********\n");
 	
-	UpStreamMsg *message;
 	int sock;
 	int bytes =0;
 	void *buf;
@@ -324,49 +330,159 @@ static void *handle_upstream()
 		bytes = nn_recv (sock, &buf, NN_MSG, 0);
 			
 		printf ("Upstream message received from nanomsg client: \"%s\"\n", (char*)buf);
+		queue_upstream_msg (buf, bytes);
+	}
+	printf ("End of handle_upstream\n");
+	return 0;
+}
+
+/*
+ * @brief Puts a message from the parodus lib on UpStreamMsgQ,
+ *        whether it came over nanomsg or a shm ring.
+ *        buf is from nn_allocmsg.
+ */
+static void queue_upstream_msg (void *buf, int bytes)
+{
+	UpStreamMsg *message = (UpStreamMsg *)malloc(sizeof(UpStreamMsg));
+	
+	if(message)
+	{
+		message->msg =buf;
+		message->len =bytes;
+		message->next=NULL;
+		pthread_mutex_lock (&nano_mut); // was nano_prod_mut
 		
-		message = (UpStreamMsg *)malloc(sizeof(UpStreamMsg));
-		
-		if(message)
+		//Producer adds the nanoMsg into queue
+		if(UpStreamMsgQ == NULL)
 		{
-			message->msg =buf;
-			message->len =bytes;
-			message->next=NULL;
-			pthread_mutex_lock (&nano_mut); // was nano_prod_mut
-			
-			//Producer adds the nanoMsg into queue
-			if(UpStreamMsgQ == NULL)
-			{
-	
-				UpStreamMsgQ = message;
-				
-				printf("UpStreamMsgQ producer added message\n");
-			 	pthread_cond_signal(&nano_con);
-				pthread_mutex_unlock (&nano_mut); // was nano_prod_mut
-				printf("mutex unlock in UpStreamMsgQ producer thread\n");
-			}
-			else
-			{
-				UpStreamMsg *temp = UpStreamMsgQ;
-				while(temp->next)
-				{
-					temp = temp->next;
-				}
-			
-				temp->next = message;
+
+			UpStreamMsgQ = message;
 			
-				pthread_mutex_unlock (&nano_mut); // was nano_prod_mut
-			}
-					
+			printf("UpStreamMsgQ producer added message\n");
+		 	pthread_cond_signal(&nano_con);
+			pthread_mutex_unlock (&nano_mut); // was nano_prod_mut
+			printf("mutex unlock in UpStreamMsgQ producer thread\n");
 		}
 		else
 		{
-			printf("failure in allocation for message\n");
+			UpStreamMsg *temp = UpStreamMsgQ;
+			while(temp->next)
+			{
+				temp = temp->next;
+			}
+		
+			temp->next = message;
+		
+			pthread_mutex_unlock (&nano_mut); // was nano_prod_mut
 		}
 				
 	}
-	printf ("End of handle_upstream\n");
-	return 0;
+	else
+	{
+		printf("failure in allocation for message\n");
+	}
+}
+
+/*
+ * @brief Reads the upstream shm ring of a client, until the
+ *        client closes the segment.
+ */
+static void *handle_shm_upstream (void *arg)
+{
+	reg_client *client = (reg_client *) arg;
+	void *buf;
+	unsigned len;
+	int rtn;
+
+	printf("MOCKPD reading shm ring of %s\n", client->service_name);
+	while (1)
+	{
+		rtn = libpd_shm_receive (client->shm, LIBPD_SHM_UP, &buf, &len, 1000);
+		if (rtn == 1)
+			continue;
+		if (rtn != 0)
+			break;
+		printf ("Upstream message received from shm client %s\n", client->service_name);
+		queue_upstream_msg (buf, (int) len);
+	}
+	printf("MOCKPD shm ring of %s closed (%d)\n", client->service_name, rtn);
+	return NULL;
+}
+
+static void release_shm (reg_client *client)
+{
+	if (NULL == client->shm)
+		return;
+	libpd_shm_close (client->shm);
+	pthread_join (client->shm_tid, NULL);
+	libpd_shm_destroy (&client->shm);
+}
+
+/*
+ * @brief Opens the shm segment a client offers in its registration,
+ *        and starts reading its upstream ring.
+ * @return the segment path, to send back in the AUTH msg, 
+ *         or NULL if nothing was offered or it could not be opened.
+ */
+static const char *accept_shm (reg_client *client, void *reg_bytes, size_t reg_len)
+{
+	const char *offer;
+	size_t offer_len;
+	char path[64];
+	int err, oserr;
+
+	if (libpd_wrp_peek_str (reg_bytes, reg_len, LIBPD_SHM_FIELD, 
+	    &offer, &offer_len) != 0)
+	{
+		release_shm (client);
+		return NULL;
+	}
+	if (offer_len >= sizeof (path))
+	{
+		printf ("MOCKPD shm path too long\n");
+		release_shm (client);
+		return NULL;
+	}
+	memcpy (path, offer, offer_len);
+	path[offer_len] = '\0';
+	// a re-registration of the same segment keeps using it
+	if ((NULL != client->shm) && !libpd_shm_is_closed (client->shm) &&
+	    (strcmp (libpd_shm_path (client->shm), path) == 0))
+		return libpd_shm_path (client->shm);
+	release_shm (client);
+	err = libpd_shm_open (&client->shm, path, &oserr);
+	if (err != 0)
+	{
+		dbg_err (oserr, "MOCKPD unable to open shm segment %s (%d)\n", path, err);
+		return NULL;
+	}
+	err = pthread_create (&client->shm_tid, NULL, handle_shm_upstream, client);
+	if (err != 0)
+	{
+		dbg_err (err, "MOCKPD unable to create shm thread\n");
+		libpd_shm_destroy (&client->shm);
+		return NULL;
+	}
+	printf ("MOCKPD accepted shm segment %s from %s\n", path, client->service_name);
+	return libpd_shm_path (client->shm);
+}
+
+/*
+ * @brief Encodes the AUTH msg for a registration, accepting the
+ *        client's shm segment if shm_path is not NULL.
+ */
+static int make_auth_bytes (wrp_msg_t *auth_msg, const char *shm_path, void **auth_bytes)
+{
+	size_t size;
+
+	if (NULL == shm_path)
+		return wrp_struct_to (auth_msg, WRP_BYTES, auth_bytes);
+	size = libpd_wrp_encoded_size_ext (auth_msg, LIBPD_SHM_FIELD, shm_path);
+	*auth_bytes = malloc (size);
+	if (NULL == *auth_bytes)
+		return -1;
+	return (int) libpd_wrp_encode_ext (auth_msg, LIBPD_SHM_FIELD, shm_path, 
+		*auth_bytes, size);
 }
 
 
@@ -471,9 +587,11 @@ static void handleUpStreamEvents()
 							nn_connect(clients[i]->sock, msg->u.reg.url);  
 			
 							
-							size = wrp_struct_to( &auth_msg_var, WRP_BYTES, &auth_bytes );
+							size = make_auth_bytes (&auth_msg_var, 
+								accept_shm (clients[i], message->msg, message->len), &auth_bytes);
 							printf("Client registered before. Sending acknowledgement \n");
 							byte = nn_send (clients[i]->sock, auth_bytes, size, 0);
+							free(auth_bytes);
 						
 							byte = 0;
 							size = 0;
@@ -489,7 +607,7 @@ static void handleUpStreamEvents()
 					if((matchFlag == 0) || (numOfClients == 0))
 					{
 					
-						clients[numOfClients] = (reg_client*)malloc(sizeof(reg_client));
+						clients[numOfClients] = (reg_client*)calloc(1, sizeof(reg_client));
 
 						clients[numOfClients]->sock = nn_socket( AF_SP, NN_PUSH );
 						nn_connect(clients[numOfClients]->sock, msg->u.reg.url);  
@@ -508,7 +626,9 @@ static void handleUpStreamEvents()
 
 
 						//Sending success status to clients after each nanomsg registration
-						size = wrp_struct_to(&auth_msg_var, WRP_BYTES, &auth_bytes );
+						size = make_auth_bytes (&auth_msg_var, 
+							accept_shm (clients[numOfClients], message->msg, message->len), 
+							&auth_bytes);
 
 						printf("Client %s Registered successfully. Sending Acknowledgement... \n ", clients[numOfClients]->service_name);
 
@@ -783,6 +903,20 @@ static int send_to_client (reg_client *client, const char *msg, size_t msgSize)
 {
 	int i, bytes;
 
+	// clients that accepted a shm segment get everything through its
+	// downstream ring, large msgs in fragments
+	if ((NULL != client->shm) && !libpd_shm_is_closed (client->shm)) {
+		bytes = libpd_shm_send (client->shm, LIBPD_SHM_DOWN, msg, msgSize, 20000);
+		if (bytes == 0) {
+			printf("MOCKPD sent downstream message to shm client %s\n", client->service_name);
+			return 0;
+		}
+		if (bytes == 1) {
+			printf ("MOCKPD timeout on shm send\n");
+			return -1;
+		}
+	}
+
 	for (i=0; i<3; i++) {
 		printf("MOCKPD sending to nanomsg client %s\n", client->service_name);     
 		bytes = nn_send(client->sock, msg, msgSize, 0);
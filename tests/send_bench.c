@@ -0,0 +1,240 @@
+ /**
+  * Copyright 2016 Comcast Cable Communications Management, LLC
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+ */
+
+/*
+ * Multi-threaded libparodus_send benchmark.
+ *
+ * usage: send_bench [max_threads [msgs_per_thread [parodus_url]]]
+ *
+ * Binds a PULL socket on parodus_url that plays the part of parodus
+ * and just counts what arrives, then sends event msgs through one
+ * libparodus instance from 1, 2, 4 ... max_threads threads and prints
+ * the throughput for each thread count, then the encode and send
+ * latencies the instance recorded.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
+
+#include "../src/libparodus.h"
+
+#define BENCH_PARODUS_URL "tcp://127.0.0.1:6680"
+#define DEFAULT_MAX_THREADS 8
+#define DEFAULT_MSGS_PER_THREAD 20000
+#define MAX_THREADS 64
+#define SINK_RCV_TIMEOUT_MS 2000
+
+static const char *bench_payload =
+	"{\"names\":[\"Device.DeviceInfo.X_RDKCENTRAL-COM_BootTime\","
+	"\"Device.DeviceInfo.UpTime\",\"Device.DeviceInfo.SoftwareVersion\","
+	"\"Device.WiFi.SSID.10001.SSID\",\"Device.WiFi.SSID.10101.SSID\"],"
+	"\"command\":\"GET\"}";
+
+typedef struct {
+	libpd_instance_t instance;
+	unsigned num_msgs;
+	unsigned errors;
+} sender_info_t;
+
+typedef struct {
+	int sock;
+	unsigned expected;
+	unsigned received;
+} sink_info_t;
+
+static double elapsed_secs (struct timespec *start, struct timespec *end)
+{
+	return (double) (end->tv_sec - start->tv_sec) +
+		((double) (end->tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static void *sink_thread (void *arg)
+{
+	sink_info_t *sink = (sink_info_t *) arg;
+	char *buf;
+	int len;
+
+	while (sink->received < sink->expected) {
+		buf = NULL;
+		len = nn_recv (sink->sock, &buf, NN_MSG, 0);
+		if (len < 0) {
+			if (errno == ETIMEDOUT)
+				break;
+			continue;
+		}
+		nn_freemsg (buf);
+		sink->received++;
+	}
+	return NULL;
+}
+
+static void *sender_thread (void *arg)
+{
+	sender_info_t *info = (sender_info_t *) arg;
+	wrp_msg_t msg;
+	char content_type[64];
+	unsigned i;
+
+	memset (&msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/send_bench";
+	msg.u.event.dest = "event:device-status/mac:112233445566/bench";
+	msg.u.event.content_type = "application/json";
+	msg.u.event.payload = (void *) bench_payload;
+	msg.u.event.payload_size = strlen (bench_payload);
+	for (i=0; i<info->num_msgs; i++) {
+		// make each message a little different, like a real app would
+		sprintf (content_type, "application/json;seq=%u", i);
+		msg.u.event.content_type = content_type;
+		if (libparodus_send (info->instance, &msg) != 0)
+			info->errors++;
+	}
+	return NULL;
+}
+
+static int open_sink (const char *url)
+{
+	int timeout = SINK_RCV_TIMEOUT_MS;
+	int sock = nn_socket (AF_SP, NN_PULL);
+	if (sock < 0) {
+		fprintf (stderr, "Unable to create sink socket: %s\n", strerror (errno));
+		return -1;
+	}
+	if (nn_setsockopt (sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+			&timeout, sizeof (timeout)) < 0) {
+		fprintf (stderr, "Unable to set sink timeout: %s\n", strerror (errno));
+		nn_close (sock);
+		return -1;
+	}
+	if (nn_bind (sock, url) < 0) {
+		fprintf (stderr, "Unable to bind sink to %s: %s\n", url, strerror (errno));
+		nn_close (sock);
+		return -1;
+	}
+	return sock;
+}
+
+static int run_one (libpd_instance_t instance, int sink_sock,
+	unsigned num_threads, unsigned msgs_per_thread, double *rate)
+{
+	pthread_t sender_tids[MAX_THREADS];
+	sender_info_t senders[MAX_THREADS];
+	pthread_t sink_tid;
+	sink_info_t sink;
+	struct timespec start, end;
+	unsigned i, errors = 0;
+
+	sink.sock = sink_sock;
+	sink.expected = num_threads * msgs_per_thread;
+	sink.received = 0;
+	if (pthread_create (&sink_tid, NULL, sink_thread, &sink) != 0)
+		return -1;
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	for (i=0; i<num_threads; i++) {
+		senders[i].instance = instance;
+		senders[i].num_msgs = msgs_per_thread;
+		senders[i].errors = 0;
+		if (pthread_create (&sender_tids[i], NULL, sender_thread, &senders[i]) != 0) {
+			num_threads = i;
+			break;
+		}
+	}
+	for (i=0; i<num_threads; i++) {
+		pthread_join (sender_tids[i], NULL);
+		errors += senders[i].errors;
+	}
+	clock_gettime (CLOCK_MONOTONIC, &end);
+	pthread_join (sink_tid, NULL);
+	*rate = (double) (num_threads * msgs_per_thread) / elapsed_secs (&start, &end);
+	if ((errors != 0) || (sink.received != sink.expected)) {
+		fprintf (stderr, "%u send errors, %u of %u msgs received\n",
+			errors, sink.received, sink.expected);
+		return -1;
+	}
+	return 0;
+}
+
+static void print_latency (const char *name, libpd_latency_t *lat)
+{
+	printf ("%8s %10.1f %10.1f %10.1f %10.1f\n", name,
+		(double) lat->p50_ns / 1e3, (double) lat->p99_ns / 1e3,
+		(double) lat->p999_ns / 1e3, (double) lat->max_ns / 1e3);
+}
+
+int main (int argc, char **argv)
+{
+	unsigned max_threads = DEFAULT_MAX_THREADS;
+	unsigned msgs_per_thread = DEFAULT_MSGS_PER_THREAD;
+	const char *url = BENCH_PARODUS_URL;
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t cfg = {.service_name = "send_bench",
+		.receive = false, .keepalive_timeout_secs = 0};
+	unsigned num_threads;
+	libpd_latency_stats_t stats;
+	double rate, base_rate = 0.0;
+	int sink_sock, rtn = 0;
+
+	if (argc > 1)
+		max_threads = (unsigned) atoi (argv[1]);
+	if (argc > 2)
+		msgs_per_thread = (unsigned) atoi (argv[2]);
+	if (argc > 3)
+		url = argv[3];
+	if ((max_threads < 1) || (max_threads > MAX_THREADS) || (msgs_per_thread < 1)) {
+		fprintf (stderr, "usage: %s [max_threads(1-%d) [msgs_per_thread [parodus_url]]]\n",
+			argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	sink_sock = open_sink (url);
+	if (sink_sock < 0)
+		return 1;
+	cfg.parodus_url = url;
+	if (libparodus_init (&instance, &cfg) != 0) {
+		fprintf (stderr, "libparodus_init failed\n");
+		libparodus_shutdown (&instance);
+		nn_close (sink_sock);
+		return 1;
+	}
+
+	printf ("%8s %14s %8s\n", "threads", "msgs/sec", "scaling");
+	for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+		if (run_one (instance, sink_sock, num_threads, msgs_per_thread, &rate) != 0) {
+			rtn = 1;
+			break;
+		}
+		if (num_threads == 1)
+			base_rate = rate;
+		printf ("%8u %14.0f %7.2fx\n", num_threads, rate, rate / base_rate);
+	}
+
+	if (libparodus_get_latency_stats (instance, &stats) == 0) {
+		printf ("\n%8s %10s %10s %10s %10s (usecs)\n", "", "p50", "p99", "p999", "max");
+		print_latency ("encode", &stats.encode);
+		print_latency ("send", &stats.send);
+	}
+
+	libparodus_shutdown (&instance);
+	nn_close (sink_sock);
+	return rtn;
+}
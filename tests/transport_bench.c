@@ -0,0 +1,425 @@
+ /**
+  * Copyright 2016 Comcast Cable Communications Management, LLC
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  *
+ */
+
+/*
+ * tcp:// vs ipc:// transport benchmark.
+ *
+ * usage: transport_bench [msgs [round_trips]]
+ *
+ * Plays the part of parodus, the way mock_parodus does, for one
+ * receiving libparodus instance over tcp://127.0.0.1 and then another
+ * over ipc://, and for each transport prints
+ *   up      events sent with libparodus_send, in msgs/sec
+ *   down    requests from parodus received with libparodus_receive,
+ *           in msgs/sec
+ *   rtt     usecs from parodus sending a request until it gets the
+ *           reply the service sends back, one request at a time
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
+
+#include "../src/libparodus.h"
+
+#define DEFAULT_MSGS 50000
+#define DEFAULT_ROUND_TRIPS 5000
+#define PARODUS_RCV_TIMEOUT_MS 2000
+#define SERVICE_RCV_TIMEOUT_MS 2000
+#define SERVICE_NAME "transport_bench"
+#define BENCH_DEST "mac:112233445566/" SERVICE_NAME "/bench"
+
+typedef struct {
+	const char *name;
+	const char *parodus_url;
+	const char *client_url;	// NULL for the transport's default
+	libpd_transport_t transport;
+} bench_transport_t;
+
+static const bench_transport_t transports[] = {
+	{"tcp", "tcp://127.0.0.1:6690", "tcp://127.0.0.1:6691", LIBPD_TRANSPORT_TCP},
+	{"ipc", "ipc:///tmp/transport_bench_parodus.ipc", NULL, LIBPD_TRANSPORT_IPC}
+};
+
+#define NUM_TRANSPORTS (sizeof (transports) / sizeof (transports[0]))
+
+static const char *bench_payload =
+	"{\"names\":[\"Device.DeviceInfo.X_RDKCENTRAL-COM_BootTime\","
+	"\"Device.DeviceInfo.UpTime\",\"Device.DeviceInfo.SoftwareVersion\","
+	"\"Device.WiFi.SSID.10001.SSID\",\"Device.WiFi.SSID.10101.SSID\"],"
+	"\"command\":\"GET\"}";
+
+// the parodus side of one transport
+typedef struct {
+	int pull_sock;	// upstream, from the service
+	int push_sock;	// downstream, to the service's client url
+	unsigned expected;
+	unsigned received;
+} parodus_t;
+
+typedef struct {
+	libpd_instance_t instance;
+	unsigned num_msgs;
+	unsigned errors;
+} service_t;
+
+typedef struct {
+	double up_rate;
+	double down_rate;
+	uint64_t *rtts;
+	unsigned num_rtts;
+} results_t;
+
+static uint64_t now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+static int cmp_u64 (const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void init_req (wrp_msg_t *msg, const char *source, const char *dest)
+{
+	memset (msg, 0, sizeof (wrp_msg_t));
+	msg->msg_type = WRP_MSG_TYPE__REQ;
+	msg->u.req.transaction_uuid = "transport-bench-0001";
+	msg->u.req.source = (char *) source;
+	msg->u.req.dest = (char *) dest;
+	msg->u.req.payload = (void *) bench_payload;
+	msg->u.req.payload_size = strlen (bench_payload);
+}
+
+// waits for the service to register, and connects to its client url
+static int accept_registration (parodus_t *pd)
+{
+	wrp_msg_t *msg;
+	void *buf = NULL;
+	int rtn = nn_recv (pd->pull_sock, &buf, NN_MSG, 0);
+
+	if (rtn < 0) {
+		fprintf (stderr, "No registration msg: %s\n", strerror (errno));
+		return -1;
+	}
+	rtn = (int) wrp_to_struct (buf, rtn, WRP_BYTES, &msg);
+	nn_freemsg (buf);
+	if ((rtn < 1) || (msg->msg_type != WRP_MSG_TYPE__SVC_REGISTRATION)) {
+		fprintf (stderr, "Invalid registration msg\n");
+		if (rtn >= 1)
+			wrp_free_struct (msg);
+		return -1;
+	}
+	rtn = nn_connect (pd->push_sock, msg->u.reg.url);
+	if (rtn < 0)
+		fprintf (stderr, "Unable to connect to %s: %s\n", msg->u.reg.url,
+			strerror (errno));
+	wrp_free_struct (msg);
+	return (rtn < 0) ? -1 : 0;
+}
+
+static int open_parodus (parodus_t *pd, const char *url)
+{
+	int timeout = PARODUS_RCV_TIMEOUT_MS;
+
+	pd->push_sock = -1;
+	pd->pull_sock = nn_socket (AF_SP, NN_PULL);
+	if (pd->pull_sock < 0) {
+		fprintf (stderr, "Unable to create parodus socket: %s\n", strerror (errno));
+		return -1;
+	}
+	if ((nn_setsockopt (pd->pull_sock, NN_SOL_SOCKET, NN_RCVTIMEO,
+			&timeout, sizeof (timeout)) < 0) ||
+	    (nn_bind (pd->pull_sock, url) < 0)) {
+		fprintf (stderr, "Unable to bind parodus to %s: %s\n", url, strerror (errno));
+		nn_close (pd->pull_sock);
+		return -1;
+	}
+	pd->push_sock = nn_socket (AF_SP, NN_PUSH);
+	if (pd->push_sock < 0) {
+		fprintf (stderr, "Unable to create parodus socket: %s\n", strerror (errno));
+		nn_close (pd->pull_sock);
+		return -1;
+	}
+	return 0;
+}
+
+static void close_parodus (parodus_t *pd)
+{
+	nn_close (pd->push_sock);
+	nn_close (pd->pull_sock);
+}
+
+static void *sink_thread (void *arg)
+{
+	parodus_t *pd = (parodus_t *) arg;
+	char *buf;
+
+	while (pd->received < pd->expected) {
+		buf = NULL;
+		if (nn_recv (pd->pull_sock, &buf, NN_MSG, 0) < 0) {
+			if (errno == ETIMEDOUT)
+				break;
+			continue;
+		}
+		nn_freemsg (buf);
+		pd->received++;
+	}
+	return NULL;
+}
+
+// parodus pushes num_msgs copies of an encoded request
+static void *pusher_thread (void *arg)
+{
+	parodus_t *pd = (parodus_t *) arg;
+	wrp_msg_t msg;
+	void *bytes;
+	ssize_t len;
+	unsigned i;
+
+	init_req (&msg, "dns:parodus/bench", BENCH_DEST);
+	len = wrp_struct_to (&msg, WRP_BYTES, &bytes);
+	if (len <= 0)
+		return NULL;
+	for (i=0; i<pd->expected; i++)
+		if (nn_send (pd->push_sock, bytes, (size_t) len, 0) != (int) len)
+			break;
+	free (bytes);
+	return NULL;
+}
+
+// the service replies to each request it receives
+static void *responder_thread (void *arg)
+{
+	service_t *svc = (service_t *) arg;
+	wrp_msg_t *msg, reply;
+	unsigned i;
+
+	for (i=0; i<svc->num_msgs; i++) {
+		if (libparodus_receive (svc->instance, &msg, SERVICE_RCV_TIMEOUT_MS) != 0) {
+			svc->errors++;
+			break;
+		}
+		init_req (&reply, msg->u.req.dest, msg->u.req.source);
+		if (libparodus_send (svc->instance, &reply) != 0)
+			svc->errors++;
+		libparodus_free_msg (svc->instance, msg);
+	}
+	return NULL;
+}
+
+static int bench_up (libpd_instance_t instance, parodus_t *pd, unsigned num_msgs,
+	double *rate)
+{
+	wrp_msg_t msg;
+	pthread_t sink_tid;
+	uint64_t start;
+	unsigned i, errors = 0;
+
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/" SERVICE_NAME;
+	msg.u.event.dest = "event:device-status/mac:112233445566/bench";
+	msg.u.event.content_type = "application/json";
+	msg.u.event.payload = (void *) bench_payload;
+	msg.u.event.payload_size = strlen (bench_payload);
+	pd->expected = num_msgs;
+	pd->received = 0;
+	if (pthread_create (&sink_tid, NULL, sink_thread, pd) != 0)
+		return -1;
+	start = now_ns ();
+	for (i=0; i<num_msgs; i++)
+		if (libparodus_send (instance, &msg) != 0)
+			errors++;
+	pthread_join (sink_tid, NULL);
+	*rate = (double) num_msgs * 1e9 / (double) (now_ns () - start);
+	if ((errors != 0) || (pd->received != num_msgs)) {
+		fprintf (stderr, "up: %u send errors, %u of %u msgs received\n",
+			errors, pd->received, num_msgs);
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_down (libpd_instance_t instance, parodus_t *pd, unsigned num_msgs,
+	double *rate)
+{
+	wrp_msg_t *msg;
+	pthread_t pusher_tid;
+	uint64_t start;
+	unsigned received;
+
+	pd->expected = num_msgs;
+	if (pthread_create (&pusher_tid, NULL, pusher_thread, pd) != 0)
+		return -1;
+	start = now_ns ();
+	for (received=0; received<num_msgs; received++) {
+		if (libparodus_receive (instance, &msg, SERVICE_RCV_TIMEOUT_MS) != 0)
+			break;
+		libparodus_free_msg (instance, msg);
+	}
+	*rate = (double) received * 1e9 / (double) (now_ns () - start);
+	pthread_join (pusher_tid, NULL);
+	if (received != num_msgs) {
+		fprintf (stderr, "down: %u of %u msgs received\n", received, num_msgs);
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_rtt (libpd_instance_t instance, parodus_t *pd,
+	unsigned round_trips, uint64_t *rtts)
+{
+	service_t svc = {instance, round_trips, 0};
+	pthread_t responder_tid;
+	wrp_msg_t msg;
+	void *bytes, *buf;
+	ssize_t len;
+	uint64_t start;
+	unsigned i;
+	int rtn = 0;
+
+	init_req (&msg, "dns:parodus/bench", BENCH_DEST);
+	len = wrp_struct_to (&msg, WRP_BYTES, &bytes);
+	if (len <= 0)
+		return -1;
+	if (pthread_create (&responder_tid, NULL, responder_thread, &svc) != 0) {
+		free (bytes);
+		return -1;
+	}
+	for (i=0; i<round_trips; i++) {
+		start = now_ns ();
+		if (nn_send (pd->push_sock, bytes, (size_t) len, 0) != (int) len) {
+			rtn = -1;
+			break;
+		}
+		buf = NULL;
+		if (nn_recv (pd->pull_sock, &buf, NN_MSG, 0) < 0) {
+			rtn = -1;
+			break;
+		}
+		rtts[i] = now_ns () - start;
+		nn_freemsg (buf);
+	}
+	pthread_join (responder_tid, NULL);
+	free (bytes);
+	if ((rtn != 0) || (svc.errors != 0)) {
+		fprintf (stderr, "rtt: %u of %u round trips, %u service errors\n",
+			i, round_trips, svc.errors);
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_transport (const bench_transport_t *tp, unsigned num_msgs,
+	unsigned round_trips, results_t *results)
+{
+	libpd_instance_t instance = NULL;
+	libpd_cfg_t cfg = {.service_name = SERVICE_NAME,
+		.receive = true, .keepalive_timeout_secs = 0};
+	parodus_t pd;
+	int rtn;
+
+	if (open_parodus (&pd, tp->parodus_url) != 0)
+		return -1;
+	cfg.parodus_url = tp->parodus_url;
+	cfg.client_url = tp->client_url;
+	cfg.transport = tp->transport;
+	cfg.receive_queue_size = 1000;
+	rtn = libparodus_init (&instance, &cfg);
+	if (rtn != 0) {
+		fprintf (stderr, "libparodus_init failed: %s\n", libparodus_strerror (rtn));
+		libparodus_shutdown (&instance);
+		close_parodus (&pd);
+		return -1;
+	}
+	rtn = accept_registration (&pd);
+	if (rtn == 0)
+		rtn = bench_up (instance, &pd, num_msgs, &results->up_rate);
+	if (rtn == 0)
+		rtn = bench_down (instance, &pd, num_msgs, &results->down_rate);
+	if (rtn == 0)
+		rtn = bench_rtt (instance, &pd, round_trips, results->rtts);
+	if (rtn == 0) {
+		results->num_rtts = round_trips;
+		qsort (results->rtts, round_trips, sizeof (uint64_t), cmp_u64);
+	}
+	libparodus_shutdown (&instance);
+	close_parodus (&pd);
+	return rtn;
+}
+
+static double rtt_usecs (results_t *results, double fraction)
+{
+	unsigned i = (unsigned) (fraction * (double) results->num_rtts);
+
+	if (i >= results->num_rtts)
+		i = results->num_rtts - 1;
+	return (double) results->rtts[i] / 1e3;
+}
+
+int main (int argc, char **argv)
+{
+	unsigned num_msgs = DEFAULT_MSGS;
+	unsigned round_trips = DEFAULT_ROUND_TRIPS;
+	results_t results;
+	unsigned i;
+	int rtn = 0;
+
+	if (argc > 1)
+		num_msgs = (unsigned) atoi (argv[1]);
+	if (argc > 2)
+		round_trips = (unsigned) atoi (argv[2]);
+	if ((num_msgs < 1) || (round_trips < 1)) {
+		fprintf (stderr, "usage: %s [msgs [round_trips]]\n", argv[0]);
+		return 1;
+	}
+	results.rtts = (uint64_t *) malloc (round_trips * sizeof (uint64_t));
+	if (NULL == results.rtts) {
+		fprintf (stderr, "Unable to allocate %u round trip times\n", round_trips);
+		return 1;
+	}
+
+	printf ("%9s %12s %12s %10s %10s %10s\n", "transport", "up msgs/s",
+		"down msgs/s", "rtt p50", "rtt p99", "rtt max");
+	for (i=0; i<NUM_TRANSPORTS; i++) {
+		if (bench_transport (&transports[i], num_msgs, round_trips, &results) != 0) {
+			fprintf (stderr, "%s benchmark failed\n", transports[i].name);
+			rtn = 1;
+			continue;
+		}
+		printf ("%9s %12.0f %12.0f %10.1f %10.1f %10.1f\n", transports[i].name,
+			results.up_rate, results.down_rate, rtt_usecs (&results, 0.50),
+			rtt_usecs (&results, 0.99), rtt_usecs (&results, 1.0));
+	}
+	printf ("(rtt in usecs)\n");
+
+	free (results.rtts);
+	return rtn;
+}